@@ -24,6 +24,14 @@ def msp_mtu_type(x):
 		raise argparse.ArgumentTypeError("MTU must be an integer at least 4 in size")
 	return mtu
 
+# CRC engines and the define that selects them in msp_crc.c
+CRC_ENGINES = {
+	'bitwise': 'MSP_CRC32_BITWISE',
+	'table': 'MSP_CRC32_TABLE',
+	'slice4': 'MSP_CRC32_SLICE_BY_4',
+	'slice8': 'MSP_CRC32_SLICE_BY_8',
+}
+
 # State requirements for obc and experiment
 OBC_REQUIRED = []
 OBC_INCOMPATIBLE = ['addr', 'mtu']
@@ -35,6 +43,7 @@ EXPERIMENT_DRIVERS = {'uno', 'due'}
 # args should be of type argparse.Namespace with the following attributes:
 #  - mode: The string 'obc' or 'experiment'
 #  - lowmem: bool
+#  - crc: str.lower or None
 #  - driver: str.lower or None
 #  - mtu: int or None
 #  - addr: str.lower or None
@@ -148,6 +157,8 @@ def generate_configuration_header(args):
 	contents += '#define MSP_CONFIGURATION_H\n\n'
 	if args.lowmem:
 		contents += '#define MSP_LOW_MEMORY\n'
+	if args.crc is not None:
+		contents += '#define %s\n' % (CRC_ENGINES[args.crc])
 	if args.mtu is not None:
 		contents += '#define MSP_EXP_MTU %d\n' % (args.mtu)
 	if args.addr is not None:
@@ -166,6 +177,13 @@ if __name__ == '__main__':
 	                    const=True, default=False,
 	                    help='Configures the MSP driver to use less memory (no lookup'
 	                         ' tables etc.)')
+	parser.add_argument('--crc', dest='crc', type=str.lower, default=None,
+	                    choices=sorted(CRC_ENGINES.keys()),
+	                    help='Selects how CRC-32 is calculated. bitwise uses no table,'
+	                         ' table uses a 1 KB constant table, slice4 and slice8 use'
+	                         ' 4 KB and 8 KB of constant tables and are faster on 32-bit'
+	                         ' and 64-bit hosts. Defaults to bitwise with --lowmem and'
+	                         ' table otherwise.')
 	parser.add_argument('--driver', dest='driver', type=str.lower, default=None, choices=OBC_DRIVERS | EXPERIMENT_DRIVERS,
 	                    help='Includes an I2C driver for the specified platform. If MSP is'
 	                         ' configured in OBC mode and this is not specified, a template file'
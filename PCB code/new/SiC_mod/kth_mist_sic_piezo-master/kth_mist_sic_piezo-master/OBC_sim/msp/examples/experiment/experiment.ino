@@ -100,6 +100,12 @@ void loop()
  * example they are all in the same file.                                  *   
  ***************************************************************************/
 
+unsigned long msp_expsend_busy_time(unsigned char opcode)
+{
+	/* This example always has its data ready */
+	return 0;
+}
+
 void msp_expsend_start(unsigned char opcode, unsigned long *len)
 {
 	/* Determine what to send */
@@ -9,5 +9,6 @@
 #define MSP_CRC_H
 
 unsigned long msp_crc32(const unsigned char *data, unsigned long len, unsigned long start_remainder);
+unsigned long msp_crc32_copy(unsigned char *dest, const unsigned char *src, unsigned long len, unsigned long start_remainder);
 
 #endif /* MSP_CRC_H */
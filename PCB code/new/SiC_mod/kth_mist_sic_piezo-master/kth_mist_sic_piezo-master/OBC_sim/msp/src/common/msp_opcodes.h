@@ -20,6 +20,11 @@
 #define MSP_OP_EXP_SEND    0x04
 #define MSP_OP_EXP_BUSY    0x05
 
+/* Windowed transfer of OBC Requests (extension, see msp_constants.h) */
+#define MSP_OP_WINDOW_ACK      0x06
+#define MSP_OP_EXP_SEND_WINDOW 0x07
+#define MSP_OP_REQ_WINDOW      0x2F
+
 /* System Commands */
 #define MSP_OP_ACTIVE      0x10
 #define MSP_OP_SLEEP       0x11
@@ -57,4 +62,29 @@
  */
 #define MSP_OP_IS_CUSTOM(opcode) (((opcode) & 0x70) >= 0x50)
 
+/**
+ * @brief The opcode of a data frame in a windowed transfer.
+ * @param seq The sequence number of the frame.
+ * @return The opcode, 0x08 to 0x0B. The frame-ID holds the lowest bit of the
+ *         sequence number.
+ */
+#define MSP_OP_WINDOW_DATA(seq) (0x08 | (((seq) >> 1) & 0x03))
+
+/**
+ * @brief Determines whether the opcode is that of a data frame in a windowed
+ *        transfer.
+ * @param opcode The opcode value.
+ * @return A non-zero value if the opcode is one of MSP_OP_WINDOW_DATA.
+ */
+#define MSP_OP_IS_WINDOW_DATA(opcode) (((opcode) & 0x7C) == 0x08)
+
+/**
+ * @brief Determines the sequence number of a data frame in a windowed
+ *        transfer.
+ * @param opcode The opcode of the frame.
+ * @param frame_id The frame-ID of the frame.
+ * @return The sequence number, 0 to MSP_WINDOW_SEQ_MASK.
+ */
+#define MSP_WINDOW_SEQ(opcode, frame_id) ((((opcode) & 0x03) << 1) | ((frame_id) & 0x01))
+
 #endif /* MSP_OPCODES_H */
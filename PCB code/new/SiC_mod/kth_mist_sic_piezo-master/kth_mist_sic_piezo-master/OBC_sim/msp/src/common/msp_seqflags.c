@@ -248,6 +248,9 @@ static struct msp_flag_position msp_get_flag_pos(unsigned char opcode)
 		case MSP_OP_SEND_PUS:
 			fp.mask = 0x0080;
 			break;
+		case MSP_OP_REQ_WINDOW:
+			fp.mask = 0x0100;
+			break;
 		default:
 			fp.mask = 0;
 			break;
@@ -23,17 +23,48 @@
 static int handle_incoming_frame(const unsigned char *frame, unsigned long len);
 static int handle_incoming_data_frame(const unsigned char *data, unsigned char frame_id, unsigned long len);
 static int handle_incoming_header_frame(unsigned char opcode, unsigned char frame_id, unsigned long dl);
-static int handle_incoming_control_frame(unsigned char opcode, unsigned char frame_id);
+static int handle_incoming_control_frame(unsigned char opcode, unsigned char frame_id, unsigned long dl);
+static int handle_incoming_window_acknowledge(unsigned long dl);
 static int handle_incoming_system_frame(unsigned char opcode, unsigned char frame_id);
-static int handle_incoming_request_frame(unsigned char opcode);
+static int handle_incoming_request_frame(unsigned char opcode, unsigned long dl);
 static int handle_incoming_send_frame(unsigned char opcode, unsigned char frame_id, unsigned long dl);
 
 static int handle_outgoing_frame(unsigned char *buf, unsigned long *len);
+static int handle_outgoing_busy_frame(unsigned char *buf, unsigned long *len);
 static int handle_outgoing_response_frame(unsigned char *buf, unsigned long *len);
 static int handle_outgoing_data_frame(unsigned char *buf, unsigned long *len);
 static int handle_outgoing_acknowledge_frame(unsigned char *buf, unsigned long *len);
 
+static void start_request(void);
 static void ensure_ready_state(void);
+static unsigned long next_data_frame(unsigned char *head, int send);
+
+#ifndef MSP_LOW_MEMORY
+/*
+ * The data frames of an OBC Request are built in one of two buffers. The
+ * frame that was sent last stays in its buffer until it is acknowledged, so
+ * that it can be sent again as it is, while the next frame is built in the
+ * other one. Costs 2*MSP_EXP_MAX_FRAME_SIZE bytes of RAM, not used with
+ * MSP_LOW_MEMORY.
+ */
+struct prepared_frame {
+	unsigned char data[MSP_EXP_MAX_FRAME_SIZE];
+	unsigned long len;        /* Length of the whole frame, 0 if unused */
+	unsigned long offset;     /* Offset of the data field in the transaction */
+	unsigned char head;       /* First byte of the frame, opcode and frame-ID */
+};
+static struct prepared_frame prepared_frames[2];
+static unsigned char sent_frame = 0;
+
+/* Header frames returned by msp_send_frame() */
+static unsigned char header_frame[9];
+
+static struct prepared_frame *find_prepared_frame(unsigned long offset, unsigned char head);
+static struct prepared_frame *prepare_frame(unsigned long offset, unsigned char head);
+static struct prepared_frame *serve_prepared_frame(void);
+#endif
+
+static unsigned long build_data_frame(unsigned char *buf, unsigned long offset, unsigned char head);
 
 /*
  * Implementation of the MSP receive callback function. This function just
@@ -54,7 +85,7 @@ int msp_recv_callback(const unsigned char *data, unsigned long len)
 		return MSP_EXP_ERR_IS_BUSY;
 
 	/* Ignore the frame is the FCS is invalid. (from_obc = 1) */
-	if (!msp_exp_frame_fcs_valid(data, 1, len))
+	if (!msp_exp_frame_rx_fcs_valid(data, len))
 		return MSP_EXP_ERR_FCS_MISMATCH;
 
 	/* Now mark the MSP state as busy and carry on */
@@ -101,6 +132,110 @@ int msp_send_callback(unsigned char *data, unsigned long *len)
 	return code;
 }
 
+#ifndef MSP_LOW_MEMORY
+/*
+ * Zero-copy version of msp_send_callback(). Data frames are served straight
+ * from the buffer they were prepared in, header frames from a static buffer.
+ * The frame stays valid until the next call to msp_send_frame() or
+ * msp_send_callback().
+ *
+ * Arguments
+ *  frame: Set to point to the frame to be sent.
+ *  len: Set to the number of bytes to be sent.
+ */
+int msp_send_frame(const unsigned char **frame, unsigned long *len)
+{
+	struct prepared_frame *prepared;
+	int code;
+
+	if (!msp_exp_state.initialized) {
+		msp_exp_state_initialize(msp_seqflags_init());
+	} else if (msp_exp_state.busy) {
+		msp_exp_frame_format_empty_header(header_frame, MSP_OP_EXP_BUSY);
+		*frame = header_frame;
+		*len = 9;
+
+		return MSP_EXP_ERR_IS_BUSY;
+	}
+
+	msp_exp_state.busy = 1;
+	if (msp_exp_state.type == MSP_EXP_STATE_OBC_REQ_TX &&
+	    msp_exp_state.processed_length < msp_exp_state.total_length) {
+		prepared = serve_prepared_frame();
+		*frame = prepared->data;
+		*len = prepared->len;
+		code = 0;
+	} else {
+		code = handle_outgoing_frame(header_frame, len);
+		*frame = header_frame;
+	}
+	msp_exp_state.busy = 0;
+
+	return code;
+}
+
+/*
+ * Builds the data frame that the OBC will ask for next, so that it is ready
+ * when the OBC reads it. Meant to be called when the experiment is otherwise
+ * idle. Once the current data frame has been sent, the frame after it is
+ * built in the other buffer, so that it can be sent as soon as the current
+ * one is acknowledged.
+ *
+ * Returns 1 if a frame was built, otherwise 0.
+ */
+int msp_exp_prepare_next(void)
+{
+	struct prepared_frame *current;
+	unsigned long offset;
+	unsigned char head;
+	int prepared;
+
+	if (!msp_exp_state.initialized || msp_exp_state.busy)
+		return 0;
+
+	msp_exp_state.busy = 1;
+	prepared = 0;
+
+	switch (msp_exp_state.type) {
+	case MSP_EXP_STATE_OBC_REQ_RESPONSE:
+		/* The first data frame follows the acknowledged response */
+		offset = 0;
+		if (msp_exp_state.tx_window > 1)
+			head = MSP_OP_WINDOW_DATA(0);
+		else
+			head = MSP_OP_DATA_FRAME | ((msp_exp_state.frame_id ^ 1) << 7);
+		break;
+	case MSP_EXP_STATE_OBC_REQ_TX:
+		offset = next_data_frame(&head, 0);
+		if (msp_exp_state.tx_window > 1)
+			break; /* The frame that the OBC reads next in the window */
+		current = find_prepared_frame(offset, head);
+		if (current == &prepared_frames[sent_frame]) {
+			/* Already sent, the OBC will ask for the next one */
+			offset += current->len - 5;
+			head ^= 0x80;
+		} else if (current != 0) {
+			/* Prepared, but not sent yet */
+			offset = msp_exp_state.total_length;
+		}
+		break;
+	default:
+		offset = msp_exp_state.total_length;
+		head = 0;
+		break;
+	}
+
+	if (offset < msp_exp_state.total_length && find_prepared_frame(offset, head) == 0) {
+		prepare_frame(offset, head);
+		prepared = 1;
+	}
+
+	msp_exp_state.busy = 0;
+
+	return prepared;
+}
+#endif
+
 
 
 /*---------------------------------------------------------------------------*/
@@ -202,13 +337,13 @@ static int handle_incoming_header_frame(unsigned char opcode, unsigned char fram
 	 * header based on the type. */
 	switch (MSP_OP_TYPE(opcode)) {
 	case MSP_OP_TYPE_CTRL:
-		code = handle_incoming_control_frame(opcode, frame_id);
+		code = handle_incoming_control_frame(opcode, frame_id, dl);
 		break;
 	case MSP_OP_TYPE_SYS:
 		code = handle_incoming_system_frame(opcode, frame_id);
 		break;
 	case MSP_OP_TYPE_REQ:
-		code = handle_incoming_request_frame(opcode);
+		code = handle_incoming_request_frame(opcode, dl);
 		break;
 	case MSP_OP_TYPE_SEND:
 		code = handle_incoming_send_frame(opcode, frame_id, dl);
@@ -227,8 +362,9 @@ static int handle_incoming_header_frame(unsigned char opcode, unsigned char fram
  * Arguments
  *  opcode: OP-code of the header.
  *  frame_id: Frame-ID of the frame.
+ *  dl: The value of the DL field in the frame.
  */
-static int handle_incoming_control_frame(unsigned char opcode, unsigned char frame_id)
+static int handle_incoming_control_frame(unsigned char opcode, unsigned char frame_id, unsigned long dl)
 {
 	int code;
 
@@ -241,7 +377,12 @@ static int handle_incoming_control_frame(unsigned char opcode, unsigned char fra
 		code = 0;
 		break;
 	case MSP_OP_F_ACK:
-		if (msp_exp_state.processed_length + msp_exp_state.prev_data_length >= msp_exp_state.total_length) {
+		if (msp_exp_state.tx_window > 1 &&
+		    (msp_exp_state.type == MSP_EXP_STATE_OBC_REQ_RESPONSE ||
+		     msp_exp_state.type == MSP_EXP_STATE_OBC_REQ_TX)) {
+			code = MSP_EXP_ERR_FAULTY_FRAME;
+			msp_debug("Got an F_ACK in a windowed transfer");
+		} else if (msp_exp_state.processed_length + msp_exp_state.prev_data_length >= msp_exp_state.total_length) {
 			/* We should get T_ACK in this situation */
 			code = MSP_EXP_ERR_FAULTY_FRAME;
 			msp_debug("Got an F_ACK when we should've gotten a T_ACK");
@@ -278,12 +419,16 @@ static int handle_incoming_control_frame(unsigned char opcode, unsigned char fra
 		} else {
 			/* Transaction Acknowledged. Call the handler function, increment
 			 * the sequence flag, and move to the Ready state. */
-			msp_expsend_complete(msp_exp_state.opcode);
+			if (msp_exp_state.opcode != MSP_OP_REQ_WINDOW)
+				msp_expsend_complete(msp_exp_state.opcode);
 			msp_seqflags_set(&msp_exp_state.seqflags, msp_exp_state.opcode, frame_id);
 			msp_exp_state.type = MSP_EXP_STATE_READY;
 			code = 0;
 		}
 		break;
+	case MSP_OP_WINDOW_ACK:
+		code = handle_incoming_window_acknowledge(dl);
+		break;
 	default:
 		code = MSP_EXP_ERR_FAULTY_FRAME;
 		msp_debug_hex("Received unhandlable control flow opcode: ", opcode);
@@ -292,6 +437,56 @@ static int handle_incoming_control_frame(unsigned char opcode, unsigned char fra
 
 	return code;
 }
+/*
+ * Handles an incoming WINDOW_ACK header frame. It acknowledges every data
+ * frame before the offset in the DL field, the frames after it are sent
+ * again. A WINDOW_ACK with DL = 0 also acknowledges the response header.
+ *
+ * Arguments
+ *  dl: The value of the DL field in the frame.
+ */
+static int handle_incoming_window_acknowledge(unsigned long dl)
+{
+	unsigned long acknowledged;
+
+	if (msp_exp_state.tx_window <= 1 ||
+	    !(msp_exp_state.type == MSP_EXP_STATE_OBC_REQ_RESPONSE ||
+	      msp_exp_state.type == MSP_EXP_STATE_OBC_REQ_TX)) {
+		msp_debug("Received WINDOW_ACK when not in a windowed transfer.");
+		return MSP_EXP_ERR_FAULTY_FRAME;
+	}
+
+	if (msp_exp_state.type == MSP_EXP_STATE_OBC_REQ_RESPONSE) {
+		if (dl != 0) {
+			msp_debug("WINDOW_ACK of the response should have DL 0.");
+			return MSP_EXP_ERR_FAULTY_FRAME;
+		}
+		/* Response Acknowledged, start transmission of data. */
+		msp_exp_state.processed_length = 0;
+		msp_exp_state.tx_seq = 0;
+		msp_exp_state.tx_sent = 0;
+		msp_exp_state.type = MSP_EXP_STATE_OBC_REQ_TX;
+		return 0;
+	}
+
+	/* The data before the offset has been received in full frames, the OBC
+	 * sends a T_ACK instead once it has received all of it. */
+	if (dl < msp_exp_state.processed_length || dl >= msp_exp_state.total_length) {
+		msp_debug_int("WINDOW_ACK outside of the window: ", dl);
+		return MSP_EXP_ERR_FAULTY_FRAME;
+	}
+	acknowledged = dl - msp_exp_state.processed_length;
+	if (acknowledged % MSP_EXP_MTU != 0 || acknowledged / MSP_EXP_MTU > msp_exp_state.tx_window) {
+		msp_debug_int("WINDOW_ACK outside of the window: ", dl);
+		return MSP_EXP_ERR_FAULTY_FRAME;
+	}
+
+	msp_exp_state.processed_length = dl;
+	msp_exp_state.tx_seq = (msp_exp_state.tx_seq + acknowledged / MSP_EXP_MTU) & MSP_WINDOW_SEQ_MASK;
+	msp_exp_state.tx_sent = 0;
+
+	return 0;
+}
 /*
  * Handles an incoming system control header frame.
  * 
@@ -327,11 +522,11 @@ static int handle_incoming_system_frame(unsigned char opcode, unsigned char fram
  * 
  * Arguments
  *  opcode: OP-code of the frame.
+ *  dl: The value of the DL field in the frame, the window that the OBC asks
+ *      for. Always 0 in classic MSP.
  */
-static int handle_incoming_request_frame(unsigned char opcode)
+static int handle_incoming_request_frame(unsigned char opcode, unsigned long dl)
 {
-	unsigned long data_to_send;
-
 	ensure_ready_state();
 
 	msp_exp_state.transaction_id = msp_seqflags_get_next(&msp_exp_state.seqflags, opcode);
@@ -339,14 +534,39 @@ static int handle_incoming_request_frame(unsigned char opcode)
 	msp_exp_state.opcode = opcode;
 	msp_exp_state.processed_length = 0;
 	msp_exp_state.prev_data_length = 0;
+	msp_exp_state.tx_window = 1;
+#ifndef MSP_LOW_MEMORY
+	/* Frames prepared for an earlier transaction are no longer valid */
+	prepared_frames[0].len = 0;
+	prepared_frames[1].len = 0;
+#endif
+
+	if (opcode == MSP_OP_REQ_WINDOW) {
+		/* Handled by MSP. The OBC offers a window in DL and is sent the
+		 * window that will be used, which applies from the next request. */
+		if (dl < 1)
+			msp_exp_state.window = 1;
+		else if (dl > MSP_EXP_WINDOW)
+			msp_exp_state.window = MSP_EXP_WINDOW;
+		else
+			msp_exp_state.window = (unsigned char) dl;
+		msp_exp_state.total_length = 1;
+		msp_exp_state.type = MSP_EXP_STATE_OBC_REQ_RESPONSE;
+		return 0;
+	}
 
-	data_to_send = 0;
-	msp_expsend_start(opcode, &data_to_send);
-	
-	msp_exp_state.total_length = data_to_send;
+	/* A windowed transfer is only used if it has been negotiated */
+	if (msp_exp_state.window > 1 && dl > 1 && dl <= msp_exp_state.window)
+		msp_exp_state.tx_window = (unsigned char) dl;
 
-	/* OBC Send state */
-	msp_exp_state.type = MSP_EXP_STATE_OBC_REQ_RESPONSE;
+	if (msp_expsend_busy_time(opcode) != 0) {
+		/* Answer with EXP_BUSY until the experiment is ready, the transaction
+		 * is started first then. */
+		msp_exp_state.total_length = 0;
+		msp_exp_state.type = MSP_EXP_STATE_OBC_REQ_BUSY;
+	} else {
+		start_request();
+	}
 
 	return 0;
 }
@@ -407,6 +627,9 @@ static int handle_outgoing_frame(unsigned char *buf, unsigned long *len)
 		*len = 9;
 		code = 0;
 		break;
+	case MSP_EXP_STATE_OBC_REQ_BUSY:
+		code = handle_outgoing_busy_frame(buf, len);
+		break;
 	case MSP_EXP_STATE_OBC_REQ_RESPONSE:
 		code = handle_outgoing_response_frame(buf, len);
 		break;
@@ -430,6 +653,32 @@ static int handle_outgoing_frame(unsigned char *buf, unsigned long *len)
 
 	return code;
 }
+/*
+ * Handles an outgoing frame to an OBC Request that the experiment was not
+ * ready to serve. Sends EXP_BUSY with the number of milliseconds until the
+ * experiment expects to be ready in the DL field, or the response header once
+ * it is ready.
+ *
+ * Arguments
+ *  buf: Pointer to the buffer where the frame will be stored.
+ *  len: Pointer to an integer which represents the length of the outgoing 
+ *       data.
+ */
+static int handle_outgoing_busy_frame(unsigned char *buf, unsigned long *len)
+{
+	unsigned long busy_time;
+
+	busy_time = msp_expsend_busy_time(msp_exp_state.opcode);
+	if (busy_time == 0) {
+		start_request();
+		return handle_outgoing_response_frame(buf, len);
+	}
+
+	msp_exp_frame_format_header(buf, MSP_OP_EXP_BUSY, msp_exp_state.transaction_id, busy_time);
+	*len = 9;
+
+	return 0;
+}
 /*
  * Handles an outgoing response frame to an OBC Request.
  *
@@ -440,9 +689,12 @@ static int handle_outgoing_frame(unsigned char *buf, unsigned long *len)
  */
 static int handle_outgoing_response_frame(unsigned char *buf, unsigned long *len)
 {
+	unsigned char opcode;
+
 	/* Format a header saying how much we are going to send. State and frame-ID
 	 * is only updated first when we receive an acknowledge frame. */
-	msp_exp_frame_format_header(buf, MSP_OP_EXP_SEND, msp_exp_state.transaction_id, msp_exp_state.total_length);
+	opcode = msp_exp_state.tx_window > 1 ? MSP_OP_EXP_SEND_WINDOW : MSP_OP_EXP_SEND;
+	msp_exp_frame_format_header(buf, opcode, msp_exp_state.transaction_id, msp_exp_state.total_length);
 	*len = 9;
 
 	return 0;
@@ -457,8 +709,13 @@ static int handle_outgoing_response_frame(unsigned char *buf, unsigned long *len
  */
 static int handle_outgoing_data_frame(unsigned char *buf, unsigned long *len)
 {
-	unsigned long send_len, remaining_len;
-	unsigned long fcs;
+#ifndef MSP_LOW_MEMORY
+	struct prepared_frame *prepared;
+	unsigned long i;
+#else
+	unsigned long offset;
+	unsigned char head;
+#endif
 
 	/* If we have nothing left to send, something has gone very wrong. Send a
 	 * NULL frame to the OBC and go to the ready state. */
@@ -470,29 +727,162 @@ static int handle_outgoing_data_frame(unsigned char *buf, unsigned long *len)
 		return MSP_EXP_ERR_STATE_ERROR;
 	}
 
+#ifndef MSP_LOW_MEMORY
+	prepared = serve_prepared_frame();
+	for (i = 0; i < prepared->len; i++)
+		buf[i] = prepared->data[i];
+	*len = prepared->len;
+#else
+	offset = next_data_frame(&head, 1);
+	*len = build_data_frame(buf, offset, head);
+
+	/* This is needed for when we receive acknowledgments */
+	msp_exp_state.prev_data_length = *len - 5;
+#endif
+
+	return 0;
+}
+/*
+ * Picks the data frame that is sent when the OBC reads one and returns the
+ * offset of its data field.
+ *
+ * In a windowed transfer the frames after the acknowledged ones are sent one
+ * after the other. If the whole window has been sent and the OBC reads again,
+ * it has missed a frame or its acknowledgement was lost, and the window is
+ * sent again from the start.
+ *
+ * Arguments
+ *  head: Set to the first byte of the frame, opcode and frame-ID.
+ *  send: Non-zero if the frame is sent, 0 to only look at it.
+ */
+static unsigned long next_data_frame(unsigned char *head, int send)
+{
+	unsigned long offset;
+	unsigned char sent;
+
+	if (msp_exp_state.tx_window <= 1) {
+		*head = MSP_OP_DATA_FRAME | (msp_exp_state.frame_id << 7);
+		return msp_exp_state.processed_length;
+	}
+
+	sent = msp_exp_state.tx_sent;
+	offset = msp_exp_state.processed_length + (unsigned long) sent * MSP_EXP_MTU;
+	if (sent >= msp_exp_state.tx_window || offset >= msp_exp_state.total_length) {
+		sent = 0;
+		offset = msp_exp_state.processed_length;
+	}
+	if (send)
+		msp_exp_state.tx_sent = sent + 1;
+
+	sent = (msp_exp_state.tx_seq + sent) & MSP_WINDOW_SEQ_MASK;
+	*head = MSP_OP_WINDOW_DATA(sent) | ((sent & 0x01) << 7);
+
+	return offset;
+}
+/*
+ * Builds a data frame of the current transaction. Only the FCS fields of the
+ * MSP state are changed.
+ *
+ * Arguments
+ *  buf: Pointer to the buffer where the frame will be stored.
+ *  offset: Offset of the data field in the transaction.
+ *  head: First byte of the frame, opcode and frame-ID.
+ *
+ * Returns the length of the whole frame.
+ */
+static unsigned long build_data_frame(unsigned char *buf, unsigned long offset, unsigned char head)
+{
+	unsigned long send_len, remaining_len;
+	unsigned long fcs;
+
 	/* Calculate how many bytes that are to be sent. */
 	send_len = MSP_EXP_MTU;
-	remaining_len = msp_exp_state.total_length - msp_exp_state.processed_length;
+	remaining_len = msp_exp_state.total_length - offset;
 	if (remaining_len < MSP_EXP_MTU) {
 		send_len = remaining_len;
 	}
 
-	/* This is needed for when we receive acknowledgments */
-	msp_exp_state.prev_data_length = send_len;
-
-	/* All good, now lets fill up the buffer with data. */
-	buf[0] = MSP_OP_DATA_FRAME | (msp_exp_state.frame_id << 7);
-	msp_expsend_data(msp_exp_state.opcode, buf + 1, send_len, msp_exp_state.processed_length);
-
-	/* Generate and format the Frame Check Sequence (from_obc = 0) */
-	fcs = msp_exp_frame_generate_fcs(buf, 0, send_len+1);
+	/* All good, now lets fill up the buffer with data. The FCS (from_obc = 0)
+	 * is started here and updated by the handler as it writes the data. */
+	buf[0] = head;
+	msp_exp_state.tx_fcs = msp_exp_frame_fcs_update(msp_exp_frame_fcs_init(0), buf, 1);
+	msp_exp_state.tx_fcs_length = 0;
+	if (msp_exp_state.opcode == MSP_OP_REQ_WINDOW)
+		buf[1] = msp_exp_state.window; /* the negotiated window */
+	else
+		msp_expsend_data(msp_exp_state.opcode, buf + 1, send_len, offset);
+
+	/* Add the part of the data field that the handler did not add itself */
+	if (msp_exp_state.tx_fcs_length <= send_len) {
+		fcs = msp_exp_frame_fcs_update(msp_exp_state.tx_fcs,
+				buf + 1 + msp_exp_state.tx_fcs_length,
+				send_len - msp_exp_state.tx_fcs_length);
+		fcs = msp_exp_frame_fcs_final(fcs);
+	} else {
+		fcs = msp_exp_frame_generate_fcs(buf, 0, send_len+1);
+	}
 	msp_to_bigendian32(buf + (send_len + 1), fcs);
 
-	/* Set the total length of the frame */
-	*len = send_len+5;
+	/* The total length of the frame */
+	return send_len+5;
+}
+#ifndef MSP_LOW_MEMORY
+/*
+ * Looks for a data frame of the current transaction that has already been
+ * built. Returns 0 if there is none.
+ */
+static struct prepared_frame *find_prepared_frame(unsigned long offset, unsigned char head)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (prepared_frames[i].len != 0 &&
+		    prepared_frames[i].offset == offset &&
+		    prepared_frames[i].head == head)
+			return &prepared_frames[i];
+	}
 
 	return 0;
 }
+/*
+ * Builds a data frame in the buffer that does not hold the frame that was
+ * sent last.
+ */
+static struct prepared_frame *prepare_frame(unsigned long offset, unsigned char head)
+{
+	struct prepared_frame *frame;
+
+	frame = &prepared_frames[sent_frame ^ 1];
+	frame->len = 0;
+	frame->offset = offset;
+	frame->head = head;
+	frame->len = build_data_frame(frame->data, offset, head);
+
+	return frame;
+}
+/*
+ * Returns the current data frame, building it first if it has not been
+ * prepared, and marks it as sent.
+ */
+static struct prepared_frame *serve_prepared_frame(void)
+{
+	struct prepared_frame *frame;
+	unsigned long offset;
+	unsigned char head;
+
+	offset = next_data_frame(&head, 1);
+	frame = find_prepared_frame(offset, head);
+	if (frame == 0)
+		frame = prepare_frame(offset, head);
+
+	sent_frame = (unsigned char) (frame - prepared_frames);
+
+	/* This is needed for when we receive acknowledgments */
+	msp_exp_state.prev_data_length = frame->len - 5;
+
+	return frame;
+}
+#endif
 /*
  * Handles an outgoing acknowledge frame. Also handles the case where we
  * receive a duplicate OBC Send transaction.
@@ -552,6 +942,22 @@ static int handle_outgoing_acknowledge_frame(unsigned char *buf, unsigned long *
 
 
 
+/*
+ * Starts the OBC Request transaction that has been set up in the MSP state,
+ * the experiment is asked how much data it will send.
+ */
+static void start_request(void)
+{
+	unsigned long data_to_send;
+
+	data_to_send = 0;
+	msp_expsend_start(msp_exp_state.opcode, &data_to_send);
+
+	msp_exp_state.total_length = data_to_send;
+
+	/* OBC Send state */
+	msp_exp_state.type = MSP_EXP_STATE_OBC_REQ_RESPONSE;
+}
 /*
  * Ensures that MSP is in the ready state. This means that if a current
  * transaction is active, it will be aborted.
@@ -567,11 +973,13 @@ static void ensure_ready_state(void)
 		break;
 	case MSP_EXP_STATE_OBC_REQ_RESPONSE:
 	case MSP_EXP_STATE_OBC_REQ_TX:
-		msp_expsend_error(msp_exp_state.opcode, MSP_EXP_ERR_TRANSACTION_ABORTED);
+		if (msp_exp_state.opcode != MSP_OP_REQ_WINDOW)
+			msp_expsend_error(msp_exp_state.opcode, MSP_EXP_ERR_TRANSACTION_ABORTED);
 		break;
 	default:
-		/* If we were in a state of a duplicate transaction or simply in the
-		 * ready state, we don't need to report any errors. */
+		/* If we were in a state of a duplicate transaction, in a request
+		 * that was never started or simply in the ready state, we don't need
+		 * to report any errors. */
 		break;
 	}
 
@@ -33,4 +33,29 @@ int msp_recv_callback(const unsigned char *data, unsigned long len);
  */
 int msp_send_callback(unsigned char *data, unsigned long *len);
 
+#ifndef MSP_LOW_MEMORY
+/**
+ * @brief Like msp_send_callback(), but returns a pointer to the frame instead
+ *        of copying it.
+ * @param frame Set to point to the frame to be sent. It stays valid until the
+ *              next call to msp_send_frame() or msp_send_callback().
+ * @param len Set to the number of bytes to be sent.
+ * @return 0 if OK, otherwise an error code from msp_exp_error.h.
+ *
+ * Data frames of an OBC Request are kept in two buffers: the one that was
+ * sent last, so that it can be sent again without being rebuilt, and the next
+ * one, which msp_exp_prepare_next() can build before the OBC asks for it.
+ */
+int msp_send_frame(const unsigned char **frame, unsigned long *len);
+
+/**
+ * @brief Builds the data frame that the OBC will ask for next.
+ * @return 1 if a frame was built, otherwise 0.
+ *
+ * Meant to be called while the experiment is idle between I2C transfers.
+ * It does nothing if MSP is busy or not in an OBC Request.
+ */
+int msp_exp_prepare_next(void);
+#endif
+
 #endif
@@ -19,6 +19,11 @@
  *                        definition should be used to determine minimum size
  *                        of the buffers used to send or receive MSP frames.
  *                        This is defined in this file.
+ *  - MSP_EXP_WINDOW: The largest number of data frames that the experiment
+ *                    sends before they are acknowledged, if the OBC has
+ *                    negotiated a windowed transfer. Between 1 and
+ *                    MSP_WINDOW_MAX, 1 turns windowed transfer off. Defaults
+ *                    to MSP_WINDOW_MAX.
  */
 
 #ifndef MSP_EXP_DEFINITIONS_H
@@ -26,6 +31,7 @@
 
 /* Import MSP_EXP_ADDR and MSP_EXP_MTU from the configuration file */
 #include "msp_configuration.h"
+#include "msp_constants.h"
 
 #ifndef MSP_EXP_ADDR
 #error MSP_EXP_ADDR not set
@@ -37,5 +43,11 @@
 #define MSP_EXP_MAX_FRAME_SIZE (((MSP_EXP_MTU) + 5) > 9 ? ((MSP_EXP_MTU) + 5) : 9)
 #endif
 
+#ifndef MSP_EXP_WINDOW
+#define MSP_EXP_WINDOW MSP_WINDOW_MAX
+#elif (MSP_EXP_WINDOW) < 1 || (MSP_EXP_WINDOW) > MSP_WINDOW_MAX
+#error MSP_EXP_WINDOW must be between 1 and MSP_WINDOW_MAX
+#endif
+
 
 #endif /* MSP_EXP_DEFINITIONS_H */
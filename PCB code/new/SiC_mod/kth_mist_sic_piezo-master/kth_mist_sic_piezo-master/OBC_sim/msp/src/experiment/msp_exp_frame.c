@@ -7,9 +7,74 @@
 
 #include "msp_crc.h"
 #include "msp_endian.h"
+#include "msp_opcodes.h"
 
 #include "msp_exp_frame.h"
 #include "msp_exp_definitions.h"
+#include "msp_exp_handler.h"
+#include "msp_exp_state.h"
+
+#ifndef MSP_LOW_MEMORY
+/* The header frames with DL = 0 that the experiment sends the most, for both
+ * frame-ID's. They only depend on MSP_EXP_ADDR, so they are formatted once and
+ * then copied. Costs 72 bytes of RAM, not used with MSP_LOW_MEMORY. */
+#define MSP_EXP_FRAME_CACHE_SIZE 4
+static unsigned char msp_exp_frame_cache[MSP_EXP_FRAME_CACHE_SIZE][2][9];
+static volatile unsigned char msp_exp_frame_cache_valid = 0;
+
+static int cache_index(unsigned char opcode);
+#endif
+
+static void format_header(unsigned char *dest, unsigned char opcode, unsigned char frame_id, unsigned long dl);
+
+/**
+ * @brief Starts the calculation of an FCS.
+ * @param from_obc A boolean value that specifies whether the FCS should be
+ *                 calculated as if the frame came from the OBC or from the
+ *                 experiment.
+ * @return The FCS remainder after the pseudo header, to be passed to
+ *         msp_exp_frame_fcs_update().
+ */
+unsigned long msp_exp_frame_fcs_init(int from_obc)
+{
+	unsigned char pseudo_header;
+
+	/* Format the pseudo header */
+	pseudo_header = (MSP_EXP_ADDR) << 1;
+	if (!from_obc)
+		pseudo_header |= 0x01;
+
+	return msp_crc32(&pseudo_header, 1, 0);
+}
+
+/**
+ * @brief Adds a sequence of bytes to an FCS that is being calculated.
+ * @param fcs The FCS remainder so far.
+ * @param data Pointer to the next bytes of the frame.
+ * @param len Number of bytes pointed to by data.
+ * @return The updated FCS remainder.
+ *
+ * The bytes of a frame can be added in any number of calls, as long as they
+ * are added in order.
+ */
+unsigned long msp_exp_frame_fcs_update(unsigned long fcs, const unsigned char *data, unsigned long len)
+{
+	return msp_crc32(data, len, fcs);
+}
+
+/**
+ * @brief Finishes the calculation of an FCS.
+ * @param fcs The FCS remainder after the last byte of the frame.
+ * @return The FCS value of the frame.
+ *
+ * The CRC-32 remainder is finalized after every update, so this does not
+ * change the value. It marks where a remainder becomes a value that can be
+ * sent or compared.
+ */
+unsigned long msp_exp_frame_fcs_final(unsigned long fcs)
+{
+	return fcs;
+}
 
 /**
  * @brief Calculates the FCS of an MSP frame.
@@ -29,20 +94,12 @@
  */
 unsigned long msp_exp_frame_generate_fcs(const unsigned char *data, int from_obc, unsigned long len)
 {
-	unsigned char pseudo_header;
 	unsigned long remainder;
 
-	/* Format the pseudo header */
-	pseudo_header = (MSP_EXP_ADDR) << 1;
-	if (!from_obc)
-		pseudo_header |= 0x01;
+	remainder = msp_exp_frame_fcs_init(from_obc);
+	remainder = msp_exp_frame_fcs_update(remainder, data, len);
 
-	remainder = msp_crc32(&pseudo_header, 1, 0);
-
-	/* Now account for the rest of the frame */
-	remainder = msp_crc32(data, len, remainder);
-
-	return remainder;
+	return msp_exp_frame_fcs_final(remainder);
 }
 
 /**
@@ -72,6 +129,109 @@ int msp_exp_frame_fcs_valid(const unsigned char *data, int from_obc, unsigned lo
 }
 
 
+/**
+ * @brief Starts the FCS of a frame that is about to be received from the OBC.
+ *
+ * Should be called by the I2C driver when the OBC addresses the experiment
+ * for a write, before the first byte arrives.
+ */
+void msp_exp_frame_rx_start(void)
+{
+	msp_exp_state.rx_fcs = msp_exp_frame_fcs_init(1);
+	msp_exp_state.rx_fcs_length = 0;
+	msp_exp_state.rx_fcs_started = 1;
+}
+
+/**
+ * @brief Adds newly received bytes to the FCS of the incoming frame.
+ * @param frame Pointer to the buffer that the frame is received into.
+ * @param received Number of bytes received so far.
+ *
+ * Meant to be called from the I2C receive interrupt, once per byte or once
+ * per chunk. The length of the frame is not known until the transfer stops,
+ * so the last 4 bytes received are held back in case they are the FCS.
+ */
+void msp_exp_frame_rx_update(const unsigned char *frame, unsigned long received)
+{
+	unsigned long len;
+
+	if (!msp_exp_state.rx_fcs_started || received <= 4)
+		return;
+
+	len = received - 4;
+	if (len > msp_exp_state.rx_fcs_length) {
+		msp_exp_state.rx_fcs = msp_exp_frame_fcs_update(msp_exp_state.rx_fcs,
+				frame + msp_exp_state.rx_fcs_length,
+				len - msp_exp_state.rx_fcs_length);
+		msp_exp_state.rx_fcs_length = len;
+	}
+}
+
+/**
+ * @brief Checks if the FCS of a frame received from the OBC is valid.
+ * @param data Pointer to the first byte in the MSP frame.
+ * @param len Number of bytes in the MSP frame.
+ * @return 1 if the FCS is valid, 0 otherwise.
+ *
+ * Only the bytes that msp_exp_frame_rx_update() has not seen yet are read.
+ * If the FCS was never started for this frame, the whole frame is checked
+ * with msp_exp_frame_fcs_valid().
+ */
+int msp_exp_frame_rx_fcs_valid(const unsigned char *data, unsigned long len)
+{
+	unsigned long fcs;
+
+	if (!msp_exp_state.rx_fcs_started || len < 4 || msp_exp_state.rx_fcs_length > len - 4) {
+		msp_exp_state.rx_fcs_started = 0;
+		return msp_exp_frame_fcs_valid(data, 1, len);
+	}
+
+	msp_exp_frame_rx_update(data, len);
+	msp_exp_state.rx_fcs_started = 0;
+
+	fcs = msp_from_bigendian32(data + (len - 4));
+	if (fcs == msp_exp_frame_fcs_final(msp_exp_state.rx_fcs))
+		return 1;
+	else
+		return 0;
+}
+
+
+/**
+ * @brief Copies data into the outgoing data frame and adds it to the FCS.
+ * @param dest Where the data goes in the buffer passed to msp_expsend_data().
+ * @param src The data to send.
+ * @param len Number of bytes to copy.
+ *
+ * To be used by msp_expsend_data(). Copies the data and calculates the FCS in
+ * the same pass, so that the frame does not have to be read again before it
+ * is sent. The data field must be written from the start and in order.
+ */
+void msp_expsend_copy(unsigned char *dest, const unsigned char *src, unsigned long len)
+{
+	msp_exp_state.tx_fcs = msp_crc32_copy(dest, src, len, msp_exp_state.tx_fcs);
+	msp_exp_state.tx_fcs_length += len;
+}
+
+/**
+ * @brief Adds data that has been written to the outgoing data frame to the
+ *        FCS.
+ * @param data Pointer to the bytes that were written.
+ * @param len Number of bytes written.
+ *
+ * To be used by msp_expsend_data() for data that is formatted directly into
+ * the buffer, preferably chunk by chunk while it is still in registers or
+ * cache. The data field must be added from the start and in order. Bytes that
+ * are not added by the handler are added by MSP after msp_expsend_data()
+ * returns.
+ */
+void msp_expsend_fcs_update(const unsigned char *data, unsigned long len)
+{
+	msp_exp_state.tx_fcs = msp_exp_frame_fcs_update(msp_exp_state.tx_fcs, data, len);
+	msp_exp_state.tx_fcs_length += len;
+}
+
+
 /**
  * @brief Formats a header frame into a sequence of bytes.
  * @param dest Pointer to the buffer where the formatted frame will be stored.
@@ -84,21 +244,30 @@ int msp_exp_frame_fcs_valid(const unsigned char *data, int from_obc, unsigned lo
  *
  * This function formats the entire frame, including the FCS value. The
  * resulting sequence of bytes can be sent directly to the OBC.
+ *
+ * NULL, F_ACK, T_ACK and EXP_BUSY frames with DL = 0 are copied from a cache
+ * instead of having their FCS calculated, since the OBC is waiting for them.
  */
 void msp_exp_frame_format_header(unsigned char *dest, unsigned char opcode, unsigned char frame_id, unsigned long dl)
 {
-	unsigned long fcs;
+#ifndef MSP_LOW_MEMORY
+	const unsigned char *frame;
+	int index;
+	int i;
 
-	/* Format OP code and Frame-ID */
-	dest[0] = opcode & 0x7F;
-	dest[0] |= (frame_id & 0x1) << 7;
+	index = cache_index(opcode & 0x7F);
+	if (dl == 0 && index >= 0) {
+		if (!msp_exp_frame_cache_valid)
+			msp_exp_frame_prepare_cache();
 
-	/* Format the DL field */
-	msp_to_bigendian32(dest + 1, dl);
+		frame = msp_exp_frame_cache[index][frame_id & 0x1];
+		for (i = 0; i < 9; i++)
+			dest[i] = frame[i];
+		return;
+	}
+#endif
 
-	/* Format the FCS field */
-	fcs = msp_exp_frame_generate_fcs(dest, 0, 5);
-	msp_to_bigendian32(dest + 5, fcs);
+	format_header(dest, opcode, frame_id, dl);
 }
 
 /**
@@ -116,3 +285,64 @@ void msp_exp_frame_format_empty_header(unsigned char *dest, unsigned char opcode
 {
 	msp_exp_frame_format_header(dest, opcode, 0, 0);
 }
+
+/**
+ * @brief Formats the cached header frames.
+ *
+ * Called automatically the first time a cached frame is needed. Calling it at
+ * start up keeps the cost out of the first reply to the OBC. Does nothing with
+ * MSP_LOW_MEMORY.
+ */
+void msp_exp_frame_prepare_cache(void)
+{
+#ifndef MSP_LOW_MEMORY
+	static const unsigned char opcodes[MSP_EXP_FRAME_CACHE_SIZE] = {
+		MSP_OP_NULL, MSP_OP_F_ACK, MSP_OP_T_ACK, MSP_OP_EXP_BUSY
+	};
+	int i;
+
+	for (i = 0; i < MSP_EXP_FRAME_CACHE_SIZE; i++) {
+		format_header(msp_exp_frame_cache[i][0], opcodes[i], 0, 0);
+		format_header(msp_exp_frame_cache[i][1], opcodes[i], 1, 0);
+	}
+	msp_exp_frame_cache_valid = 1;
+#endif
+}
+
+
+
+/* Formats a header frame, see msp_exp_frame_format_header() */
+static void format_header(unsigned char *dest, unsigned char opcode, unsigned char frame_id, unsigned long dl)
+{
+	unsigned long fcs;
+
+	/* Format OP code and Frame-ID */
+	dest[0] = opcode & 0x7F;
+	dest[0] |= (frame_id & 0x1) << 7;
+
+	/* Format the DL field */
+	msp_to_bigendian32(dest + 1, dl);
+
+	/* Format the FCS field */
+	fcs = msp_exp_frame_generate_fcs(dest, 0, 5);
+	msp_to_bigendian32(dest + 5, fcs);
+}
+
+#ifndef MSP_LOW_MEMORY
+/* Returns where a header frame with DL = 0 is in the cache, or -1 */
+static int cache_index(unsigned char opcode)
+{
+	switch (opcode) {
+	case MSP_OP_NULL:
+		return 0;
+	case MSP_OP_F_ACK:
+		return 1;
+	case MSP_OP_T_ACK:
+		return 2;
+	case MSP_OP_EXP_BUSY:
+		return 3;
+	default:
+		return -1;
+	}
+}
+#endif
@@ -8,9 +8,16 @@
 #ifndef MSP_FRAME_H
 #define MSP_FRAME_H
 
+unsigned long msp_exp_frame_fcs_init(int from_obc);
+unsigned long msp_exp_frame_fcs_update(unsigned long fcs, const unsigned char *data, unsigned long len);
+unsigned long msp_exp_frame_fcs_final(unsigned long fcs);
 unsigned long msp_exp_frame_generate_fcs(const unsigned char *data, int from_obc, unsigned long len);
 int msp_exp_frame_fcs_valid(const unsigned char *data, int from_obc, unsigned long len);
+void msp_exp_frame_rx_start(void);
+void msp_exp_frame_rx_update(const unsigned char *frame, unsigned long received);
+int msp_exp_frame_rx_fcs_valid(const unsigned char *data, unsigned long len);
 void msp_exp_frame_format_header(unsigned char *dest, unsigned char opcode, unsigned char frame_id, unsigned long dl);
-void msp_exp_frame_format_empty_header(unsigned char *dest, unsigned char opcode);
+void msp_exp_frame_format_empty_header(unsigned char *dest, unsigned char opcode );
+void msp_exp_frame_prepare_cache(void);
 
 #endif /* MSP_FRAME_H */
@@ -34,6 +34,8 @@ void msp_exp_state_initialize(msp_seqflags_t seqflags)
 	msp_exp_state.type = MSP_EXP_STATE_READY;
 
 	msp_exp_state.seqflags = seqflags;
+	msp_exp_state.window = 1;
+	msp_exp_state.tx_window = 1;
 
 	msp_exp_state.busy = 0;
 	msp_exp_state.initialized = 1;
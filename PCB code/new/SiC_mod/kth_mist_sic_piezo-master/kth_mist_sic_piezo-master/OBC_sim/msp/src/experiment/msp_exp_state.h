@@ -17,6 +17,7 @@ typedef enum {
 	MSP_EXP_STATE_READY, /**< Ready to start a new transaction. */
 	MSP_EXP_STATE_OBC_SEND_RX, /**< In an OBC Send transaction. */
 	MSP_EXP_STATE_OBC_SEND_RX_DUPLICATE, /**< Receiving a duplicate OBC Send transaction. */
+	MSP_EXP_STATE_OBC_REQ_BUSY, /**< Not yet ready to respond to an OBC Request transaction. */
 	MSP_EXP_STATE_OBC_REQ_RESPONSE, /**< Responding to an OBC Request transaction. */
 	MSP_EXP_STATE_OBC_REQ_TX /**< In an OBC Request transaction. */
 } msp_exp_state_type_t;
@@ -74,6 +75,30 @@ struct msp_exp_state_information {
 	 */
 	unsigned char opcode;
 
+	/**
+	 * @brief The largest window that the OBC has negotiated with
+	 *        MSP_OP_REQ_WINDOW, 1 if the data frames are sent one at a time.
+	 */
+	unsigned char window;
+
+	/**
+	 * @brief The window of the ongoing OBC Request transaction, 1 if it is
+	 *        carried out as in classic MSP.
+	 */
+	unsigned char tx_window;
+
+	/**
+	 * @brief The sequence number of the first data frame that has not been
+	 *        acknowledged, in a windowed transfer.
+	 */
+	unsigned char tx_seq;
+
+	/**
+	 * @brief The number of data frames sent after the acknowledged ones, in a
+	 *        windowed transfer.
+	 */
+	unsigned char tx_sent;
+
 	/**
 	 * @brief The sequence flags of the experiment state.
 	 *
@@ -100,6 +125,38 @@ struct msp_exp_state_information {
 	 *        in an OBC Request transaction.
 	 */
 	unsigned long prev_data_length;
+
+	/**
+	 * @brief The running FCS of the data frame that is being sent.
+	 *
+	 * Seeded with the pseudo header and the opcode byte before
+	 * msp_expsend_data() is called, and updated by the handler through
+	 * msp_expsend_copy() or msp_expsend_fcs_update().
+	 */
+	unsigned long tx_fcs;
+
+	/**
+	 * @brief The number of bytes of the outgoing data field that are included
+	 *        in tx_fcs.
+	 */
+	unsigned long tx_fcs_length;
+
+	/**
+	 * @brief The running FCS of the frame that is being received.
+	 */
+	unsigned long rx_fcs;
+
+	/**
+	 * @brief The number of bytes of the incoming frame that are included in
+	 *        rx_fcs.
+	 */
+	unsigned long rx_fcs_length;
+
+	/**
+	 * @brief A boolean value to keep track of whether rx_fcs has been started
+	 *        for the frame that is being received.
+	 */
+	unsigned char rx_fcs_started;
 };
 
 
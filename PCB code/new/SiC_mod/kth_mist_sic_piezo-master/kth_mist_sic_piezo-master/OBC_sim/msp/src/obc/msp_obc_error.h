@@ -28,6 +28,7 @@
 #define MSP_OBC_ERR_INVALID_LENGTH -13
 #define MSP_OBC_ERR_NULL_POINTER -14
 #define MSP_OBC_ERR_INVALID_ACTION -15
+#define MSP_OBC_ERR_INVALID_WINDOW -16
 
 /* I2C Errors: [-9,-1] and [1,9] */
 
@@ -49,7 +49,7 @@ struct msp_obc_frame msp_obc_decode_frame(const msp_link_t *lnk, unsigned char *
     frame.opcode = src[0] & 0x7F;
     frame.id = (src[0] >> 7) & 0x01;
 
-    if (frame.opcode == MSP_OP_DATA_FRAME) {
+    if (frame.opcode == MSP_OP_DATA_FRAME || MSP_OP_IS_WINDOW_DATA(frame.opcode)) {
         frame.type = MSP_OBC_FRAME_DATA;
         frame.data = src + 1;
         frame.datalen = len - 5;
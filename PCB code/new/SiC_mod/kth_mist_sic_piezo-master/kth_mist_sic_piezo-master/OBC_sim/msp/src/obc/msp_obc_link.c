@@ -33,6 +33,11 @@ static void msp_set_as_ready(msp_link_t *lnk)
 
 	lnk->total_length = 0;
 	lnk->processed_length = 0;
+	lnk->busy_time = 0;
+
+	lnk->transaction_window = 1;
+	lnk->seq = 0;
+	lnk->unacked = 0;
 }
 
 static struct msp_response msp_response_error(int error_code)
@@ -49,9 +54,11 @@ static struct msp_response msp_response_ok(void) {
 	return r;
 }
 
-static struct msp_response msp_response_busy(void) {
+static struct msp_response msp_response_busy(msp_link_t *lnk, unsigned long busy_time) {
 	struct msp_response r;
 	r.status = MSP_RESPONSE_BUSY;
+	r.busy_time = busy_time;
+	lnk->busy_time = busy_time;
 	return r;
 }
 
@@ -108,6 +115,8 @@ msp_link_t msp_create_link(unsigned long slave_address,
 	lnk.buffer = buf;
 	lnk.mtu = mtu;
 	lnk.flags = flags;
+	lnk.window = 1;
+	lnk.window_offer = 1;
 
 	msp_set_as_ready(&lnk);
 
@@ -171,6 +180,40 @@ struct msp_response msp_start_transaction(msp_link_t *lnk,
 	return msp_response_ok();
 }
 
+/**
+ * @brief Starts a transaction that negotiates a windowed transfer of OBC
+ *        Requests with the experiment. (Non-Blocking)
+ * @param lnk The link to start the transaction with.
+ * @param window The largest window to offer, 1 to MSP_WINDOW_MAX. Offering a
+ *               window of 1 turns windowed transfer off.
+ * @return An MSP response.
+ *
+ * The transaction is an OBC Request with the opcode MSP_OP_REQ_WINDOW, it is
+ * carried out like any other. The experiment sends a single byte, the window
+ * it agrees to. Once the transaction is successful the window is used by
+ * every OBC Request that follows, see msp_window().
+ *
+ * An experiment that does not implement windowed transfer sends no data, and
+ * the window remains 1.
+ */
+struct msp_response msp_negotiate_window(msp_link_t *lnk,
+                                         unsigned char window)
+{
+	struct msp_response r;
+
+	if (lnk == NULL)
+		return msp_response_error(MSP_OBC_ERR_NULL_POINTER);
+
+	if (window < 1 || window > MSP_WINDOW_MAX)
+		return msp_response_error(MSP_OBC_ERR_INVALID_WINDOW);
+
+	r = msp_start_transaction(lnk, MSP_OP_REQ_WINDOW, 0);
+	if (r.status == MSP_RESPONSE_OK)
+		lnk->window_offer = window;
+
+	return r;
+}
+
 /**
  * @brief Aborts an ongoing transaction. (Blocking)
  * @param lnk The link whose ongoing transaction should be aborted.
@@ -329,11 +372,17 @@ struct msp_response msp_send_header_frame(msp_link_t *lnk)
 		frame.dl = lnk->total_length;
 		break;
 	case MSP_LINK_STATE_REQ_TX_HEADER:
-		/* Send request header (DL0, FID0) */
+		/* Send request header (FID0). DL is the window that is offered or
+		 * asked for, 0 in classic MSP. */
 		frame.type = MSP_OBC_FRAME_HEADER;
 		frame.id = 0;
 		frame.opcode = lnk->opcode;
-		frame.dl = 0;
+		if (lnk->opcode == MSP_OP_REQ_WINDOW)
+			frame.dl = lnk->window_offer;
+		else if (lnk->window > 1)
+			frame.dl = lnk->window;
+		else
+			frame.dl = 0;
 		break;
 	case MSP_LINK_STATE_REQ_RX_DATA:
 		frame.type = MSP_OBC_FRAME_HEADER;
@@ -342,6 +391,12 @@ struct msp_response msp_send_header_frame(msp_link_t *lnk)
 			frame.opcode = MSP_OP_T_ACK;
 			frame.dl = 0;
 			msp_debug_int("formatting T_ACK with id ", frame.id);
+		} else if (lnk->transaction_window > 1) {
+			/* Acknowledge everything received in order so far */
+			frame.id = 0;
+			frame.opcode = MSP_OP_WINDOW_ACK;
+			frame.dl = lnk->processed_length;
+			msp_debug_int("formatting WINDOW_ACK with offset ", frame.dl);
 		} else {
 			frame.id = lnk->frame_id;
 			frame.opcode = MSP_OP_F_ACK;
@@ -369,6 +424,8 @@ struct msp_response msp_send_header_frame(msp_link_t *lnk)
 	/* Now check what the next action should be */
 	if (frame.opcode == MSP_OP_T_ACK) {
 		msp_seqflags_set(&lnk->flags, lnk->opcode, lnk->transaction_id);
+		if (lnk->opcode == MSP_OP_REQ_WINDOW)
+			lnk->window = lnk->window_offer;
 		r = msp_response_successful(lnk);
 		msp_set_as_ready(lnk);
 		return r;
@@ -387,6 +444,7 @@ struct msp_response msp_send_header_frame(msp_link_t *lnk)
 	case MSP_LINK_STATE_REQ_RX_DATA:
 		/* Should read a data frame next */
 		lnk->next_action = MSP_LINK_ACTION_RX_DATA;
+		lnk->unacked = 0;
 		break;
 	default:
 		msp_debug("Invalid state at 2nd switch statement in msp_send_header_frame");
@@ -458,10 +516,38 @@ struct msp_response msp_recv_data_frame(msp_link_t *lnk,
 		lnk->error_count += 1;
 		return msp_response_error(code);
 	}
+	lnk->busy_time = 0;
 
 	/* First try to decode it as a data frame */
 	frame = msp_obc_decode_frame(lnk, lnk->buffer, len + 5);
-	if (frame.type == MSP_OBC_FRAME_DATA) {
+	if (frame.type == MSP_OBC_FRAME_DATA && lnk->transaction_window > 1) {
+		/* Only the next frame in sequence is taken, after anything else
+		 * the frames from the last one taken are asked for again. */
+		if (!MSP_OP_IS_WINDOW_DATA(frame.opcode) ||
+		    MSP_WINDOW_SEQ(frame.opcode, frame.id) != lnk->seq) {
+			lnk->error_count += 1;
+			lnk->next_action = MSP_LINK_ACTION_TX_HEADER;
+			return msp_response_error(MSP_OBC_ERR_INVALID_FRAME);
+		}
+
+		for (i = 0; i < frame.datalen; i++)
+			data[i] = frame.data[i];
+
+		*datalen = frame.datalen;
+
+		lnk->processed_length += frame.datalen;
+		lnk->seq = (lnk->seq + 1) & MSP_WINDOW_SEQ_MASK;
+		lnk->unacked += 1;
+
+		/* Keep reading until the window is full */
+		if (lnk->unacked < lnk->transaction_window && msp_next_data_length(lnk) > 0)
+			lnk->next_action = MSP_LINK_ACTION_RX_DATA;
+		else
+			lnk->next_action = MSP_LINK_ACTION_TX_HEADER;
+
+		r.status = MSP_RESPONSE_OK;
+		return r;
+	} else if (frame.type == MSP_OBC_FRAME_DATA && frame.opcode == MSP_OP_DATA_FRAME) {
 		/* Check that it is not a duplicate frame */
 		if (frame.id != (lnk->frame_id ^ 1)) {
 			lnk->error_count += 1;
@@ -474,6 +560,14 @@ struct msp_response msp_recv_data_frame(msp_link_t *lnk,
 
 		*datalen = frame.datalen;
 
+		/* The window that the experiment agrees to */
+		if (lnk->opcode == MSP_OP_REQ_WINDOW && lnk->processed_length == 0 && frame.datalen > 0) {
+			if (frame.data[0] < lnk->window_offer)
+				lnk->window_offer = frame.data[0];
+			if (lnk->window_offer < 1)
+				lnk->window_offer = 1;
+		}
+
 		lnk->frame_id = frame.id;
 		lnk->next_action = MSP_LINK_ACTION_TX_HEADER;
 		lnk->processed_length += frame.datalen;
@@ -501,9 +595,10 @@ struct msp_response msp_recv_data_frame(msp_link_t *lnk,
 		return r;
 	}
 
-	/* If it turns out that the experiment is busy, we report that */
+	/* If it turns out that the experiment is busy, we report that along with
+	 * how long it expects to be busy */
 	if (frame.opcode == MSP_OP_EXP_BUSY)
-		return msp_response_busy();
+		return msp_response_busy(lnk, frame.dl);
 
 	/* If we received the EXP_SEND header again, then we simply discard it as
 	 * an error. */
@@ -556,6 +651,7 @@ struct msp_response msp_recv_header_frame(msp_link_t *lnk)
 		lnk->error_count += 1;
 		return msp_response_error(code);
 	}
+	lnk->busy_time = 0;
 
 	frame = msp_obc_decode_frame(lnk, lnk->buffer, 9);
 	if (frame.type != MSP_OBC_FRAME_HEADER) {
@@ -572,9 +668,10 @@ struct msp_response msp_recv_header_frame(msp_link_t *lnk)
 		return r;
 	}
 
-	/* Take no further action if the experiment is busy */
+	/* Take no further action if the experiment is busy, but report how long
+	 * it expects to be busy */
 	if (frame.opcode == MSP_OP_EXP_BUSY)
-		return msp_response_busy();
+		return msp_response_busy(lnk, frame.dl);
 
 	switch (lnk->state) {
 	case MSP_LINK_STATE_SEND_TX_HEADER:
@@ -617,7 +714,18 @@ struct msp_response msp_recv_header_frame(msp_link_t *lnk)
 	case MSP_LINK_STATE_REQ_RX_RESPONSE:
 		/* The only header with should get in a request transaction is a
 		 * response header. */
-		if (frame.opcode == MSP_OP_EXP_SEND) {
+		if (frame.opcode == MSP_OP_EXP_SEND ||
+		    (frame.opcode == MSP_OP_EXP_SEND_WINDOW && lnk->window > 1)) {
+			if (frame.opcode == MSP_OP_EXP_SEND_WINDOW) {
+				lnk->transaction_window = lnk->window;
+			} else if (lnk->window > 1 && lnk->opcode != MSP_OP_REQ_WINDOW) {
+				/* The experiment no longer agrees to a windowed transfer,
+				 * for instance after a restart. */
+				msp_debug("Windowed transfer refused, using classic MSP");
+				lnk->window = 1;
+			}
+			lnk->seq = 0;
+			lnk->unacked = 0;
 			lnk->state = MSP_LINK_STATE_REQ_RX_DATA;
 			lnk->next_action = MSP_LINK_ACTION_TX_HEADER;
 			lnk->transaction_id = frame.id;
@@ -631,6 +739,9 @@ struct msp_response msp_recv_header_frame(msp_link_t *lnk)
 			} else {
 				lnk->total_length = frame.dl;
 			}
+			/* Nothing to be agreed to, stay with classic MSP */
+			if (lnk->opcode == MSP_OP_REQ_WINDOW && lnk->total_length == 0)
+				lnk->window_offer = 1;
 			r = msp_response_ok();
 		} else {
 			/* Something went wrong... */
@@ -733,3 +844,35 @@ int msp_error_count(const msp_link_t *lnk)
 		return 0;
 	return lnk->error_count;
 }
+
+
+/**
+ * @brief Returns the number of milliseconds until the experiment expects to
+ *        be ready.
+ * @param lnk The link towards the experiment.
+ * @return The time from the last EXP_BUSY frame, or 0 if the last frame
+ *         received from the experiment was not EXP_BUSY.
+ *
+ * Use this to decide when to take the next action in a transaction that the
+ * experiment answered with MSP_RESPONSE_BUSY, instead of retrying at once.
+ */
+unsigned long msp_busy_time(const msp_link_t *lnk)
+{
+	if (lnk == NULL)
+		return 0;
+	return lnk->busy_time;
+}
+
+
+/**
+ * @brief Returns the window of data frames that is used in OBC Requests.
+ * @param lnk The link towards the experiment.
+ * @return The window negotiated with msp_negotiate_window(), 1 if the
+ *         transfers are not windowed.
+ */
+unsigned char msp_window(const msp_link_t *lnk)
+{
+	if (lnk == NULL)
+		return 1;
+	return lnk->window;
+}
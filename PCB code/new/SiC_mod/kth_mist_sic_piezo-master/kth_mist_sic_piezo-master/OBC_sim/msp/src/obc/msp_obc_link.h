@@ -78,6 +78,19 @@ typedef struct msp_link {
 	 */
 	msp_seqflags_t flags;
 
+	/**
+	 * @brief The window of data frames in an OBC Request, as negotiated with
+	 *        msp_negotiate_window(). 1 if the transfer is not windowed.
+	 */
+	unsigned char window;
+
+	/**
+	 * @brief The window that is offered in an ongoing MSP_OP_REQ_WINDOW
+	 *        transaction. It becomes the window once the transaction is
+	 *        successful.
+	 */
+	unsigned char window_offer;
+
 
 	/**
 	 * @brief A variable for keeping track of the current link state.
@@ -135,6 +148,33 @@ typedef struct msp_link {
 	 * data frame.
 	 */
 	unsigned long processed_length;
+
+	/**
+	 * @brief The number of milliseconds until the experiment expects to be
+	 *        ready, as given by the last EXP_BUSY frame it sent.
+	 *
+	 * Set to 0 when the experiment sends any other frame, or an EXP_BUSY
+	 * frame without an estimate.
+	 */
+	unsigned long busy_time;
+
+	/**
+	 * @brief The window of the ongoing OBC Request, 1 unless the experiment
+	 *        responded with EXP_SEND_WINDOW.
+	 */
+	unsigned char transaction_window;
+
+	/**
+	 * @brief The sequence number of the next data frame to be received in a
+	 *        windowed transfer.
+	 */
+	unsigned char seq;
+
+	/**
+	 * @brief The number of data frames that have been received in a windowed
+	 *        transfer since the last WINDOW_ACK.
+	 */
+	unsigned char unacked;
 } msp_link_t;
 
 /**
@@ -183,6 +223,16 @@ struct msp_response {
 	 * MSP_RESPONSE_TRANSACTION_ABORTED.
 	 */
 	unsigned long len;
+
+	/**
+	 * @brief The number of milliseconds until the experiment expects to be
+	 *        ready. This is only set if the status is set as
+	 *        MSP_RESPONSE_BUSY.
+	 *
+	 * Taken from the DL field of the EXP_BUSY frame. It is 0 if the
+	 * experiment gave no estimate, the action can then be retried at once.
+	 */
+	unsigned long busy_time;
 };
 
 
@@ -197,6 +247,9 @@ struct msp_response msp_start_transaction(msp_link_t *lnk,
 
 struct msp_response msp_abort_transaction(msp_link_t *lnk);
 
+struct msp_response msp_negotiate_window(msp_link_t *lnk,
+                                         unsigned char window);
+
 struct msp_response msp_send_data_frame(msp_link_t *lnk,
                                         unsigned char *data,
                                         unsigned long datalen);
@@ -215,5 +268,7 @@ msp_link_action_t msp_next_action(const msp_link_t *lnk);
 unsigned long msp_next_data_length(const msp_link_t *lnk);
 unsigned long msp_next_data_offset(const msp_link_t *lnk);
 int msp_error_count(const msp_link_t *lnk);
+unsigned long msp_busy_time(const msp_link_t *lnk);
+unsigned char msp_window(const msp_link_t *lnk);
 
 #endif
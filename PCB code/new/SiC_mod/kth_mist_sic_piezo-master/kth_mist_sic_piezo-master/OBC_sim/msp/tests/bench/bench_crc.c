@@ -0,0 +1,133 @@
+/*
+ * MSP CRC-32 Benchmark
+ *
+ * Checks the configured CRC engine against a bit-for-bit reference and then
+ * measures its throughput, and that of copying a 507 byte data field with
+ * memcpy() and msp_crc32() against msp_crc32_copy(). Built once per engine by
+ * the Makefile.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "msp_crc.h"
+
+#ifndef ENGINE
+#define ENGINE "default"
+#endif
+
+#define BUFFER_SIZE (64 * 1024)
+#define MIN_SECONDS 1.0
+#define FRAME_SIZE 507
+
+static unsigned char buffer[BUFFER_SIZE];
+static unsigned char frame[FRAME_SIZE];
+
+static unsigned long reference_crc32(const unsigned char *data, unsigned long len, unsigned long start_remainder)
+{
+	unsigned long crc = (~start_remainder) & 0xFFFFFFFF;
+	unsigned long i;
+	int j;
+
+	for (i = 0; i < len; i++) {
+		crc ^= data[i];
+		for (j = 0; j < 8; j++)
+			crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+	}
+	return (~crc) & 0xFFFFFFFF;
+}
+
+static int verify(void)
+{
+	const unsigned char check[] = "123456789";
+	unsigned long offset, len, split;
+
+	if (msp_crc32(check, 9, 0) != 0xCBF43926) {
+		fprintf(stderr, "%s: wrong check value %08lX\n", ENGINE, msp_crc32(check, 9, 0));
+		return 0;
+	}
+
+	/* all alignments and lengths around the slice sizes, also in two parts */
+	for (offset = 0; offset < 8; offset++) {
+		for (len = 0; len < 40; len++) {
+			unsigned long expected = reference_crc32(buffer + offset, len, 0);
+			if (msp_crc32(buffer + offset, len, 0) != expected) {
+				fprintf(stderr, "%s: mismatch at offset %lu length %lu\n", ENGINE, offset, len);
+				return 0;
+			}
+			for (split = 0; split <= len; split++) {
+				unsigned long first = msp_crc32(buffer + offset, split, 0);
+				if (msp_crc32(buffer + offset + split, len - split, first) != expected) {
+					fprintf(stderr, "%s: mismatch at offset %lu length %lu split %lu\n", ENGINE, offset, len, split);
+					return 0;
+				}
+			}
+		}
+	}
+	for (len = 0; len < 40; len++) {
+		if (msp_crc32_copy(frame, buffer + 3, len, 0) != reference_crc32(buffer + 3, len, 0)
+		    || memcmp(frame, buffer + 3, len) != 0) {
+			fprintf(stderr, "%s: copy mismatch at length %lu\n", ENGINE, len);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Returns the number of frames per second, copied in one or two passes */
+static double frame_rate(int fused, unsigned long *crc)
+{
+	unsigned long rounds = 0;
+	unsigned long offset = 0;
+	double seconds;
+	clock_t start;
+
+	start = clock();
+	do {
+		if (fused) {
+			*crc = msp_crc32_copy(frame, buffer + offset, FRAME_SIZE, *crc);
+		} else {
+			memcpy(frame, buffer + offset, FRAME_SIZE);
+			*crc = msp_crc32(frame, FRAME_SIZE, *crc);
+		}
+		offset = (offset + FRAME_SIZE) % (BUFFER_SIZE - FRAME_SIZE);
+		rounds++;
+		seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+	} while (seconds < MIN_SECONDS);
+
+	return rounds / seconds;
+}
+
+int main(void)
+{
+	unsigned long i;
+	unsigned long rounds = 0;
+	unsigned long crc = 0;
+	double seconds;
+	clock_t start;
+
+	srand(1);
+	for (i = 0; i < BUFFER_SIZE; i++)
+		buffer[i] = rand() & 0xFF;
+
+	if (!verify())
+		return 1;
+
+	start = clock();
+	do {
+		crc = msp_crc32(buffer, BUFFER_SIZE, crc);
+		rounds++;
+		seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+	} while (seconds < MIN_SECONDS);
+
+	printf("%-8s %8.1f MB/s (crc %08lX)\n", ENGINE,
+	       (double) rounds * BUFFER_SIZE / seconds / 1e6, crc);
+
+	crc = 0;
+	printf("%-8s %8.0f frames/s memcpy + crc, ", ENGINE, frame_rate(0, &crc));
+	crc = 0;
+	printf("%8.0f frames/s fused copy\n", frame_rate(1, &crc));
+	return 0;
+}
@@ -144,6 +144,10 @@ void msp_exprecv_start(unsigned char opcode, unsigned long len)
 
 	seq++;
 }
+unsigned long msp_expsend_busy_time(unsigned char opcode)
+{
+	return 0;
+}
 void msp_expsend_start(unsigned char opcode, unsigned long *len)
 {
 	test_assert(0, "msp_expsend_start should be unreachable");
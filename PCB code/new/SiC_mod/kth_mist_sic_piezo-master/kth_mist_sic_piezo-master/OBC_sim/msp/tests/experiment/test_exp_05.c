@@ -7,6 +7,13 @@
 
 static int seq = 0;
 
+/* The retransmitted frame is built again only without the prepared frames */
+#ifdef MSP_LOW_MEMORY
+#define DATA_CALLS 2
+#else
+#define DATA_CALLS 1
+#endif
+
 unsigned char pl_data[30];
 
 void test(void)
@@ -25,7 +32,8 @@ void test(void)
 	 * we expect to get the following call sequence:
 	 * msp_expsend_start()
 	 * msp_expsend_data()
-	 * msp_expsend_data() [with the same parameters as before]
+	 * msp_expsend_data() [with the same parameters as before, only with
+	 *                    MSP_LOW_MEMORY]
 	 * msp_expsend_complete()
 	 */
 
@@ -92,7 +100,7 @@ void test(void)
 	code = msp_recv_callback(buf, 9);
 	test_assert(code == 0, "Unexpected error (7)");
 
-	test_assert(seq == 4, "four handlers should be called in total");
+	test_assert(seq == 2 + DATA_CALLS, "all handlers should be called");
 	return;
 }
 
@@ -105,7 +113,7 @@ void msp_expsend_data(unsigned char opcode, unsigned char *buf, unsigned long le
 {
 	unsigned long i;
 
-	test_assert(seq == 1 || seq == 2, "msp_expsend_data should be called second and third");
+	test_assert(seq >= 1 && seq <= DATA_CALLS, "msp_expsend_data should be called after msp_expsend_start");
 	test_assert(offset == 0, "offset should not change between retransmissions");
 	test_assert(len == 30, "length of data to send in data frame");
 	test_assert(opcode == MSP_OP_REQ_PAYLOAD, "opcode in msp_exprecv_data");
@@ -120,6 +128,10 @@ void msp_exprecv_start(unsigned char opcode, unsigned long len)
 {
 	test_assert(0, "msp_exprecv_start should be unreachable");
 }
+unsigned long msp_expsend_busy_time(unsigned char opcode)
+{
+	return 0;
+}
 void msp_expsend_start(unsigned char opcode, unsigned long *len)
 {
 	test_assert(seq == 0, "msp_expsend_start should be called first");
@@ -136,7 +148,7 @@ void msp_exprecv_complete(unsigned char opcode)
 }
 void msp_expsend_complete(unsigned char opcode)
 {
-	test_assert(seq == 3, "msp_expsend_complete should be called fourth");
+	test_assert(seq == 1 + DATA_CALLS, "msp_expsend_complete should be called last");
 	test_assert(opcode == MSP_OP_REQ_PAYLOAD, "opcode should be MSP_OP_REQ_PAYLOAD in msp_expsend_complete");
 
 	seq++;
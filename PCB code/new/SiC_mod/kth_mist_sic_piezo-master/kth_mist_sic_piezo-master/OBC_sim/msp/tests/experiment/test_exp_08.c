@@ -132,6 +132,10 @@ void test(void)
 }
 
 
+unsigned long msp_expsend_busy_time(unsigned char opcode)
+{
+	return 0;
+}
 void msp_expsend_start(unsigned char opcode, unsigned long *len)
 {
 	if (seq == 0) {
@@ -130,6 +130,10 @@ void test(void)
 }
 
 
+unsigned long msp_expsend_busy_time(unsigned char opcode)
+{
+	return 0;
+}
 void msp_expsend_start(unsigned char opcode, unsigned long *len)
 {
 	test_assert(seq == 0 || seq == 3, "msp_expsend_data should be called first or fourth");
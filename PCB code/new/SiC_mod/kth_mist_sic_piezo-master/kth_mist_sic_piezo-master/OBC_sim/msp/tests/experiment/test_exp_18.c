@@ -0,0 +1,200 @@
+/*
+ * MSP Experiment Test 18
+ *
+ * Tests the incremental FCS: chunked calculation, msp_crc32_copy, frames
+ * folded in byte by byte as they are received and data frames where the
+ * handler calculates the FCS while it copies the data.
+ */
+
+#include <string.h>
+
+#include "test_exp.h"
+
+#define PAYLOAD_LENGTH 700
+
+static unsigned char payload[PAYLOAD_LENGTH];
+static int copy_mode = 0; /* 0 = no help, 1 = msp_expsend_copy, 2 = mixed */
+
+/* Receives a frame as if it arrived one byte at a time through the I2C ISR */
+static int receive_bytewise(unsigned char *frame, unsigned long len)
+{
+	unsigned long i;
+
+	msp_exp_frame_rx_start();
+	for (i = 1; i <= len; i++)
+		msp_exp_frame_rx_update(frame, i);
+
+	return msp_recv_callback(frame, len);
+}
+
+static void format_obc_header(unsigned char *buf, unsigned char opcode, unsigned long dl)
+{
+	unsigned long fcs;
+
+	buf[0] = opcode;
+	msp_to_bigendian32(buf + 1, dl);
+	fcs = msp_exp_frame_generate_fcs(buf, 1, 5);
+	msp_to_bigendian32(buf + 5, fcs);
+}
+
+static void request_payload(int mode)
+{
+	unsigned char buf[MSP_EXP_MAX_FRAME_SIZE];
+	unsigned long len, received;
+	int code;
+
+	copy_mode = mode;
+	received = 0;
+
+	format_obc_header(buf, MSP_OP_REQ_PAYLOAD, 0);
+	code = receive_bytewise(buf, 9);
+	test_assert(code == 0, "request header");
+	code = msp_send_callback(buf, &len);
+	test_assert(code == 0 && (buf[0] & 0x7F) == MSP_OP_EXP_SEND, "response frame");
+
+	format_obc_header(buf, MSP_OP_F_ACK, 0);
+	buf[0] |= msp_exp_state.transaction_id << 7;
+	msp_to_bigendian32(buf + 5, msp_exp_frame_generate_fcs(buf, 1, 5));
+	code = receive_bytewise(buf, 9);
+	test_assert(code == 0, "ack of response");
+
+	while (received < PAYLOAD_LENGTH) {
+		code = msp_send_callback(buf, &len);
+		test_assert(code == 0, "data frame");
+		test_assert((buf[0] & 0x7F) == MSP_OP_DATA_FRAME, "opcode of data frame");
+		test_assert(msp_exp_frame_generate_fcs(buf, 0, len - 4) == msp_from_bigendian32(buf + len - 4), "FCS of data frame");
+		test_assert(memcmp(buf + 1, payload + received, len - 5) == 0, "payload of data frame");
+		received += len - 5;
+
+		format_obc_header(buf, received < PAYLOAD_LENGTH ? MSP_OP_F_ACK : MSP_OP_T_ACK, 0);
+		if (received < PAYLOAD_LENGTH)
+			buf[0] |= msp_exp_state.frame_id << 7;
+		else
+			buf[0] |= msp_exp_state.transaction_id << 7;
+		msp_to_bigendian32(buf + 5, msp_exp_frame_generate_fcs(buf, 1, 5));
+		code = receive_bytewise(buf, 9);
+		test_assert(code == 0, "ack of data frame");
+	}
+
+	test_assert(msp_exp_state.type == MSP_EXP_STATE_READY, "transaction completed");
+}
+
+void test(void)
+{
+	unsigned char src[64];
+	unsigned char dest[64];
+	unsigned char frame[MSP_EXP_MAX_FRAME_SIZE];
+	unsigned long fcs, i, split;
+	int code;
+
+	for (i = 0; i < sizeof(src); i++)
+		src[i] = (unsigned char) (i * 37 + 11);
+	for (i = 0; i < PAYLOAD_LENGTH; i++)
+		payload[i] = (unsigned char) (i * 13 + 7);
+
+	/* Chunked calculation gives the same FCS as a single pass */
+	for (split = 0; split <= sizeof(src); split++) {
+		fcs = msp_exp_frame_fcs_init(0);
+		fcs = msp_exp_frame_fcs_update(fcs, src, split);
+		fcs = msp_exp_frame_fcs_update(fcs, src + split, sizeof(src) - split);
+		test_assert(msp_exp_frame_fcs_final(fcs) == msp_exp_frame_generate_fcs(src, 0, sizeof(src)), "chunked FCS");
+	}
+
+	/* Copying gives the same CRC as copying and then calculating */
+	for (i = 0; i <= sizeof(src); i++) {
+		memset(dest, 0, sizeof(dest));
+		fcs = msp_crc32_copy(dest, src, i, 0x12345678);
+		test_assert(fcs == msp_crc32(src, i, 0x12345678), "msp_crc32_copy");
+		test_assert(memcmp(dest, src, i) == 0, "msp_crc32_copy data");
+	}
+
+	msp_exp_state_initialize(msp_seqflags_init());
+
+	/* A NULL frame folded in byte by byte */
+	format_obc_header(frame, MSP_OP_NULL, 0);
+	code = receive_bytewise(frame, 9);
+	test_assert(code == 0, "NULL frame received byte by byte");
+
+	/* A corrupted FCS must still be caught */
+	format_obc_header(frame, MSP_OP_NULL, 0);
+	frame[8] ^= 0x01;
+	code = receive_bytewise(frame, 9);
+	test_assert(code == MSP_EXP_ERR_FCS_MISMATCH, "corrupted FCS");
+
+	/* Corrupted data in a long frame */
+	frame[0] = MSP_OP_DATA_FRAME;
+	memcpy(frame + 1, payload, 300);
+	msp_to_bigendian32(frame + 301, msp_exp_frame_generate_fcs(frame, 1, 301));
+	frame[150] ^= 0x80;
+	code = receive_bytewise(frame, 305);
+	test_assert(code == MSP_EXP_ERR_FCS_MISMATCH, "corrupted data");
+
+	/* Without msp_exp_frame_rx_start() the whole frame is checked */
+	format_obc_header(frame, MSP_OP_NULL, 0);
+	code = msp_recv_callback(frame, 9);
+	test_assert(code == 0, "NULL frame without incremental FCS");
+
+	request_payload(0);
+	request_payload(1);
+	request_payload(2);
+}
+
+
+unsigned long msp_expsend_busy_time(unsigned char opcode)
+{
+	return 0;
+}
+void msp_expsend_start(unsigned char opcode, unsigned long *len)
+{
+	*len = PAYLOAD_LENGTH;
+}
+void msp_expsend_data(unsigned char opcode, unsigned char *buf, unsigned long len, unsigned long offset)
+{
+	unsigned long half;
+
+	switch (copy_mode) {
+	case 1:
+		msp_expsend_copy(buf, payload + offset, len);
+		break;
+	case 2:
+		/* Copy the first half, write the rest and leave it for MSP */
+		half = len / 2;
+		msp_expsend_copy(buf, payload + offset, half);
+		memcpy(buf + half, payload + offset + half, 1);
+		msp_expsend_fcs_update(buf + half, 1);
+		memcpy(buf + half + 1, payload + offset + half + 1, len - half - 1);
+		break;
+	default:
+		memcpy(buf, payload + offset, len);
+		break;
+	}
+}
+void msp_expsend_complete(unsigned char opcode)
+{
+}
+void msp_expsend_error(unsigned char opcode, int error)
+{
+	test_assert(0, "msp_expsend_error should be unreachable");
+}
+
+void msp_exprecv_start(unsigned char opcode, unsigned long len)
+{
+	test_assert(0, "msp_exprecv_start should be unreachable");
+}
+void msp_exprecv_data(unsigned char opcode, const unsigned char *buf, unsigned long len, unsigned long offset)
+{
+	test_assert(0, "msp_exprecv_data should be unreachable");
+}
+void msp_exprecv_complete(unsigned char opcode)
+{
+	test_assert(0, "msp_exprecv_complete should be unreachable");
+}
+void msp_exprecv_error(unsigned char opcode, int error)
+{
+	test_assert(0, "msp_exprecv_error should be unreachable");
+}
+
+void msp_exprecv_syscommand(unsigned char opcode)
+{
+	test_assert(0, "msp_exprecv_syscommand should be unreachable");
+}
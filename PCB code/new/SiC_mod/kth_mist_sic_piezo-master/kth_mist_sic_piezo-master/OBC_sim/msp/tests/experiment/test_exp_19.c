@@ -0,0 +1,94 @@
+/*
+ * MSP Experiment Test 19
+ *
+ * Tests that header frames copied from the frame cache are identical to
+ * frames formatted from scratch, and that other headers are unaffected.
+ */
+
+#include "test_exp.h"
+
+static void check_header(unsigned char opcode, unsigned char frame_id, unsigned long dl)
+{
+	unsigned char frame[9];
+	unsigned char expected[9];
+	unsigned long fcs;
+	int i;
+
+	expected[0] = (opcode & 0x7F) | ((frame_id & 0x1) << 7);
+	msp_to_bigendian32(expected + 1, dl);
+	fcs = msp_exp_frame_generate_fcs(expected, 0, 5);
+	msp_to_bigendian32(expected + 5, fcs);
+
+	msp_exp_frame_format_header(frame, opcode, frame_id, dl);
+	for (i = 0; i < 9; i++)
+		test_assert(frame[i] == expected[i], "header frame byte");
+}
+
+void test(void)
+{
+	unsigned char frame[9];
+	unsigned char opcode;
+
+	/* Before and after the cache has been prepared */
+	check_header(MSP_OP_T_ACK, 1, 0);
+	msp_exp_frame_prepare_cache();
+
+	for (opcode = 0; opcode < 0x80; opcode++) {
+		check_header(opcode, 0, 0);
+		check_header(opcode, 1, 0);
+		check_header(opcode, 1, 1234);
+	}
+
+	/* Frames that use the frame-ID bit of the opcode argument */
+	check_header(MSP_OP_F_ACK | 0x80, 0, 0);
+
+	msp_exp_frame_format_empty_header(frame, MSP_OP_EXP_BUSY);
+	test_assert(frame[0] == MSP_OP_EXP_BUSY, "EXP_BUSY frame");
+	test_assert(msp_exp_frame_fcs_valid(frame, 0, 9), "EXP_BUSY FCS");
+}
+
+
+void msp_exprecv_data(unsigned char opcode, const unsigned char *buf, unsigned long len, unsigned long offset)
+{
+	test_assert(0, "msp_exprecv_data should be unreachable");
+}
+void msp_expsend_data(unsigned char opcode, unsigned char *buf, unsigned long len, unsigned long offset)
+{
+	test_assert(0, "msp_expsend_data should be unreachable");
+}
+
+void msp_exprecv_start(unsigned char opcode, unsigned long len)
+{
+	test_assert(0, "msp_exprecv_start should be unreachable");
+}
+unsigned long msp_expsend_busy_time(unsigned char opcode)
+{
+	return 0;
+}
+void msp_expsend_start(unsigned char opcode, unsigned long *len)
+{
+	test_assert(0, "msp_expsend_start should be unreachable");
+}
+
+void msp_exprecv_complete(unsigned char opcode)
+{
+	test_assert(0, "msp_exprecv_complete should be unreachable");
+}
+void msp_expsend_complete(unsigned char opcode)
+{
+	test_assert(0, "msp_expsend_complete should be unreachable");
+}
+
+void msp_exprecv_error(unsigned char opcode, int error)
+{
+	test_assert(0, "msp_exprecv_error should be unreachable");
+}
+void msp_expsend_error(unsigned char opcode, int error)
+{
+	test_assert(0, "msp_expsend_error should be unreachable");
+}
+
+void msp_exprecv_syscommand(unsigned char opcode)
+{
+	test_assert(0, "msp_exprecv_syscommand should be unreachable");
+}
@@ -0,0 +1,194 @@
+/*
+ * MSP Experiment Test 20
+ *
+ * Tests the prepared data frames of OBC Requests: frames built ahead of time
+ * by msp_exp_prepare_next(), frames served without copying by
+ * msp_send_frame() and retransmissions that are not built again.
+ */
+
+#include <string.h>
+
+#include "test_exp.h"
+
+#define PAYLOAD_LENGTH 1200
+
+static unsigned char payload[PAYLOAD_LENGTH];
+static int data_calls = 0;
+
+#ifndef MSP_LOW_MEMORY
+static void send_obc_header(unsigned char opcode, unsigned char frame_id)
+{
+	unsigned char buf[9];
+	unsigned long fcs;
+	int code;
+
+	buf[0] = opcode | (frame_id << 7);
+	msp_to_bigendian32(buf + 1, 0);
+	fcs = msp_exp_frame_generate_fcs(buf, 1, 5);
+	msp_to_bigendian32(buf + 5, fcs);
+	code = msp_recv_callback(buf, 9);
+	test_assert(code == 0, "OBC header frame");
+}
+
+static void check_data_frame(const unsigned char *frame, unsigned long len, unsigned long offset, unsigned char frame_id)
+{
+	unsigned long expected_len;
+
+	expected_len = PAYLOAD_LENGTH - offset;
+	if (expected_len > MSP_EXP_MTU)
+		expected_len = MSP_EXP_MTU;
+
+	test_assert(len == expected_len + 5, "length of data frame");
+	test_assert(frame[0] == (MSP_OP_DATA_FRAME | (frame_id << 7)), "opcode and frame-ID of data frame");
+	test_assert(memcmp(frame + 1, payload + offset, expected_len) == 0, "data field");
+	test_assert(msp_exp_frame_generate_fcs(frame, 0, len - 4) == msp_from_bigendian32(frame + len - 4), "FCS of data frame");
+}
+
+static void start_request(void)
+{
+	const unsigned char *frame;
+	unsigned long len;
+	int code;
+
+	send_obc_header(MSP_OP_REQ_PAYLOAD, 0);
+
+	/* Nothing to prepare before the response has been sent */
+	code = msp_send_frame(&frame, &len);
+	test_assert(code == 0 && len == 9, "response frame");
+	test_assert((frame[0] & 0x7F) == MSP_OP_EXP_SEND, "opcode of response frame");
+	test_assert(msp_from_bigendian32(frame + 1) == PAYLOAD_LENGTH, "DL of response frame");
+}
+#endif
+
+void test(void)
+{
+#ifndef MSP_LOW_MEMORY
+	unsigned char copy[MSP_EXP_MAX_FRAME_SIZE];
+	const unsigned char *frame;
+	const unsigned char *first;
+	unsigned long len, copy_len;
+	unsigned char frame_id;
+	int code;
+	int i;
+
+	for (i = 0; i < PAYLOAD_LENGTH; i++)
+		payload[i] = (unsigned char) (i * 7 + 3);
+
+	msp_exp_state_initialize(msp_seqflags_init());
+
+	/* Nothing to prepare outside of a request */
+	test_assert(msp_exp_prepare_next() == 0, "nothing to prepare when ready");
+
+	start_request();
+	frame_id = msp_exp_state.transaction_id;
+
+	/* The first data frame can be built before the response is acknowledged */
+	test_assert(msp_exp_prepare_next() == 1, "first data frame prepared");
+	test_assert(data_calls == 1, "first data frame built once");
+	test_assert(msp_exp_prepare_next() == 0, "first data frame prepared only once");
+
+	send_obc_header(MSP_OP_F_ACK, frame_id);
+	frame_id ^= 1;
+
+	code = msp_send_frame(&frame, &len);
+	test_assert(code == 0, "first data frame");
+	test_assert(data_calls == 1, "prepared frame is not built again");
+	check_data_frame(frame, len, 0, frame_id);
+	first = frame;
+
+	/* The second frame is built while the first one waits for its F_ACK */
+	test_assert(msp_exp_prepare_next() == 1, "second data frame prepared");
+	test_assert(data_calls == 2, "second data frame built");
+	test_assert(msp_exp_prepare_next() == 0, "second data frame prepared only once");
+
+	/* A retransmission is served from the same buffer as it is */
+	code = msp_send_frame(&frame, &len);
+	test_assert(code == 0 && frame == first, "retransmission from the same buffer");
+	test_assert(data_calls == 2, "retransmission is not built again");
+	check_data_frame(frame, len, 0, frame_id);
+
+	send_obc_header(MSP_OP_F_ACK, frame_id);
+	frame_id ^= 1;
+
+	code = msp_send_frame(&frame, &len);
+	test_assert(code == 0 && frame != first, "second data frame from the other buffer");
+	test_assert(data_calls == 2, "second data frame was already prepared");
+	check_data_frame(frame, len, MSP_EXP_MTU, frame_id);
+
+	/* Without msp_exp_prepare_next() the frame is built on demand */
+	send_obc_header(MSP_OP_F_ACK, frame_id);
+	frame_id ^= 1;
+
+	code = msp_send_callback(copy, &copy_len);
+	test_assert(code == 0, "last data frame");
+	test_assert(data_calls == 3, "last data frame built on demand");
+	check_data_frame(copy, copy_len, 2 * MSP_EXP_MTU, frame_id);
+
+	/* The copy and the zero-copy frame are identical */
+	code = msp_send_frame(&frame, &len);
+	test_assert(code == 0 && len == copy_len && memcmp(frame, copy, len) == 0, "copied frame");
+	test_assert(data_calls == 3, "last data frame built once");
+
+	/* Nothing follows the last frame */
+	test_assert(msp_exp_prepare_next() == 0, "nothing after the last data frame");
+
+	send_obc_header(MSP_OP_T_ACK, msp_exp_state.transaction_id);
+	test_assert(msp_exp_state.type == MSP_EXP_STATE_READY, "transaction completed");
+
+	/* Frames of the previous transaction are not reused */
+	start_request();
+	send_obc_header(MSP_OP_F_ACK, msp_exp_state.transaction_id);
+	code = msp_send_frame(&frame, &len);
+	test_assert(code == 0, "first data frame of new transaction");
+	test_assert(data_calls == 4, "new transaction builds its frames again");
+	check_data_frame(frame, len, 0, msp_exp_state.frame_id);
+	send_obc_header(MSP_OP_NULL, 0);
+#endif
+}
+
+
+void msp_exprecv_data(unsigned char opcode, const unsigned char *buf, unsigned long len, unsigned long offset)
+{
+	test_assert(0, "msp_exprecv_data should be unreachable");
+}
+void msp_expsend_data(unsigned char opcode, unsigned char *buf, unsigned long len, unsigned long offset)
+{
+	test_assert(offset + len <= PAYLOAD_LENGTH, "data within the payload");
+	msp_expsend_copy(buf, payload + offset, len);
+	data_calls++;
+}
+
+void msp_exprecv_start(unsigned char opcode, unsigned long len)
+{
+	test_assert(0, "msp_exprecv_start should be unreachable");
+}
+unsigned long msp_expsend_busy_time(unsigned char opcode)
+{
+	return 0;
+}
+void msp_expsend_start(unsigned char opcode, unsigned long *len)
+{
+	*len = PAYLOAD_LENGTH;
+}
+
+void msp_exprecv_complete(unsigned char opcode)
+{
+	test_assert(0, "msp_exprecv_complete should be unreachable");
+}
+void msp_expsend_complete(unsigned char opcode)
+{
+}
+
+void msp_exprecv_error(unsigned char opcode, int error)
+{
+	test_assert(0, "msp_exprecv_error should be unreachable");
+}
+void msp_expsend_error(unsigned char opcode, int error)
+{
+	test_assert(error == MSP_EXP_ERR_TRANSACTION_ABORTED, "only the last transaction is aborted");
+}
+
+void msp_exprecv_syscommand(unsigned char opcode)
+{
+	test_assert(0, "msp_exprecv_syscommand should be unreachable");
+}
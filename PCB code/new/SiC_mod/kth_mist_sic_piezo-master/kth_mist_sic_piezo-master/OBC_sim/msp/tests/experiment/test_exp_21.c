@@ -0,0 +1,157 @@
+/*
+ * MSP Experiment Test 21
+ *
+ * Tests that an OBC Request the experiment is not ready for is answered with
+ * EXP_BUSY frames that carry the time until it is ready, and that the
+ * transaction is only started once the experiment is ready.
+ */
+
+#include "test_exp.h"
+
+static int seq = 0;
+static unsigned long busy_time = 0;
+static int busy_calls = 0;
+
+static void send_header(unsigned char opcode, unsigned char frame_id)
+{
+	unsigned char buf[9];
+	unsigned long fcs;
+	int code;
+
+	buf[0] = opcode | (frame_id << 7);
+	msp_to_bigendian32(buf+1, 0);
+	fcs = msp_exp_frame_generate_fcs(buf, 1, 5);
+	msp_to_bigendian32(buf+5, fcs);
+	code = msp_recv_callback(buf, 9);
+	test_assert(code == 0, "Unexpected error when receiving a header");
+}
+
+void test(void)
+{
+	static unsigned char buf[1000];
+	unsigned long len;
+	int code;
+
+	msp_exp_state_initialize(msp_seqflags_init());
+	msp_seqflags_set(&msp_exp_state.seqflags, MSP_OP_REQ_HK, 0);
+
+	/* The experiment needs 2.5 seconds before it can serve the request */
+	busy_time = 2500;
+	send_header(MSP_OP_REQ_HK, 0);
+	test_assert(busy_calls == 1, "busy time asked for when the request is received");
+
+	code = msp_send_callback(buf, &len);
+	test_assert(code == 0, "Unexpected error (1)");
+	test_assert(len == 9, "EXP_BUSY header frame length");
+	test_assert((buf[0] & 0x7F) == MSP_OP_EXP_BUSY, "opcode of the frame while busy");
+	test_assert((buf[0] & 0x80) == 0x80, "Frame-ID of EXP_BUSY is the transaction-ID");
+	test_assert(msp_from_bigendian32(buf+1) == 2500, "DL of EXP_BUSY is the busy time");
+	test_assert(msp_exp_frame_generate_fcs(buf, 0, 5) == msp_from_bigendian32(buf+5), "FCS of EXP_BUSY (1)");
+
+	/* Later on it has made progress */
+	busy_time = 400;
+	code = msp_send_callback(buf, &len);
+	test_assert(code == 0, "Unexpected error (2)");
+	test_assert((buf[0] & 0x7F) == MSP_OP_EXP_BUSY, "opcode of the frame while still busy");
+	test_assert(msp_from_bigendian32(buf+1) == 400, "DL of EXP_BUSY follows the busy time");
+	test_assert(msp_exp_frame_generate_fcs(buf, 0, 5) == msp_from_bigendian32(buf+5), "FCS of EXP_BUSY (2)");
+	test_assert(seq == 0, "no handler called while busy");
+
+	/* Now it is ready, the response header is sent */
+	busy_time = 0;
+	code = msp_send_callback(buf, &len);
+	test_assert(code == 0, "Unexpected error (3)");
+	test_assert(len == 9, "EXP_SEND header frame length");
+	test_assert((buf[0] & 0x7F) == MSP_OP_EXP_SEND, "opcode of the response once ready");
+	test_assert((buf[0] & 0x80) == 0x80, "Frame-ID of EXP_SEND");
+	test_assert(msp_from_bigendian32(buf+1) == 20, "DL of EXP_SEND");
+	test_assert(seq == 1, "msp_expsend_start called once ready");
+	test_assert(busy_calls == 4, "busy time asked for each time the response is read");
+
+	/* The rest of the transaction as usual */
+	send_header(MSP_OP_F_ACK, 1);
+	code = msp_send_callback(buf, &len);
+	test_assert(code == 0, "Unexpected error (4)");
+	test_assert(len == 20+5, "data frame length");
+	test_assert((buf[0] & 0x7F) == MSP_OP_DATA_FRAME, "opcode of data frame");
+	send_header(MSP_OP_T_ACK, 1);
+	test_assert(seq == 3, "transaction completed");
+	test_assert(msp_seqflags_get(&msp_exp_state.seqflags, MSP_OP_REQ_HK) == 1, "sequence flag updated");
+
+	/* A request that is given up by the OBC while the experiment is busy is
+	 * never started, so no error is reported. */
+	busy_time = 10000;
+	send_header(MSP_OP_REQ_PAYLOAD, 0);
+	code = msp_send_callback(buf, &len);
+	test_assert(code == 0, "Unexpected error (5)");
+	test_assert((buf[0] & 0x7F) == MSP_OP_EXP_BUSY, "opcode of the frame while busy");
+	test_assert(msp_from_bigendian32(buf+1) == 10000, "DL of EXP_BUSY");
+	send_header(MSP_OP_NULL, 0);
+	code = msp_send_callback(buf, &len);
+	test_assert(code == 0, "Unexpected error (6)");
+	test_assert((buf[0] & 0x7F) == MSP_OP_NULL, "NULL frame after the request was given up");
+	test_assert(msp_seqflags_get(&msp_exp_state.seqflags, MSP_OP_REQ_PAYLOAD) == 0, "sequence flag not updated");
+
+	test_assert(seq == 3, "should have called 3 handlers");
+	return;
+}
+
+
+unsigned long msp_expsend_busy_time(unsigned char opcode)
+{
+	busy_calls++;
+	return busy_time;
+}
+void msp_expsend_start(unsigned char opcode, unsigned long *len)
+{
+	test_assert(seq == 0, "msp_expsend_start should be called first");
+	test_assert(opcode == MSP_OP_REQ_HK, "opcode in msp_expsend_start");
+	*len = 20;
+
+	seq++;
+}
+void msp_expsend_data(unsigned char opcode, unsigned char *buf, unsigned long len, unsigned long offset)
+{
+	unsigned long i;
+
+	test_assert(seq == 1, "msp_expsend_data should be called second");
+	test_assert(opcode == MSP_OP_REQ_HK, "opcode in msp_expsend_data");
+	for (i = 0; i < len; i++)
+		buf[i] = 0x21;
+
+	seq++;
+}
+void msp_expsend_complete(unsigned char opcode)
+{
+	test_assert(seq == 2, "msp_expsend_complete should be called third");
+	test_assert(opcode == MSP_OP_REQ_HK, "opcode in msp_expsend_complete");
+
+	seq++;
+}
+void msp_expsend_error(unsigned char opcode, int error)
+{
+	test_assert(0, "msp_expsend_error should be unreachable");
+}
+
+
+void msp_exprecv_start(unsigned char opcode, unsigned long len)
+{
+	test_assert(0, "msp_exprecv_start should be unreachable");
+}
+void msp_exprecv_data(unsigned char opcode, const unsigned char *buf, unsigned long len, unsigned long offset)
+{
+	test_assert(0, "msp_exprecv_data should be unreachable");
+}
+void msp_exprecv_complete(unsigned char opcode)
+{
+	test_assert(0, "msp_exprecv_complete should be unreachable");
+}
+void msp_exprecv_error(unsigned char opcode, int error)
+{
+	test_assert(0, "msp_exprecv_error should be unreachable");
+}
+
+void msp_exprecv_syscommand(unsigned char opcode)
+{
+	test_assert(0, "msp_exprecv_syscommand should be unreachable");
+}
@@ -0,0 +1,261 @@
+/*
+ * MSP Experiment Test 22
+ *
+ * Tests windowed transfer of OBC Requests. The window is negotiated with
+ * MSP_OP_REQ_WINDOW, after which a request that asks for a window is sent in
+ * numbered data frames that are acknowledged with WINDOW_ACK. Frames that are
+ * lost, sent twice or whose acknowledgement is lost are sent again.
+ */
+
+#include "test_exp.h"
+
+#define TEST_LENGTH (5*MSP_EXP_MTU + 100)
+
+static int started = 0;
+static int completed = 0;
+static int errors = 0;
+
+static int send_header(unsigned char opcode, unsigned char frame_id, unsigned long dl)
+{
+	unsigned char buf[9];
+	unsigned long fcs;
+
+	buf[0] = opcode | (frame_id << 7);
+	msp_to_bigendian32(buf+1, dl);
+	fcs = msp_exp_frame_generate_fcs(buf, 1, 5);
+	msp_to_bigendian32(buf+5, fcs);
+	return msp_recv_callback(buf, 9);
+}
+
+/* Reads a header frame and returns its DL, the opcode and frame-ID are
+ * checked against the expected ones */
+static unsigned long read_header(unsigned char opcode, const char *msg)
+{
+	static unsigned char buf[MSP_EXP_MAX_FRAME_SIZE];
+	unsigned long len;
+	int code;
+
+	code = msp_send_callback(buf, &len);
+	test_assert(code == 0, msg);
+	test_assert(len == 9, msg);
+	test_assert((buf[0] & 0x7F) == opcode, msg);
+	test_assert(msp_exp_frame_generate_fcs(buf, 0, 5) == msp_from_bigendian32(buf+5), msg);
+	return msp_from_bigendian32(buf+1);
+}
+
+/* Reads a data frame and checks its sequence number and data */
+static void read_window_frame(unsigned char seq, unsigned long offset, const char *msg)
+{
+	static unsigned char buf[MSP_EXP_MAX_FRAME_SIZE];
+	unsigned long len, datalen, i;
+	int code;
+
+	code = msp_send_callback(buf, &len);
+	test_assert(code == 0, msg);
+
+	datalen = TEST_LENGTH - offset;
+	if (datalen > MSP_EXP_MTU)
+		datalen = MSP_EXP_MTU;
+	test_assert(len == datalen + 5, msg);
+	test_assert(MSP_OP_IS_WINDOW_DATA(buf[0] & 0x7F), msg);
+	test_assert(MSP_WINDOW_SEQ(buf[0] & 0x7F, buf[0] >> 7) == seq, msg);
+	test_assert(msp_exp_frame_generate_fcs(buf, 0, len - 4) == msp_from_bigendian32(buf + len - 4), msg);
+	for (i = 0; i < datalen; i++) {
+		if (buf[i + 1] != (unsigned char) (offset + i)) {
+			test_assert(0, msg);
+			break;
+		}
+	}
+}
+
+/* Negotiates a window with the offer in DL and returns the agreed window */
+static unsigned char negotiate(unsigned long offer)
+{
+	static unsigned char buf[MSP_EXP_MAX_FRAME_SIZE];
+	unsigned long len;
+	unsigned char tid;
+	int code;
+
+	code = send_header(MSP_OP_REQ_WINDOW, 0, offer);
+	test_assert(code == 0, "REQ_WINDOW received");
+	code = msp_send_callback(buf, &len);
+	test_assert(code == 0, "response to REQ_WINDOW");
+	test_assert((buf[0] & 0x7F) == MSP_OP_EXP_SEND, "REQ_WINDOW is answered with a classic EXP_SEND");
+	test_assert(msp_from_bigendian32(buf+1) == 1, "REQ_WINDOW is answered with a single byte");
+	tid = buf[0] >> 7;
+
+	send_header(MSP_OP_F_ACK, tid, 0);
+	code = msp_send_callback(buf, &len);
+	test_assert(code == 0, "data frame of REQ_WINDOW");
+	test_assert(len == 6, "length of the data frame of REQ_WINDOW");
+	test_assert(buf[0] == (MSP_OP_DATA_FRAME | ((tid ^ 1) << 7)), "classic data frame of REQ_WINDOW");
+	test_assert(buf[1] == msp_exp_state.window, "the agreed window is sent");
+
+	code = send_header(MSP_OP_T_ACK, tid, 0);
+	test_assert(code == 0, "T_ACK of REQ_WINDOW");
+	test_assert(msp_exp_state.type == MSP_EXP_STATE_READY, "ready after REQ_WINDOW");
+
+	return buf[1];
+}
+
+void test(void)
+{
+	unsigned long dl;
+	unsigned char tid;
+	int code;
+
+	msp_exp_state_initialize(msp_seqflags_init());
+	test_assert(msp_exp_state.window == 1, "no window until negotiated");
+
+	/* Before the negotiation a window that is asked for is not used */
+	send_header(MSP_OP_REQ_PAYLOAD, 0, 2);
+	read_header(MSP_OP_EXP_SEND, "classic response before the negotiation");
+	send_header(MSP_OP_NULL, 0, 0);
+	test_assert(errors == 1, "aborted request reported");
+
+	/* The offer is limited to what the experiment supports */
+	test_assert(negotiate(MSP_WINDOW_MAX + 4) == MSP_EXP_WINDOW, "offer above the largest window");
+	test_assert(negotiate(0) == 1, "an offer of 0 turns the window off");
+	test_assert(negotiate(3) == 3, "offer of a window of 3");
+	test_assert(started == 1 && completed == 0 && errors == 1, "no handler called for REQ_WINDOW");
+
+	/* A request that does not ask for a window, or for one that is too large,
+	 * is carried out as in classic MSP */
+	send_header(MSP_OP_REQ_PAYLOAD, 0, 0);
+	read_header(MSP_OP_EXP_SEND, "classic response without a window");
+	send_header(MSP_OP_NULL, 0, 0);
+	send_header(MSP_OP_REQ_PAYLOAD, 0, 4);
+	read_header(MSP_OP_EXP_SEND, "classic response with a window too large");
+	send_header(MSP_OP_NULL, 0, 0);
+	test_assert(errors == 3, "aborted requests reported");
+
+	/* A windowed transfer */
+	code = send_header(MSP_OP_REQ_PAYLOAD, 0, 3);
+	test_assert(code == 0, "windowed request received");
+	dl = read_header(MSP_OP_EXP_SEND_WINDOW, "windowed response");
+	test_assert(dl == TEST_LENGTH, "DL of the windowed response");
+	tid = msp_exp_state.transaction_id;
+
+	/* The response is acknowledged with a WINDOW_ACK, not F_ACK */
+	code = send_header(MSP_OP_F_ACK, tid, 0);
+	test_assert(code == MSP_EXP_ERR_FAULTY_FRAME, "F_ACK rejected in a windowed transfer");
+	code = send_header(MSP_OP_WINDOW_ACK, 0, 0);
+	test_assert(code == 0, "response acknowledged");
+
+#ifndef MSP_LOW_MEMORY
+	test_assert(msp_exp_prepare_next() == 1, "first frame of the window prepared");
+#endif
+	read_window_frame(0, 0, "frame 0");
+#ifndef MSP_LOW_MEMORY
+	test_assert(msp_exp_prepare_next() == 1, "second frame of the window prepared");
+#endif
+	read_window_frame(1, MSP_EXP_MTU, "frame 1");
+	read_window_frame(2, 2*MSP_EXP_MTU, "frame 2");
+
+	/* Frame 2 did not reach the OBC, only the first two are acknowledged */
+	code = send_header(MSP_OP_WINDOW_ACK, 0, 2*MSP_EXP_MTU);
+	test_assert(code == 0, "two frames acknowledged");
+	read_window_frame(2, 2*MSP_EXP_MTU, "frame 2 sent again");
+	read_window_frame(3, 3*MSP_EXP_MTU, "frame 3");
+	read_window_frame(4, 4*MSP_EXP_MTU, "frame 4");
+
+	/* The acknowledgement of the window is lost, the OBC reads again */
+	read_window_frame(2, 2*MSP_EXP_MTU, "window sent again from frame 2");
+	code = send_header(MSP_OP_WINDOW_ACK, 0, 5*MSP_EXP_MTU);
+	test_assert(code == 0, "window acknowledged");
+
+	/* Acknowledgements that are sent twice, corrupted or out of the window
+	 * change nothing */
+	code = send_header(MSP_OP_WINDOW_ACK, 0, 5*MSP_EXP_MTU);
+	test_assert(code == 0, "duplicate acknowledgement");
+	code = send_header(MSP_OP_WINDOW_ACK, 0, 4*MSP_EXP_MTU);
+	test_assert(code == MSP_EXP_ERR_FAULTY_FRAME, "acknowledgement of data already acknowledged");
+	code = send_header(MSP_OP_WINDOW_ACK, 0, 5*MSP_EXP_MTU + 50);
+	test_assert(code == MSP_EXP_ERR_FAULTY_FRAME, "acknowledgement inside a frame");
+	{
+		unsigned char buf[9];
+
+		buf[0] = MSP_OP_WINDOW_ACK;
+		msp_to_bigendian32(buf+1, 5*MSP_EXP_MTU);
+		msp_to_bigendian32(buf+5, msp_exp_frame_generate_fcs(buf, 1, 5) ^ 0x01);
+		code = msp_recv_callback(buf, 9);
+		test_assert(code == MSP_EXP_ERR_FCS_MISMATCH, "corrupted acknowledgement");
+	}
+	read_window_frame(5, 5*MSP_EXP_MTU, "last frame");
+
+	/* Only a T_ACK ends the transfer */
+	code = send_header(MSP_OP_WINDOW_ACK, 0, TEST_LENGTH);
+	test_assert(code == MSP_EXP_ERR_FAULTY_FRAME, "WINDOW_ACK of the whole transfer");
+	code = send_header(MSP_OP_T_ACK, tid, 0);
+	test_assert(code == 0, "T_ACK of the windowed transfer");
+	test_assert(completed == 1, "msp_expsend_complete called");
+	test_assert(msp_exp_state.type == MSP_EXP_STATE_READY, "ready after the transfer");
+
+	/* A WINDOW_ACK outside of a windowed transfer is faulty */
+	code = send_header(MSP_OP_WINDOW_ACK, 0, 0);
+	test_assert(code == MSP_EXP_ERR_FAULTY_FRAME, "WINDOW_ACK when ready");
+
+	/* A restarted experiment has forgotten the window */
+	msp_exp_state_initialize(msp_seqflags_init());
+	send_header(MSP_OP_REQ_PAYLOAD, 0, 3);
+	read_header(MSP_OP_EXP_SEND, "classic response after a restart");
+	send_header(MSP_OP_NULL, 0, 0);
+
+	test_assert(errors == 4, "aborted requests reported");
+	return;
+}
+
+
+unsigned long msp_expsend_busy_time(unsigned char opcode)
+{
+	test_assert(opcode == MSP_OP_REQ_PAYLOAD, "msp_expsend_busy_time only called for REQ_PAYLOAD");
+	return 0;
+}
+void msp_expsend_start(unsigned char opcode, unsigned long *len)
+{
+	test_assert(opcode == MSP_OP_REQ_PAYLOAD, "opcode in msp_expsend_start");
+	*len = TEST_LENGTH;
+	started++;
+}
+void msp_expsend_data(unsigned char opcode, unsigned char *buf, unsigned long len, unsigned long offset)
+{
+	unsigned long i;
+
+	test_assert(opcode == MSP_OP_REQ_PAYLOAD, "opcode in msp_expsend_data");
+	for (i = 0; i < len; i++)
+		buf[i] = (unsigned char) (offset + i);
+}
+void msp_expsend_complete(unsigned char opcode)
+{
+	test_assert(opcode == MSP_OP_REQ_PAYLOAD, "opcode in msp_expsend_complete");
+	completed++;
+}
+void msp_expsend_error(unsigned char opcode, int error)
+{
+	test_assert(opcode == MSP_OP_REQ_PAYLOAD, "opcode in msp_expsend_error");
+	test_assert(error == MSP_EXP_ERR_TRANSACTION_ABORTED, "error in msp_expsend_error");
+	errors++;
+}
+
+
+void msp_exprecv_start(unsigned char opcode, unsigned long len)
+{
+	test_assert(0, "msp_exprecv_start should be unreachable");
+}
+void msp_exprecv_data(unsigned char opcode, const unsigned char *buf, unsigned long len, unsigned long offset)
+{
+	test_assert(0, "msp_exprecv_data should be unreachable");
+}
+void msp_exprecv_complete(unsigned char opcode)
+{
+	test_assert(0, "msp_exprecv_complete should be unreachable");
+}
+void msp_exprecv_error(unsigned char opcode, int error)
+{
+	test_assert(0, "msp_exprecv_error should be unreachable");
+}
+
+void msp_exprecv_syscommand(unsigned char opcode)
+{
+	test_assert(0, "msp_exprecv_syscommand should be unreachable");
+}
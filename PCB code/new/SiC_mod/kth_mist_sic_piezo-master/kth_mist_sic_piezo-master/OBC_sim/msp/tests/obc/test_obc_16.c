@@ -0,0 +1,169 @@
+/*
+ * MSP OBC Test 16
+ *
+ * Test that the OBC reports the time until the experiment is ready, which
+ * the experiment puts in the DL field of EXP_BUSY.
+ */
+
+#define TEST_MTU 507
+
+#include "test_obc.h"
+
+struct msp_response simulate_loop(msp_link_t *link);
+
+unsigned char test_buf[TEST_MTU + 5];
+unsigned char test_storage[8192];
+msp_link_t test_link;
+
+static unsigned int seq = 0;
+
+static void format_header(unsigned char *data, unsigned char opcode, unsigned long dl)
+{
+	unsigned long fcs;
+	unsigned char pseudo_header;
+
+	pseudo_header = (0x11 << 1) | 0x01;
+	fcs = msp_crc32(&pseudo_header, 1, 0);
+
+	data[0] = opcode;
+	msp_to_bigendian32(data + 1, dl);
+	fcs = msp_crc32(data, 5, fcs);
+	msp_to_bigendian32(data + 5, fcs);
+}
+
+void test(void)
+{
+	struct msp_response r;
+
+	test_link = msp_create_link(0x11, msp_seqflags_init(), test_buf, TEST_MTU);
+	test_assert(msp_busy_time(&test_link) == 0, "No busy time on a new link");
+
+	msp_seqflags_set(&test_link.flags, MSP_OP_REQ_HK, 1);
+
+	r = msp_start_transaction(&test_link, MSP_OP_REQ_HK, 0);
+	test_assert(r.status == MSP_RESPONSE_OK, "");
+	/* Send request header */
+	r = simulate_loop(&test_link);
+	test_assert(r.status == MSP_RESPONSE_OK, "");
+	/* Receive response header, the experiment needs 1.5 seconds */
+	r = simulate_loop(&test_link);
+	test_assert(r.status == MSP_RESPONSE_BUSY, "");
+	test_assert(r.busy_time == 1500, "Busy time in the response");
+	test_assert(msp_busy_time(&test_link) == 1500, "Busy time of the link");
+	test_assert(msp_next_action(&test_link) == MSP_LINK_ACTION_RX_HEADER, "Response header read again");
+	/* Receive response header, still 200 ms to go */
+	r = simulate_loop(&test_link);
+	test_assert(r.status == MSP_RESPONSE_BUSY, "");
+	test_assert(r.busy_time == 200, "Busy time in the response");
+	test_assert(msp_busy_time(&test_link) == 200, "Busy time of the link");
+	/* Receive response header */
+	r = simulate_loop(&test_link);
+	test_assert(r.status == MSP_RESPONSE_OK, "");
+	test_assert(msp_busy_time(&test_link) == 0, "No busy time once the experiment answered");
+	/* Send F_ACK */
+	r = simulate_loop(&test_link);
+	test_assert(r.status == MSP_RESPONSE_OK, "");
+	/* Receive data frame, busy without an estimate */
+	r = simulate_loop(&test_link);
+	test_assert(r.status == MSP_RESPONSE_BUSY, "");
+	test_assert(r.busy_time == 0, "Busy without an estimate");
+	/* Receive data frame */
+	r = simulate_loop(&test_link);
+	test_assert(r.status == MSP_RESPONSE_OK, "");
+	/* Send T_ACK */
+	r = simulate_loop(&test_link);
+	test_assert(r.status == MSP_RESPONSE_TRANSACTION_SUCCESSFUL, "");
+	test_assert(r.len == 4, "");
+	test_assert(msp_busy_time(&test_link) == 0, "No busy time after the transaction");
+
+	test_assert(seq == 8, "8 I2C transmissions should've occured");
+
+	return;
+}
+
+struct msp_response simulate_loop(msp_link_t *link)
+{
+	struct msp_response r;
+	unsigned long len, offset;
+
+	switch (msp_next_action(link)) {
+	case MSP_LINK_ACTION_TX_HEADER:
+		r = msp_send_header_frame(link);
+		break;
+	case MSP_LINK_ACTION_RX_HEADER:
+		r = msp_recv_header_frame(link);
+		break;
+	case MSP_LINK_ACTION_TX_DATA:
+		len = msp_next_data_length(link);
+		offset = msp_next_data_offset(link);
+		r = msp_send_data_frame(link, test_storage + offset, len);
+		break;
+	case MSP_LINK_ACTION_RX_DATA:
+		offset = msp_next_data_offset(link);
+		r = msp_recv_data_frame(link, test_storage + offset, &len);
+		break;
+	default:
+		break;
+	}
+
+	return r;
+}
+
+
+int msp_i2c_write(unsigned long slave_address, unsigned char *data, unsigned long size)
+{
+	test_assert(slave_address == 0x11, "Value of slave_address in msp_i2c_write");
+	switch (seq) {
+	case 0: /* Request Header */
+		test_assert(data[0] == MSP_OP_REQ_HK, "");
+		break;
+	case 4: /* F_ACK */
+		test_assert(data[0] == MSP_OP_F_ACK, "");
+		break;
+	case 7: /* T_ACK */
+		test_assert(data[0] == MSP_OP_T_ACK, "");
+		break;
+	default:
+		test_assert(0, "msp_i2c_write called out of sequence");
+		break;
+	}
+
+	seq++;
+	return 0;
+}
+int msp_i2c_read(unsigned long slave_address, unsigned char *data, unsigned long size)
+{
+	unsigned long fcs, i;
+	unsigned char pseudo_header;
+
+	test_assert(slave_address == 0x11, "Value of slave_address in msp_i2c_read");
+	switch (seq) {
+	case 1: /* Busy for 1.5 seconds */
+		format_header(data, MSP_OP_EXP_BUSY, 1500);
+		break;
+	case 2: /* Busy for 200 ms */
+		format_header(data, MSP_OP_EXP_BUSY, 200);
+		break;
+	case 3: /* Response Header */
+		format_header(data, MSP_OP_EXP_SEND, 4);
+		break;
+	case 5: /* Busy */
+		format_header(data, MSP_OP_EXP_BUSY, 0);
+		break;
+	case 6: /* Data Frame */
+		pseudo_header = (slave_address << 1) | 0x01;
+		fcs = msp_crc32(&pseudo_header, 1, 0);
+		data[0] = MSP_OP_DATA_FRAME | 0x80;
+		for (i = 0; i < 4; i++)
+			data[i + 1] = 0x16;
+		fcs = msp_crc32(data, 5, fcs);
+		msp_to_bigendian32(data + 5, fcs);
+		break;
+	default:
+		test_assert(0, "msp_i2c_read called out of sequence");
+		break;
+	}
+
+	seq++;
+	return 0;
+}
@@ -0,0 +1,331 @@
+/*
+ * MSP OBC Test 17
+ *
+ * Test that the OBC negotiates a window, reads OBC Requests in windows of
+ * data frames acknowledged with WINDOW_ACK, asks again for frames that are
+ * corrupted or sent twice, and falls back to classic MSP when the experiment
+ * does not agree to a windowed transfer.
+ */
+
+#define TEST_MTU 10
+#define TEST_LENGTH 45
+
+#include "test_obc.h"
+
+struct msp_response simulate_loop(msp_link_t *link);
+
+unsigned char test_buf[TEST_MTU + 5];
+unsigned char test_storage[8192];
+msp_link_t test_link;
+
+static unsigned int seq = 0;
+
+static void format_header(unsigned char *data, unsigned char head, unsigned long dl)
+{
+	unsigned long fcs;
+	unsigned char pseudo_header;
+
+	pseudo_header = (0x11 << 1) | 0x01;
+	fcs = msp_crc32(&pseudo_header, 1, 0);
+
+	data[0] = head;
+	msp_to_bigendian32(data + 1, dl);
+	fcs = msp_crc32(data, 5, fcs);
+	msp_to_bigendian32(data + 5, fcs);
+}
+
+static void format_data(unsigned char *data, unsigned char head, unsigned long offset, unsigned long len)
+{
+	unsigned long fcs, i;
+	unsigned char pseudo_header;
+
+	pseudo_header = (0x11 << 1) | 0x01;
+	fcs = msp_crc32(&pseudo_header, 1, 0);
+
+	data[0] = head;
+	for (i = 0; i < len; i++)
+		data[i + 1] = (unsigned char) (0x40 + offset + i);
+	fcs = msp_crc32(data, len + 1, fcs);
+	msp_to_bigendian32(data + len + 1, fcs);
+}
+
+/* The data frame of REQ_WINDOW, the window that the experiment agrees to */
+static void format_window_byte(unsigned char *data, unsigned char window)
+{
+	unsigned long fcs;
+	unsigned char pseudo_header;
+
+	pseudo_header = (0x11 << 1) | 0x01;
+	fcs = msp_crc32(&pseudo_header, 1, 0);
+
+	data[0] = MSP_OP_DATA_FRAME;
+	data[1] = window;
+	fcs = msp_crc32(data, 2, fcs);
+	msp_to_bigendian32(data + 2, fcs);
+}
+
+/* A data frame of the windowed transfer with the given sequence number */
+static void format_window_data(unsigned char *data, unsigned char n, unsigned long offset)
+{
+	unsigned long len;
+
+	len = TEST_LENGTH - offset;
+	if (len > TEST_MTU)
+		len = TEST_MTU;
+	format_data(data, MSP_OP_WINDOW_DATA(n) | ((n & 0x01) << 7), offset, len);
+}
+
+static void check_header(unsigned char *data, unsigned char opcode, unsigned long dl)
+{
+	test_assert((data[0] & 0x7F) == opcode, "opcode of the header sent");
+	test_assert(msp_from_bigendian32(data + 1) == dl, "DL of the header sent");
+}
+
+void test(void)
+{
+	struct msp_response r;
+	unsigned long i;
+
+	test_link = msp_create_link(0x11, msp_seqflags_init(), test_buf, TEST_MTU);
+	test_assert(msp_window(&test_link) == 1, "No window on a new link");
+
+	r = msp_negotiate_window(&test_link, 0);
+	test_assert(r.status == MSP_RESPONSE_ERROR && r.error_code == MSP_OBC_ERR_INVALID_WINDOW, "window of 0");
+	r = msp_negotiate_window(&test_link, MSP_WINDOW_MAX + 1);
+	test_assert(r.status == MSP_RESPONSE_ERROR && r.error_code == MSP_OBC_ERR_INVALID_WINDOW, "window too large");
+	test_assert(!msp_is_active(&test_link), "No transaction started for an invalid window");
+
+	/* Negotiate, a window of 3 is offered and 2 is agreed to */
+	r = msp_negotiate_window(&test_link, 3);
+	test_assert(r.status == MSP_RESPONSE_OK, "");
+	while (msp_is_active(&test_link)) {
+		r = simulate_loop(&test_link);
+		test_assert(r.status == MSP_RESPONSE_OK || r.status == MSP_RESPONSE_TRANSACTION_SUCCESSFUL, "negotiation");
+	}
+	test_assert(r.opcode == MSP_OP_REQ_WINDOW && r.len == 1, "");
+	test_assert(msp_window(&test_link) == 2, "Window agreed to by the experiment");
+	test_assert(seq == 5, "5 I2C transmissions in the negotiation");
+
+	/* A windowed transfer */
+	r = msp_start_transaction(&test_link, MSP_OP_REQ_PAYLOAD, 0);
+	test_assert(r.status == MSP_RESPONSE_OK, "");
+	/* Send request header, receive response, send WINDOW_ACK */
+	for (i = 0; i < 3; i++) {
+		r = simulate_loop(&test_link);
+		test_assert(r.status == MSP_RESPONSE_OK, "");
+	}
+	/* Two frames are read in a row */
+	r = simulate_loop(&test_link);
+	test_assert(r.status == MSP_RESPONSE_OK, "");
+	test_assert(msp_next_action(&test_link) == MSP_LINK_ACTION_RX_DATA, "The window is read in a row");
+	r = simulate_loop(&test_link);
+	test_assert(r.status == MSP_RESPONSE_OK, "");
+	test_assert(msp_next_action(&test_link) == MSP_LINK_ACTION_TX_HEADER, "The window is acknowledged once full");
+	/* WINDOW_ACK, corrupted frame, WINDOW_ACK */
+	r = simulate_loop(&test_link);
+	test_assert(r.status == MSP_RESPONSE_OK, "");
+	r = simulate_loop(&test_link);
+	test_assert(r.status == MSP_RESPONSE_ERROR, "Corrupted data frame");
+	test_assert(msp_next_action(&test_link) == MSP_LINK_ACTION_TX_HEADER, "Frames asked for again");
+	r = simulate_loop(&test_link);
+	test_assert(r.status == MSP_RESPONSE_OK, "");
+	/* The frame, then the same one again */
+	r = simulate_loop(&test_link);
+	test_assert(r.status == MSP_RESPONSE_OK, "");
+	r = simulate_loop(&test_link);
+	test_assert(r.status == MSP_RESPONSE_ERROR, "Data frame sent twice");
+	test_assert(msp_next_data_offset(&test_link) == 3*TEST_MTU, "Data frame sent twice is not taken");
+	/* WINDOW_ACK, the last two frames and T_ACK */
+	for (i = 0; i < 3; i++) {
+		r = simulate_loop(&test_link);
+		test_assert(r.status == MSP_RESPONSE_OK, "");
+	}
+	r = simulate_loop(&test_link);
+	test_assert(r.status == MSP_RESPONSE_TRANSACTION_SUCCESSFUL, "");
+	test_assert(r.len == TEST_LENGTH, "");
+	test_assert(msp_error_count(&test_link) == 0, "Error count is reset after the transaction");
+	for (i = 0; i < TEST_LENGTH; i++) {
+		if (test_storage[i] != (unsigned char) (0x40 + i)) {
+			test_assert(0, "Data of the windowed transfer");
+			break;
+		}
+	}
+	test_assert(seq == 19, "19 I2C transmissions after the windowed transfer");
+
+	/* The experiment answers with a classic EXP_SEND, the window is dropped */
+	r = msp_start_transaction(&test_link, MSP_OP_REQ_HK, 0);
+	test_assert(r.status == MSP_RESPONSE_OK, "");
+	while (msp_is_active(&test_link)) {
+		r = simulate_loop(&test_link);
+		test_assert(r.status == MSP_RESPONSE_OK || r.status == MSP_RESPONSE_TRANSACTION_SUCCESSFUL, "classic transfer");
+	}
+	test_assert(r.len == 4, "");
+	test_assert(msp_window(&test_link) == 1, "Window dropped after a classic response");
+
+	/* An experiment that does not implement windowed transfer */
+	r = msp_negotiate_window(&test_link, 4);
+	test_assert(r.status == MSP_RESPONSE_OK, "");
+	while (msp_is_active(&test_link)) {
+		r = simulate_loop(&test_link);
+		test_assert(r.status == MSP_RESPONSE_OK || r.status == MSP_RESPONSE_TRANSACTION_SUCCESSFUL, "negotiation");
+	}
+	test_assert(r.len == 0, "");
+	test_assert(msp_window(&test_link) == 1, "No window if the experiment sends no data");
+
+	/* A windowed response is not accepted without a window */
+	r = msp_start_transaction(&test_link, MSP_OP_REQ_HK, 0);
+	test_assert(r.status == MSP_RESPONSE_OK, "");
+	r = simulate_loop(&test_link);
+	test_assert(r.status == MSP_RESPONSE_OK, "");
+	r = simulate_loop(&test_link);
+	test_assert(r.status == MSP_RESPONSE_ERROR && r.error_code == MSP_OBC_ERR_INVALID_FRAME, "EXP_SEND_WINDOW without a window");
+	r = msp_abort_transaction(&test_link);
+	test_assert(r.status == MSP_RESPONSE_OK, "");
+
+	test_assert(seq == 30, "30 I2C transmissions should've occured");
+
+	return;
+}
+
+struct msp_response simulate_loop(msp_link_t *link)
+{
+	struct msp_response r;
+	unsigned long len, offset;
+
+	switch (msp_next_action(link)) {
+	case MSP_LINK_ACTION_TX_HEADER:
+		r = msp_send_header_frame(link);
+		break;
+	case MSP_LINK_ACTION_RX_HEADER:
+		r = msp_recv_header_frame(link);
+		break;
+	case MSP_LINK_ACTION_TX_DATA:
+		len = msp_next_data_length(link);
+		offset = msp_next_data_offset(link);
+		r = msp_send_data_frame(link, test_storage + offset, len);
+		break;
+	case MSP_LINK_ACTION_RX_DATA:
+		offset = msp_next_data_offset(link);
+		r = msp_recv_data_frame(link, test_storage + offset, &len);
+		break;
+	default:
+		break;
+	}
+
+	return r;
+}
+
+
+int msp_i2c_write(unsigned long slave_address, unsigned char *data, unsigned long size)
+{
+	test_assert(slave_address == 0x11, "Value of slave_address in msp_i2c_write");
+	switch (seq) {
+	case 0: /* Window offered */
+		check_header(data, MSP_OP_REQ_WINDOW, 3);
+		break;
+	case 2: /* F_ACK */
+		check_header(data, MSP_OP_F_ACK, 0);
+		break;
+	case 4: /* T_ACK */
+		check_header(data, MSP_OP_T_ACK, 0);
+		test_assert(data[0] & 0x80, "Frame-ID of T_ACK");
+		break;
+	case 5: /* Request with the window */
+		check_header(data, MSP_OP_REQ_PAYLOAD, 2);
+		break;
+	case 7: /* Response acknowledged */
+		check_header(data, MSP_OP_WINDOW_ACK, 0);
+		break;
+	case 10: /* Two frames acknowledged */
+	case 12: /* Corrupted frame asked for again */
+		check_header(data, MSP_OP_WINDOW_ACK, 2*TEST_MTU);
+		break;
+	case 15: /* The frame sent twice is not acknowledged twice */
+		check_header(data, MSP_OP_WINDOW_ACK, 3*TEST_MTU);
+		break;
+	case 18: /* T_ACK */
+		check_header(data, MSP_OP_T_ACK, 0);
+		test_assert(data[0] & 0x80, "Frame-ID of T_ACK");
+		break;
+	case 19: /* Request with the window */
+		check_header(data, MSP_OP_REQ_HK, 2);
+		break;
+	case 21: /* Classic F_ACK */
+		check_header(data, MSP_OP_F_ACK, 0);
+		break;
+	case 23: /* T_ACK */
+		check_header(data, MSP_OP_T_ACK, 0);
+		break;
+	case 24: /* Window offered */
+		check_header(data, MSP_OP_REQ_WINDOW, 4);
+		break;
+	case 26: /* T_ACK */
+		check_header(data, MSP_OP_T_ACK, 0);
+		break;
+	case 27: /* Request without a window */
+		check_header(data, MSP_OP_REQ_HK, 0);
+		break;
+	case 29: /* NULL */
+		check_header(data, MSP_OP_NULL, 0);
+		break;
+	default:
+		test_assert(0, "msp_i2c_write called out of sequence");
+		break;
+	}
+
+	seq++;
+	return 0;
+}
+int msp_i2c_read(unsigned long slave_address, unsigned char *data, unsigned long size)
+{
+	test_assert(slave_address == 0x11, "Value of slave_address in msp_i2c_read");
+	switch (seq) {
+	case 1: /* Response to REQ_WINDOW */
+		format_header(data, MSP_OP_EXP_SEND | 0x80, 1);
+		break;
+	case 3: /* The agreed window */
+		format_window_byte(data, 2);
+		break;
+	case 6: /* Windowed response */
+		format_header(data, MSP_OP_EXP_SEND_WINDOW | 0x80, TEST_LENGTH);
+		break;
+	case 8:
+		format_window_data(data, 0, 0);
+		break;
+	case 9:
+		format_window_data(data, 1, TEST_MTU);
+		break;
+	case 11: /* Corrupted */
+		format_window_data(data, 2, 2*TEST_MTU);
+		data[3] ^= 0x10;
+		break;
+	case 13:
+	case 14: /* Sent twice */
+		format_window_data(data, 2, 2*TEST_MTU);
+		break;
+	case 16:
+		format_window_data(data, 3, 3*TEST_MTU);
+		break;
+	case 17:
+		format_window_data(data, 4, 4*TEST_MTU);
+		break;
+	case 20: /* Classic response, the experiment restarted */
+		format_header(data, MSP_OP_EXP_SEND | 0x80, 4);
+		break;
+	case 22:
+		format_data(data, MSP_OP_DATA_FRAME, 0, 4);
+		break;
+	case 25: /* An experiment without windowed transfer sends nothing */
+		format_header(data, MSP_OP_EXP_SEND, 0);
+		break;
+	case 28:
+		format_header(data, MSP_OP_EXP_SEND_WINDOW, 4);
+		break;
+	default:
+		test_assert(0, "msp_i2c_read called out of sequence");
+		break;
+	}
+
+	seq++;
+	return 0;
+}
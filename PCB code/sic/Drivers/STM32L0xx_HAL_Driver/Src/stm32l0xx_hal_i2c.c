@@ -1536,46 +1536,6 @@ HAL_StatusTypeDef HAL_I2C_Slave_Receive(I2C_HandleTypeDef *hi2c, uint8_t *pData,
     return HAL_BUSY;
   }
 }
-HAL_StatusTypeDef HAL_I2C_Slave_TxRx_IT(I2C_HandleTypeDef *hi2c, uint8_t *pData, uint16_t Size)
-{
-  if (hi2c->State == HAL_I2C_STATE_READY)
-  {
-    /* Process Locked */
-    __HAL_LOCK(hi2c);
-
-    hi2c->State       = HAL_I2C_STATE_BUSY_TX;
-    hi2c->Mode        = HAL_I2C_MODE_SLAVE;
-    hi2c->ErrorCode   = HAL_I2C_ERROR_NONE;
-
-    /* Enable Address Acknowledge */
-    hi2c->Instance->CR2 &= ~I2C_CR2_NACK;
-
-    /* Prepare transfer parameters */
-    hi2c->pBuffPtr    = pData;
-    hi2c->XferCount   = Size;
-    hi2c->XferSize    = hi2c->XferCount;
-    hi2c->XferOptions = I2C_NO_OPTION_FRAME;
-    hi2c->XferISR     = I2C_Slave_ISR_IT;
-
-    /* Process Unlocked */
-    __HAL_UNLOCK(hi2c);
-
-    /* Note : The I2C interrupts must be enabled after unlocking current process
-              to avoid the risk of I2C interrupt handle execution before current
-              process unlock */
-
-    /* Enable ERR, TC, STOP, NACK, TXI interrupt */
-    /* possible to enable all of these */
-    /* I2C_IT_ERRI | I2C_IT_TCI| I2C_IT_STOPI| I2C_IT_NACKI | I2C_IT_ADDRI | I2C_IT_RXI | I2C_IT_TXI */
-    I2C_Enable_IRQ(hi2c, I2C_XFER_RX_IT | I2C_XFER_TX_IT | I2C_XFER_LISTEN_IT);
-
-    return HAL_OK;
-  }
-  else
-  {
-    return HAL_BUSY;
-  }
-}
 
 /**
   * @brief  Transmit in master mode an amount of data in non-blocking mode with Interrupt
@@ -4460,6 +4420,19 @@ __weak void HAL_I2C_SlaveRxCpltCallback(I2C_HandleTypeDef *hi2c)
    */
 }
 
+/**
+  * @brief  Slave Rx byte received callback, called by the slave interrupt
+  *         handler for every byte that is stored in the buffer.
+  * @param  hi2c Pointer to a I2C_HandleTypeDef structure that contains
+  *                the configuration information for the specified I2C.
+  * @retval None
+  */
+__weak void HAL_I2C_SlaveRxByteCallback(I2C_HandleTypeDef *hi2c)
+{
+  /* Prevent unused argument(s) compilation warning */
+  UNUSED(hi2c);
+}
+
 /**
   * @brief  Slave Address Match callback.
   * @param  hi2c Pointer to a I2C_HandleTypeDef structure that contains
@@ -4825,21 +4798,31 @@ static HAL_StatusTypeDef I2C_Slave_ISR_IT(struct __I2C_HandleTypeDef *hi2c, uint
   }
   else if ((I2C_CHECK_FLAG(ITFlags, I2C_FLAG_RXNE) != RESET) && (I2C_CHECK_IT_SOURCE(ITSources, I2C_IT_RXI) != RESET))
   {
-     if (!(ITFlags & I2C_FLAG_STOPF))
+    /* The last byte is read by I2C_ITSlaveCplt() when STOPF is set as well.
+       A last frame is only complete at STOP, frames may be shorter than the
+       buffer. Bytes that do not fit are read and dropped. */
+    if (!(ITFlags & I2C_FLAG_STOPF))
     {
-      /* Read data from RXDR */
-      (*hi2c->pBuffPtr++) = hi2c->Instance->RXDR;
-      //hi2c->XferSize--;
-      //hi2c->XferCount--;
-    }
-
-    else if ((hi2c->XferOptions != I2C_NO_OPTION_FRAME))
-    {
-      /* Call I2C Slave Sequential complete process */
-      I2C_ITSlaveSeqCplt(hi2c);
-      //sice it is not used anymore for recive
-      //hi2c->XferCount = 0U;
-      //hi2c->XferSize = 0U;
+      if (hi2c->XferCount > 0U)
+      {
+        /* Read data from RXDR */
+        (*hi2c->pBuffPtr++) = hi2c->Instance->RXDR;
+        hi2c->XferSize--;
+        hi2c->XferCount--;
+        HAL_I2C_SlaveRxByteCallback(hi2c);
+
+        /* A first or next frame completes when it is full, so the rest of the
+           transfer can be received by another call */
+        if ((hi2c->XferCount == 0U) && ((tmpoptions == I2C_FIRST_FRAME) || (tmpoptions == I2C_NEXT_FRAME)))
+        {
+          /* Call I2C Slave Sequential complete process */
+          I2C_ITSlaveSeqCplt(hi2c);
+        }
+      }
+      else
+      {
+        (void)hi2c->Instance->RXDR;
+      }
     }
   }
   else if ((I2C_CHECK_FLAG(ITFlags, I2C_FLAG_ADDR) != RESET) && (I2C_CHECK_IT_SOURCE(ITSources, I2C_IT_ADDRI) != RESET))
@@ -4871,6 +4854,12 @@ static HAL_StatusTypeDef I2C_Slave_ISR_IT(struct __I2C_HandleTypeDef *hi2c, uint
         /* Call I2C Slave Sequential complete process */
         I2C_ITSlaveSeqCplt(hi2c);
       }
+      else if (tmpoptions == I2C_FIRST_AND_LAST_FRAME)
+      {
+        /* The master reads past the end of the frame, pad it instead of
+           stretching SCL until the bus times out */
+        hi2c->Instance->TXDR = 0x00U;
+      }
     }
   }
   else
@@ -5265,11 +5254,6 @@ static void I2C_ITAddrCplt(I2C_HandleTypeDef *hi2c, uint32_t ITFlags)
   slaveaddrcode     = I2C_GET_ADDR_MATCH(hi2c);
   ownadd1code       = I2C_GET_OWN_ADDRESS1(hi2c);
   ownadd2code       = I2C_GET_OWN_ADDRESS2(hi2c);
-  
-  
-  //I2C_Disable_IRQ(hi2c, I2C_XFER_LISTEN_IT);
-  
-  HAL_I2C_AddrCallback(hi2c, transferdirection, slaveaddrcode);
 
   /* Prevent unused argument(s) compilation warning */
   UNUSED(ITFlags);
@@ -5634,17 +5618,22 @@ static void I2C_ITSlaveCplt(I2C_HandleTypeDef *hi2c, uint32_t ITFlags)
     /* Remove RXNE flag on temporary variable as read done */
     ITFlags &= ~I2C_FLAG_RXNE;
 
-    /* Read data from RXDR */
-    *hi2c->pBuffPtr = (uint8_t)hi2c->Instance->RXDR;
-
-    /* Increment Buffer pointer */
-    hi2c->pBuffPtr++;
-
     if ((hi2c->XferSize > 0U))
     {
+      /* Read data from RXDR */
+      *hi2c->pBuffPtr = (uint8_t)hi2c->Instance->RXDR;
+
+      /* Increment Buffer pointer */
+      hi2c->pBuffPtr++;
+
       hi2c->XferSize--;
       hi2c->XferCount--;
     }
+    else
+    {
+      /* No room left in the buffer, drop the byte */
+      (void)hi2c->Instance->RXDR;
+    }
   }
 
   /* All data are not transferred, so set error code accordingly */
@@ -5740,20 +5729,25 @@ static void I2C_ITListenCplt(I2C_HandleTypeDef *hi2c, uint32_t ITFlags)
     /* Remove RXNE flag on temporary variable as read done */
     ITFlags &= ~I2C_FLAG_RXNE;
 
-    /* Read data from RXDR */
-    *hi2c->pBuffPtr = (uint8_t)hi2c->Instance->RXDR;
-
-    /* Increment Buffer pointer */
-    hi2c->pBuffPtr++;
-
     if ((hi2c->XferSize > 0U))
     {
+      /* Read data from RXDR */
+      *hi2c->pBuffPtr = (uint8_t)hi2c->Instance->RXDR;
+
+      /* Increment Buffer pointer */
+      hi2c->pBuffPtr++;
+
       hi2c->XferSize--;
       hi2c->XferCount--;
 
       /* Set ErrorCode corresponding to a Non-Acknowledge */
       hi2c->ErrorCode |= HAL_I2C_ERROR_AF;
     }
+    else
+    {
+      /* No room left in the buffer, drop the byte */
+      (void)hi2c->Instance->RXDR;
+    }
   }
 
   /* Disable all Interrupts*/
@@ -0,0 +1,221 @@
+/**
+ *****************************************************************************
+ * @file hal_shim.c
+ * @brief virtual clock and HAL replacement for host builds of Piezo.c
+ *****************************************************************************
+ * USART1 is connected to piezo_sim.c. Like the real USART with overrun
+ * detection disabled, only the last byte that arrived is kept in RDR, and
+ * bytes that arrive while RE485 is high never reach the USART.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "usart.h"
+#include "tim.h"
+#include "piezo.h"
+#include "power_management.h"
+#include "msp_i2c_slave.h"
+#include "hal_shim.h"
+#include "piezo_sim.h"
+
+GPIO_TypeDef hal_shim_gpioa;
+UART_HandleTypeDef huart1;
+TIM_HandleTypeDef htim21;
+
+static uint64_t now_us;
+static struct hal_shim_stats stats;
+
+static bool receiver_on;
+static uint64_t receiver_on_since;
+
+static void (*delay_hook)(void);
+
+static bool timer_running;
+static uint32_t timer_period_ms = 1000;
+static uint64_t timer_next_us;
+
+static void advance(uint64_t to_us)
+{
+	while (timer_running && timer_next_us <= to_us) {
+		now_us = timer_next_us;
+		timer_next_us += timer_period_ms * 1000ULL;
+		piezo_poll_tick();
+	}
+	if (to_us > now_us)
+		now_us = to_us;
+}
+
+void hal_shim_reset(void)
+{
+	now_us = 0;
+	memset(&stats, 0, sizeof(stats));
+	receiver_on = false;
+	timer_running = false;
+	timer_period_ms = 1000;
+	delay_hook = NULL;
+}
+
+void hal_shim_set_delay_hook(void (*hook)(void))
+{
+	delay_hook = hook;
+}
+
+uint64_t hal_shim_now_us(void)
+{
+	return now_us;
+}
+
+const struct hal_shim_stats *hal_shim_get_stats(void)
+{
+	if (receiver_on) {
+		stats.receiver_on_us += now_us - receiver_on_since;
+		receiver_on_since = now_us;
+	}
+	return &stats;
+}
+
+/* the main loop has nothing to do, sleep until the next timer event */
+void hal_shim_idle(uint64_t until_us)
+{
+	if (timer_running && timer_next_us < until_us)
+		until_us = timer_next_us;
+	advance(until_us);
+}
+
+/* the main loop of main.c, without the MSP part */
+void hal_shim_run(uint32_t ms)
+{
+	uint64_t end = now_us + ms * 1000ULL;
+
+	while (now_us < end) {
+		piezo_poll();
+		hal_shim_idle(end);
+	}
+}
+
+uint32_t HAL_GetTick(void)
+{
+	return (uint32_t)(now_us / 1000);
+}
+
+void HAL_Delay(uint32_t Delay)
+{
+	advance(now_us + Delay * 1000ULL);
+}
+
+/* the test stands in for the OBC, if it set a hook */
+void msp_i2c_delay(uint32_t ms)
+{
+	if (delay_hook != NULL)
+		delay_hook();
+	HAL_Delay(ms);
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+	bool on = PinState == GPIO_PIN_RESET;
+
+	if (GPIOx != GPIOA || GPIO_Pin != RE485_Pin || on == receiver_on)
+		return;
+	if (on)
+		receiver_on_since = now_us;
+	else
+		stats.receiver_on_us += now_us - receiver_on_since;
+	receiver_on = on;
+}
+
+HAL_StatusTypeDef HAL_UART_Receive(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+	for (uint16_t i = 0; i < Size; i++) {
+		uint64_t deadline = now_us + Timeout * 1000ULL;
+		uint64_t arrival;
+
+		if (!receiver_on)
+			return HAL_TIMEOUT;
+		for (;;) {
+			uint64_t next;
+
+			if (!piezo_sim_peek(0, &arrival) || arrival > deadline) {
+				advance(deadline);
+				return HAL_TIMEOUT;
+			}
+			/* lost while the receiver was off, or overwritten in RDR */
+			if (arrival < receiver_on_since ||
+			    (piezo_sim_peek(1, &next) && next <= now_us)) {
+				piezo_sim_pop();
+				stats.lost_bytes++;
+				continue;
+			}
+			break;
+		}
+		advance(arrival);
+		pData[i] = piezo_sim_pop();
+		stats.rx_bytes++;
+	}
+	return HAL_OK;
+}
+
+void hal_shim_uart_request(UART_HandleTypeDef *huart, uint32_t request)
+{
+	uint64_t arrival;
+
+	if (request != UART_RXDATA_FLUSH_REQUEST)
+		return;
+	while (piezo_sim_peek(0, &arrival) && arrival <= now_us) {
+		piezo_sim_pop();
+		stats.lost_bytes++;
+	}
+}
+
+HAL_StatusTypeDef usart1_transmit_dma(const uint8_t *data, uint16_t length, uint32_t timeout)
+{
+	uint32_t bit_us = (piezo_sim_byte_time_us() + 9) / 10;
+	uint64_t duration = (uint64_t)length * piezo_sim_byte_time_us() + HAL_SHIM_DE_BITS * bit_us;
+
+	if (duration > timeout * 1000ULL)
+		return HAL_TIMEOUT;
+	stats.driver_on_us += duration;
+	stats.tx_bytes += length;
+	advance(now_us + duration);
+	piezo_sim_receive(data, length, now_us);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Start_IT(TIM_HandleTypeDef *htim)
+{
+	timer_running = true;
+	timer_next_us = now_us + timer_period_ms * 1000ULL;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Stop_IT(TIM_HandleTypeDef *htim)
+{
+	timer_running = false;
+	return HAL_OK;
+}
+
+void tim21_set_period_ms(uint16_t period_ms)
+{
+	if (period_ms == 0)
+		period_ms = 1;
+	timer_period_ms = period_ms;
+	timer_next_us = now_us + period_ms * 1000ULL;
+}
+
+void piezo_power_on(void)
+{
+	piezo_sim_power(true, now_us);
+}
+
+void piezo_power_off(void)
+{
+	piezo_sim_power(false, now_us);
+}
+
+void Error_Handler(void)
+{
+	fprintf(stderr, "Error_Handler called\n");
+	abort();
+}
@@ -0,0 +1,36 @@
+/**
+ *****************************************************************************
+ * @file hal_shim.h
+ * @brief virtual clock and HAL replacement for host builds of Piezo.c
+ *****************************************************************************
+ * time only moves when the driver waits for something (HAL_Delay, a UART
+ * byte, a DMA transfer) or when the test calls hal_shim_idle(). TIM21 is
+ * emulated on the same clock and calls piezo_poll_tick() like main.c does.
+ * msp_i2c_delay() calls the delay hook before it waits, where the target
+ * answers the OBC.
+ */
+#ifndef HAL_SHIM_H
+#define HAL_SHIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* must match USART1_DE_ASSERTION_TIME / USART1_DE_DEASSERTION_TIME, in bits */
+#define HAL_SHIM_DE_BITS 2
+
+struct hal_shim_stats {
+	uint64_t driver_on_us;       /* time the RS485 driver was enabled */
+	uint64_t receiver_on_us;     /* time the RS485 receiver was enabled */
+	uint32_t tx_bytes;
+	uint32_t rx_bytes;
+	uint32_t lost_bytes;         /* arrived while the receiver was off or overwritten */
+};
+
+void hal_shim_reset(void);
+uint64_t hal_shim_now_us(void);
+void hal_shim_idle(uint64_t until_us);
+void hal_shim_run(uint32_t ms);
+const struct hal_shim_stats *hal_shim_get_stats(void);
+void hal_shim_set_delay_hook(void (*hook)(void));
+
+#endif /* HAL_SHIM_H */
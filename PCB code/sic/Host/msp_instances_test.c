@@ -0,0 +1,385 @@
+/**
+ *****************************************************************************
+ * @file msp_instances_test.c
+ * @brief regression tests for the two MSP addresses, run through the MSP library
+ *****************************************************************************
+ * the OBC talks to the SiC (0x45) and the Piezo (0x65) address in turns, and
+ * the next data frames are prepared between the frames as the main loop does.
+ * Both addresses share the two buffers that the data frames are built in.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "msp_exp.h"
+
+#define SIC 0x45
+#define PIEZO 0x65
+/* six data frames, the last one short */
+#define LENGTH (5 * MSP_EXP_MTU + 100)
+#define FRAMES ((LENGTH + MSP_EXP_MTU - 1) / MSP_EXP_MTU)
+
+static int failures;
+/* per experiment, see slot(): the data frames built of each frame, the
+ * requests that completed and the ones that ended with an error */
+static int built[2][FRAMES];
+static int completed[2];
+static int aborted[2];
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("    %s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+		return; \
+	} \
+} while (0)
+
+static int slot(unsigned char opcode)
+{
+	return opcode == REQ_PIEZO;
+}
+
+/* the data byte of a request at an offset, different for the two requests */
+static unsigned char data_byte(unsigned char opcode, unsigned long offset)
+{
+	return (unsigned char)(offset * 7 + opcode);
+}
+
+/* the OBC writes a header frame */
+static int obc_header(char addr, unsigned char opcode, unsigned char frame_id, unsigned long dl)
+{
+	unsigned char frame[9];
+
+	frame[0] = opcode | (frame_id << 7);
+	msp_to_bigendian32(frame + 1, dl);
+	msp_to_bigendian32(frame + 5, msp_exp_frame_generate_fcs(frame, 1, 5, addr));
+	return msp_recv_callback(frame, 9, addr);
+}
+
+/* the OBC reads a frame */
+static unsigned long obc_read(char addr, const unsigned char **frame)
+{
+	unsigned long len;
+
+	msp_send_frame(frame, &len, addr);
+	return len;
+}
+
+/* the main loop between two transfers */
+static void idle(void)
+{
+	while (msp_exp_prepare_next(SIC) || msp_exp_prepare_next(PIEZO))
+		;
+}
+
+/* checks that a data frame holds the data of a request at an offset */
+static int data_ok(unsigned char opcode, const unsigned char *frame, unsigned long len, unsigned long offset)
+{
+	unsigned long i;
+	unsigned long expected = LENGTH - offset < MSP_EXP_MTU ? LENGTH - offset : MSP_EXP_MTU;
+
+	if (len != expected + 5)
+		return 0;
+	for (i = 0; i < expected; i++) {
+		if (frame[1 + i] != data_byte(opcode, offset + i))
+			return 0;
+	}
+	return msp_exp_frame_fcs_valid(frame, 0, len, opcode == REQ_PIEZO ? PIEZO : SIC);
+}
+
+/* starts a request, returns the transaction-ID or -1 if it was not answered
+ * with the response header */
+static int start_request(char addr, unsigned char opcode, unsigned long window)
+{
+	const unsigned char *frame;
+	unsigned char response = window > 1 ? MSP_OP_EXP_SEND_WINDOW : MSP_OP_EXP_SEND;
+
+	obc_header(addr, opcode, 0, window);
+	obc_read(addr, &frame);
+	if ((frame[0] & 0x7F) != response || msp_from_bigendian32(frame + 1) != LENGTH)
+		return -1;
+	return frame[0] >> 7;
+}
+
+/* reads the next data frame of a classic request and acknowledges it,
+ * returns 0 if it does not hold the data at the offset */
+static int read_data(char addr, unsigned char opcode, unsigned long *offset)
+{
+	const unsigned char *frame;
+	unsigned long len;
+
+	len = obc_read(addr, &frame);
+	if ((frame[0] & 0x7F) != MSP_OP_DATA_FRAME || !data_ok(opcode, frame, len, *offset))
+		return 0;
+	*offset += len - 5;
+	if (*offset < LENGTH)
+		obc_header(addr, MSP_OP_F_ACK, frame[0] >> 7, 0);
+	return 1;
+}
+
+/* reads the next data frame of a windowed request, returns 0 if it is not
+ * the frame with the sequence number */
+static int read_window_data(char addr, unsigned char opcode, unsigned char seq)
+{
+	const unsigned char *frame;
+	unsigned long len;
+
+	len = obc_read(addr, &frame);
+	if (!MSP_OP_IS_WINDOW_DATA(frame[0] & 0x7F) ||
+	    MSP_WINDOW_SEQ(frame[0] & 0x7F, frame[0] >> 7) != seq)
+		return 0;
+	return data_ok(opcode, frame, len, seq * (unsigned long) MSP_EXP_MTU);
+}
+
+static void setup(void)
+{
+	msp_exp_state_initialize(msp_seqflags_init(), SIC);
+	msp_exp_state_initialize(msp_seqflags_init(), PIEZO);
+	memset(built, 0, sizeof(built));
+	memset(completed, 0, sizeof(completed));
+	memset(aborted, 0, sizeof(aborted));
+}
+
+static void test_interleaved_requests(void)
+{
+	unsigned long offsetSic = 0, offsetPiezo = 0;
+	int tidSic, tidPiezo;
+
+	setup();
+	tidSic = start_request(SIC, REQ_SIC, 0);
+	tidPiezo = start_request(PIEZO, REQ_PIEZO, 0);
+	CHECK(tidSic >= 0 && tidPiezo >= 0);
+	obc_header(SIC, MSP_OP_F_ACK, tidSic, 0);
+	obc_header(PIEZO, MSP_OP_F_ACK, tidPiezo, 0);
+
+	/* one frame from each address in turn, each gets its own data */
+	while (offsetSic < LENGTH || offsetPiezo < LENGTH) {
+		idle();
+		if (offsetSic < LENGTH)
+			CHECK(read_data(SIC, REQ_SIC, &offsetSic));
+		idle();
+		if (offsetPiezo < LENGTH)
+			CHECK(read_data(PIEZO, REQ_PIEZO, &offsetPiezo));
+	}
+	CHECK(obc_header(SIC, MSP_OP_T_ACK, tidSic, 0) == 0);
+	CHECK(obc_header(PIEZO, MSP_OP_T_ACK, tidPiezo, 0) == 0);
+	CHECK(completed[slot(REQ_SIC)] == 1 && completed[slot(REQ_PIEZO)] == 1);
+	CHECK(aborted[slot(REQ_SIC)] == 0 && aborted[slot(REQ_PIEZO)] == 0);
+}
+
+static void test_prepared_frame_evicted(void)
+{
+	const unsigned char *sent;
+	unsigned char copy[MSP_EXP_MAX_FRAME_SIZE];
+	unsigned long len, offset = 0;
+	int tidSic, tidPiezo;
+
+	setup();
+	tidSic = start_request(SIC, REQ_SIC, 0);
+	CHECK(tidSic >= 0);
+	obc_header(SIC, MSP_OP_F_ACK, tidSic, 0);
+
+	/* the SiC frame that was sent is held, the next one is built ahead */
+	len = obc_read(SIC, &sent);
+	memcpy(copy, sent, len);
+	idle();
+	CHECK(built[slot(REQ_SIC)][0] == 1 && built[slot(REQ_SIC)][1] == 1);
+
+	/* the Piezo frame is not built ahead in a buffer that SiC uses, but
+	 * when the OBC reads it, it takes the buffer of the frame that SiC has
+	 * not sent, never the one that the OBC may still be reading */
+	tidPiezo = start_request(PIEZO, REQ_PIEZO, 0);
+	CHECK(tidPiezo >= 0);
+	obc_header(PIEZO, MSP_OP_F_ACK, tidPiezo, 0);
+	idle();
+	CHECK(built[slot(REQ_PIEZO)][0] == 0);
+	CHECK(read_data(PIEZO, REQ_PIEZO, &offset));
+	CHECK(built[slot(REQ_PIEZO)][0] == 1);
+	CHECK(memcmp(sent, copy, len) == 0);
+
+	/* the SiC frame is sent again as it was when its F_ACK is lost */
+	len = obc_read(SIC, &sent);
+	CHECK(data_ok(REQ_SIC, sent, len, 0));
+	CHECK(built[slot(REQ_SIC)][0] == 1);
+
+	/* and the evicted one is built again when the OBC asks for it */
+	obc_header(SIC, MSP_OP_F_ACK, sent[0] >> 7, 0);
+	offset = MSP_EXP_MTU;
+	CHECK(read_data(SIC, REQ_SIC, &offset));
+	CHECK(built[slot(REQ_SIC)][1] == 2);
+}
+
+static void test_window_rewind(void)
+{
+	const unsigned char *frame;
+	unsigned long offsetPiezo = 0;
+	int tidSic, tidPiezo;
+	unsigned char seq;
+
+	setup();
+	/* the SiC address negotiates a window of four frames */
+	CHECK(obc_header(SIC, MSP_OP_REQ_WINDOW, 0, MSP_WINDOW_MAX) == 0);
+	obc_read(SIC, &frame);
+	CHECK((frame[0] & 0x7F) == MSP_OP_EXP_SEND);
+	tidSic = frame[0] >> 7;
+	obc_header(SIC, MSP_OP_F_ACK, tidSic, 0);
+	obc_read(SIC, &frame);
+	CHECK((frame[0] & 0x7F) == MSP_OP_DATA_FRAME && frame[1] == MSP_WINDOW_MAX);
+	CHECK(obc_header(SIC, MSP_OP_T_ACK, tidSic, 0) == 0);
+
+	tidSic = start_request(SIC, REQ_SIC, MSP_WINDOW_MAX);
+	tidPiezo = start_request(PIEZO, REQ_PIEZO, 0);
+	CHECK(tidSic >= 0 && tidPiezo >= 0);
+	CHECK(obc_header(SIC, MSP_OP_WINDOW_ACK, 0, 0) == 0);
+	obc_header(PIEZO, MSP_OP_F_ACK, tidPiezo, 0);
+
+	/* the window is sent, with a Piezo frame after each one */
+	for (seq = 0; seq < MSP_WINDOW_MAX; seq++) {
+		idle();
+		CHECK(read_window_data(SIC, REQ_SIC, seq));
+		idle();
+		CHECK(read_data(PIEZO, REQ_PIEZO, &offsetPiezo));
+	}
+
+	/* only the first frame arrived, the window is sent again after it */
+	CHECK(obc_header(SIC, MSP_OP_WINDOW_ACK, 0, MSP_EXP_MTU) == 0);
+	for (seq = 1; seq <= MSP_WINDOW_MAX; seq++) {
+		idle();
+		CHECK(read_window_data(SIC, REQ_SIC, seq));
+	}
+	/* the OBC reads past the window, it starts over */
+	idle();
+	CHECK(read_window_data(SIC, REQ_SIC, 1));
+
+	/* the last frame */
+	CHECK(obc_header(SIC, MSP_OP_WINDOW_ACK, 0, (FRAMES - 1) * (unsigned long) MSP_EXP_MTU) == 0);
+	idle();
+	CHECK(read_window_data(SIC, REQ_SIC, FRAMES - 1));
+	CHECK(obc_header(SIC, MSP_OP_T_ACK, tidSic, 0) == 0);
+	CHECK(completed[slot(REQ_SIC)] == 1);
+
+	/* the Piezo request was not disturbed */
+	while (offsetPiezo < LENGTH) {
+		idle();
+		CHECK(read_data(PIEZO, REQ_PIEZO, &offsetPiezo));
+	}
+	CHECK(obc_header(PIEZO, MSP_OP_T_ACK, tidPiezo, 0) == 0);
+	CHECK(completed[slot(REQ_PIEZO)] == 1);
+}
+
+static void test_interleaved_receive(void)
+{
+	unsigned char sic[9], piezo[9];
+
+	setup();
+	sic[0] = MSP_OP_NULL;
+	msp_to_bigendian32(sic + 1, 1);
+	msp_to_bigendian32(sic + 5, msp_exp_frame_generate_fcs(sic, 1, 5, SIC));
+	piezo[0] = MSP_OP_NULL;
+	msp_to_bigendian32(piezo + 1, 2);
+	msp_to_bigendian32(piezo + 5, msp_exp_frame_generate_fcs(piezo, 1, 5, PIEZO));
+
+	/* the FCS of a frame to one address is kept while the other receives,
+	 * as the I2C interrupt folds in the bytes */
+	msp_exp_frame_rx_start(SIC);
+	msp_exp_frame_rx_update(sic, 7, SIC);
+	msp_exp_frame_rx_start(PIEZO);
+	msp_exp_frame_rx_update(piezo, 7, PIEZO);
+	msp_exp_frame_rx_update(sic, 9, SIC);
+	CHECK(msp_recv_callback(sic, 9, SIC) == 0);
+	msp_exp_frame_rx_update(piezo, 9, PIEZO);
+	CHECK(msp_recv_callback(piezo, 9, PIEZO) == 0);
+}
+
+static void test_abort(void)
+{
+	const unsigned char *frame;
+	unsigned long offset = 0;
+	int tid;
+
+	setup();
+	tid = start_request(SIC, REQ_SIC, 0);
+	CHECK(tid >= 0);
+	obc_header(SIC, MSP_OP_F_ACK, tid, 0);
+	CHECK(read_data(SIC, REQ_SIC, &offset));
+	idle();
+
+	/* the OBC stopped answering, the request is dropped */
+	CHECK(msp_exp_abort(SIC) == 1);
+	CHECK(aborted[slot(REQ_SIC)] == 1);
+	obc_read(SIC, &frame);
+	CHECK((frame[0] & 0x7F) == MSP_OP_NULL);
+	CHECK(msp_exp_abort(SIC) == 0);
+	CHECK(msp_exp_abort(PIEZO) == 0);
+
+	/* and started again from the beginning */
+	tid = start_request(SIC, REQ_SIC, 0);
+	CHECK(tid >= 0);
+	obc_header(SIC, MSP_OP_F_ACK, tid, 0);
+	for (offset = 0; offset < LENGTH; ) {
+		idle();
+		CHECK(read_data(SIC, REQ_SIC, &offset));
+	}
+	CHECK(obc_header(SIC, MSP_OP_T_ACK, tid, 0) == 0);
+	CHECK(completed[slot(REQ_SIC)] == 1);
+}
+
+static void run(const char *name, void (*test)(void))
+{
+	int before = failures;
+
+	test();
+	printf("%-40s %s\n", name, failures == before ? "OK" : "FAIL");
+}
+
+int main(void)
+{
+	run("interleaved requests", test_interleaved_requests);
+	run("prepared frame evicted", test_prepared_frame_evicted);
+	run("window rewind", test_window_rewind);
+	run("interleaved receive", test_interleaved_receive);
+	run("abort of a stalled request", test_abort);
+
+	if (failures) {
+		printf("%d check(s) failed\n", failures);
+		return 1;
+	}
+	return 0;
+}
+
+
+/* the handlers, REQ_SIC and REQ_PIEZO send LENGTH bytes of data_byte() */
+unsigned long msp_expsend_busy_time(unsigned char opcode)
+{
+	return 0;
+}
+
+void msp_expsend_start(unsigned char opcode, unsigned long *len)
+{
+	*len = opcode == REQ_SIC || opcode == REQ_PIEZO ? LENGTH : 0;
+}
+
+void msp_expsend_data(unsigned char opcode, unsigned char *buf, unsigned long len, unsigned long offset)
+{
+	unsigned long i;
+
+	built[slot(opcode)][offset / MSP_EXP_MTU]++;
+	for (i = 0; i < len; i++)
+		buf[i] = data_byte(opcode, offset + i);
+}
+
+void msp_expsend_complete(unsigned char opcode)
+{
+	completed[slot(opcode)]++;
+}
+
+void msp_expsend_error(unsigned char opcode, int error)
+{
+	aborted[slot(opcode)]++;
+}
+
+void msp_exprecv_start(unsigned char opcode, unsigned long len) {}
+void msp_exprecv_data(unsigned char opcode, const unsigned char *buf, unsigned long len, unsigned long offset) {}
+void msp_exprecv_complete(unsigned char opcode) {}
+void msp_exprecv_error(unsigned char opcode, int error) {}
+void msp_exprecv_syscommand(unsigned char opcode) {}
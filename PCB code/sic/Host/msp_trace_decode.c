@@ -0,0 +1,201 @@
+/**
+ *****************************************************************************
+ * @file msp_trace_decode.c
+ * @brief prints a REQ_TRACE download as a timeline of the MSP states
+ *****************************************************************************
+ * reads the download as hex bytes, as the OBC simulator prints it ("0x1F"
+ * or "1F", anything else is skipped), or as raw bytes with -b. The format
+ * is described in Lib/msp/inc/msp_trace.h.
+ *
+ *     msp_trace_decode [-b] [file]
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "msp_opcodes.h"
+#include "msp_trace.h"
+#include "msp_exp_state.h"
+
+#define MAX_DOWNLOAD (MSP_TRACE_HEADER_SIZE + 4096 * MSP_TRACE_RECORD_SIZE)
+#define INSTANCES 16
+
+static unsigned long be32(const unsigned char *p)
+{
+	return (unsigned long)p[0] << 24 | (unsigned long)p[1] << 16 | (unsigned long)p[2] << 8 | p[3];
+}
+
+static const char *event_name(unsigned char event)
+{
+	switch (event) {
+	case MSP_TRACE_RX: return "rx";
+	case MSP_TRACE_RX_REJECTED: return "rx dropped";
+	case MSP_TRACE_TX: return "tx";
+	case MSP_TRACE_UNKNOWN_OPCODE: return "unknown opcode";
+	case MSP_TRACE_UNEXPECTED_ACK: return "unexpected ack";
+	case MSP_TRACE_WRONG_FRAME_ID: return "wrong frame-ID";
+	case MSP_TRACE_BAD_WINDOW_ACK: return "bad window ack";
+	case MSP_TRACE_STATE_ERROR: return "state error";
+	case MSP_TRACE_ABORTED: return "aborted";
+	default: return "?";
+	}
+}
+
+static const char *opcode_name(unsigned char opcode)
+{
+	static char unknown[8];
+
+	if (MSP_OP_IS_WINDOW_DATA(opcode))
+		return "WINDOW_DATA";
+	switch (opcode) {
+	case MSP_OP_NULL: return "NULL";
+	case MSP_OP_DATA_FRAME: return "DATA_FRAME";
+	case MSP_OP_F_ACK: return "F_ACK";
+	case MSP_OP_T_ACK: return "T_ACK";
+	case MSP_OP_EXP_SEND: return "EXP_SEND";
+	case MSP_OP_EXP_BUSY: return "EXP_BUSY";
+	case MSP_OP_WINDOW_ACK: return "WINDOW_ACK";
+	case MSP_OP_EXP_SEND_WINDOW: return "EXP_SEND_WINDOW";
+	case MSP_OP_REQ_WINDOW: return "REQ_WINDOW";
+	case MSP_OP_ACTIVE: return "ACTIVE";
+	case MSP_OP_SLEEP: return "SLEEP";
+	case MSP_OP_POWER_OFF: return "POWER_OFF";
+	case MSP_OP_REQ_PAYLOAD: return "REQ_PAYLOAD";
+	case MSP_OP_REQ_HK: return "REQ_HK";
+	case MSP_OP_REQ_PUS: return "REQ_PUS";
+	case MSP_OP_SEND_TIME: return "SEND_TIME";
+	case MSP_OP_SEND_PUS: return "SEND_PUS";
+	case START_EXP_PIEZO: return "START_EXP_PIEZO";
+	case STOP_EXP_PIEZO: return "STOP_EXP_PIEZO";
+	case START_EXP_SIC: return "START_EXP_SIC";
+	case SIC_10V_OFF: return "SIC_10V_OFF";
+	case PIEZO_5V_OFF: return "PIEZO_5V_OFF";
+	case PIEZO_48V_OFF: return "PIEZO_48V_OFF";
+	case VBAT_OFF: return "VBAT_OFF";
+	case REQ_PIEZO: return "REQ_PIEZO";
+	case REQ_SIC: return "REQ_SIC";
+	case REQ_STATUS: return "REQ_STATUS";
+	case REQ_TRACE: return "REQ_TRACE";
+	case SEND_PIEZO_POLL_INTERVAL: return "SEND_PIEZO_POLL_INTERVAL";
+	default:
+		snprintf(unknown, sizeof(unknown), "0x%02X", opcode);
+		return unknown;
+	}
+}
+
+static const char *state_name(unsigned char type)
+{
+	switch (type) {
+	case MSP_EXP_STATE_READY: return "READY";
+	case MSP_EXP_STATE_OBC_SEND_RX: return "OBC_SEND_RX";
+	case MSP_EXP_STATE_OBC_SEND_RX_DUPLICATE: return "OBC_SEND_RX_DUPLICATE";
+	case MSP_EXP_STATE_OBC_REQ_BUSY: return "OBC_REQ_BUSY";
+	case MSP_EXP_STATE_OBC_REQ_RESPONSE: return "OBC_REQ_RESPONSE";
+	case MSP_EXP_STATE_OBC_REQ_TX: return "OBC_REQ_TX";
+	default: return "?";
+	}
+}
+
+/* what the argument of an event is */
+static const char *arg_name(unsigned char event, unsigned char opcode)
+{
+	switch (event) {
+	case MSP_TRACE_RX:
+	case MSP_TRACE_TX:
+		return opcode == MSP_OP_DATA_FRAME || MSP_OP_IS_WINDOW_DATA(opcode) ? "len " : "dl ";
+	case MSP_TRACE_RX_REJECTED: return "error -";
+	case MSP_TRACE_WRONG_FRAME_ID: return "expected ";
+	default: return "dl ";
+	}
+}
+
+static size_t read_hex(FILE *in, unsigned char *out, size_t max)
+{
+	char token[64];
+	size_t n = 0;
+
+	while (n < max && fscanf(in, "%63s", token) == 1) {
+		char *hex = token, *end;
+		unsigned long value;
+		size_t len;
+
+		if (strncmp(hex, "0x", 2) == 0 || strncmp(hex, "0X", 2) == 0)
+			hex += 2;
+		len = strlen(hex);
+		if (len == 0 || len > 2 || !isxdigit((unsigned char)hex[0]))
+			continue;
+		value = strtoul(hex, &end, 16);
+		if (*end == '\0')
+			out[n++] = (unsigned char)value;
+	}
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	static unsigned char data[MAX_DOWNLOAD];
+	int prev[INSTANCES];
+	int binary = 0;
+	const char *path = NULL;
+	FILE *in = stdin;
+	size_t len, records;
+	unsigned long start;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-b") == 0)
+			binary = 1;
+		else
+			path = argv[i];
+	}
+	if (path != NULL && (in = fopen(path, binary ? "rb" : "r")) == NULL) {
+		perror(path);
+		return 1;
+	}
+	len = binary ? fread(data, 1, sizeof(data), in) : read_hex(in, data, sizeof(data));
+	if (in != stdin)
+		fclose(in);
+
+	if (len < MSP_TRACE_HEADER_SIZE) {
+		fprintf(stderr, "not a REQ_TRACE download, %zu bytes\n", len);
+		return 1;
+	}
+	records = (len - MSP_TRACE_HEADER_SIZE) / MSP_TRACE_RECORD_SIZE;
+	if ((len - MSP_TRACE_HEADER_SIZE) % MSP_TRACE_RECORD_SIZE != 0)
+		fprintf(stderr, "%zu trailing bytes ignored\n", (len - MSP_TRACE_HEADER_SIZE) % MSP_TRACE_RECORD_SIZE);
+
+	start = be32(data + 4);
+	printf("%zu records, %lu lost before them, download started at %lu ms\n",
+	       records, be32(data), start);
+	printf("%10s %8s  %-4s %-15s %-24s %3s  %-14s %s\n",
+	       "tick", "age", "inst", "event", "opcode", "fid", "arg", "state");
+
+	for (int i = 0; i < INSTANCES; i++)
+		prev[i] = -1;
+	for (size_t r = 0; r < records; r++) {
+		const unsigned char *p = data + MSP_TRACE_HEADER_SIZE + r * MSP_TRACE_RECORD_SIZE;
+		unsigned char event = p[0], opcode = p[1], state = p[2], frame_id = p[3];
+		unsigned long arg = be32(p + 4), tick = be32(p + 8);
+		unsigned char instance = state >> 4, type = state & 0x0F;
+		char argbuf[32];
+
+		snprintf(argbuf, sizeof(argbuf), "%s%lu", arg_name(event, opcode), arg);
+		if (event == MSP_TRACE_STATE_ERROR || event == MSP_TRACE_ABORTED)
+			snprintf(argbuf, sizeof(argbuf), "was %s", state_name(arg));
+		printf("%10lu %8ld  #%-3u %-15s %-24s %3u  %-14s ",
+		       tick, (long)(start - tick), instance, event_name(event),
+		       opcode_name(opcode), frame_id, argbuf);
+
+		if (state == 0xFF)
+			printf("(no state)\n");
+		else if (prev[instance] == type)
+			printf("\n");
+		else if (prev[instance] < 0)
+			printf("%s\n", state_name(type));
+		else
+			printf("%s -> %s\n", state_name(prev[instance]), state_name(type));
+		if (state != 0xFF)
+			prev[instance] = type;
+	}
+	return 0;
+}
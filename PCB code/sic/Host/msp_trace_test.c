@@ -0,0 +1,306 @@
+/**
+ *****************************************************************************
+ * @file msp_trace_test.c
+ * @brief regression tests for the MSP trace, run through the MSP library
+ *****************************************************************************
+ * the frames are passed to the MSP callbacks as msp_i2c_slave.c does, and the
+ * trace is downloaded with REQ_TRACE like the OBC would.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "msp_exp.h"
+#include "msp_trace.h"
+
+#define ADDR 0x45
+#define STATUS_BYTES 5
+
+static int failures;
+static unsigned long tick;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("    %s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+		return; \
+	} \
+} while (0)
+
+unsigned long msp_trace_tick(void)
+{
+	return tick;
+}
+
+/* the OBC writes a header frame */
+static int obc_header(unsigned char opcode, unsigned char frame_id, unsigned long dl)
+{
+	unsigned char frame[9];
+
+	frame[0] = opcode | (frame_id << 7);
+	msp_to_bigendian32(frame + 1, dl);
+	msp_to_bigendian32(frame + 5, msp_exp_frame_generate_fcs(frame, 1, 5, ADDR));
+	tick++;
+	return msp_recv_callback(frame, 9, ADDR);
+}
+
+/* the OBC reads a frame */
+static unsigned long obc_read(const unsigned char **frame)
+{
+	unsigned long len;
+
+	tick++;
+	msp_send_frame(frame, &len, ADDR);
+	return len;
+}
+
+/* carries out an OBC request, returns the number of bytes received */
+static unsigned long obc_request(unsigned char opcode, unsigned char *data)
+{
+	const unsigned char *frame;
+	unsigned long len, total, received;
+	unsigned char tid;
+
+	obc_header(opcode, 0, 0);
+	obc_read(&frame);
+	if ((frame[0] & 0x7F) != MSP_OP_EXP_SEND)
+		return 0;
+	tid = frame[0] >> 7;
+	total = msp_from_bigendian32(frame + 1);
+	received = 0;
+	obc_header(MSP_OP_F_ACK, tid, 0);
+	while (received < total) {
+		len = obc_read(&frame);
+		memcpy(data + received, frame + 1, len - 5);
+		received += len - 5;
+		if (received < total)
+			obc_header(MSP_OP_F_ACK, frame[0] >> 7, 0);
+	}
+	obc_header(MSP_OP_T_ACK, tid, 0);
+	return received;
+}
+
+/* the records of a download */
+static const unsigned char *record(const unsigned char *download, int n)
+{
+	return download + MSP_TRACE_HEADER_SIZE + n * MSP_TRACE_RECORD_SIZE;
+}
+
+static unsigned long record_arg(const unsigned char *download, int n)
+{
+	return msp_from_bigendian32(record(download, n) + 4);
+}
+
+/* the first record of an event and an opcode, -1 if there is none */
+static int find_record(const unsigned char *download, unsigned long len, unsigned char event, unsigned char opcode)
+{
+	int n;
+
+	for (n = 0; MSP_TRACE_HEADER_SIZE + (n + 1) * MSP_TRACE_RECORD_SIZE <= len; n++) {
+		if (record(download, n)[0] == event && record(download, n)[1] == opcode)
+			return n;
+	}
+	return -1;
+}
+
+/*
+ * every test starts with the trace of the download in setup(): its request,
+ * response, F_ACK and data frame were written after the download started,
+ * and its T_ACK after it ended.
+ */
+#define SETUP_RECORDS 5
+
+/* the records of a download of len bytes: its request, response, and an
+ * F_ACK and a data frame for every frame, the T_ACK not included */
+#define DOWNLOAD_RECORDS(len) (2 + 2 * (((len) + MSP_EXP_MTU - 1) / MSP_EXP_MTU))
+
+static unsigned char download[MSP_TRACE_HEADER_SIZE + MSP_TRACE_SIZE * MSP_TRACE_RECORD_SIZE];
+
+static void setup(void)
+{
+	msp_exp_state_initialize(msp_seqflags_init(), ADDR);
+	obc_request(REQ_TRACE, download);
+}
+
+static void test_transaction_timeline(void)
+{
+	unsigned char data[STATUS_BYTES];
+	unsigned long len;
+	int n;
+
+	setup();
+	CHECK(obc_request(REQ_STATUS, data) == STATUS_BYTES);
+
+	len = obc_request(REQ_TRACE, download);
+	CHECK(len == MSP_TRACE_HEADER_SIZE + (SETUP_RECORDS + 5) * MSP_TRACE_RECORD_SIZE);
+	CHECK(msp_from_bigendian32(download) == 0);
+	CHECK(record(download, 0)[0] == MSP_TRACE_RX && record(download, 0)[1] == REQ_TRACE);
+	CHECK(record(download, SETUP_RECORDS - 1)[1] == MSP_OP_T_ACK);
+
+	/* REQ_STATUS, answered with EXP_SEND */
+	n = find_record(download, len, MSP_TRACE_RX, REQ_STATUS);
+	CHECK(n == SETUP_RECORDS);
+	CHECK((record(download, n)[2] & 0x0F) == MSP_EXP_STATE_OBC_REQ_RESPONSE);
+	CHECK(record(download, n + 1)[0] == MSP_TRACE_TX && record(download, n + 1)[1] == MSP_OP_EXP_SEND);
+	CHECK(record_arg(download, n + 1) == STATUS_BYTES);
+	/* F_ACK, the data frame and T_ACK */
+	CHECK(record(download, n + 2)[1] == MSP_OP_F_ACK);
+	CHECK((record(download, n + 2)[2] & 0x0F) == MSP_EXP_STATE_OBC_REQ_TX);
+	CHECK(record(download, n + 3)[0] == MSP_TRACE_TX && record(download, n + 3)[1] == MSP_OP_DATA_FRAME);
+	CHECK(record_arg(download, n + 3) == STATUS_BYTES);
+	CHECK(record(download, n + 3)[3] == (record(download, n + 1)[3] ^ 1));
+	CHECK(record(download, n + 4)[1] == MSP_OP_T_ACK);
+	CHECK((record(download, n + 4)[2] & 0x0F) == MSP_EXP_STATE_READY);
+	/* the ticks follow the bus */
+	CHECK(msp_from_bigendian32(record(download, n + 4) + 8) > msp_from_bigendian32(record(download, n) + 8));
+}
+
+static void test_faults(void)
+{
+	unsigned char frame[9];
+	unsigned long len;
+	int n;
+
+	setup();
+	/* a T_ACK out of a transaction, and a frame with a bad FCS */
+	CHECK(obc_header(MSP_OP_T_ACK, 1, 0) == MSP_EXP_ERR_FAULTY_FRAME);
+	frame[0] = MSP_OP_NULL;
+	memset(frame + 1, 0, 8);
+	CHECK(msp_recv_callback(frame, 9, ADDR) == MSP_EXP_ERR_FCS_MISMATCH);
+
+	len = obc_request(REQ_TRACE, download);
+	n = find_record(download, len, MSP_TRACE_UNEXPECTED_ACK, MSP_OP_T_ACK);
+	CHECK(n == SETUP_RECORDS);
+	CHECK(record(download, n + 1)[0] == MSP_TRACE_RX_REJECTED);
+	CHECK(record_arg(download, n + 1) == (unsigned long) -MSP_EXP_ERR_FAULTY_FRAME);
+	CHECK(record(download, n + 2)[0] == MSP_TRACE_RX_REJECTED);
+	CHECK(record_arg(download, n + 2) == (unsigned long) -MSP_EXP_ERR_FCS_MISMATCH);
+}
+
+static void test_overwritten_records(void)
+{
+	unsigned long len;
+	int i;
+
+	setup();
+	for (i = 0; i < MSP_TRACE_SIZE + 10; i++)
+		obc_header(MSP_OP_NULL, 0, i);
+
+	/* the oldest records are overwritten */
+	len = obc_request(REQ_TRACE, download);
+	CHECK(len == sizeof(download));
+	CHECK(msp_from_bigendian32(download) == SETUP_RECORDS + 10);
+	CHECK(record(download, 0)[1] == MSP_OP_NULL && record_arg(download, 0) == 10);
+	CHECK(record_arg(download, MSP_TRACE_SIZE - 1) == MSP_TRACE_SIZE + 9);
+
+	/* the trace of that download did not fit, only its T_ACK is left */
+	len = obc_request(REQ_TRACE, download);
+	CHECK(msp_from_bigendian32(download) == DOWNLOAD_RECORDS(sizeof(download)));
+	CHECK(record(download, 0)[1] == MSP_OP_T_ACK);
+
+	/* lost records are reported once */
+	obc_request(REQ_TRACE, download);
+	CHECK(msp_from_bigendian32(download) == 0);
+}
+
+static void test_records_kept_while_sent(void)
+{
+	const unsigned char *frame;
+	unsigned long len;
+	unsigned char tid;
+	int i, n;
+
+	setup();
+	for (i = 0; i < MSP_TRACE_SIZE; i++)
+		obc_header(MSP_OP_NULL, 0, i);
+
+	/* the download is started with a full ring, the frames of the download
+	 * do not overwrite the records that are sent */
+	obc_header(REQ_TRACE, 0, 0);
+	obc_read(&frame);
+	CHECK((frame[0] & 0x7F) == MSP_OP_EXP_SEND);
+	tid = frame[0] >> 7;
+	obc_header(MSP_OP_F_ACK, tid, 0);
+	len = obc_read(&frame);
+	n = (len - 5 - MSP_TRACE_HEADER_SIZE) / MSP_TRACE_RECORD_SIZE;
+	CHECK(msp_from_bigendian32(frame + 1) == SETUP_RECORDS);
+	CHECK(msp_from_bigendian32(record(frame + 1, 0) + 4) == 0);
+	CHECK(msp_from_bigendian32(record(frame + 1, n - 1) + 4) == (unsigned long) n - 1);
+
+	/* the OBC gives up, the records are sent again, less the one that the
+	 * NULL frame overwrote, and the dropped ones are counted */
+	obc_header(MSP_OP_NULL, 0, MSP_TRACE_SIZE);
+	obc_request(REQ_TRACE, download);
+	CHECK(msp_from_bigendian32(download) == SETUP_RECORDS + 1 + 4);
+	CHECK(record_arg(download, 0) == 1);
+	CHECK(record_arg(download, MSP_TRACE_SIZE - 1) == MSP_TRACE_SIZE);
+}
+
+static void run(const char *name, void (*test)(void))
+{
+	int before = failures;
+
+	test();
+	printf("%-40s %s\n", name, failures == before ? "OK" : "FAIL");
+}
+
+int main(void)
+{
+	run("trace of a transaction", test_transaction_timeline);
+	run("trace of faulty frames", test_faults);
+	run("overwritten records", test_overwritten_records);
+	run("records kept while sent", test_records_kept_while_sent);
+
+	if (failures) {
+		printf("%d check(s) failed\n", failures);
+		return 1;
+	}
+	return 0;
+}
+
+
+/* the handlers, REQ_STATUS sends a fixed report and REQ_TRACE the trace */
+unsigned long msp_expsend_busy_time(unsigned char opcode)
+{
+	return 0;
+}
+
+void msp_expsend_start(unsigned char opcode, unsigned long *len)
+{
+	if (opcode == REQ_TRACE)
+		*len = msp_trace_open();
+	else if (opcode == REQ_STATUS)
+		*len = STATUS_BYTES;
+	else
+		*len = 0;
+}
+
+void msp_expsend_data(unsigned char opcode, unsigned char *buf, unsigned long len, unsigned long offset)
+{
+	unsigned long i;
+
+	if (opcode == REQ_TRACE) {
+		msp_trace_copy(buf, len, offset);
+		return;
+	}
+	for (i = 0; i < len; i++)
+		buf[i] = (unsigned char)(offset + i);
+}
+
+void msp_expsend_complete(unsigned char opcode)
+{
+	if (opcode == REQ_TRACE)
+		msp_trace_release();
+}
+
+void msp_expsend_error(unsigned char opcode, int error)
+{
+	if (opcode == REQ_TRACE)
+		msp_trace_abort();
+}
+
+void msp_exprecv_start(unsigned char opcode, unsigned long len) {}
+void msp_exprecv_data(unsigned char opcode, const unsigned char *buf, unsigned long len, unsigned long offset) {}
+void msp_exprecv_complete(unsigned char opcode) {}
+void msp_exprecv_error(unsigned char opcode, int error) {}
+void msp_exprecv_syscommand(unsigned char opcode) {}
@@ -0,0 +1,122 @@
+/**
+ *****************************************************************************
+ * @file piezo_bench.c
+ * @brief benchmarks for Piezo.c against the simulated controller
+ *****************************************************************************
+ * usage: piezo_bench [baud] [latency_us]
+ *
+ * the parser is timed on the host CPU, everything else is virtual time on the
+ * target, computed from the baud rate, the controller latency and the delays
+ * in the driver.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "piezo.h"
+#include "hal_shim.h"
+#include "piezo_sim.h"
+
+#define PARSE_ITERATIONS 1000000
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench_parser(void)
+{
+	char reply[] = "XU6:7,3482,4585,5688,6791,7894,8997,1101,7022\r";
+	int record[PIEZO_RECORD_VALUES + 2];
+	volatile int valid = 0;
+	double start = now_ns();
+
+	for (int i = 0; i < PARSE_ITERATIONS; i++) {
+		memset(record, 0, sizeof(record));
+		if (!record_was_empty(&reply[6])) {
+			ascii_to_int(&reply[4], record);
+			valid += piezo_checksum(record);
+		}
+	}
+	printf("parser: %.1f ns per record (host)\n", (now_ns() - start) / PARSE_ITERATIONS);
+}
+
+static void bench_bulk(const struct piezo_sim_config *base, int records)
+{
+	struct piezo_sim_config config = *base;
+	const struct hal_shim_stats *stats;
+	uint64_t start;
+	uint64_t elapsed;
+
+	config.record_count = records;
+	hal_shim_reset();
+	piezo_sim_init(&config);
+
+	piezo_start_exp();
+	while (piezo_get_state() == PIEZO_STATE_BOOTING)
+		hal_shim_run(PIEZO_PROBE_INTERVAL_MS);
+
+	start = hal_shim_now_us();
+	piezo_stop_exp();
+	elapsed = hal_shim_now_us() - start;
+	stats = hal_shim_get_stats();
+
+	printf("bulk %2d records: %8.1f ms, %7.1f ms/record, driver on %6.2f ms, receiver on %8.2f ms\n",
+			records, elapsed / 1000.0, elapsed / 1000.0 / (records + 1),
+			stats->driver_on_us / 1000.0, stats->receiver_on_us / 1000.0);
+	clear_piezo_buffer();
+}
+
+static void bench_poll(const struct piezo_sim_config *base)
+{
+	struct piezo_sim_config config = *base;
+	uint64_t start;
+	uint64_t longest = 0;
+
+	config.record_count = 10;
+	config.record_interval_ms = 100;
+	hal_shim_reset();
+	piezo_sim_init(&config);
+
+	start = hal_shim_now_us();
+	piezo_start_exp();
+	while (piezo_get_state() == PIEZO_STATE_BOOTING)
+		hal_shim_run(PIEZO_PROBE_INTERVAL_MS);
+	printf("boot: %u ms until XM3 (controller boots in %u ms)\n",
+			piezo_get_boot_time(NULL), config.boot_ms);
+
+	/* the longest time the main loop is blocked by a single poll */
+	for (int i = 0; i < 10; i++) {
+		hal_shim_idle(hal_shim_now_us() + PIEZO_POLL_INTERVAL_MS * 1000ULL);
+		start = hal_shim_now_us();
+		piezo_poll();
+		if (hal_shim_now_us() - start > longest)
+			longest = hal_shim_now_us() - start;
+	}
+	printf("poll: main loop blocked at most %.3f ms per record\n", longest / 1000.0);
+	piezo_stop_exp();
+	clear_piezo_buffer();
+}
+
+int main(int argc, char *argv[])
+{
+	struct piezo_sim_config config;
+
+	piezo_sim_default_config(&config);
+	if (argc > 1)
+		config.baud = strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		config.latency_us = strtoul(argv[2], NULL, 0);
+	printf("controller: %u baud, %u us latency\n", config.baud, config.latency_us);
+
+	bench_parser();
+	bench_poll(&config);
+	bench_bulk(&config, 1);
+	bench_bulk(&config, 5);
+	bench_bulk(&config, PIEZO_DUMP_MAX_RECORDS);
+	return 0;
+}
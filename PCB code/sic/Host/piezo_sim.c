@@ -0,0 +1,211 @@
+/**
+ *****************************************************************************
+ * @file piezo_sim.c
+ * @brief simulated Piezo LEGS controller
+ *****************************************************************************
+ * a record reply is "XU6:" followed by nine comma separated values and a
+ * carriage return. The first value is the record number plus one, the last is
+ * the xor of the seven values in between. A record that has not been written
+ * yet is all zeros, which is what record_was_empty() looks for.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "piezo_sim.h"
+
+#define QUEUE_SIZE 512
+#define COMMAND_SIZE 32
+
+struct queued_byte {
+	uint8_t value;
+	uint64_t arrival_us;
+};
+
+static struct piezo_sim_config conf;
+static struct piezo_sim_stats stats;
+
+static struct queued_byte queue[QUEUE_SIZE];
+static int queue_first;
+static int queue_count;
+
+static char command[COMMAND_SIZE];
+static int command_length;
+
+static bool powered;
+static uint64_t power_on_us;
+static bool running;
+static uint64_t run_start_us;
+static int frozen_count;      /* records written when XM4 was received */
+static int record_replies;
+static int all_replies;
+
+void piezo_sim_default_config(struct piezo_sim_config *config)
+{
+	memset(config, 0, sizeof(*config));
+	config->record_count = 5;
+	config->record_interval_ms = 0;
+	config->boot_ms = 500;
+	config->latency_us = 200;
+	config->baud = 115200;
+}
+
+void piezo_sim_init(const struct piezo_sim_config *config)
+{
+	conf = *config;
+	memset(&stats, 0, sizeof(stats));
+	queue_first = 0;
+	queue_count = 0;
+	command_length = 0;
+	powered = false;
+	running = false;
+	frozen_count = 0;
+	record_replies = 0;
+	all_replies = 0;
+}
+
+void piezo_sim_power(bool on, uint64_t now_us)
+{
+	if (on && !powered)
+		power_on_us = now_us;
+	if (!on) {
+		running = false;
+		frozen_count = 0;
+		queue_count = 0;
+	}
+	powered = on;
+}
+
+uint32_t piezo_sim_byte_time_us(void)
+{
+	/* start bit, 8 data bits and a stop bit */
+	return (10 * 1000000UL + conf.baud - 1) / conf.baud;
+}
+
+void piezo_sim_record(int record, int *values)
+{
+	int checksum = 0;
+
+	values[0] = record + 1;
+	for (int v = 1; v < PIEZO_SIM_VALUES - 1; v++) {
+		values[v] = (record * 397 + v * 1103) % 9000 + 1;
+		checksum ^= values[v];
+	}
+	values[PIEZO_SIM_VALUES - 1] = checksum;
+}
+
+const struct piezo_sim_stats *piezo_sim_get_stats(void)
+{
+	return &stats;
+}
+
+bool piezo_sim_peek(int index, uint64_t *arrival_us)
+{
+	if (index >= queue_count)
+		return false;
+	*arrival_us = queue[(queue_first + index) % QUEUE_SIZE].arrival_us;
+	return true;
+}
+
+uint8_t piezo_sim_pop(void)
+{
+	uint8_t value = queue[queue_first].value;
+
+	queue_first = (queue_first + 1) % QUEUE_SIZE;
+	queue_count--;
+	return value;
+}
+
+static int records_written(uint64_t now_us)
+{
+	uint64_t written;
+
+	if (!running)
+		return frozen_count;
+	if (conf.record_interval_ms == 0)
+		return conf.record_count;
+	written = (now_us - run_start_us) / (conf.record_interval_ms * 1000ULL);
+	return written < (uint64_t)conf.record_count ? (int)written : conf.record_count;
+}
+
+static void queue_reply(const char *reply, int length, uint64_t end_us)
+{
+	uint64_t arrival = end_us + conf.latency_us;
+	int drop = -1;
+
+	all_replies++;
+	if (conf.drop_every > 0 && all_replies % conf.drop_every == 0) {
+		drop = (all_replies * 7) % length;
+		stats.dropped++;
+	}
+
+	for (int i = 0; i < length && queue_count < QUEUE_SIZE; i++) {
+		arrival += piezo_sim_byte_time_us();
+		if (i == drop)
+			continue;
+		queue[(queue_first + queue_count) % QUEUE_SIZE].value = reply[i];
+		queue[(queue_first + queue_count) % QUEUE_SIZE].arrival_us = arrival;
+		queue_count++;
+	}
+}
+
+static void handle_command(uint64_t end_us)
+{
+	bool answering = powered && !conf.silent && end_us - power_on_us >= conf.boot_ms * 1000ULL;
+	int values[PIEZO_SIM_VALUES] = {0};
+	char reply[128];
+	int length;
+	int record;
+
+	command[command_length] = '\0';
+
+	if (strcmp(command, "XM3;") == 0) {
+		stats.xm3++;
+		if (answering) {
+			running = true;
+			run_start_us = end_us;
+		}
+		return;
+	}
+	if (strcmp(command, "XM4;") == 0) {
+		stats.xm4++;
+		if (answering && running) {
+			frozen_count = records_written(end_us);
+			running = false;
+		}
+		return;
+	}
+	if (sscanf(command, "XU6,%d\r", &record) != 1)
+		return;
+
+	stats.requests++;
+	if (!answering)
+		return;
+	stats.replies++;
+
+	if (record < records_written(end_us)) {
+		piezo_sim_record(record, values);
+		record_replies++;
+		if (conf.corrupt_every > 0 && record_replies % conf.corrupt_every == 0) {
+			values[1] ^= 1;
+			stats.corrupted++;
+		}
+	}
+
+	length = sprintf(reply, "XU6:%d,%d,%d,%d,%d,%d,%d,%d,%d\r",
+			values[0], values[1], values[2], values[3], values[4],
+			values[5], values[6], values[7], values[8]);
+	queue_reply(reply, length, end_us);
+}
+
+void piezo_sim_receive(const uint8_t *data, uint16_t length, uint64_t end_us)
+{
+	for (uint16_t i = 0; i < length; i++) {
+		if (command_length < COMMAND_SIZE - 1)
+			command[command_length++] = data[i];
+		if (data[i] == ';' || data[i] == '\r') {
+			handle_command(end_us);
+			command_length = 0;
+		}
+	}
+}
@@ -0,0 +1,50 @@
+/**
+ *****************************************************************************
+ * @file piezo_sim.h
+ * @brief simulated Piezo LEGS controller
+ *****************************************************************************
+ * models the RS-485 protocol of the motor controller as seen by Piezo.c.
+ * Answers XM3; XM4; and XU6,n\r with byte accurate timing on a virtual clock
+ * in microseconds, owned by hal_shim.c.
+ */
+#ifndef PIEZO_SIM_H
+#define PIEZO_SIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PIEZO_SIM_VALUES 9
+
+struct piezo_sim_config {
+	int record_count;            /* records the motor writes during a run */
+	uint32_t record_interval_ms; /* time between two records, 0 = all at XM3 */
+	uint32_t boot_ms;            /* time from power on until it answers */
+	uint32_t latency_us;         /* end of request to first reply byte */
+	uint32_t baud;               /* 8N1 byte timing */
+	int corrupt_every;           /* every n:th record reply has a bad value, 0 = never */
+	int drop_every;              /* every n:th reply loses one byte, 0 = never */
+	bool silent;                 /* never answers */
+};
+
+struct piezo_sim_stats {
+	int xm3;                     /* XM3; seen, also when not answering */
+	int xm4;
+	int requests;                /* XU6 requests seen */
+	int replies;                 /* XU6 requests answered */
+	int corrupted;
+	int dropped;
+};
+
+void piezo_sim_default_config(struct piezo_sim_config *config);
+void piezo_sim_init(const struct piezo_sim_config *config);
+void piezo_sim_power(bool on, uint64_t now_us);
+void piezo_sim_receive(const uint8_t *data, uint16_t length, uint64_t end_us);
+
+bool piezo_sim_peek(int index, uint64_t *arrival_us);
+uint8_t piezo_sim_pop(void);
+
+uint32_t piezo_sim_byte_time_us(void);
+void piezo_sim_record(int record, int *values);
+const struct piezo_sim_stats *piezo_sim_get_stats(void);
+
+#endif /* PIEZO_SIM_H */
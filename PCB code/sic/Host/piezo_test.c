@@ -0,0 +1,339 @@
+/**
+ *****************************************************************************
+ * @file piezo_test.c
+ * @brief regression tests for Piezo.c against the simulated controller
+ *****************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "piezo.h"
+#include "msp_exp.h"
+#include "hal_shim.h"
+#include "piezo_sim.h"
+
+#define RECORD_BYTES (2 * PIEZO_RECORD_VALUES)
+#define ADDR 0x45
+
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("    %s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+		return; \
+	} \
+} while (0)
+
+static void setup(const struct piezo_sim_config *config)
+{
+	hal_shim_reset();
+	piezo_sim_init(config);
+}
+
+/* starts the motor and waits until XM3 has been sent */
+static void start_motor(void)
+{
+	piezo_start_exp();
+	for (int i = 0; i < 100 && piezo_get_state() == PIEZO_STATE_BOOTING; i++)
+		hal_shim_run(PIEZO_PROBE_INTERVAL_MS);
+}
+
+/* the record as it is sent to the OBC, big endian 16 bit values */
+static void expected_record(int record, uint8_t *out)
+{
+	int values[PIEZO_SIM_VALUES];
+
+	piezo_sim_record(record, values);
+	for (int v = 0; v < PIEZO_RECORD_VALUES; v++) {
+		out[2 * v] = values[v] >> 8 & 0xFF;
+		out[2 * v + 1] = values[v] & 0xFF;
+	}
+}
+
+static int check_dump(int records)
+{
+	static uint8_t buf[200];
+	uint8_t expected[RECORD_BYTES];
+
+	if (piezo_get_data_length() != records * RECORD_BYTES)
+		return 0;
+	memset(buf, 0, sizeof(buf));
+	piezo_get_data(buf, 0);
+	for (int r = 0; r < records; r++) {
+		expected_record(r, expected);
+		if (memcmp(&buf[r * RECORD_BYTES], expected, RECORD_BYTES) != 0)
+			return 0;
+	}
+	return 1;
+}
+
+/* the OBC writes a header frame */
+static int obc_header(unsigned char opcode, unsigned char frame_id, unsigned long dl)
+{
+	unsigned char frame[9];
+
+	frame[0] = opcode | (frame_id << 7);
+	msp_to_bigendian32(frame + 1, dl);
+	msp_to_bigendian32(frame + 5, msp_exp_frame_generate_fcs(frame, 1, 5, ADDR));
+	return msp_recv_callback(frame, 9, ADDR);
+}
+
+/* the OBC reads a header frame, returns its opcode and DL */
+static unsigned char obc_read(unsigned long *dl)
+{
+	const unsigned char *frame;
+	unsigned long len;
+
+	msp_send_frame(&frame, &len, ADDR);
+	*dl = len == 9 ? msp_from_bigendian32(frame + 1) : 0;
+	return frame[0] & 0x7F;
+}
+
+/* what the OBC read while the records were dumped */
+static int busyReads;
+static int busyWrong;
+static unsigned long busyLast;
+
+/* the OBC asks for the records while they are dumped, and reads the
+ * answer whenever the dump waits */
+static void obc_poll_busy(void)
+{
+	unsigned long dl;
+
+	if (busyReads++ == 0)
+		obc_header(REQ_PIEZO, 0, 0);
+	if (obc_read(&dl) != MSP_OP_EXP_BUSY || dl == 0 || dl > busyLast)
+		busyWrong++;
+	busyLast = dl;
+}
+
+static void test_bulk_dump(void)
+{
+	struct piezo_sim_config config;
+
+	piezo_sim_default_config(&config);
+	config.record_count = 10;
+	setup(&config);
+
+	start_motor();
+	CHECK(piezo_get_state() == PIEZO_STATE_RUNNING);
+	piezo_stop_exp();
+	CHECK(piezo_sim_get_stats()->xm3 == 1);
+	CHECK(piezo_sim_get_stats()->xm4 == 1);
+	CHECK(check_dump(10));
+	CHECK(piezo_time_to_ready() == 0);
+	clear_piezo_buffer();
+	CHECK(piezo_get_data_length() == 0);
+}
+
+static void test_boot_handshake(void)
+{
+	struct piezo_sim_config config;
+	uint32_t boot;
+	bool timed_out;
+
+	piezo_sim_default_config(&config);
+	config.boot_ms = 420;
+	setup(&config);
+
+	start_motor();
+	boot = piezo_get_boot_time(&timed_out);
+	CHECK(!timed_out);
+	CHECK(boot >= 420);
+	CHECK(boot <= 420 + PIEZO_PROBE_INTERVAL_MS + PIEZO_POLL_RX_TIMEOUT_MS);
+	piezo_stop_exp();
+}
+
+static void test_boot_timeout(void)
+{
+	struct piezo_sim_config config;
+	bool timed_out;
+
+	piezo_sim_default_config(&config);
+	config.silent = true;
+	setup(&config);
+
+	start_motor();
+	CHECK(piezo_get_state() == PIEZO_STATE_RUNNING);
+	CHECK(piezo_get_boot_time(&timed_out) >= PIEZO_BOOT_TIMEOUT_MS);
+	CHECK(timed_out);
+	CHECK(piezo_sim_get_stats()->xm3 == 1);
+	piezo_stop_exp();
+	CHECK(piezo_get_data_length() == 0);
+}
+
+static void test_stop_while_booting(void)
+{
+	struct piezo_sim_config config;
+
+	piezo_sim_default_config(&config);
+	config.boot_ms = 2000;
+	setup(&config);
+
+	piezo_start_exp();
+	hal_shim_run(200);
+	piezo_stop_exp();
+	CHECK(piezo_get_state() == PIEZO_STATE_OFF);
+	CHECK(piezo_sim_get_stats()->xm3 == 0);
+	CHECK(piezo_sim_get_stats()->xm4 == 0);
+}
+
+static void test_checksum_recovery(void)
+{
+	struct piezo_sim_config config;
+
+	piezo_sim_default_config(&config);
+	config.record_count = 8;
+	config.corrupt_every = 3;
+	setup(&config);
+
+	start_motor();
+	piezo_stop_exp();
+	CHECK(piezo_sim_get_stats()->corrupted > 0);
+	CHECK(check_dump(8));
+	clear_piezo_buffer();
+}
+
+static void test_dropped_byte_recovery(void)
+{
+	struct piezo_sim_config config;
+
+	piezo_sim_default_config(&config);
+	config.record_count = 8;
+	config.drop_every = 4;
+	setup(&config);
+
+	start_motor();
+	piezo_stop_exp();
+	CHECK(piezo_sim_get_stats()->dropped > 0);
+	CHECK(check_dump(8));
+	clear_piezo_buffer();
+}
+
+static void test_dump_buffer_full(void)
+{
+	struct piezo_sim_config config;
+
+	piezo_sim_default_config(&config);
+	config.record_count = PIEZO_DUMP_MAX_RECORDS + 4;
+	setup(&config);
+
+	start_motor();
+	piezo_stop_exp();
+	CHECK(check_dump(PIEZO_DUMP_MAX_RECORDS));
+	clear_piezo_buffer();
+}
+
+static void test_in_run_samples(void)
+{
+	struct piezo_sim_config config;
+	uint8_t buf[PIEZO_SAMPLE_RING_SIZE * PIEZO_SAMPLE_SIZE];
+	uint8_t expected[RECORD_BYTES];
+	int length;
+	int samples;
+
+	piezo_sim_default_config(&config);
+	config.record_count = 20;
+	config.record_interval_ms = 500;
+	config.corrupt_every = 2;
+	config.drop_every = 5;
+	setup(&config);
+
+	start_motor();
+	hal_shim_run(6000);
+	CHECK(piezo_telemetry_running());
+
+	length = piezo_get_sample_length();
+	samples = length / PIEZO_SAMPLE_SIZE;
+	CHECK(length % PIEZO_SAMPLE_SIZE == 0);
+	CHECK(samples >= 3);
+	piezo_get_samples(buf, length, 0);
+	for (int s = 0; s < samples; s++) {
+		expected_record(s, expected);
+		CHECK(memcmp(&buf[s * PIEZO_SAMPLE_SIZE + 4], expected, RECORD_BYTES) == 0);
+	}
+	piezo_release_samples();
+	CHECK(piezo_get_sample_length() == 0);
+	piezo_abort_samples();
+	piezo_stop_exp();
+	clear_piezo_buffer();
+}
+
+static void test_busy_while_dumping(void)
+{
+	struct piezo_sim_config config;
+	unsigned long dl;
+
+	piezo_sim_default_config(&config);
+	config.record_count = 5;
+	setup(&config);
+	msp_exp_state_initialize(msp_seqflags_init(), ADDR);
+
+	start_motor();
+	busyReads = 0;
+	busyWrong = 0;
+	busyLast = PIEZO_DUMP_MAX_RECORDS * PIEZO_DUMP_RECORD_ESTIMATE_MS;
+	hal_shim_set_delay_hook(obc_poll_busy);
+	piezo_stop_exp();
+	hal_shim_set_delay_hook(NULL);
+
+	/* five records and the empty one, each read once, with a shorter
+	 * estimate every time */
+	CHECK(busyReads == 6);
+	CHECK(busyWrong == 0);
+	CHECK(busyLast < (PIEZO_DUMP_MAX_RECORDS - 4) * PIEZO_DUMP_RECORD_ESTIMATE_MS);
+	/* the records are sent once they are read */
+	CHECK(obc_read(&dl) == MSP_OP_EXP_SEND);
+	CHECK(dl == 5 * RECORD_BYTES);
+	clear_piezo_buffer();
+}
+
+static void run(const char *name, void (*test)(void))
+{
+	int before = failures;
+
+	test();
+	printf("%-40s %s\n", name, failures == before ? "OK" : "FAIL");
+}
+
+int main(void)
+{
+	run("bulk dump at XM4", test_bulk_dump);
+	run("boot handshake", test_boot_handshake);
+	run("boot timeout fallback", test_boot_timeout);
+	run("stop while booting", test_stop_while_booting);
+	run("recovery from bad checksums", test_checksum_recovery);
+	run("recovery from dropped bytes", test_dropped_byte_recovery);
+	run("dump buffer full", test_dump_buffer_full);
+	run("in-run samples", test_in_run_samples);
+	run("busy while dumping", test_busy_while_dumping);
+
+	if (failures) {
+		printf("%d check(s) failed\n", failures);
+		return 1;
+	}
+	return 0;
+}
+
+
+/* the handlers, REQ_PIEZO is busy while the records are read, no data is sent */
+unsigned long msp_expsend_busy_time(unsigned char opcode)
+{
+	return opcode == REQ_PIEZO ? piezo_time_to_ready() : 0;
+}
+
+void msp_expsend_start(unsigned char opcode, unsigned long *len)
+{
+	*len = opcode == REQ_PIEZO ? piezo_get_data_length() : 0;
+}
+
+void msp_expsend_data(unsigned char opcode, unsigned char *buf, unsigned long len, unsigned long offset) {}
+void msp_expsend_complete(unsigned char opcode) {}
+void msp_expsend_error(unsigned char opcode, int error) {}
+void msp_exprecv_start(unsigned char opcode, unsigned long len) {}
+void msp_exprecv_data(unsigned char opcode, const unsigned char *buf, unsigned long len, unsigned long offset) {}
+void msp_exprecv_complete(unsigned char opcode) {}
+void msp_exprecv_error(unsigned char opcode, int error) {}
+void msp_exprecv_syscommand(unsigned char opcode) {}
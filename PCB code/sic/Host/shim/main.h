@@ -0,0 +1,65 @@
+/**
+ *****************************************************************************
+ * @file main.h
+ * @brief host replacement for the CubeMX main.h
+ *****************************************************************************
+ * provides the few HAL types, pins and functions that the Piezo driver uses,
+ * all of them are implemented by hal_shim.c on top of the simulator.
+ */
+#ifndef __MAIN_H
+#define __MAIN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum
+{
+  HAL_OK       = 0x00U,
+  HAL_ERROR    = 0x01U,
+  HAL_BUSY     = 0x02U,
+  HAL_TIMEOUT  = 0x03U
+} HAL_StatusTypeDef;
+
+typedef enum
+{
+  GPIO_PIN_RESET = 0U,
+  GPIO_PIN_SET
+} GPIO_PinState;
+
+typedef struct
+{
+  int id;
+} GPIO_TypeDef;
+
+typedef struct
+{
+  int id;
+} UART_HandleTypeDef;
+
+typedef struct
+{
+  int id;
+} TIM_HandleTypeDef;
+
+extern GPIO_TypeDef hal_shim_gpioa;
+#define GPIOA (&hal_shim_gpioa)
+
+#define RE485_Pin 0x0800U
+#define RE485_GPIO_Port GPIOA
+#define DE485_Pin 0x1000U
+#define DE485_GPIO_Port GPIOA
+
+#define UART_RXDATA_FLUSH_REQUEST 0x08U
+#define __HAL_UART_SEND_REQ(__HANDLE__, __REQ__) hal_shim_uart_request((__HANDLE__), (__REQ__))
+
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t Delay);
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+HAL_StatusTypeDef HAL_UART_Receive(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_TIM_Base_Start_IT(TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_Base_Stop_IT(TIM_HandleTypeDef *htim);
+void hal_shim_uart_request(UART_HandleTypeDef *huart, uint32_t request);
+
+void Error_Handler(void);
+
+#endif /* __MAIN_H */
@@ -0,0 +1,16 @@
+/**
+ *****************************************************************************
+ * @file tim.h
+ * @brief host replacement for the CubeMX tim.h
+ *****************************************************************************
+ */
+#ifndef __tim_H
+#define __tim_H
+
+#include "main.h"
+
+extern TIM_HandleTypeDef htim21;
+
+void tim21_set_period_ms(uint16_t period_ms);
+
+#endif /* __tim_H */
@@ -0,0 +1,16 @@
+/**
+ *****************************************************************************
+ * @file usart.h
+ * @brief host replacement for the CubeMX usart.h
+ *****************************************************************************
+ */
+#ifndef __usart_H
+#define __usart_H
+
+#include "main.h"
+
+extern UART_HandleTypeDef huart1;
+
+HAL_StatusTypeDef usart1_transmit_dma(const uint8_t *data, uint16_t length, uint32_t timeout);
+
+#endif /* __usart_H */
@@ -0,0 +1,22 @@
+#include <stdint.h>
+
+typedef enum {
+  ARENA_PHASE_IDLE,
+  ARENA_PHASE_SIC_ACQUISITION,   // the sweep, before it is packed into the SiC buffer
+  ARENA_PHASE_PIEZO_ACQUISITION, // the records read from the motor when it stops
+  ARENA_PHASE_DOWNLOAD           // the test driver copies of the results
+} arena_phase;
+
+//function prototypes
+void arena_begin(arena_phase phase);
+void *arena_alloc(uint16_t size);
+void arena_end(void);
+arena_phase arena_get_phase(void);
+uint16_t arena_get_high_water(void);
+
+#define ARENA_SIZE 720UL // bytes, the largest phase is the SiC sweep
+
+// size of an allocation in the arena, they are all word aligned
+#define ARENA_ROUND(size) (((size) + 3) & ~3UL)
+// fails to compile if the allocations of a phase, given as their sum, do not fit
+#define ARENA_FITS(phase, size) typedef char phase##_fits_in_arena[(size) <= ARENA_SIZE ? 1 : -1]
@@ -0,0 +1,24 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+  COMMAND_PIEZO_START,
+  COMMAND_PIEZO_STOP,
+  COMMAND_SIC_START,
+  COMMAND_SAVE_SEQFLAGS,
+  COMMAND_SLEEP,
+  COMMAND_ACTIVE,
+  COMMAND_PIEZO_POLL_INTERVAL  // argument: interval in ms
+} command_type;
+
+typedef struct {
+  command_type type;
+  uint16_t argument;
+} command;
+
+//function prototypes
+bool command_queue_push(command_type type, uint16_t argument);
+bool command_queue_full(void);
+bool command_queue_run_next(void);
+
+#define COMMAND_QUEUE_LENGTH 8 // must be a power of two
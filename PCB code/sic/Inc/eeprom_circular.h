@@ -1,9 +1,18 @@
 
+
 #include "stm32l0xx_hal.h"
 # include <stdint.h>
 #include <stdbool.h>
-static int find_current_EEPROM_address(void);
+void EEPROM_init(void);
+bool EEPROM_write(uint32_t address, const void *data, uint16_t length);
+bool EEPROM_idle(void);
+void EEPROM_flush(void);
+uint16_t EEPROM_get_error_count(void);
+void EEPROM_IRQHandler(void);
 void reset_EEPROM_buffer(void);
-bool EEPROM_read_buffer(unsigned short *data1, unsigned short *data2);
-void EEPROM_write_buffer(unsigned short *data1, unsigned short *data2);
-uint16_t checksum (uint16_t *ptr1, uint8_t sz1, uint16_t *ptr2, uint8_t sz2);
\ No newline at end of file
+void EEPROM_journal_restore(uint16_t *data);
+uint8_t EEPROM_journal_update(const uint16_t *data);
+
+#define JOURNAL_HALFWORDS 16 // the sequence flags of both MSP addresses, 8 halfwords each
+#define JOURNAL_RECORDS 128  // 8 bytes each, 1k of the 2k data eeprom
+#define EEPROM_QUEUE_LENGTH 8 // word, halfword or byte writes waiting, must be a power of two and fit a journal record
@@ -0,0 +1,27 @@
+#include <stdint.h>
+#include "msp_stats.h"
+
+//function prototypes
+void housekeeping_snapshot(void);
+void housekeeping_copy(unsigned char *buf, unsigned long len, unsigned long offset);
+
+/* the report sent for MSP_OP_REQ_HK, all values big endian */
+#define HK_BOOT_LISTEN_US 0       // uint32, reset until I2C1 listened for the OBC
+#define HK_BOOT_ANSWER_US 4       // uint32, reset until the first frame was answered
+#define HK_I2C_RECOVERIES 8       // uint16, I2C peripheral resets since boot
+#define HK_WAKE_LATENCY_US 10     // uint16, longest wake-up from Stop to an address match
+#define HK_EEPROM_ERRORS 12       // uint16, failed eeprom writes since boot
+#define HK_ARENA_HIGH_WATER 14    // uint16, most bytes of the scratch arena used
+#define HK_I2C_BUSY 16            // uint32, EXP_BUSY read while a frame waited for the main loop
+#define HK_MSP_STATS 20           // MSP_STATS_LENGTH bytes, the link statistics, see msp_stats.h
+#define HOUSEKEEPING_LENGTH (HK_MSP_STATS + MSP_STATS_LENGTH)
+
+/* the report sent for REQ_STATUS */
+#define STATUS_ACTIVITY 0         // uint8, the STATUS_ flags below
+#define STATUS_READY_MS 1         // uint32 big endian, ms until REQ_SIC, REQ_PIEZO and MSP_OP_REQ_PAYLOAD are served
+#define STATUS_LENGTH 5
+
+#define STATUS_SIC_SWEEP 0x01     // a sweep is running
+#define STATUS_PIEZO_DUMP 0x02    // the records are read from the stopped motor
+#define STATUS_PIEZO_RUNNING 0x04 // the motor is running
+#define STATUS_SIC_PENDING 0x08   // a sweep waits for the OBC
@@ -1,2 +1,3 @@
+#include <stdbool.h>
 void restore_seqflags(void);
-void save_seqflags(void);
+bool save_seqflags(void);
@@ -0,0 +1,20 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+//function prototypes
+void msp_i2c_start(void);
+bool msp_i2c_poll(void);
+void msp_i2c_delay(uint32_t ms);
+void msp_i2c_sleep(void);
+bool msp_i2c_idle(void);
+uint16_t msp_i2c_get_recovery_count(void);
+uint16_t msp_i2c_get_wake_latency_us(void);
+uint32_t msp_i2c_get_boot_listen_us(void);
+uint32_t msp_i2c_get_boot_answer_us(void);
+uint32_t msp_i2c_get_busy_count(void);
+
+#define MSP_I2C_TRANSFER_TIMEOUT_MS 250 // longest time from address match to STOP before the bus is reset
+#define MSP_I2C_REQUEST_TIMEOUT_MS 2000 // longest time between the frames of a request before it is aborted
+#define MSP_I2C_WAKE_LATENCY_LIMIT_US 500 // longest SCL stretch after Stop that is accepted, far below the OBC timeout
+#define MSP_I2C_ADDR_SIC 0x45   // OA1, the SiC experiment
+#define MSP_I2C_ADDR_PIEZO 0x65 // OA2, the Piezo experiment
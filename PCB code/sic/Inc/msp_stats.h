@@ -0,0 +1,39 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+//function prototypes
+void msp_stats_receiving(uint8_t address);
+void msp_stats_received(uint8_t address, int receiveCode);
+void msp_stats_sent(int sendCode, uint8_t sentOpcode, uint32_t latencyUs);
+void msp_stats_start(uint8_t opcode);
+void msp_stats_bytes(uint8_t opcode, uint32_t length);
+void msp_stats_end(uint8_t opcode, bool completed);
+void msp_stats_snapshot(uint8_t *report);
+
+#define MSP_STATS_BUCKETS 12      // log2 buckets: 0, 1, 2-3, 4-7 ... 1024 and more
+#define MSP_STATS_OPCODES 5       // the opcodes in MSP_STATS_OPCODE_LIST and one for all others
+
+// the opcodes that are counted on their own, in the order of the report:
+// the requests that carry the data. Every other opcode, the small requests,
+// the sends and the system commands among them, shares the last slot
+#define MSP_STATS_OPCODE_LIST {MSP_OP_REQ_PAYLOAD, REQ_SIC, REQ_PIEZO, MSP_OP_REQ_HK}
+
+/* the statistics in the housekeeping report, all values big endian */
+#define MSP_STATS_RX_FRAMES 0     // uint32, frames handed to MSP
+#define MSP_STATS_RX_REJECTED 4   // uint32, frames that MSP dropped, the two below included
+#define MSP_STATS_FCS_MISMATCHES 8 // uint32, frames with a bad FCS
+#define MSP_STATS_DUPLICATES 12   // uint32, data frames received twice
+#define MSP_STATS_TX_FRAMES 16    // uint32, frames prepared for the OBC
+#define MSP_STATS_BUSY 20         // uint32, EXP_BUSY sent because the experiment was not ready
+#define MSP_STATS_ABORTED 24      // uint32, transactions that ended with an error
+#define MSP_STATS_OPCODE 28       // MSP_STATS_OPCODES times the block below
+#define MSP_STATS_LENGTH (MSP_STATS_OPCODE + MSP_STATS_OPCODES*MSP_STATS_OPCODE_SIZE)
+
+/* the block of an opcode */
+#define MSP_STATS_OPCODE_BYTES 0  // uint32, data bytes sent or received
+#define MSP_STATS_OPCODE_COMPLETED 4 // uint16, transactions that completed
+#define MSP_STATS_OPCODE_ABORTED 6 // uint16, transactions that ended with an error
+#define MSP_STATS_OPCODE_REPEATED 8 // uint16, sends and system commands that the OBC started again after they completed
+#define MSP_STATS_OPCODE_LATENCY 10 // uint16 per bucket, us that the MSP callbacks took per frame of a transaction
+#define MSP_STATS_OPCODE_DURATION (MSP_STATS_OPCODE_LATENCY + 2*MSP_STATS_BUCKETS) // uint16 per bucket, ms from the start to the end of a transaction
+#define MSP_STATS_OPCODE_SIZE (MSP_STATS_OPCODE_DURATION + 2*MSP_STATS_BUCKETS)
@@ -0,0 +1,18 @@
+#include <stdint.h>
+
+//function prototypes
+unsigned long payload_open(void);
+void payload_copy(unsigned char *buf, unsigned long len, unsigned long offset);
+void payload_release(void);
+void payload_abort(void);
+
+/* the container sent for MSP_OP_REQ_PAYLOAD is a list of items, each one a
+   type byte, a 16 bit big endian length and that many bytes of value */
+#define PAYLOAD_ITEM_HEADER 3
+#define PAYLOAD_SIC 0x01            // the SiC buffer, BUFFERLENGTH bytes
+#define PAYLOAD_PIEZO_RECORDS 0x02  // the records dumped when the motor stopped, as for REQ_PIEZO
+#define PAYLOAD_PIEZO_SAMPLES 0x03  // the records sampled while the motor runs, as for REQ_PIEZO
+#define PAYLOAD_HOUSEKEEPING 0x04   // the report of MSP_OP_REQ_HK
+#define PAYLOAD_PIEZO_TIMING 0x05   // uint32 ms until xm3 was sent, uint8 1 if the controller never answered
+#define PAYLOAD_PIEZO_TIMING_LENGTH 5
+#define PAYLOAD_MAX_ITEMS 5
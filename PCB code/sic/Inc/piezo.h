@@ -1,5 +1,12 @@
 #include <stdbool.h>
 #include <stdint.h>
+
+typedef enum {
+  PIEZO_STATE_OFF,
+  PIEZO_STATE_BOOTING,  // powered, waiting for the controller to answer
+  PIEZO_STATE_RUNNING   // xm3 has been sent
+} piezo_state_type;
+
 //function prototypes
 //void piezo_recive_data(uint8_t *transmitt, uint8_t *recive);
 unsigned char piezo_read_data_records(void);
@@ -10,9 +17,21 @@ void ascii_to_int (char * bufferIn, int * bufferOut);
 bool record_was_empty(char * bufferIn);
 void piezo_get_data(unsigned char *buf, long data_offset);
 int piezo_get_data_length(void);
-void convert_to_8bit(uint8_t * buffer, uint16_t length);
+void convert_to_8bit(uint8_t * buffer, const int * values, uint16_t length);
 void clear_piezo_buffer(void);
 void RS485(uint8_t);
+bool piezo_transmit(const uint8_t *data, uint16_t length, uint32_t timeout);
+void piezo_poll_tick(void);
+void piezo_poll(void);
+void piezo_set_poll_interval(uint16_t interval_ms);
+bool piezo_telemetry_running(void);
+piezo_state_type piezo_get_state(void);
+uint32_t piezo_get_boot_time(bool *timed_out);
+int piezo_get_sample_length(void);
+void piezo_get_samples(unsigned char *buf, unsigned long len, unsigned long data_offset);
+void piezo_release_samples(void);
+void piezo_abort_samples(void);
+uint32_t piezo_time_to_ready(void);
 
 #define RS_TRANSMIT_ENABLE 0x1
 #define RS_TRANSMIT_DISABLE 0x2
@@ -22,3 +41,19 @@ void RS485(uint8_t);
 #define RS_MODE_TRANSMIT 0x5
 #define RS_MODE_RECEIVE 0x6
 #define RS_MODE_DEACTIVATE 0x7
+
+/* power up */
+#define PIEZO_PROBE_INTERVAL_MS 50      // time between two probes while booting
+#define PIEZO_BOOT_TIMEOUT_MS 3000      // xm3 is sent after this even without an answer
+
+/* in-run telemetry */
+#define PIEZO_POLL_INTERVAL_MS 1000     // default time between two record reads
+#define PIEZO_POLL_RX_TIMEOUT_MS 10     // max wait for each byte of a reply
+#define PIEZO_SAMPLE_RING_SIZE 16       // number of records kept between downloads
+#define PIEZO_RECORD_VALUES 9           // values in one data record
+#define PIEZO_RECORD_MAX_LENGTH 100     // longest reply to XU6 that is accepted
+#define PIEZO_DUMP_MAX_RECORDS 11       // records that fit in the 200 byte dump buffer
+#define PIEZO_DUMP_REPLY_LENGTH 200     // reply buffer while the records are dumped
+#define PIEZO_DUMP_RECORD_ESTIMATE_MS 1100 // one record of the dump, the reply and the wait after it
+#define PIEZO_DUMP_VALUES (PIEZO_DUMP_MAX_RECORDS * PIEZO_RECORD_VALUES + 2) // the checksum reads two values past a record
+#define PIEZO_SAMPLE_SIZE (4 + 2 * PIEZO_RECORD_VALUES) // bytes per sample sent to the OBC
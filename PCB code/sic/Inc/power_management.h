@@ -1,3 +1,5 @@
+#include <stdbool.h>
+
 void piezo_power_on(void);
 void piezo_power_off(void);
 void sic_power_on(void);
@@ -7,3 +9,9 @@ void turn_off_5v(void);
 void turn_off_10v(void);
 void turn_off_vbat(void);
 
+void power_init(void);
+void power_sleep(void);
+void power_active(void);
+bool power_is_sleeping(void);
+bool power_stop_allowed(void);
+void power_enter_stop(void);
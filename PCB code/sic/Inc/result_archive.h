@@ -0,0 +1,12 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+//function prototypes
+void result_archive_init(uint8_t *data);
+void result_archive_store(const uint8_t *data);
+void result_archive_acknowledge(uint8_t *data);
+bool result_archive_pending(void);
+
+#define ARCHIVE_START_ADDR 0x08080400UL // the 1k of the data eeprom after the journal
+#define ARCHIVE_WORDS 256               // 4 bytes each
+#define ARCHIVE_CHANNELS 8              // temperature, Vbe, Vb and Vc of the Si and the SiC transistor
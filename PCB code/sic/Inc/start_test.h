@@ -5,4 +5,9 @@ void sic_get_data(unsigned char *buf, long data_offset);
 void clear_sic_buffer (void);
 void sic_test_driver(void);
 void readADCvalues(uint8_t);
-void setDAC_voltage(uint32_t);
\ No newline at end of file
+void setDAC_voltage(uint32_t);
+uint32_t sic_time_to_ready(void);
+
+#define SIC_SETTLE_MS 1000           // the SiC rail settles before the first step
+#define SIC_STEP_ESTIMATE_MS 200     // one step of the sweep, until the first one is measured
+#define SIC_FINISH_ESTIMATE_MS 700   // powering down and archiving the sweep
@@ -3,4 +3,3 @@
 /* function prototypes */
 void Flush_Buffer(int* pBuffer, uint16_t BufferLength);
 void Flush_Buffer8(uint8_t* pBuffer, uint16_t BufferLength);
-void buff_length(uint8_t* pBuffer, long *BufferLength);
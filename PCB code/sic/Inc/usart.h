@@ -33,13 +33,16 @@
 extern UART_HandleTypeDef huart1;
 
 /* USER CODE BEGIN Private defines */
-
+/* time the RS485 driver is enabled before the start bit and after the stop
+   bit, in sample times (1/16 bit). 16 = one bit time, 8.7 us at 115200 */
+#define USART1_DE_ASSERTION_TIME 16
+#define USART1_DE_DEASSERTION_TIME 16
 /* USER CODE END Private defines */
 
 void MX_USART1_UART_Init(void);
 
 /* USER CODE BEGIN Prototypes */
-
+HAL_StatusTypeDef usart1_transmit_dma(const uint8_t *data, uint16_t length, uint32_t timeout);
 /* USER CODE END Prototypes */
 
 #ifdef __cplusplus
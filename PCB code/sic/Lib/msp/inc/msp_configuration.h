@@ -9,5 +9,11 @@
 
 #define MSP_EXP_MTU 507
 #define MSP_EXP_ADDR 0x45
+#define MSP_EXP_INSTANCES 2
+#define MSP_CRC32_TABLE
+
+/* The trace of msp_trace.h is left out of the flight build. Define
+ * MSP_TRACE, and MSP_TRACE_SIZE if 32 records is not right, in the
+ * compiler options of a build that should keep it. */
 
 #endif
@@ -19,4 +19,32 @@
  */
 #define MSP_MAX_DATA_LENGTH 4294967295UL
 
+/**
+ * @brief The largest window of a windowed transfer.
+ *
+ * Windowed transfer is an extension to MSP for OBC Requests. Instead of
+ * acknowledging every data frame, the OBC reads up to a window of data frames
+ * in a row and then acknowledges all of them at once with a WINDOW_ACK header,
+ * whose DL field is the number of bytes it has received in order. The frames
+ * after those are sent again.
+ *
+ * The OBC negotiates the window with the MSP_OP_REQ_WINDOW request, it offers
+ * a window in the DL field and the experiment answers with a single byte, the
+ * window it agrees to. The OBC then asks for a windowed transfer by putting
+ * the window in the DL field of a request header, the experiment agrees by
+ * responding with EXP_SEND_WINDOW instead of EXP_SEND. Otherwise the
+ * transaction is carried out as in classic MSP.
+ */
+#define MSP_WINDOW_MAX 4
+
+/**
+ * @brief The mask of a sequence number in a windowed transfer.
+ *
+ * The data frames of a windowed transfer are numbered from 0 in the order of
+ * their data, see MSP_OP_WINDOW_DATA(). Each window is at most half of the
+ * sequence numbers, so that a frame that is sent again is never taken for a
+ * new one.
+ */
+#define MSP_WINDOW_SEQ_MASK 0x07
+
 #endif /* MSP_CONSTANTS_H */
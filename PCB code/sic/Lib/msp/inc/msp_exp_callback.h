@@ -16,6 +16,8 @@
  * @brief Callback function for when receiving data from the OBC.
  * @param data Pointer to the received data from the OBC.
  * @param len Number of bytes received from the OBC.
+ * @param addr The I2C address that the OBC wrote to. Each address has its own
+ *             MSP state, see msp_exp_state_initialize().
  * @return 0 if OK, otherwise an error code from msp_exp_error.h.
  */
 int msp_recv_callback(const unsigned char *data, unsigned long len, char addr);
@@ -29,8 +31,49 @@ int msp_recv_callback(const unsigned char *data, unsigned long len, char addr);
  *             msp_exp_definitions.h.
  * @param len A pointer to a 32-bit unsigned integer that represents the number
  *            of bytes to be sent.
+ * @param addr The I2C address that the OBC reads from.
  * @return 0 if OK, otherwise an error code from msp_exp_error.h.
  */
 int msp_send_callback(unsigned char *data, unsigned long *len, char addr);
 
+/**
+ * @brief Aborts the transaction that is open on an address.
+ * @param addr The I2C address of the transaction.
+ * @return 1 if a transaction was aborted, otherwise 0.
+ *
+ * For a transaction that the OBC has stopped answering. The handlers are
+ * told as if the OBC had started a new transaction, and a read from the
+ * address is answered with MSP_OP_NULL until it does.
+ */
+int msp_exp_abort(char addr);
+
+#ifndef MSP_LOW_MEMORY
+/**
+ * @brief Like msp_send_callback(), but returns a pointer to the frame instead
+ *        of copying it.
+ * @param frame Set to point to the frame to be sent. It stays valid until the
+ *              next call to msp_send_frame() or msp_send_callback() for the
+ *              same address.
+ * @param len Set to the number of bytes to be sent.
+ * @param addr The I2C address that the OBC reads from.
+ * @return 0 if OK, otherwise an error code from msp_exp_error.h.
+ *
+ * Data frames of an OBC Request are kept in two buffers that all addresses
+ * share: the one that an address sent last, so that it can be sent again
+ * without being rebuilt, and the next one, which msp_exp_prepare_next() can
+ * build before the OBC asks for it.
+ */
+int msp_send_frame(const unsigned char **frame, unsigned long *len, char addr);
+
+/**
+ * @brief Builds the data frame that the OBC will ask for next.
+ * @param addr The I2C address that the OBC will read from.
+ * @return 1 if a frame was built, otherwise 0.
+ *
+ * Meant to be called while the experiment is idle between I2C transfers.
+ * It does nothing if MSP is busy or not in an OBC Request.
+ */
+int msp_exp_prepare_next(char addr);
+#endif
+
 #endif
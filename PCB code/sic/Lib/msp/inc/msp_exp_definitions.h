@@ -15,6 +15,7 @@
 
 /* Import MSP_EXP_ADDR and MSP_EXP_MTU from the configuration file */
 #include "msp_configuration.h"
+#include "msp_constants.h"
 
 #ifndef MSP_EXP_ADDR
 #error MSP_EXP_ADDR not set
@@ -32,5 +33,25 @@
 #define MSP_EXP_MAX_FRAME_SIZE (((MSP_EXP_MTU) + 5) > 9 ? ((MSP_EXP_MTU) + 5) : 9)
 #endif
 
+#ifndef MSP_EXP_INSTANCES
+/**
+ * @brief The number of I2C addresses that the experiment answers on.
+ *
+ * Each address has its own MSP state, sequence flags and transactions.
+ */
+#define MSP_EXP_INSTANCES 1
+#endif
+
+#ifndef MSP_EXP_WINDOW
+/**
+ * @brief The largest number of data frames that the experiment sends before
+ *        they are acknowledged, if the OBC has negotiated a windowed transfer.
+ *
+ * Between 1 and MSP_WINDOW_MAX, 1 turns windowed transfer off.
+ */
+#define MSP_EXP_WINDOW MSP_WINDOW_MAX
+#elif (MSP_EXP_WINDOW) < 1 || (MSP_EXP_WINDOW) > MSP_WINDOW_MAX
+#error MSP_EXP_WINDOW must be between 1 and MSP_WINDOW_MAX
+#endif
 
 #endif /* MSP_EXP_DEFINITIONS_H */
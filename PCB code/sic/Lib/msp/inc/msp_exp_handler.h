@@ -47,11 +47,27 @@
  * corresponding function with the "_error" suffix is called instead of the
  * function with the "_complete" suffix. The main exception is when a system
  * command is received from the OBC, then msp_exprecv_syscommand is the only
- * function that is called.
+ * function that is called. Before an OBC Request is started,
+ * msp_expsend_busy_time() is called one or more times to ask if the
+ * experiment is ready for it.
  */
 #ifndef MSP_EXP_HANDLER_H
 #define MSP_EXP_HANDLER_H
 
+/**
+ * @brief Called to ask if the experiment is ready to serve an OBC Request.
+ * @param opcode The opcode of the request. (As determined by the OBC.)
+ * @return The number of milliseconds until the experiment expects to be
+ *         ready, or 0 if it is ready now.
+ *
+ * Called when a request header is received and, as long as a time other than
+ * 0 is returned, every time the OBC reads the response header. Until then the
+ * experiment answers with EXP_BUSY frames that carry the time in their DL
+ * field, so that the OBC knows when to ask again, and msp_expsend_start() is
+ * not called. An experiment that is always ready returns 0.
+ */
+unsigned long msp_expsend_busy_time(unsigned char opcode);
+
 /**
  * @brief Called at the start of an OBC Request transaction.
  * @param opcode The opcode of the transaction. (As determined by the OBC.)
@@ -91,6 +107,11 @@ void msp_expsend_start(unsigned char opcode, unsigned long *len);
  * buf or to try to keep track of the offset outside of this function as MSP
  * may ask for the same data again if a frame got corrupted.
  *
+ * The data can be copied with msp_expsend_copy(), which calculates the FCS of
+ * the frame in the same pass. Data that is formatted directly into buf can be
+ * added to the FCS with msp_expsend_fcs_update(). Anything that is not added
+ * this way is added by MSP when this function returns.
+ *
  * msp_expsend_start() will always be called before this function. This
  * function will be called as part of the transaction that was last initiated
  * by an invocation of msp_expsend_start().
@@ -225,4 +246,11 @@ void msp_exprecv_error(unsigned char opcode, int error);
  */
 void msp_exprecv_syscommand(unsigned char opcode);
 
+/*
+ * Implemented by MSP, to be called from msp_expsend_data(). See
+ * msp_exp_frame.c.
+ */
+void msp_expsend_copy(unsigned char *dest, const unsigned char *src, unsigned long len);
+void msp_expsend_fcs_update(const unsigned char *data, unsigned long len);
+
 #endif /* MSP_EXP_HANDLER_H */
@@ -11,12 +11,14 @@
 #ifndef MSP_EXP_STATE_H
 #define MSP_EXP_STATE_H
 
+#include "msp_exp_definitions.h"
 #include "msp_seqflags.h"
 
 typedef enum {
 	MSP_EXP_STATE_READY, /**< Ready to start a new transaction. */
 	MSP_EXP_STATE_OBC_SEND_RX, /**< In an OBC Send transaction. */
 	MSP_EXP_STATE_OBC_SEND_RX_DUPLICATE, /**< Receiving a duplicate OBC Send transaction. */
+	MSP_EXP_STATE_OBC_REQ_BUSY, /**< Not yet ready to respond to an OBC Request transaction. */
 	MSP_EXP_STATE_OBC_REQ_RESPONSE, /**< Responding to an OBC Request transaction. */
 	MSP_EXP_STATE_OBC_REQ_TX /**< In an OBC Request transaction. */
 } msp_exp_state_type_t;
@@ -37,6 +39,11 @@ struct msp_exp_state_information {
 	 */
 	unsigned char initialized;
 
+	/**
+	 * @brief The I2C address of the experiment that the state belongs to.
+	 */
+	char addr;
+
 	/**
 	 * @brief A boolean value to keep track of if the experiment is busy with
 	 *        processing an MSP frame.
@@ -74,6 +81,30 @@ struct msp_exp_state_information {
 	 */
 	unsigned char opcode;
 
+	/**
+	 * @brief The largest window that the OBC has negotiated with
+	 *        MSP_OP_REQ_WINDOW, 1 if the data frames are sent one at a time.
+	 */
+	unsigned char window;
+
+	/**
+	 * @brief The window of the ongoing OBC Request transaction, 1 if it is
+	 *        carried out as in classic MSP.
+	 */
+	unsigned char tx_window;
+
+	/**
+	 * @brief The sequence number of the first data frame that has not been
+	 *        acknowledged, in a windowed transfer.
+	 */
+	unsigned char tx_seq;
+
+	/**
+	 * @brief The number of data frames sent after the acknowledged ones, in a
+	 *        windowed transfer.
+	 */
+	unsigned char tx_sent;
+
 	/**
 	 * @brief The sequence flags of the experiment state.
 	 *
@@ -100,15 +131,63 @@ struct msp_exp_state_information {
 	 *        in an OBC Request transaction.
 	 */
 	unsigned long prev_data_length;
+
+	/**
+	 * @brief The running FCS of the frame that is being received on the
+	 *        address.
+	 *
+	 * Kept per address, since a frame written to one address may wait to be
+	 * handled while the OBC writes to the other.
+	 */
+	unsigned long rx_fcs;
+
+	/**
+	 * @brief The number of bytes of the incoming frame that are included in
+	 *        rx_fcs.
+	 */
+	unsigned long rx_fcs_length;
+
+	/**
+	 * @brief A boolean value to keep track of whether rx_fcs has been started
+	 *        for the frame that is being received.
+	 */
+	unsigned char rx_fcs_started;
+};
+
+/**
+ * @brief Contains the running FCS value of the frame that is being sent.
+ *
+ * Only one frame is prepared at a time, so it is shared by all experiment
+ * states. The FCS of a received frame is kept in the state of its address.
+ */
+struct msp_exp_fcs_information {
+	/**
+	 * @brief The running FCS of the data frame that is being sent.
+	 *
+	 * Seeded with the pseudo header and the opcode byte before
+	 * msp_expsend_data() is called, and updated by the handler through
+	 * msp_expsend_copy() or msp_expsend_fcs_update().
+	 */
+	unsigned long tx_fcs;
+
+	/**
+	 * @brief The number of bytes of the outgoing data field that are included
+	 *        in tx_fcs.
+	 */
+	unsigned long tx_fcs_length;
 };
 
 
 /**
- * Declares the existance of the MSP experiment state.
+ * Declares the existance of the MSP experiment states, one for each address
+ * that the experiment answers on.
  */
-extern volatile struct msp_exp_state_information msp_exp_state;
+extern volatile struct msp_exp_state_information msp_exp_states[MSP_EXP_INSTANCES];
+extern volatile struct msp_exp_fcs_information msp_exp_fcs;
 
-void msp_exp_state_initialize(msp_seqflags_t seqflags);
-msp_seqflags_t msp_exp_state_get_seqflags(void);
+volatile struct msp_exp_state_information *msp_exp_state_get(char addr);
+volatile struct msp_exp_state_information *msp_exp_state_initialize(msp_seqflags_t seqflags, char addr);
+msp_seqflags_t msp_exp_state_get_seqflags(char addr);
+int msp_exp_state_in_request(char addr);
 
 #endif /* MSP_EXP_STATE_H */
@@ -0,0 +1,135 @@
+/**
+ * @file      msp_trace.h
+ * @brief     Binary trace of the MSP state machine.
+ *
+ * @details
+ * If MSP_TRACE is defined, every frame that the experiment receives or sends
+ * and every fault that the MSP library detects is written as a fixed size
+ * record to a ring in RAM. The OBC downloads the ring with the custom request
+ * REQ_TRACE, and Host/msp_trace_decode turns it into a timeline of the MSP
+ * states. Otherwise the trace macros expand to nothing, the arguments are
+ * not evaluated and the ring takes no RAM.
+ *
+ * A record is 12 bytes when it is downloaded, all fields big endian:
+ *  - event (1 byte), one of the MSP_TRACE_* events below
+ *  - opcode (1 byte) of the frame, or of the transaction for a fault
+ *  - state (1 byte), the instance in the upper nibble and the state type
+ *    of msp_exp_state.h in the lower, after the event was handled
+ *  - frame-ID (1 byte)
+ *  - arg (4 bytes), see the events
+ *  - tick (4 bytes), msp_trace_tick() when the record was written
+ * The records follow a header of 8 bytes: the number of records lost since
+ * the last download and msp_trace_tick() when the download started.
+ *
+ * The ring has a single writer, the MSP callbacks, and a single reader, the
+ * REQ_TRACE handlers. Each one owns its own counter, and a record is written
+ * in full before the counter of the writer moves past it, so neither needs to
+ * turn interrupts off. msp_trace_put() must not interrupt itself, which holds
+ * as long as the MSP callbacks are not called from more than one context.
+ */
+
+#ifndef MSP_TRACE_H
+#define MSP_TRACE_H
+
+#include "msp_exp_definitions.h"
+#include "msp_exp_state.h"
+
+/* A frame was received and accepted, arg is the DL or the data length */
+#define MSP_TRACE_RX            0x01
+/* A frame was received and dropped, arg is the error code, negated */
+#define MSP_TRACE_RX_REJECTED   0x02
+/* A frame was sent, arg is the DL or the data length */
+#define MSP_TRACE_TX            0x03
+/* An opcode that MSP does not handle, arg is the DL */
+#define MSP_TRACE_UNKNOWN_OPCODE 0x10
+/* An acknowledgement that does not fit the state, arg is the DL */
+#define MSP_TRACE_UNEXPECTED_ACK 0x11
+/* An acknowledgement with the wrong frame-ID, arg is the expected one */
+#define MSP_TRACE_WRONG_FRAME_ID 0x12
+/* A WINDOW_ACK outside of the window, arg is the DL */
+#define MSP_TRACE_BAD_WINDOW_ACK 0x13
+/* The state did not allow the step, it is reset, arg is the state type */
+#define MSP_TRACE_STATE_ERROR   0x14
+/* The experiment gives up on the transaction, written before the state is
+ * reset, arg is the state type */
+#define MSP_TRACE_ABORTED       0x15
+
+/** The size of a downloaded record. */
+#define MSP_TRACE_RECORD_SIZE 12
+/** The size of the header of a download. */
+#define MSP_TRACE_HEADER_SIZE 8
+
+#ifdef MSP_TRACE
+
+#ifndef MSP_TRACE_SIZE
+/**
+ * @brief The number of records in the ring, a power of two.
+ */
+#define MSP_TRACE_SIZE 32
+#elif ((MSP_TRACE_SIZE) & ((MSP_TRACE_SIZE) - 1)) != 0
+#error MSP_TRACE_SIZE must be a power of two
+#endif
+
+/**
+ * @brief Writes a record to the trace.
+ * @param state The MSP state the event belongs to.
+ * @param event One of the MSP_TRACE_* events.
+ * @param opcode The opcode of the frame or the transaction.
+ * @param frame_id The frame-ID of the frame.
+ * @param arg Depends on the event.
+ */
+#define msp_trace(state,event,opcode,frame_id,arg) \
+	msp_trace_put((state),(event),(opcode),(frame_id),(arg))
+
+/**
+ * @brief Writes a record of a frame to the trace, the opcode, the frame-ID
+ *        and the DL or the data length are taken from the frame.
+ * @param state The MSP state the frame belongs to.
+ * @param event MSP_TRACE_RX or MSP_TRACE_TX.
+ * @param frame The frame.
+ * @param len The length of the frame.
+ */
+#define msp_trace_frame(state,event,frame,len) \
+	msp_trace_put_frame((state),(event),(frame),(len))
+
+void msp_trace_put(volatile struct msp_exp_state_information *state, unsigned char event, unsigned char opcode, unsigned char frame_id, unsigned long arg);
+void msp_trace_put_frame(volatile struct msp_exp_state_information *state, unsigned char event, const unsigned char *frame, unsigned long len);
+
+/**
+ * @brief Starts a download of the trace. The records that are sent can not
+ *        be overwritten until it ends.
+ * @return The number of bytes of the download.
+ */
+unsigned long msp_trace_open(void);
+
+/**
+ * @brief Copies a part of the download.
+ * @param buf Where the bytes are copied to.
+ * @param len The number of bytes.
+ * @param offset The offset of the first byte in the download.
+ */
+void msp_trace_copy(unsigned char *buf, unsigned long len, unsigned long offset);
+
+/**
+ * @brief Ends a download that the OBC has acknowledged, the records that
+ *        were sent are removed from the trace.
+ */
+void msp_trace_release(void);
+
+/**
+ * @brief Ends a download that failed, the records are sent again next time.
+ */
+void msp_trace_abort(void);
+
+/**
+ * @brief Returns the time of a record, implemented by the experiment.
+ * @return A free running counter, in milliseconds on this experiment.
+ */
+unsigned long msp_trace_tick(void);
+
+#else
+#define msp_trace(state,event,opcode,frame_id,arg)
+#define msp_trace_frame(state,event,frame,len)
+#endif
+
+#endif /* MSP_TRACE_H */
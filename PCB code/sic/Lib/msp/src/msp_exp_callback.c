@@ -8,9 +8,9 @@
  * Implements the MSP Callbacks defined in msp_exp_callback.h.
  */
 
-#include "msp_debug.h"
 #include "msp_endian.h"
 #include "msp_opcodes.h"
+#include "msp_trace.h"
 
 #include "msp_exp_callback.h"
 #include "msp_exp_definitions.h"
@@ -20,20 +20,54 @@
 #include "msp_exp_state.h"
 
 
-static int handle_incoming_frame(const unsigned char *frame, unsigned long len);
-static int handle_incoming_data_frame(const unsigned char *data, unsigned char frame_id, unsigned long len);
-static int handle_incoming_header_frame(unsigned char opcode, unsigned char frame_id, unsigned long dl);
-static int handle_incoming_control_frame(unsigned char opcode, unsigned char frame_id);
-static int handle_incoming_system_frame(unsigned char opcode, unsigned char frame_id);
-static int handle_incoming_request_frame(unsigned char opcode);
-static int handle_incoming_send_frame(unsigned char opcode, unsigned char frame_id, unsigned long dl);
+static int handle_incoming_frame(volatile struct msp_exp_state_information *state, const unsigned char *frame, unsigned long len);
+static int handle_incoming_data_frame(volatile struct msp_exp_state_information *state, const unsigned char *data, unsigned char frame_id, unsigned long len);
+static int handle_incoming_header_frame(volatile struct msp_exp_state_information *state, unsigned char opcode, unsigned char frame_id, unsigned long dl);
+static int handle_incoming_control_frame(volatile struct msp_exp_state_information *state, unsigned char opcode, unsigned char frame_id, unsigned long dl);
+static int handle_incoming_window_acknowledge(volatile struct msp_exp_state_information *state, unsigned long dl);
+static int handle_incoming_system_frame(volatile struct msp_exp_state_information *state, unsigned char opcode, unsigned char frame_id);
+static int handle_incoming_request_frame(volatile struct msp_exp_state_information *state, unsigned char opcode, unsigned long dl);
+static int handle_incoming_send_frame(volatile struct msp_exp_state_information *state, unsigned char opcode, unsigned char frame_id, unsigned long dl);
 
-static int handle_outgoing_frame(unsigned char *buf, unsigned long *len, char addr);
-static int handle_outgoing_response_frame(unsigned char *buf, unsigned long *len, char addr);
-static int handle_outgoing_data_frame(unsigned char *buf, unsigned long *len, char addr);
-static int handle_outgoing_acknowledge_frame(unsigned char *buf, unsigned long *len, char addr);
+static int handle_outgoing_frame(volatile struct msp_exp_state_information *state, unsigned char *buf, unsigned long *len);
+static int handle_outgoing_busy_frame(volatile struct msp_exp_state_information *state, unsigned char *buf, unsigned long *len);
+static int handle_outgoing_response_frame(volatile struct msp_exp_state_information *state, unsigned char *buf, unsigned long *len);
+static int handle_outgoing_data_frame(volatile struct msp_exp_state_information *state, unsigned char *buf, unsigned long *len);
+static int handle_outgoing_acknowledge_frame(volatile struct msp_exp_state_information *state, unsigned char *buf, unsigned long *len);
 
-static void ensure_ready_state(void);
+static void start_request(volatile struct msp_exp_state_information *state);
+static void ensure_ready_state(volatile struct msp_exp_state_information *state);
+static unsigned long next_data_frame(volatile struct msp_exp_state_information *state, unsigned char *head, int send);
+
+#ifndef MSP_LOW_MEMORY
+/*
+ * The data frames of an OBC Request are built in one of two buffers, which
+ * are shared by all addresses. The frame that an address sent last stays in
+ * its buffer until it is acknowledged, so that it can be sent again as it is,
+ * while the next frame is built in a buffer that no address is waiting on.
+ * Costs 2*MSP_EXP_MAX_FRAME_SIZE bytes of RAM, not used with MSP_LOW_MEMORY.
+ */
+struct prepared_frame {
+	unsigned char data[MSP_EXP_MAX_FRAME_SIZE];
+	unsigned long len;        /* Length of the whole frame, 0 if unused */
+	unsigned long offset;     /* Offset of the data field in the transaction */
+	unsigned char head;       /* First byte of the frame, opcode and frame-ID */
+	unsigned char sent;       /* Sent and not yet acknowledged */
+	volatile struct msp_exp_state_information *owner;
+};
+static struct prepared_frame prepared_frames[2];
+
+/* Header frames returned by msp_send_frame(), one for each address */
+static unsigned char header_frames[MSP_EXP_INSTANCES][9];
+static unsigned char unknown_frame[9];
+
+static struct prepared_frame *find_prepared_frame(volatile struct msp_exp_state_information *state, unsigned long offset, unsigned char head);
+static struct prepared_frame *prepare_frame(volatile struct msp_exp_state_information *state, unsigned long offset, unsigned char head, int evict);
+static struct prepared_frame *serve_prepared_frame(volatile struct msp_exp_state_information *state);
+static void release_prepared_frames(volatile struct msp_exp_state_information *state);
+#endif
+
+static unsigned long build_data_frame(volatile struct msp_exp_state_information *state, unsigned char *buf, unsigned long offset, unsigned char head);
 
 /*
  * Implementation of the MSP receive callback function. This function just
@@ -43,24 +77,38 @@ static void ensure_ready_state(void);
  * Arguments
  *  data: Pointer to the received data from the OBC. 
  *  len: Number of bytes received from the OBC.
+ *  addr: The I2C address that the OBC wrote the frame to.
  */
 int msp_recv_callback(const unsigned char *data, unsigned long len, char addr)
 {
+	volatile struct msp_exp_state_information *state;
 	int code;
 
-	if (!msp_exp_state.initialized) /* Check that we are initialized */
-		msp_exp_state_initialize(msp_seqflags_init());
-	else if (msp_exp_state.busy) /* If we are busy, just return */
+	state = msp_exp_state_get(addr);
+	if (state == 0) { /* Check that we are initialized */
+		state = msp_exp_state_initialize(msp_seqflags_init(), addr);
+		if (state == 0)
+			return MSP_EXP_ERR_STATE_ERROR;
+	} else if (state->busy) { /* If we are busy, just return */
+		msp_trace(state, MSP_TRACE_RX_REJECTED, len != 0 ? data[0] & 0x7F : 0, len != 0 ? data[0] >> 7 : 0, (unsigned long) -MSP_EXP_ERR_IS_BUSY);
 		return MSP_EXP_ERR_IS_BUSY;
+	}
 
 	/* Ignore the frame is the FCS is invalid. (from_obc = 1) */
-	if (!msp_exp_frame_fcs_valid(data, 1, len, addr))
+	if (!msp_exp_frame_rx_fcs_valid(data, len, addr)) {
+		msp_trace(state, MSP_TRACE_RX_REJECTED, len != 0 ? data[0] & 0x7F : 0, len != 0 ? data[0] >> 7 : 0, (unsigned long) -MSP_EXP_ERR_FCS_MISMATCH);
 		return MSP_EXP_ERR_FCS_MISMATCH;
+	}
 
 	/* Now mark the MSP state as busy and carry on */
-	msp_exp_state.busy = 1;
-	code = handle_incoming_frame(data, len);
-	msp_exp_state.busy = 0;
+	state->busy = 1;
+	code = handle_incoming_frame(state, data, len);
+	state->busy = 0;
+
+	if (code == 0)
+		msp_trace_frame(state, MSP_TRACE_RX, data, len);
+	else
+		msp_trace(state, MSP_TRACE_RX_REJECTED, data[0] & 0x7F, data[0] >> 7, (unsigned long) -code);
 
 	return code;
 }
@@ -76,31 +124,164 @@ int msp_recv_callback(const unsigned char *data, unsigned long len, char addr)
  *        in msp_exp_definitions.h)
  *  len: A pointer to a 32-bit unsigned int that represents the number of bytes
  *       to be sent.
+ *  addr: The I2C address that the OBC reads from.
  */
 int msp_send_callback(unsigned char *data, unsigned long *len, char addr)
 {
+	volatile struct msp_exp_state_information *state;
 	int code;
 
-	if (!msp_exp_state.initialized) {
+	state = msp_exp_state_get(addr);
+	if (state == 0) {
 		/* Check that we are initialized */
-		msp_exp_state_initialize(msp_seqflags_init());
-	} else if (msp_exp_state.busy) {
+		state = msp_exp_state_initialize(msp_seqflags_init(), addr);
+		if (state == 0) {
+			msp_exp_frame_format_empty_header(data, MSP_OP_NULL, addr);
+			*len = 9;
+
+			return MSP_EXP_ERR_STATE_ERROR;
+		}
+	} else if (state->busy) {
 		/* If we are busy, send a header telling the OBC that we are in the
 		 * process of handling a previous packet. */
 		msp_exp_frame_format_empty_header(data, MSP_OP_EXP_BUSY, addr);
 		*len = 9; /* length of header frame = 9 */
+		msp_trace_frame(state, MSP_TRACE_TX, data, *len);
 
 		return MSP_EXP_ERR_IS_BUSY;
 	}
 
 	/* Now mark the MSP state as busy and carry on */
-	msp_exp_state.busy = 1;
-	code = handle_outgoing_frame(data, len, addr);
-	msp_exp_state.busy = 0;
+	state->busy = 1;
+	code = handle_outgoing_frame(state, data, len);
+	state->busy = 0;
+	msp_trace_frame(state, MSP_TRACE_TX, data, *len);
+
+	return code;
+}
+
+#ifndef MSP_LOW_MEMORY
+/*
+ * Zero-copy version of msp_send_callback(). Data frames are served straight
+ * from the buffer they were prepared in, header frames from a static buffer
+ * of the address. The frame stays valid until the next call to
+ * msp_send_frame() or msp_send_callback() for the same address.
+ *
+ * Arguments
+ *  frame: Set to point to the frame to be sent.
+ *  len: Set to the number of bytes to be sent.
+ *  addr: The I2C address that the OBC reads from.
+ */
+int msp_send_frame(const unsigned char **frame, unsigned long *len, char addr)
+{
+	volatile struct msp_exp_state_information *state;
+	struct prepared_frame *prepared;
+	unsigned char *header_frame;
+	int code;
+
+	state = msp_exp_state_get(addr);
+	if (state == 0) {
+		state = msp_exp_state_initialize(msp_seqflags_init(), addr);
+		if (state == 0) {
+			msp_exp_frame_format_empty_header(unknown_frame, MSP_OP_NULL, addr);
+			*frame = unknown_frame;
+			*len = 9;
+
+			return MSP_EXP_ERR_STATE_ERROR;
+		}
+	}
+
+	header_frame = header_frames[state - msp_exp_states];
+	if (state->busy) {
+		msp_exp_frame_format_empty_header(header_frame, MSP_OP_EXP_BUSY, addr);
+		*frame = header_frame;
+		*len = 9;
+		msp_trace_frame(state, MSP_TRACE_TX, *frame, *len);
+
+		return MSP_EXP_ERR_IS_BUSY;
+	}
+
+	state->busy = 1;
+	if (state->type == MSP_EXP_STATE_OBC_REQ_TX &&
+	    state->processed_length < state->total_length) {
+		prepared = serve_prepared_frame(state);
+		*frame = prepared->data;
+		*len = prepared->len;
+		code = 0;
+	} else {
+		code = handle_outgoing_frame(state, header_frame, len);
+		*frame = header_frame;
+	}
+	state->busy = 0;
+	msp_trace_frame(state, MSP_TRACE_TX, *frame, *len);
 
 	return code;
 }
 
+/*
+ * Builds the data frame that the OBC will ask for next from an address, so
+ * that it is ready when the OBC reads it. Meant to be called when the
+ * experiment is otherwise idle. Once the current data frame has been sent, the
+ * frame after it is built in the other buffer, so that it can be sent as soon
+ * as the current one is acknowledged. Nothing is built while both buffers hold
+ * frames that are waiting for an acknowledgement.
+ *
+ * Returns 1 if a frame was built, otherwise 0.
+ */
+int msp_exp_prepare_next(char addr)
+{
+	volatile struct msp_exp_state_information *state;
+	struct prepared_frame *current;
+	unsigned long offset;
+	unsigned char head;
+	int prepared;
+
+	state = msp_exp_state_get(addr);
+	if (state == 0 || state->busy)
+		return 0;
+
+	state->busy = 1;
+	prepared = 0;
+
+	switch (state->type) {
+	case MSP_EXP_STATE_OBC_REQ_RESPONSE:
+		/* The first data frame follows the acknowledged response */
+		offset = 0;
+		if (state->tx_window > 1)
+			head = MSP_OP_WINDOW_DATA(0);
+		else
+			head = MSP_OP_DATA_FRAME | ((state->frame_id ^ 1) << 7);
+		break;
+	case MSP_EXP_STATE_OBC_REQ_TX:
+		offset = next_data_frame(state, &head, 0);
+		if (state->tx_window > 1)
+			break; /* The frame that the OBC reads next in the window */
+		current = find_prepared_frame(state, offset, head);
+		if (current != 0 && current->sent) {
+			/* Already sent, the OBC will ask for the next one */
+			offset += current->len - 5;
+			head ^= 0x80;
+		} else if (current != 0) {
+			/* Prepared, but not sent yet */
+			offset = state->total_length;
+		}
+		break;
+	default:
+		offset = state->total_length;
+		head = 0;
+		break;
+	}
+
+	if (offset < state->total_length && find_prepared_frame(state, offset, head) == 0)
+		prepared = prepare_frame(state, offset, head, 0) != 0;
+
+	state->busy = 0;
+
+	return prepared;
+}
+#endif
+
+
 
 
 /*---------------------------------------------------------------------------*/
@@ -116,7 +297,7 @@ int msp_send_callback(unsigned char *data, unsigned long *len, char addr)
  *  frame: The received bytes that make up the frame.
  *  len: The number of bytes received.
  */
-static int handle_incoming_frame(const unsigned char *frame, unsigned long len)
+static int handle_incoming_frame(volatile struct msp_exp_state_information *state, const unsigned char *frame, unsigned long len)
 {
 	unsigned char opcode;
 	unsigned char frame_id;
@@ -130,14 +311,14 @@ static int handle_incoming_frame(const unsigned char *frame, unsigned long len)
 		if (len < 6 || len > MSP_EXP_MAX_FRAME_SIZE)
 			return MSP_EXP_ERR_INVALID_DATA_FRAME;
 		else
-			return handle_incoming_data_frame(frame + 1, frame_id, len - 5);
+			return handle_incoming_data_frame(state, frame + 1, frame_id, len - 5);
 	} else {
 		/* Check that the header frame has length 9 */
 		if (len != 9) {
 			return MSP_EXP_ERR_INVALID_HEADER_FRAME;
 		} else {
 			dl = msp_from_bigendian32(frame + 1);
-			return handle_incoming_header_frame(opcode, frame_id, dl);
+			return handle_incoming_header_frame(state, opcode, frame_id, dl);
 		}
 	}
 }
@@ -161,27 +342,27 @@ static int handle_incoming_frame(const unsigned char *frame, unsigned long len)
  *  frame_id: Frame-ID of the frame.
  *  len: Length of the data field in the frame.
  */
-static int handle_incoming_data_frame(const unsigned char *data, unsigned char frame_id, unsigned long len)
+static int handle_incoming_data_frame(volatile struct msp_exp_state_information *state, const unsigned char *data, unsigned char frame_id, unsigned long len)
 {
 	/* We should only receive data frames in the OBC Send state */
-	if (msp_exp_state.type != MSP_EXP_STATE_OBC_SEND_RX)
+	if (state->type != MSP_EXP_STATE_OBC_SEND_RX)
 		return MSP_EXP_ERR_UNEXPECTED_DATA_FRAME;
 
 	/* Check that the frame-ID is different from the previous frame */
-	if (frame_id == msp_exp_state.last_received_frame_id)
+	if (frame_id == state->last_received_frame_id)
 		return MSP_EXP_ERR_DUPLICATE_FRAME;
 
 	/* Check that we are not receiving more data than we are expecting */
-	if (msp_exp_state.processed_length + len > msp_exp_state.total_length)
+	if (state->processed_length + len > state->total_length)
 		return MSP_EXP_ERR_INVALID_DATA_FRAME;
 
 	/* All seems good. This is a data frame that we have previously not
 	 * encountered. So we can safely send it up to the exprecv handler. */
-	msp_exprecv_data(msp_exp_state.opcode, data, len, msp_exp_state.processed_length);
+	msp_exprecv_data(state->opcode, data, len, state->processed_length);
 
 	/* Update the number of processed bytes */
-	msp_exp_state.processed_length += len;
-	msp_exp_state.last_received_frame_id = frame_id;
+	state->processed_length += len;
+	state->last_received_frame_id = frame_id;
 
 	return 0;
 }
@@ -194,7 +375,7 @@ static int handle_incoming_data_frame(const unsigned char *data, unsigned char f
  *  frame_id: Frame-ID of the frame.
  *  dl: The value of the DL field in the frame.
  */
-static int handle_incoming_header_frame(unsigned char opcode, unsigned char frame_id, unsigned long dl)
+static int handle_incoming_header_frame(volatile struct msp_exp_state_information *state, unsigned char opcode, unsigned char frame_id, unsigned long dl)
 {
 	int code;
 
@@ -202,20 +383,20 @@ static int handle_incoming_header_frame(unsigned char opcode, unsigned char fram
 	 * header based on the type. */
 	switch (MSP_OP_TYPE(opcode)) {
 	case MSP_OP_TYPE_CTRL:
-		code = handle_incoming_control_frame(opcode, frame_id);
+		code = handle_incoming_control_frame(state, opcode, frame_id, dl);
 		break;
 	case MSP_OP_TYPE_SYS:
-		code = handle_incoming_system_frame(opcode, frame_id);
+		code = handle_incoming_system_frame(state, opcode, frame_id);
 		break;
 	case MSP_OP_TYPE_REQ:
-		code = handle_incoming_request_frame(opcode);
+		code = handle_incoming_request_frame(state, opcode, dl);
 		break;
 	case MSP_OP_TYPE_SEND:
-		code = handle_incoming_send_frame(opcode, frame_id, dl);
+		code = handle_incoming_send_frame(state, opcode, frame_id, dl);
 		break;
 	default:
 		code = MSP_EXP_ERR_FAULTY_FRAME;
-		msp_debug_hex("Unknown opcode type for ", opcode);
+		msp_trace(state, MSP_TRACE_UNKNOWN_OPCODE, opcode, frame_id, dl);
 		break;
 	}
 
@@ -227,8 +408,9 @@ static int handle_incoming_header_frame(unsigned char opcode, unsigned char fram
  * Arguments
  *  opcode: OP-code of the header.
  *  frame_id: Frame-ID of the frame.
+ *  dl: The value of the DL field in the frame.
  */
-static int handle_incoming_control_frame(unsigned char opcode, unsigned char frame_id)
+static int handle_incoming_control_frame(volatile struct msp_exp_state_information *state, unsigned char opcode, unsigned char frame_id, unsigned long dl)
 {
 	int code;
 
@@ -237,61 +419,120 @@ static int handle_incoming_control_frame(unsigned char opcode, unsigned char fra
 		/* If we received a NULL frame, we should always go back to the READY
 		 * state. If we were in a state previously, we need to send and error
 		 * notifying that we have aborted the transaction. */
-		ensure_ready_state();
+		ensure_ready_state(state);
 		code = 0;
 		break;
 	case MSP_OP_F_ACK:
-		if (msp_exp_state.processed_length + msp_exp_state.prev_data_length >= msp_exp_state.total_length) {
+		if (state->tx_window > 1 &&
+		    (state->type == MSP_EXP_STATE_OBC_REQ_RESPONSE ||
+		     state->type == MSP_EXP_STATE_OBC_REQ_TX)) {
+			code = MSP_EXP_ERR_FAULTY_FRAME;
+			msp_trace(state, MSP_TRACE_UNEXPECTED_ACK, opcode, frame_id, dl);
+		} else if (state->processed_length + state->prev_data_length >= state->total_length) {
 			/* We should get T_ACK in this situation */
 			code = MSP_EXP_ERR_FAULTY_FRAME;
-			msp_debug("Got an F_ACK when we should've gotten a T_ACK");
-		} else if (frame_id != msp_exp_state.frame_id) {
+			msp_trace(state, MSP_TRACE_UNEXPECTED_ACK, opcode, frame_id, dl);
+		} else if (frame_id != state->frame_id) {
 			code = MSP_EXP_ERR_FAULTY_FRAME;
-			msp_debug("Frame-ID of F_ACK does not match up with last sent frame.");
-		} else if (msp_exp_state.type == MSP_EXP_STATE_OBC_REQ_RESPONSE) {
+			msp_trace(state, MSP_TRACE_WRONG_FRAME_ID, opcode, frame_id, state->frame_id);
+		} else if (state->type == MSP_EXP_STATE_OBC_REQ_RESPONSE) {
 			/* Response Acknowledged, start transmission of data. */
-			msp_exp_state.processed_length = 0;
-			msp_exp_state.frame_id ^= 1;
-			msp_exp_state.type = MSP_EXP_STATE_OBC_REQ_TX;
+			state->processed_length = 0;
+			state->frame_id ^= 1;
+			state->type = MSP_EXP_STATE_OBC_REQ_TX;
 			code = 0;
-		} else if (msp_exp_state.type == MSP_EXP_STATE_OBC_REQ_TX) {
+		} else if (state->type == MSP_EXP_STATE_OBC_REQ_TX) {
 			/* Data frame acknowledged, prepare the next data */
-			msp_exp_state.processed_length += msp_exp_state.prev_data_length;
-			msp_exp_state.frame_id ^= 1;
+			state->processed_length += state->prev_data_length;
+			state->frame_id ^= 1;
 			code = 0;
 		} else {
 			code = MSP_EXP_ERR_FAULTY_FRAME;
-			msp_debug("Received F_ACK when not sending any data.");
+			msp_trace(state, MSP_TRACE_UNEXPECTED_ACK, opcode, frame_id, dl);
 		}
 		break;
 	case MSP_OP_T_ACK:
 		/* We should only get this frame if we are in an OBC Request situation. */
-		if (!(msp_exp_state.type == MSP_EXP_STATE_OBC_REQ_RESPONSE ||
-			  msp_exp_state.type == MSP_EXP_STATE_OBC_REQ_TX)) {
+		if (!(state->type == MSP_EXP_STATE_OBC_REQ_RESPONSE ||
+			  state->type == MSP_EXP_STATE_OBC_REQ_TX)) {
 			code = MSP_EXP_ERR_FAULTY_FRAME;
-			msp_debug("Received T_ACK when not in a request state.");
-		} else if (frame_id != msp_exp_state.transaction_id) {
+			msp_trace(state, MSP_TRACE_UNEXPECTED_ACK, opcode, frame_id, dl);
+		} else if (frame_id != state->transaction_id) {
 			/* The transaction ID of the transaction does not match up with
 			 * the T_ACK. */
 			code = MSP_EXP_ERR_FAULTY_FRAME;
-			msp_debug_int("T_ACK should have frame-ID ", msp_exp_state.transaction_id);
+			msp_trace(state, MSP_TRACE_WRONG_FRAME_ID, opcode, frame_id, state->transaction_id);
 		} else {
 			/* Transaction Acknowledged. Call the handler function, increment
 			 * the sequence flag, and move to the Ready state. */
-			msp_expsend_complete(msp_exp_state.opcode);
-			msp_seqflags_set(&msp_exp_state.seqflags, msp_exp_state.opcode, frame_id);
-			msp_exp_state.type = MSP_EXP_STATE_READY;
+			if (state->opcode != MSP_OP_REQ_WINDOW)
+				msp_expsend_complete(state->opcode);
+			msp_seqflags_set(&state->seqflags, state->opcode, frame_id);
+			state->type = MSP_EXP_STATE_READY;
 			code = 0;
 		}
 		break;
+	case MSP_OP_WINDOW_ACK:
+		code = handle_incoming_window_acknowledge(state, dl);
+		break;
 	default:
 		code = MSP_EXP_ERR_FAULTY_FRAME;
-		msp_debug_hex("Received unhandlable control flow opcode: ", opcode);
+		msp_trace(state, MSP_TRACE_UNKNOWN_OPCODE, opcode, frame_id, dl);
 		break;
 	}
 
 	return code;
 }
+/*
+ * Handles an incoming WINDOW_ACK header frame. It acknowledges every data
+ * frame before the offset in the DL field, the frames after it are sent
+ * again. A WINDOW_ACK with DL = 0 also acknowledges the response header.
+ *
+ * Arguments
+ *  dl: The value of the DL field in the frame.
+ */
+static int handle_incoming_window_acknowledge(volatile struct msp_exp_state_information *state, unsigned long dl)
+{
+	unsigned long acknowledged;
+
+	if (state->tx_window <= 1 ||
+	    !(state->type == MSP_EXP_STATE_OBC_REQ_RESPONSE ||
+	      state->type == MSP_EXP_STATE_OBC_REQ_TX)) {
+		msp_trace(state, MSP_TRACE_UNEXPECTED_ACK, MSP_OP_WINDOW_ACK, 0, dl);
+		return MSP_EXP_ERR_FAULTY_FRAME;
+	}
+
+	if (state->type == MSP_EXP_STATE_OBC_REQ_RESPONSE) {
+		if (dl != 0) {
+			msp_trace(state, MSP_TRACE_UNEXPECTED_ACK, MSP_OP_WINDOW_ACK, 0, dl);
+			return MSP_EXP_ERR_FAULTY_FRAME;
+		}
+		/* Response Acknowledged, start transmission of data. */
+		state->processed_length = 0;
+		state->tx_seq = 0;
+		state->tx_sent = 0;
+		state->type = MSP_EXP_STATE_OBC_REQ_TX;
+		return 0;
+	}
+
+	/* The data before the offset has been received in full frames, the OBC
+	 * sends a T_ACK instead once it has received all of it. */
+	if (dl < state->processed_length || dl >= state->total_length) {
+		msp_trace(state, MSP_TRACE_BAD_WINDOW_ACK, MSP_OP_WINDOW_ACK, 0, dl);
+		return MSP_EXP_ERR_FAULTY_FRAME;
+	}
+	acknowledged = dl - state->processed_length;
+	if (acknowledged % MSP_EXP_MTU != 0 || acknowledged / MSP_EXP_MTU > state->tx_window) {
+		msp_trace(state, MSP_TRACE_BAD_WINDOW_ACK, MSP_OP_WINDOW_ACK, 0, dl);
+		return MSP_EXP_ERR_FAULTY_FRAME;
+	}
+
+	state->processed_length = dl;
+	state->tx_seq = (state->tx_seq + acknowledged / MSP_EXP_MTU) & MSP_WINDOW_SEQ_MASK;
+	state->tx_sent = 0;
+
+	return 0;
+}
 /*
  * Handles an incoming system control header frame.
  * 
@@ -299,25 +540,25 @@ static int handle_incoming_control_frame(unsigned char opcode, unsigned char fra
  *  opcode: OP-code of the frame.
  *  frame_id: Frame-ID of the frame.
  */
-static int handle_incoming_system_frame(unsigned char opcode, unsigned char frame_id)
+static int handle_incoming_system_frame(volatile struct msp_exp_state_information *state, unsigned char opcode, unsigned char frame_id)
 {
-	ensure_ready_state();
+	ensure_ready_state(state);
 
-	msp_exp_state.transaction_id = frame_id;
-	msp_exp_state.last_received_frame_id = frame_id;
-	msp_exp_state.opcode = opcode;
-	msp_exp_state.total_length = 0;
-	msp_exp_state.processed_length = 0;
-	msp_exp_state.prev_data_length = 0;
+	state->transaction_id = frame_id;
+	state->last_received_frame_id = frame_id;
+	state->opcode = opcode;
+	state->total_length = 0;
+	state->processed_length = 0;
+	state->prev_data_length = 0;
 
 	/* Do not call handler here, wait until we have acknowledged the
 	 * transaction and that it is different from the previous transaction. */
 
 	/* Set the MSP state */
-	if (msp_seqflags_is_set(&msp_exp_state.seqflags, opcode, frame_id)) {
-		msp_exp_state.type = MSP_EXP_STATE_OBC_SEND_RX_DUPLICATE;
+	if (msp_seqflags_is_set(&state->seqflags, opcode, frame_id)) {
+		state->type = MSP_EXP_STATE_OBC_SEND_RX_DUPLICATE;
 	} else {
-		msp_exp_state.type = MSP_EXP_STATE_OBC_SEND_RX;
+		state->type = MSP_EXP_STATE_OBC_SEND_RX;
 	}
 
 	return 0;
@@ -327,27 +568,50 @@ static int handle_incoming_system_frame(unsigned char opcode, unsigned char fram
  * 
  * Arguments
  *  opcode: OP-code of the frame.
+ *  dl: The value of the DL field in the frame, the window that the OBC asks
+ *      for. Always 0 in classic MSP.
  */
-static int handle_incoming_request_frame(unsigned char opcode)
+static int handle_incoming_request_frame(volatile struct msp_exp_state_information *state, unsigned char opcode, unsigned long dl)
 {
-	unsigned long data_to_send;
-
-	ensure_ready_state();
-
-	msp_exp_state.transaction_id = msp_seqflags_get_next(&msp_exp_state.seqflags, opcode);
-	msp_exp_state.frame_id = msp_exp_state.transaction_id;
-	msp_exp_state.opcode = opcode;
-	msp_exp_state.processed_length = 0;
-	msp_exp_state.prev_data_length = 0;
+	ensure_ready_state(state);
+
+	state->transaction_id = msp_seqflags_get_next(&state->seqflags, opcode);
+	state->frame_id = state->transaction_id;
+	state->opcode = opcode;
+	state->processed_length = 0;
+	state->prev_data_length = 0;
+	state->tx_window = 1;
+#ifndef MSP_LOW_MEMORY
+	/* Frames prepared for an earlier transaction are no longer valid */
+	release_prepared_frames(state);
+#endif
+
+	if (opcode == MSP_OP_REQ_WINDOW) {
+		/* Handled by MSP. The OBC offers a window in DL and is sent the
+		 * window that will be used, which applies from the next request. */
+		if (dl < 1)
+			state->window = 1;
+		else if (dl > MSP_EXP_WINDOW)
+			state->window = MSP_EXP_WINDOW;
+		else
+			state->window = (unsigned char) dl;
+		state->total_length = 1;
+		state->type = MSP_EXP_STATE_OBC_REQ_RESPONSE;
+		return 0;
+	}
 
-	data_to_send = 0;
-        
-	msp_expsend_start(opcode, &data_to_send);
-	
-	msp_exp_state.total_length = data_to_send;
+	/* A windowed transfer is only used if it has been negotiated */
+	if (state->window > 1 && dl > 1 && dl <= state->window)
+		state->tx_window = (unsigned char) dl;
 
-	/* OBC Send state */
-	msp_exp_state.type = MSP_EXP_STATE_OBC_REQ_RESPONSE;
+	if (msp_expsend_busy_time(opcode) != 0) {
+		/* Answer with EXP_BUSY until the experiment is ready, the transaction
+		 * is started first then. */
+		state->total_length = 0;
+		state->type = MSP_EXP_STATE_OBC_REQ_BUSY;
+	} else {
+		start_request(state);
+	}
 
 	return 0;
 }
@@ -359,21 +623,21 @@ static int handle_incoming_request_frame(unsigned char opcode)
  *  frame_id: Frame-ID of the frame.
  *  dl: The value of the DL field in the frame.
  */
-static int handle_incoming_send_frame(unsigned char opcode, unsigned char frame_id, unsigned long dl)
+static int handle_incoming_send_frame(volatile struct msp_exp_state_information *state, unsigned char opcode, unsigned char frame_id, unsigned long dl)
 {
-	ensure_ready_state();
+	ensure_ready_state(state);
 
-	msp_exp_state.transaction_id = frame_id;
-	msp_exp_state.last_received_frame_id = frame_id;
-	msp_exp_state.opcode = opcode;
-	msp_exp_state.total_length = dl;
-	msp_exp_state.processed_length = 0;
+	state->transaction_id = frame_id;
+	state->last_received_frame_id = frame_id;
+	state->opcode = opcode;
+	state->total_length = dl;
+	state->processed_length = 0;
 
 	/* Set the MSP state */
-	if (msp_seqflags_is_set(&msp_exp_state.seqflags, opcode, frame_id)) {
-		msp_exp_state.type = MSP_EXP_STATE_OBC_SEND_RX_DUPLICATE;
+	if (msp_seqflags_is_set(&state->seqflags, opcode, frame_id)) {
+		state->type = MSP_EXP_STATE_OBC_SEND_RX_DUPLICATE;
 	} else {
-		msp_exp_state.type = MSP_EXP_STATE_OBC_SEND_RX;
+		state->type = MSP_EXP_STATE_OBC_SEND_RX;
 		
 		/* If this is not a duplicate, then we call the appropriate handler to
 		 * setup all the data. */
@@ -398,39 +662,68 @@ static int handle_incoming_send_frame(unsigned char opcode, unsigned char frame_
  *  len: Pointer to an integer which represents the length of the outgoing 
  *       data.
  */
-static int handle_outgoing_frame(unsigned char *buf, unsigned long *len, char addr)
+static int handle_outgoing_frame(volatile struct msp_exp_state_information *state, unsigned char *buf, unsigned long *len)
 {
 	int code;
 
-	switch (msp_exp_state.type) {
+	switch (state->type) {
 	case MSP_EXP_STATE_READY:
-		msp_exp_frame_format_empty_header(buf, MSP_OP_NULL, addr);
+		msp_exp_frame_format_empty_header(buf, MSP_OP_NULL, state->addr);
 		*len = 9;
 		code = 0;
 		break;
+	case MSP_EXP_STATE_OBC_REQ_BUSY:
+		code = handle_outgoing_busy_frame(state, buf, len);
+		break;
 	case MSP_EXP_STATE_OBC_REQ_RESPONSE:
-		code = handle_outgoing_response_frame(buf, len, addr);
+		code = handle_outgoing_response_frame(state, buf, len);
 		break;
 	case MSP_EXP_STATE_OBC_REQ_TX:
-		code = handle_outgoing_data_frame(buf, len, addr);
+		code = handle_outgoing_data_frame(state, buf, len);
 		break;
 	case MSP_EXP_STATE_OBC_SEND_RX:
 	case MSP_EXP_STATE_OBC_SEND_RX_DUPLICATE:
-		code = handle_outgoing_acknowledge_frame(buf, len, addr);
+		code = handle_outgoing_acknowledge_frame(state, buf, len);
 		break;
 	default:
 		/* If we are in some form of erroneous state, go into the Ready state
 		 * and send a NULL frame. */
-		ensure_ready_state();
-		msp_exp_frame_format_empty_header(buf, MSP_OP_NULL, addr);
+		msp_trace(state, MSP_TRACE_STATE_ERROR, state->opcode, state->frame_id, state->type);
+		ensure_ready_state(state);
+		msp_exp_frame_format_empty_header(buf, MSP_OP_NULL, state->addr);
 		*len = 9;
 		code = MSP_EXP_ERR_STATE_ERROR;
-		msp_debug("invalid state type");
 		break;
 	}
 
 	return code;
 }
+/*
+ * Handles an outgoing frame to an OBC Request that the experiment was not
+ * ready to serve. Sends EXP_BUSY with the number of milliseconds until the
+ * experiment expects to be ready in the DL field, or the response header once
+ * it is ready.
+ *
+ * Arguments
+ *  buf: Pointer to the buffer where the frame will be stored.
+ *  len: Pointer to an integer which represents the length of the outgoing 
+ *       data.
+ */
+static int handle_outgoing_busy_frame(volatile struct msp_exp_state_information *state, unsigned char *buf, unsigned long *len)
+{
+	unsigned long busy_time;
+
+	busy_time = msp_expsend_busy_time(state->opcode);
+	if (busy_time == 0) {
+		start_request(state);
+		return handle_outgoing_response_frame(state, buf, len);
+	}
+
+	msp_exp_frame_format_header(buf, MSP_OP_EXP_BUSY, state->transaction_id, busy_time, state->addr);
+	*len = 9;
+
+	return 0;
+}
 /*
  * Handles an outgoing response frame to an OBC Request.
  *
@@ -439,11 +732,14 @@ static int handle_outgoing_frame(unsigned char *buf, unsigned long *len, char ad
  *  len: Pointer to an integer which represents the length of the outgoing 
  *       data.
  */
-static int handle_outgoing_response_frame(unsigned char *buf, unsigned long *len, char addr)
+static int handle_outgoing_response_frame(volatile struct msp_exp_state_information *state, unsigned char *buf, unsigned long *len)
 {
+	unsigned char opcode;
+
 	/* Format a header saying how much we are going to send. State and frame-ID
 	 * is only updated first when we receive an acknowledge frame. */
-	msp_exp_frame_format_header(buf, MSP_OP_EXP_SEND, msp_exp_state.transaction_id, msp_exp_state.total_length, addr);
+	opcode = state->tx_window > 1 ? MSP_OP_EXP_SEND_WINDOW : MSP_OP_EXP_SEND;
+	msp_exp_frame_format_header(buf, opcode, state->transaction_id, state->total_length, state->addr);
 	*len = 9;
 
 	return 0;
@@ -456,44 +752,229 @@ static int handle_outgoing_response_frame(unsigned char *buf, unsigned long *len
  *  len: Pointer to an integer which represents the length of the outgoing 
  *       data.
  */
-static int handle_outgoing_data_frame(unsigned char *buf, unsigned long *len, char addr)
+static int handle_outgoing_data_frame(volatile struct msp_exp_state_information *state, unsigned char *buf, unsigned long *len)
 {
-	unsigned long send_len, remaining_len;
-	unsigned long fcs;
+#ifndef MSP_LOW_MEMORY
+	struct prepared_frame *prepared;
+	unsigned long i;
+#else
+	unsigned long offset;
+	unsigned char head;
+#endif
 
 	/* If we have nothing left to send, something has gone very wrong. Send a
 	 * NULL frame to the OBC and go to the ready state. */
-	if (msp_exp_state.processed_length >= msp_exp_state.total_length) {
-		ensure_ready_state();
-		msp_exp_frame_format_empty_header(buf, MSP_OP_NULL, addr);
+	if (state->processed_length >= state->total_length) {
+		msp_trace(state, MSP_TRACE_STATE_ERROR, state->opcode, state->frame_id, state->type);
+		ensure_ready_state(state);
+		msp_exp_frame_format_empty_header(buf, MSP_OP_NULL, state->addr);
 		*len = 9;
-		msp_debug("trying to send empty data frame");
 		return MSP_EXP_ERR_STATE_ERROR;
 	}
 
+#ifndef MSP_LOW_MEMORY
+	prepared = serve_prepared_frame(state);
+	for (i = 0; i < prepared->len; i++)
+		buf[i] = prepared->data[i];
+	*len = prepared->len;
+#else
+	offset = next_data_frame(state, &head, 1);
+	*len = build_data_frame(state, buf, offset, head);
+
+	/* This is needed for when we receive acknowledgments */
+	state->prev_data_length = *len - 5;
+#endif
+
+	return 0;
+}
+/*
+ * Picks the data frame that is sent when the OBC reads one and returns the
+ * offset of its data field.
+ *
+ * In a windowed transfer the frames after the acknowledged ones are sent one
+ * after the other. If the whole window has been sent and the OBC reads again,
+ * it has missed a frame or its acknowledgement was lost, and the window is
+ * sent again from the start.
+ *
+ * Arguments
+ *  head: Set to the first byte of the frame, opcode and frame-ID.
+ *  send: Non-zero if the frame is sent, 0 to only look at it.
+ */
+static unsigned long next_data_frame(volatile struct msp_exp_state_information *state, unsigned char *head, int send)
+{
+	unsigned long offset;
+	unsigned char sent;
+
+	if (state->tx_window <= 1) {
+		*head = MSP_OP_DATA_FRAME | (state->frame_id << 7);
+		return state->processed_length;
+	}
+
+	sent = state->tx_sent;
+	offset = state->processed_length + (unsigned long) sent * MSP_EXP_MTU;
+	if (sent >= state->tx_window || offset >= state->total_length) {
+		sent = 0;
+		offset = state->processed_length;
+	}
+	if (send)
+		state->tx_sent = sent + 1;
+
+	sent = (state->tx_seq + sent) & MSP_WINDOW_SEQ_MASK;
+	*head = MSP_OP_WINDOW_DATA(sent) | ((sent & 0x01) << 7);
+
+	return offset;
+}
+/*
+ * Builds a data frame of the current transaction. Only the FCS fields of the
+ * MSP state are changed.
+ *
+ * Arguments
+ *  buf: Pointer to the buffer where the frame will be stored.
+ *  offset: Offset of the data field in the transaction.
+ *  head: First byte of the frame, opcode and frame-ID.
+ *
+ * Returns the length of the whole frame.
+ */
+static unsigned long build_data_frame(volatile struct msp_exp_state_information *state, unsigned char *buf, unsigned long offset, unsigned char head)
+{
+	unsigned long send_len, remaining_len;
+	unsigned long fcs;
+
 	/* Calculate how many bytes that are to be sent. */
 	send_len = MSP_EXP_MTU;
-	remaining_len = msp_exp_state.total_length - msp_exp_state.processed_length;
+	remaining_len = state->total_length - offset;
 	if (remaining_len < MSP_EXP_MTU) {
 		send_len = remaining_len;
 	}
 
-	/* This is needed for when we receive acknowledgments */
-	msp_exp_state.prev_data_length = send_len;
-
-	/* All good, now lets fill up the buffer with data. */
-	buf[0] = MSP_OP_DATA_FRAME | (msp_exp_state.frame_id << 7);
-        msp_expsend_data(msp_exp_state.opcode, buf + 1, send_len, msp_exp_state.processed_length);
-
-	/* Generate and format the Frame Check Sequence (from_obc = 0) */
-	fcs = msp_exp_frame_generate_fcs(buf, 0, send_len+1, addr);
+	/* All good, now lets fill up the buffer with data. The FCS (from_obc = 0)
+	 * is started here and updated by the handler as it writes the data. */
+	buf[0] = head;
+	msp_exp_fcs.tx_fcs = msp_exp_frame_fcs_update(msp_exp_frame_fcs_init(0, state->addr), buf, 1);
+	msp_exp_fcs.tx_fcs_length = 0;
+	if (state->opcode == MSP_OP_REQ_WINDOW)
+		buf[1] = state->window; /* the negotiated window */
+	else
+		msp_expsend_data(state->opcode, buf + 1, send_len, offset);
+
+	/* Add the part of the data field that the handler did not add itself */
+	if (msp_exp_fcs.tx_fcs_length <= send_len) {
+		fcs = msp_exp_frame_fcs_update(msp_exp_fcs.tx_fcs,
+				buf + 1 + msp_exp_fcs.tx_fcs_length,
+				send_len - msp_exp_fcs.tx_fcs_length);
+		fcs = msp_exp_frame_fcs_final(fcs);
+	} else {
+		fcs = msp_exp_frame_generate_fcs(buf, 0, send_len+1, state->addr);
+	}
 	msp_to_bigendian32(buf + (send_len + 1), fcs);
 
-	/* Set the total length of the frame */
-	*len = send_len+5;
+	/* The total length of the frame */
+	return send_len+5;
+}
+#ifndef MSP_LOW_MEMORY
+/*
+ * Looks for a data frame of the current transaction of an address that has
+ * already been built. Returns 0 if there is none.
+ */
+static struct prepared_frame *find_prepared_frame(volatile struct msp_exp_state_information *state, unsigned long offset, unsigned char head)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (prepared_frames[i].len != 0 &&
+		    prepared_frames[i].owner == state &&
+		    prepared_frames[i].offset == offset &&
+		    prepared_frames[i].head == head)
+			return &prepared_frames[i];
+	}
 
 	return 0;
 }
+/*
+ * Builds a data frame in a buffer that does not hold a frame that is waiting
+ * for an acknowledgement. A buffer that is unused or already belongs to the
+ * address is taken before one that holds a frame prepared for another
+ * address. Returns 0 if every buffer is waiting.
+ *
+ * Arguments
+ *  evict: Non-zero if the frame is sent now, it may then take a frame that
+ *         was built ahead for another address that is in a request. Frames
+ *         built ahead never take each other's buffer, or two addresses would
+ *         keep building their next frames in turns.
+ */
+static struct prepared_frame *prepare_frame(volatile struct msp_exp_state_information *state, unsigned long offset, unsigned char head, int evict)
+{
+	struct prepared_frame *frame;
+	int i;
+
+	frame = 0;
+	for (i = 0; i < 2; i++) {
+		if (prepared_frames[i].len != 0 && prepared_frames[i].sent &&
+		    prepared_frames[i].owner->type == MSP_EXP_STATE_OBC_REQ_TX)
+			continue;
+		if (!evict && prepared_frames[i].len != 0 && prepared_frames[i].owner != state &&
+		    (prepared_frames[i].owner->type == MSP_EXP_STATE_OBC_REQ_RESPONSE ||
+		     prepared_frames[i].owner->type == MSP_EXP_STATE_OBC_REQ_TX))
+			continue;
+		if (frame == 0 || prepared_frames[i].len == 0 || prepared_frames[i].owner == state)
+			frame = &prepared_frames[i];
+	}
+	if (frame == 0)
+		return 0;
+
+	frame->len = 0;
+	frame->offset = offset;
+	frame->head = head;
+	frame->sent = 0;
+	frame->owner = state;
+	frame->len = build_data_frame(state, frame->data, offset, head);
+
+	return frame;
+}
+/*
+ * Returns the current data frame of an address, building it first if it has
+ * not been prepared, and marks it as sent. The frame that the address sent
+ * before is no longer waiting, either it is sent again or it has been
+ * acknowledged, so there is always a buffer to build in.
+ */
+static struct prepared_frame *serve_prepared_frame(volatile struct msp_exp_state_information *state)
+{
+	struct prepared_frame *frame;
+	unsigned long offset;
+	unsigned char head;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (prepared_frames[i].owner == state)
+			prepared_frames[i].sent = 0;
+	}
+
+	offset = next_data_frame(state, &head, 1);
+	frame = find_prepared_frame(state, offset, head);
+	if (frame == 0)
+		frame = prepare_frame(state, offset, head, 1);
+	frame->sent = 1;
+
+	/* This is needed for when we receive acknowledgments */
+	state->prev_data_length = frame->len - 5;
+
+	return frame;
+}
+/*
+ * Drops the frames that were prepared for an address.
+ */
+static void release_prepared_frames(volatile struct msp_exp_state_information *state)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (prepared_frames[i].owner == state) {
+			prepared_frames[i].len = 0;
+			prepared_frames[i].sent = 0;
+		}
+	}
+}
+#endif
 /*
  * Handles an outgoing acknowledge frame. Also handles the case where we
  * receive a duplicate OBC Send transaction.
@@ -503,47 +984,47 @@ static int handle_outgoing_data_frame(unsigned char *buf, unsigned long *len, ch
  *  len: Pointer to an integer which represents the length of the outgoing 
  *       data.
  */
-static int handle_outgoing_acknowledge_frame(unsigned char *buf, unsigned long *len, char addr)
+static int handle_outgoing_acknowledge_frame(volatile struct msp_exp_state_information *state, unsigned char *buf, unsigned long *len)
 {
 	int code;
 	unsigned char opcode;
 	unsigned char transaction_id;
 
-	if (msp_exp_state.type == MSP_EXP_STATE_OBC_SEND_RX_DUPLICATE) {
-		msp_exp_frame_format_header(buf, MSP_OP_T_ACK, msp_exp_state.transaction_id, 0, addr);
+	if (state->type == MSP_EXP_STATE_OBC_SEND_RX_DUPLICATE) {
+		msp_exp_frame_format_header(buf, MSP_OP_T_ACK, state->transaction_id, 0, state->addr);
 		*len = 9;
-		msp_exp_state.type = MSP_EXP_STATE_READY;
+		state->type = MSP_EXP_STATE_READY;
 		return 0;
 	}
 
 	code = 0;
 
 	/* Now check if we need to T_ACK an actual transaction */
-	if (msp_exp_state.processed_length >= msp_exp_state.total_length) {
-		msp_exp_frame_format_header(buf, MSP_OP_T_ACK, msp_exp_state.transaction_id, 0, addr);
+	if (state->processed_length >= state->total_length) {
+		msp_exp_frame_format_header(buf, MSP_OP_T_ACK, state->transaction_id, 0, state->addr);
 		*len = 9;
-		msp_exp_state.type = MSP_EXP_STATE_READY;
+		state->type = MSP_EXP_STATE_READY;
 
-		opcode = msp_exp_state.opcode;
-		transaction_id = msp_exp_state.transaction_id;
+		opcode = state->opcode;
+		transaction_id = state->transaction_id;
 
-		switch (MSP_OP_TYPE(msp_exp_state.opcode)) {
+		switch (MSP_OP_TYPE(state->opcode)) {
 		case MSP_OP_TYPE_SYS:
-			msp_exprecv_syscommand(msp_exp_state.opcode);
-			msp_seqflags_set(&msp_exp_state.seqflags, opcode, transaction_id);
+			msp_exprecv_syscommand(state->opcode);
+			msp_seqflags_set(&state->seqflags, opcode, transaction_id);
 			break;
 		case MSP_OP_TYPE_SEND:
-			msp_exprecv_complete(msp_exp_state.opcode);
-			msp_seqflags_set(&msp_exp_state.seqflags, opcode, transaction_id);
+			msp_exprecv_complete(state->opcode);
+			msp_seqflags_set(&state->seqflags, opcode, transaction_id);
 			break;
 		default:
-			msp_debug("Trying to send T_ACK in non OBC Send state");
+			msp_trace(state, MSP_TRACE_STATE_ERROR, opcode, transaction_id, MSP_EXP_STATE_OBC_SEND_RX);
 			code = MSP_EXP_ERR_STATE_ERROR;
 			break;
 		}
 	} else {
 		/* Acknowledge a single frame */
-		msp_exp_frame_format_header(buf, MSP_OP_F_ACK, msp_exp_state.last_received_frame_id, 0, addr);
+		msp_exp_frame_format_header(buf, MSP_OP_F_ACK, state->last_received_frame_id, 0, state->addr);
 		*len = 9;
 	}
 
@@ -553,28 +1034,71 @@ static int handle_outgoing_acknowledge_frame(unsigned char *buf, unsigned long *
 
 
 
+/*
+ * Starts the OBC Request transaction that has been set up in the MSP state,
+ * the experiment is asked how much data it will send.
+ */
+static void start_request(volatile struct msp_exp_state_information *state)
+{
+	unsigned long data_to_send;
+
+	data_to_send = 0;
+	msp_expsend_start(state->opcode, &data_to_send);
+
+	state->total_length = data_to_send;
+
+	/* OBC Send state */
+	state->type = MSP_EXP_STATE_OBC_REQ_RESPONSE;
+}
+/*
+ * Aborts the transaction that is open on an address, for one that the OBC
+ * has stopped answering.
+ *
+ * Returns 1 if a transaction was aborted, otherwise 0.
+ */
+int msp_exp_abort(char addr)
+{
+	volatile struct msp_exp_state_information *state;
+
+	state = msp_exp_state_get(addr);
+	if (state == 0 || state->busy || state->type == MSP_EXP_STATE_READY)
+		return 0;
+
+	state->busy = 1;
+	msp_trace(state, MSP_TRACE_ABORTED, state->opcode, state->transaction_id, state->type);
+	ensure_ready_state(state);
+#ifndef MSP_LOW_MEMORY
+	release_prepared_frames(state);
+#endif
+	state->busy = 0;
+
+	return 1;
+}
+
 /*
  * Ensures that MSP is in the ready state. This means that if a current
  * transaction is active, it will be aborted.
  */
-static void ensure_ready_state(void)
+static void ensure_ready_state(volatile struct msp_exp_state_information *state)
 {
-	switch (msp_exp_state.type) {
+	switch (state->type) {
 	case MSP_EXP_STATE_OBC_SEND_RX:
 		/* System Control OP codes are an exception as they have a special
 		 * handler. */
-		if (MSP_OP_TYPE(msp_exp_state.opcode) != MSP_OP_TYPE_SYS)
-			msp_exprecv_error(msp_exp_state.opcode, MSP_EXP_ERR_TRANSACTION_ABORTED);
+		if (MSP_OP_TYPE(state->opcode) != MSP_OP_TYPE_SYS)
+			msp_exprecv_error(state->opcode, MSP_EXP_ERR_TRANSACTION_ABORTED);
 		break;
 	case MSP_EXP_STATE_OBC_REQ_RESPONSE:
 	case MSP_EXP_STATE_OBC_REQ_TX:
-		msp_expsend_error(msp_exp_state.opcode, MSP_EXP_ERR_TRANSACTION_ABORTED);
+		if (state->opcode != MSP_OP_REQ_WINDOW)
+			msp_expsend_error(state->opcode, MSP_EXP_ERR_TRANSACTION_ABORTED);
 		break;
 	default:
-		/* If we were in a state of a duplicate transaction or simply in the
-		 * ready state, we don't need to report any errors. */
+		/* If we were in a state of a duplicate transaction, in a request
+		 * that was never started or simply in the ready state, we don't need
+		 * to report any errors. */
 		break;
 	}
 
-	msp_exp_state.type = MSP_EXP_STATE_READY;
+	state->type = MSP_EXP_STATE_READY;
 }
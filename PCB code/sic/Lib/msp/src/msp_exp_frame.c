@@ -7,9 +7,77 @@
 
 #include "msp_crc.h"
 #include "msp_endian.h"
+#include "msp_opcodes.h"
 
 #include "msp_exp_frame.h"
 #include "msp_exp_definitions.h"
+#include "msp_exp_handler.h"
+#include "msp_exp_state.h"
+
+#ifndef MSP_LOW_MEMORY
+/* The header frames with DL = 0 that the experiment sends the most, for both
+ * frame-ID's. They only depend on the address, so they are formatted once for
+ * each address and then copied. Costs 72 bytes of RAM per address, not used
+ * with MSP_LOW_MEMORY. */
+#define MSP_EXP_FRAME_CACHE_SIZE 4
+static unsigned char msp_exp_frame_cache[MSP_EXP_INSTANCES][MSP_EXP_FRAME_CACHE_SIZE][2][9];
+static char msp_exp_frame_cache_addr[MSP_EXP_INSTANCES];
+static volatile unsigned char msp_exp_frame_cache_valid[MSP_EXP_INSTANCES] = {0};
+
+static int cache_index(unsigned char opcode);
+static int cache_slot(char addr);
+#endif
+
+static void format_header(unsigned char *dest, unsigned char opcode, unsigned char frame_id, unsigned long dl, char addr);
+
+/**
+ * @brief Starts the calculation of an FCS.
+ * @param from_obc A boolean value that specifies whether the FCS should be
+ *                 calculated as if the frame came from the OBC or from the
+ *                 experiment.
+ * @return The FCS remainder after the pseudo header, to be passed to
+ *         msp_exp_frame_fcs_update().
+ */
+unsigned long msp_exp_frame_fcs_init(int from_obc, char addr)
+{
+	unsigned char pseudo_header;
+
+	/* Format the pseudo header */
+	pseudo_header = (addr) << 1;
+	if (!from_obc)
+		pseudo_header |= 0x01;
+
+	return msp_crc32(&pseudo_header, 1, 0);
+}
+
+/**
+ * @brief Adds a sequence of bytes to an FCS that is being calculated.
+ * @param fcs The FCS remainder so far.
+ * @param data Pointer to the next bytes of the frame.
+ * @param len Number of bytes pointed to by data.
+ * @return The updated FCS remainder.
+ *
+ * The bytes of a frame can be added in any number of calls, as long as they
+ * are added in order.
+ */
+unsigned long msp_exp_frame_fcs_update(unsigned long fcs, const unsigned char *data, unsigned long len)
+{
+	return msp_crc32(data, len, fcs);
+}
+
+/**
+ * @brief Finishes the calculation of an FCS.
+ * @param fcs The FCS remainder after the last byte of the frame.
+ * @return The FCS value of the frame.
+ *
+ * The CRC-32 remainder is finalized after every update, so this does not
+ * change the value. It marks where a remainder becomes a value that can be
+ * sent or compared.
+ */
+unsigned long msp_exp_frame_fcs_final(unsigned long fcs)
+{
+	return fcs;
+}
 
 /**
  * @brief Calculates the FCS of an MSP frame.
@@ -29,20 +97,12 @@
  */
 unsigned long msp_exp_frame_generate_fcs(const unsigned char *data, int from_obc, unsigned long len, char addr)
 {
-	unsigned char pseudo_header;
 	unsigned long remainder;
 
-	/* Format the pseudo header */
-	pseudo_header = (addr) << 1;
-	if (!from_obc)
-		pseudo_header |= 0x01;
-
-	remainder = msp_crc32(&pseudo_header, 1, 0);
-
-	/* Now account for the rest of the frame */
-	remainder = msp_crc32(data, len, remainder);
+	remainder = msp_exp_frame_fcs_init(from_obc, addr);
+	remainder = msp_exp_frame_fcs_update(remainder, data, len);
 
-	return remainder;
+	return msp_exp_frame_fcs_final(remainder);
 }
 
 /**
@@ -72,6 +132,119 @@ int msp_exp_frame_fcs_valid(const unsigned char *data, int from_obc, unsigned lo
 }
 
 
+/**
+ * @brief Starts the FCS of a frame that is about to be received from the OBC.
+ * @param addr The address the frame is written to.
+ *
+ * Should be called by the I2C driver when the OBC addresses the experiment
+ * for a write, before the first byte arrives.
+ */
+void msp_exp_frame_rx_start(char addr)
+{
+	volatile struct msp_exp_state_information *state = msp_exp_state_get(addr);
+
+	if (state == 0)
+		return;
+	state->rx_fcs = msp_exp_frame_fcs_init(1, addr);
+	state->rx_fcs_length = 0;
+	state->rx_fcs_started = 1;
+}
+
+/**
+ * @brief Adds newly received bytes to the FCS of the incoming frame.
+ * @param frame Pointer to the buffer that the frame is received into.
+ * @param received Number of bytes received so far.
+ * @param addr The address the frame is written to.
+ *
+ * Meant to be called from the I2C receive interrupt, once per byte or once
+ * per chunk. The length of the frame is not known until the transfer stops,
+ * so the last 4 bytes received are held back in case they are the FCS.
+ */
+void msp_exp_frame_rx_update(const unsigned char *frame, unsigned long received, char addr)
+{
+	volatile struct msp_exp_state_information *state = msp_exp_state_get(addr);
+	unsigned long len;
+
+	if (state == 0 || !state->rx_fcs_started || received <= 4)
+		return;
+
+	len = received - 4;
+	if (len > state->rx_fcs_length) {
+		state->rx_fcs = msp_exp_frame_fcs_update(state->rx_fcs,
+				frame + state->rx_fcs_length,
+				len - state->rx_fcs_length);
+		state->rx_fcs_length = len;
+	}
+}
+
+/**
+ * @brief Checks if the FCS of a frame received from the OBC is valid.
+ * @param data Pointer to the first byte in the MSP frame.
+ * @param len Number of bytes in the MSP frame.
+ * @return 1 if the FCS is valid, 0 otherwise.
+ *
+ * Only the bytes that msp_exp_frame_rx_update() has not seen yet are read.
+ * If the FCS was never started for this frame, the whole frame is checked
+ * with msp_exp_frame_fcs_valid().
+ */
+int msp_exp_frame_rx_fcs_valid(const unsigned char *data, unsigned long len, char addr)
+{
+	volatile struct msp_exp_state_information *state = msp_exp_state_get(addr);
+	unsigned long fcs;
+
+	if (state == 0)
+		return msp_exp_frame_fcs_valid(data, 1, len, addr);
+	if (!state->rx_fcs_started || len < 4 || state->rx_fcs_length > len - 4) {
+		state->rx_fcs_started = 0;
+		return msp_exp_frame_fcs_valid(data, 1, len, addr);
+	}
+
+	msp_exp_frame_rx_update(data, len, addr);
+	state->rx_fcs_started = 0;
+
+	fcs = msp_from_bigendian32(data + (len - 4));
+	if (fcs == msp_exp_frame_fcs_final(state->rx_fcs))
+		return 1;
+	else
+		return 0;
+}
+
+
+/**
+ * @brief Copies data into the outgoing data frame and adds it to the FCS.
+ * @param dest Where the data goes in the buffer passed to msp_expsend_data().
+ * @param src The data to send.
+ * @param len Number of bytes to copy.
+ *
+ * To be used by msp_expsend_data(). Copies the data and calculates the FCS in
+ * the same pass, so that the frame does not have to be read again before it
+ * is sent. The data field must be written from the start and in order.
+ */
+void msp_expsend_copy(unsigned char *dest, const unsigned char *src, unsigned long len)
+{
+	msp_exp_fcs.tx_fcs = msp_crc32_copy(dest, src, len, msp_exp_fcs.tx_fcs);
+	msp_exp_fcs.tx_fcs_length += len;
+}
+
+/**
+ * @brief Adds data that has been written to the outgoing data frame to the
+ *        FCS.
+ * @param data Pointer to the bytes that were written.
+ * @param len Number of bytes written.
+ *
+ * To be used by msp_expsend_data() for data that is formatted directly into
+ * the buffer, preferably chunk by chunk while it is still in registers or
+ * cache. The data field must be added from the start and in order. Bytes that
+ * are not added by the handler are added by MSP after msp_expsend_data()
+ * returns.
+ */
+void msp_expsend_fcs_update(const unsigned char *data, unsigned long len)
+{
+	msp_exp_fcs.tx_fcs = msp_exp_frame_fcs_update(msp_exp_fcs.tx_fcs, data, len);
+	msp_exp_fcs.tx_fcs_length += len;
+}
+
+
 /**
  * @brief Formats a header frame into a sequence of bytes.
  * @param dest Pointer to the buffer where the formatted frame will be stored.
@@ -84,21 +257,37 @@ int msp_exp_frame_fcs_valid(const unsigned char *data, int from_obc, unsigned lo
  *
  * This function formats the entire frame, including the FCS value. The
  * resulting sequence of bytes can be sent directly to the OBC.
+ *
+ * NULL, F_ACK, T_ACK and EXP_BUSY frames with DL = 0 are copied from a cache
+ * instead of having their FCS calculated, since the OBC is waiting for them.
  */
 void msp_exp_frame_format_header(unsigned char *dest, unsigned char opcode, unsigned char frame_id, unsigned long dl, char addr)
 {
-	unsigned long fcs;
+#ifndef MSP_LOW_MEMORY
+	const unsigned char *frame;
+	int index;
+	int slot;
+	int i;
 
-	/* Format OP code and Frame-ID */
-	dest[0] = opcode & 0x7F;
-	dest[0] |= (frame_id & 0x1) << 7;
+	index = cache_index(opcode & 0x7F);
+	if (dl == 0 && index >= 0) {
+		slot = cache_slot(addr);
+		if (slot < 0) {
+			msp_exp_frame_prepare_cache(addr);
+			slot = cache_slot(addr);
+		}
 
-	/* Format the DL field */
-	msp_to_bigendian32(dest + 1, dl);
+		/* Only MSP_EXP_INSTANCES addresses have a cache */
+		if (slot >= 0) {
+			frame = msp_exp_frame_cache[slot][index][frame_id & 0x1];
+			for (i = 0; i < 9; i++)
+				dest[i] = frame[i];
+			return;
+		}
+	}
+#endif
 
-	/* Format the FCS field */
-	fcs = msp_exp_frame_generate_fcs(dest, 0, 5, addr);
-	msp_to_bigendian32(dest + 5, fcs);
+	format_header(dest, opcode, frame_id, dl, addr);
 }
 
 /**
@@ -116,3 +305,94 @@ void msp_exp_frame_format_empty_header(unsigned char *dest, unsigned char opcode
 {
 	msp_exp_frame_format_header(dest, opcode, 0, 0, addr);
 }
+
+/**
+ * @brief Formats the cached header frames for an address.
+ *
+ * Called automatically the first time a cached frame is needed. Calling it at
+ * start up for every address keeps the cost out of the first reply to the
+ * OBC. At most MSP_EXP_INSTANCES addresses are cached. Does nothing with
+ * MSP_LOW_MEMORY.
+ */
+void msp_exp_frame_prepare_cache(char addr)
+{
+#ifndef MSP_LOW_MEMORY
+	static const unsigned char opcodes[MSP_EXP_FRAME_CACHE_SIZE] = {
+		MSP_OP_NULL, MSP_OP_F_ACK, MSP_OP_T_ACK, MSP_OP_EXP_BUSY
+	};
+	int slot;
+	int i;
+
+	/* Use the cache of the address, or one that no address uses yet */
+	slot = cache_slot(addr);
+	for (i = 0; slot < 0 && i < MSP_EXP_INSTANCES; i++) {
+		if (!msp_exp_frame_cache_valid[i])
+			slot = i;
+	}
+	if (slot < 0)
+		return;
+
+	/* Invalidate first so that a concurrent caller never copies a frame that
+	 * is half way formatted. */
+	msp_exp_frame_cache_valid[slot] = 0;
+	for (i = 0; i < MSP_EXP_FRAME_CACHE_SIZE; i++) {
+		format_header(msp_exp_frame_cache[slot][i][0], opcodes[i], 0, 0, addr);
+		format_header(msp_exp_frame_cache[slot][i][1], opcodes[i], 1, 0, addr);
+	}
+	msp_exp_frame_cache_addr[slot] = addr;
+	msp_exp_frame_cache_valid[slot] = 1;
+#else
+	(void) addr;
+#endif
+}
+
+
+
+/* Formats a header frame, see msp_exp_frame_format_header() */
+static void format_header(unsigned char *dest, unsigned char opcode, unsigned char frame_id, unsigned long dl, char addr)
+{
+	unsigned long fcs;
+
+	/* Format OP code and Frame-ID */
+	dest[0] = opcode & 0x7F;
+	dest[0] |= (frame_id & 0x1) << 7;
+
+	/* Format the DL field */
+	msp_to_bigendian32(dest + 1, dl);
+
+	/* Format the FCS field */
+	fcs = msp_exp_frame_generate_fcs(dest, 0, 5, addr);
+	msp_to_bigendian32(dest + 5, fcs);
+}
+
+#ifndef MSP_LOW_MEMORY
+/* Returns where a header frame with DL = 0 is in the cache, or -1 */
+static int cache_index(unsigned char opcode)
+{
+	switch (opcode) {
+	case MSP_OP_NULL:
+		return 0;
+	case MSP_OP_F_ACK:
+		return 1;
+	case MSP_OP_T_ACK:
+		return 2;
+	case MSP_OP_EXP_BUSY:
+		return 3;
+	default:
+		return -1;
+	}
+}
+
+/* Returns the cache that holds the frames of an address, or -1 */
+static int cache_slot(char addr)
+{
+	int i;
+
+	for (i = 0; i < MSP_EXP_INSTANCES; i++) {
+		if (msp_exp_frame_cache_valid[i] && msp_exp_frame_cache_addr[i] == addr)
+			return i;
+	}
+
+	return -1;
+}
+#endif
@@ -2,46 +2,92 @@
  * @file      msp_exp_state.c
  * @author    John Wikman
  * @copyright MIT License
- * @brief     The location of the global MSP experiment state.
+ * @brief     The location of the global MSP experiment states.
  *
  * @details
- * The source file where the global variable representing the MSP experiment
- * state is located.
+ * The source file where the global variables representing the MSP experiment
+ * states are located. There is one state for each I2C address that the
+ * experiment answers on, so that the transactions of one address do not
+ * interfere with the other.
  */
 
 #include "msp_seqflags.h"
 
 #include "msp_exp_state.h"
 
-/* The MSP state */
-volatile struct msp_exp_state_information msp_exp_state = {0};
+/* The MSP states, one for each address */
+volatile struct msp_exp_state_information msp_exp_states[MSP_EXP_INSTANCES];
+
+/* The FCS of the frame that is sent */
+volatile struct msp_exp_fcs_information msp_exp_fcs = {0};
+
+/**
+ * @brief Returns the MSP state of an address.
+ * @param addr The I2C address of the experiment.
+ * @return Pointer to the state, or 0 if no state has been initialized for the
+ *         address.
+ */
+volatile struct msp_exp_state_information *msp_exp_state_get(char addr)
+{
+	int i;
+
+	for (i = 0; i < MSP_EXP_INSTANCES; i++) {
+		if (msp_exp_states[i].initialized && msp_exp_states[i].addr == addr)
+			return &msp_exp_states[i];
+	}
+
+	return 0;
+}
 
 /**
- * @brief Initializes the MSP state.
+ * @brief Initializes the MSP state of an address.
  * @param seqflags The sequence flags that the MSP state should be initialized
  *                 with.
+ * @param addr The I2C address of the experiment.
+ * @return Pointer to the state, or 0 if all MSP_EXP_INSTANCES states are
+ *         used by other addresses.
  *
  * Initializes the MSP state with the specified sequence flags. This function
- * should be called before any MSP transaction takes place. Ideally before
- * starting the I2C driver.
+ * should be called for every address before any MSP transaction takes place.
+ * Ideally before starting the I2C driver. A state that is already used by the
+ * address is initialized again.
  *
  * If available, the sequence flags passed as an argument should be the
  * sequence flags that were saved to non-volatile memory/storage before the
  * experiment was restarted/powered off.
  */
-void msp_exp_state_initialize(msp_seqflags_t seqflags)
+volatile struct msp_exp_state_information *msp_exp_state_initialize(msp_seqflags_t seqflags, char addr)
 {
-	msp_exp_state.type = MSP_EXP_STATE_READY;
+	volatile struct msp_exp_state_information *state;
+	int i;
+
+	state = msp_exp_state_get(addr);
+	for (i = 0; state == 0 && i < MSP_EXP_INSTANCES; i++) {
+		if (!msp_exp_states[i].initialized)
+			state = &msp_exp_states[i];
+	}
+	if (state == 0)
+		return 0;
+
+	state->type = MSP_EXP_STATE_READY;
 
-	msp_exp_state.seqflags = seqflags;
+	state->seqflags = seqflags;
+	state->addr = addr;
+	state->window = 1;
+	state->tx_window = 1;
 
-	msp_exp_state.busy = 0;
-	msp_exp_state.initialized = 1;
+	state->busy = 0;
+	state->rx_fcs_started = 0;
+	state->initialized = 1;
+
+	return state;
 }
 
 /**
- * @brief Returns the sequence flags from the experiment state.
- * @return A copy of the current sequence flags in the experiment state.
+ * @brief Returns the sequence flags from the experiment state of an address.
+ * @param addr The I2C address of the experiment.
+ * @return A copy of the current sequence flags in the experiment state, or
+ *         cleared sequence flags if the address has no state.
  *
  * This function returns a copy of the current sequence flags in the MSP
  * experiment state. These sequence flags should be retreived and saved in
@@ -50,7 +96,31 @@ void msp_exp_state_initialize(msp_seqflags_t seqflags)
  * rebooting and also preferably on regular intervals in case the experiment
  * restarts unexpectedly.
  */
-msp_seqflags_t msp_exp_state_get_seqflags(void)
+msp_seqflags_t msp_exp_state_get_seqflags(char addr)
+{
+	volatile struct msp_exp_state_information *state;
+
+	state = msp_exp_state_get(addr);
+	if (state == 0)
+		return msp_seqflags_init();
+
+	return state->seqflags;
+}
+
+/**
+ * @brief Checks if an address is in an OBC Request transaction.
+ * @param addr The address of the experiment.
+ * @return 1 if the state of the address is in one of the OBC Request states,
+ *         0 otherwise.
+ */
+int msp_exp_state_in_request(char addr)
 {
-	return msp_exp_state.seqflags;
+	volatile struct msp_exp_state_information *state = msp_exp_state_get(addr);
+
+	if (state == 0)
+		return 0;
+
+	return state->type == MSP_EXP_STATE_OBC_REQ_BUSY ||
+		state->type == MSP_EXP_STATE_OBC_REQ_RESPONSE ||
+		state->type == MSP_EXP_STATE_OBC_REQ_TX;
 }
@@ -1,144 +1,357 @@
 //this file was written by  @author: Simon Lagerqvist.
+//
+// Every opcode the experiment handles has a descriptor in handlers[],
+// indexed by the opcode. The MSP callbacks look up the descriptor and call
+// the function for the step of the transaction, an opcode without a
+// descriptor, or a step the descriptor has no function for, is ignored.
+// A new request, send or system command is one descriptor and one entry in
+// the table.
 #include "msp_exp_handler.h"
 #include <stdint.h>
+#include <stddef.h>
 #include "main.h"
-#include "start_test.h"
 #include "msp_opcodes.h"
+#include "msp_trace.h"
 #include <stdbool.h>
 #include "piezo.h"
 #include "start_test.h"
 #include "power_management.h"
-#include "sicpiezo_global.h"
-#include <interface_flags.h>
+#include "experiment_constants.h"
+#include "command_queue.h"
+#include "result_archive.h"
+#include "housekeeping.h"
+#include "payload.h"
+#include "msp_stats.h"
 
+#define MSP_OPCODE_COUNT 0x80 // opcodes are 7 bits
 
+typedef enum {
+  POWER_DOMAIN_NONE,  // runs while the experiment sleeps
+  POWER_DOMAIN_SIC,   // powers the SiC rail, refused while sleeping
+  POWER_DOMAIN_PIEZO  // powers the Piezo rails, refused while sleeping
+} power_domain;
 
-uint8_t sicBuffer[64];
-uint8_t piezoBuffer[30];
-extern bool volatile sic;
-extern bool volatile piezo;
-extern int piezoTick;
-extern bool getData;
-extern char piezoBufferRx[50];
-extern int piezoBufferRxInt[50];
-extern int aTxBuffer[100];
-extern uint16_t buffLength;
+typedef struct {
+  unsigned char opcode;
+  power_domain domain;
+  // OBC request, the experiment sends
+  unsigned long (*busy)(void);    // ms until the data is ready, 0 when it is
+  unsigned long (*length)(void);  // bytes to send, called at the start
+  void (*send)(unsigned char *buf, unsigned long len, unsigned long offset);
+  // OBC send, the experiment receives
+  void (*start)(unsigned long len);
+  void (*receive)(const unsigned char *buf, unsigned long len, unsigned long offset);
+  // the transaction or the system command completed, or failed
+  void (*complete)(void);
+  void (*error)(int error);
+} exp_handler;
 
-extern bool volatile has_function_to_execute;
-extern void (* volatile command_ptr) ();
-bool volatile debuggvar = false;
-bool debuggvar2 = false;
-bool debuggvar3 = false;
-extern piezo_sic_type volatile piezo_sic;
-bool piezo_error = false;
-bool sic_error = false;
-int i = 0;
+bool piezoSendSamples = false; // REQ_PIEZO is served from the in-run samples
+uint8_t pollIntervalBuffer[2];
+uint8_t statusBuffer[STATUS_LENGTH];
+extern uint8_t piezoBufferint8[200];
+extern uint8_t buffer[BUFFERLENGTH]; // SiC results, see start_test.c
 
 
-void msp_expsend_start(unsigned char opcode, unsigned long *len)
+/* REQ_PIEZO */
+static unsigned long piezo_busy(void)
 {
-  if (opcode == REQ_PIEZO)
-  {
-    *len = piezo_get_data_length();
-  }
-  else if (opcode == REQ_SIC)
+  return piezo_time_to_ready(); // the records are read when the motor stops
+}
+
+static unsigned long piezo_length(void)
+{
+  piezoSendSamples = piezo_telemetry_running();
+  if (piezoSendSamples)
+    return piezo_get_sample_length();
+  return piezo_get_data_length();
+}
+
+static void piezo_send(unsigned char *buf, unsigned long len, unsigned long offset)
+{
+  if (piezoSendSamples)
+    piezo_get_samples(buf, len, offset);
+  else
+    msp_expsend_copy(buf, &piezoBufferint8[offset], len); // copy and FCS in one pass
+}
+
+static void piezo_sent(void)
+{
+  if (piezoSendSamples)
+    piezo_release_samples();
+  else
+    clear_piezo_buffer();
+  piezoSendSamples = false;
+}
+
+static void piezo_send_error(int error)
+{
+  if (piezoSendSamples)
+    piezo_abort_samples(); // keep the samples for the next request
+  piezoSendSamples = false;
+}
+
+/* REQ_SIC */
+static unsigned long sic_busy(void)
+{
+  return sic_time_to_ready(); // the buffer is written by a running sweep
+}
+
+static unsigned long sic_length(void)
+{
+  return 64;
+}
+
+static void sic_send(unsigned char *buf, unsigned long len, unsigned long offset)
+{
+  if (offset + len <= BUFFERLENGTH)
+    msp_expsend_copy(buf, &buffer[offset], len);
+}
+
+static void sic_sent(void)
+{
+  clear_sic_buffer();
+  result_archive_acknowledge(buffer); // the next sweep that was not taken, if any
+}
+
+/* MSP_OP_REQ_HK */
+static unsigned long housekeeping_length(void)
+{
+  housekeeping_snapshot();
+  return HOUSEKEEPING_LENGTH;
+}
+
+static void housekeeping_send(unsigned char *buf, unsigned long len, unsigned long offset)
+{
+  if (offset + len <= HOUSEKEEPING_LENGTH)
+    housekeeping_copy(buf, len, offset);
+}
+
+/* REQ_STATUS */
+static unsigned long status_length(void)
+{
+  uint32_t sic = sic_time_to_ready();
+  uint32_t piezo = piezo_time_to_ready();
+  uint32_t ready = sic > piezo ? sic : piezo;
+
+  statusBuffer[STATUS_ACTIVITY] = (sic != 0 ? STATUS_SIC_SWEEP : 0)
+                                | (piezo != 0 ? STATUS_PIEZO_DUMP : 0)
+                                | (piezo_telemetry_running() ? STATUS_PIEZO_RUNNING : 0)
+                                | (result_archive_pending() ? STATUS_SIC_PENDING : 0);
+  statusBuffer[STATUS_READY_MS] = ready >> 24;
+  statusBuffer[STATUS_READY_MS + 1] = ready >> 16;
+  statusBuffer[STATUS_READY_MS + 2] = ready >> 8;
+  statusBuffer[STATUS_READY_MS + 3] = ready;
+  return STATUS_LENGTH;
+}
+
+static void status_send(unsigned char *buf, unsigned long len, unsigned long offset)
+{
+  if (offset + len <= STATUS_LENGTH)
+    msp_expsend_copy(buf, &statusBuffer[offset], len);
+}
+
+/* MSP_OP_REQ_PAYLOAD, see payload.c */
+static unsigned long payload_busy(void)
+{
+  // the payload holds both results
+  uint32_t sic = sic_time_to_ready();
+  uint32_t piezo = piezo_time_to_ready();
+
+  return sic > piezo ? sic : piezo;
+}
+
+static void payload_send_error(int error)
+{
+  payload_abort();
+}
+
+#ifdef MSP_TRACE
+/* REQ_TRACE, see msp_trace.h */
+static void trace_send_error(int error)
+{
+  msp_trace_abort();
+}
+
+// the HAL tick stands still in Stop mode, which msp_i2c_sleep() only enters
+// between transactions. The ticks within a transaction are exact, the time
+// between two transactions can be shorter than it was
+unsigned long msp_trace_tick(void)
+{
+  return HAL_GetTick();
+}
+#endif
+
+/* SEND_PIEZO_POLL_INTERVAL */
+static void poll_interval_receive(const unsigned char *buf, unsigned long len, unsigned long offset)
+{
+  for (unsigned long j = 0; j < len; j++)
   {
-    *len = 64;
+    if (offset + j < sizeof(pollIntervalBuffer))
+      pollIntervalBuffer[offset + j] = buf[j];
   }
 }
 
+static void poll_interval_received(void)
+{
+  // interval in milliseconds, big endian
+  command_queue_push(COMMAND_PIEZO_POLL_INTERVAL, (uint16_t)(pollIntervalBuffer[0] << 8 | pollIntervalBuffer[1]));
+}
+
+/* system commands */
+static void push_piezo_start(void) { command_queue_push(COMMAND_PIEZO_START, 0); }
+static void push_piezo_stop(void) { command_queue_push(COMMAND_PIEZO_STOP, 0); }
+static void push_sic_start(void) { command_queue_push(COMMAND_SIC_START, 0); }
+static void push_power_off(void) { command_queue_push(COMMAND_SAVE_SEQFLAGS, 0); }
+static void push_sleep(void) { command_queue_push(COMMAND_SLEEP, 0); }
+static void push_active(void) { command_queue_push(COMMAND_ACTIVE, 0); }
+
+
+static const exp_handler piezo_request = {REQ_PIEZO, POWER_DOMAIN_NONE, piezo_busy, piezo_length, piezo_send, NULL, NULL, piezo_sent, piezo_send_error};
+static const exp_handler sic_request = {REQ_SIC, POWER_DOMAIN_NONE, sic_busy, sic_length, sic_send, NULL, NULL, sic_sent, NULL};
+static const exp_handler housekeeping_request = {MSP_OP_REQ_HK, POWER_DOMAIN_NONE, NULL, housekeeping_length, housekeeping_send, NULL, NULL, NULL, NULL};
+static const exp_handler status_request = {REQ_STATUS, POWER_DOMAIN_NONE, NULL, status_length, status_send, NULL, NULL, NULL, NULL};
+static const exp_handler payload_request = {MSP_OP_REQ_PAYLOAD, POWER_DOMAIN_NONE, payload_busy, payload_open, payload_copy, NULL, NULL, payload_release, payload_send_error};
+#ifdef MSP_TRACE
+static const exp_handler trace_request = {REQ_TRACE, POWER_DOMAIN_NONE, NULL, msp_trace_open, msp_trace_copy, NULL, NULL, msp_trace_release, trace_send_error};
+#endif
+static const exp_handler poll_interval_send = {SEND_PIEZO_POLL_INTERVAL, POWER_DOMAIN_NONE, NULL, NULL, NULL, NULL, poll_interval_receive, poll_interval_received, NULL};
+static const exp_handler piezo_start_command = {START_EXP_PIEZO, POWER_DOMAIN_PIEZO, NULL, NULL, NULL, NULL, NULL, push_piezo_start, NULL};
+static const exp_handler piezo_stop_command = {STOP_EXP_PIEZO, POWER_DOMAIN_NONE, NULL, NULL, NULL, NULL, NULL, push_piezo_stop, NULL};
+static const exp_handler sic_start_command = {START_EXP_SIC, POWER_DOMAIN_SIC, NULL, NULL, NULL, NULL, NULL, push_sic_start, NULL};
+static const exp_handler power_off_command = {MSP_OP_POWER_OFF, POWER_DOMAIN_NONE, NULL, NULL, NULL, NULL, NULL, push_power_off, NULL};
+static const exp_handler sleep_command = {MSP_OP_SLEEP, POWER_DOMAIN_NONE, NULL, NULL, NULL, NULL, NULL, push_sleep, NULL};
+static const exp_handler active_command = {MSP_OP_ACTIVE, POWER_DOMAIN_NONE, NULL, NULL, NULL, NULL, NULL, push_active, NULL};
+static const exp_handler sic_10v_off_command = {SIC_10V_OFF, POWER_DOMAIN_NONE, NULL, NULL, NULL, NULL, NULL, turn_off_10v, NULL};
+static const exp_handler piezo_5v_off_command = {PIEZO_5V_OFF, POWER_DOMAIN_NONE, NULL, NULL, NULL, NULL, NULL, turn_off_5v, NULL};
+static const exp_handler piezo_48v_off_command = {PIEZO_48V_OFF, POWER_DOMAIN_NONE, NULL, NULL, NULL, NULL, NULL, turn_off_48v, NULL};
+static const exp_handler vbat_off_command = {VBAT_OFF, POWER_DOMAIN_NONE, NULL, NULL, NULL, NULL, NULL, turn_off_vbat, NULL};
+
+// in flash, one pointer per opcode
+static const exp_handler *const handlers[MSP_OPCODE_COUNT] = {
+  [REQ_PIEZO] = &piezo_request,
+  [REQ_SIC] = &sic_request,
+  [MSP_OP_REQ_HK] = &housekeeping_request,
+  [REQ_STATUS] = &status_request,
+  [MSP_OP_REQ_PAYLOAD] = &payload_request,
+#ifdef MSP_TRACE
+  [REQ_TRACE] = &trace_request,
+#endif
+  [SEND_PIEZO_POLL_INTERVAL] = &poll_interval_send,
+  [START_EXP_PIEZO] = &piezo_start_command,
+  [STOP_EXP_PIEZO] = &piezo_stop_command,
+  [START_EXP_SIC] = &sic_start_command,
+  [MSP_OP_POWER_OFF] = &power_off_command,
+  [MSP_OP_SLEEP] = &sleep_command,
+  [MSP_OP_ACTIVE] = &active_command,
+  [SIC_10V_OFF] = &sic_10v_off_command,
+  [PIEZO_5V_OFF] = &piezo_5v_off_command,
+  [PIEZO_48V_OFF] = &piezo_48v_off_command,
+  [VBAT_OFF] = &vbat_off_command,
+};
+
+/**
+ * @brief the descriptor of an opcode, NULL if the experiment does not handle it
+ */
+static const exp_handler *handler_for(unsigned char opcode)
+{
+  const exp_handler *handler = handlers[opcode % MSP_OPCODE_COUNT];
+
+  // a descriptor put at the wrong index is never called
+  return handler != NULL && handler->opcode == opcode ? handler : NULL;
+}
+
+
+unsigned long msp_expsend_busy_time(unsigned char opcode)
+{
+  const exp_handler *handler = handler_for(opcode);
+
+  if (handler != NULL && handler->busy != NULL)
+    return handler->busy();
+  return 0;
+}
+
+void msp_expsend_start(unsigned char opcode, unsigned long *len)
+{
+  const exp_handler *handler = handler_for(opcode);
+
+  msp_stats_start(opcode);
+  if (handler != NULL && handler->length != NULL)
+    *len = handler->length();
+}
+
 void msp_expsend_data(unsigned char opcode, unsigned char *buf, unsigned long len, unsigned long offset)
 {
-  if (opcode == REQ_PIEZO)
-  {
-    piezo_get_data(buf, offset);
-  }
-  else if (opcode == REQ_SIC)
-  {
-     sic_get_data(buf, offset);
-  }
+  const exp_handler *handler = handler_for(opcode);
+
+  msp_stats_bytes(opcode, len);
+  if (handler != NULL && handler->send != NULL)
+    handler->send(buf, len, offset);
 }
 
 void msp_expsend_complete(unsigned char opcode)
 {
-// add code to clear buffers
-  if (opcode == REQ_PIEZO)
-  {
-    clear_piezo_buffer();
-  }
-  else if (opcode == REQ_SIC)
-  {
-     clear_sic_buffer();
-  }
+  const exp_handler *handler = handler_for(opcode);
+
+  msp_stats_end(opcode, true);
+  if (handler != NULL && handler->complete != NULL)
+    handler->complete();
 }
 
 void msp_expsend_error(unsigned char opcode, int error)
 {
-  //add code to set an error
+  const exp_handler *handler = handler_for(opcode);
+
+  msp_stats_end(opcode, false);
+  if (handler != NULL && handler->error != NULL)
+    handler->error(error);
 }
 
 void msp_exprecv_start(unsigned char opcode, unsigned long len)
 {
+  const exp_handler *handler = handler_for(opcode);
 
+  msp_stats_start(opcode);
+  if (handler != NULL && handler->start != NULL)
+    handler->start(len);
 }
 
 void msp_exprecv_data(unsigned char opcode, const unsigned char *buf, unsigned long len, unsigned long offset)
 {
+  const exp_handler *handler = handler_for(opcode);
 
+  msp_stats_bytes(opcode, len);
+  if (handler != NULL && handler->receive != NULL)
+    handler->receive(buf, len, offset);
 }
 
 void msp_exprecv_complete(unsigned char opcode)
 {
+  const exp_handler *handler = handler_for(opcode);
 
+  msp_stats_end(opcode, true);
+  if (handler != NULL && handler->complete != NULL)
+    handler->complete();
 }
 
 void msp_exprecv_error(unsigned char opcode, int error)
 {
+  const exp_handler *handler = handler_for(opcode);
 
+  msp_stats_end(opcode, false);
+  if (handler != NULL && handler->error != NULL)
+    handler->error(error);
 }
 
 void msp_exprecv_syscommand(unsigned char opcode)
 {
-  switch(opcode)
-  {
-    case START_EXP_PIEZO:
-      i = 1;
-      command_ptr = &piezo_start_exp;
-      has_function_to_execute = true;
-      break;
-
-    case STOP_EXP_PIEZO:
-      i = 2;
-      command_ptr = &piezo_stop_exp;
-      has_function_to_execute = true;
-      break;
-
-    case START_EXP_SIC:
-      i = 3;
-      command_ptr = start_test;
-      has_function_to_execute = true;
-      break;
-
-    case MSP_OP_POWER_OFF:
-      i = 4;
-      command_ptr = save_seqflags;
-      has_function_to_execute = true;
-      break;
-
-    case SIC_10V_OFF:
-      turn_off_10v();
-      break;
-
-    case PIEZO_5V_OFF:
-      turn_off_5v();
-      break;
-
-    case PIEZO_48V_OFF:
-      turn_off_48v();
-      break;
-
-    case VBAT_OFF:
-      turn_off_vbat();
-      break;
-  }
+  const exp_handler *handler = handler_for(opcode);
+
+  msp_stats_end(opcode, true);
+  if (handler == NULL || handler->complete == NULL)
+    return;
+  // the OBC has to send MSP_OP_ACTIVE before an experiment can be started
+  if (handler->domain != POWER_DOMAIN_NONE && power_is_sleeping())
+    return;
+  handler->complete();
 }
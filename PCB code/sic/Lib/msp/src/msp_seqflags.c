@@ -198,6 +198,17 @@ int msp_seqflags_set(volatile msp_seqflags_t *flags, unsigned char opcode, unsig
 }
 
 
+/*
+ * The flag masks of the standard opcodes, indexed by the opcode type (1 for
+ * system commands, 2 for requests and 3 for sends) and the low nibble of the
+ * opcode. Opcodes that are not in the table have no flag.
+ */
+static const unsigned short msp_standard_flag_masks[3][3] = {
+	{0x0001, 0x0002, 0x0004}, /* MSP_OP_ACTIVE, MSP_OP_SLEEP, MSP_OP_POWER_OFF */
+	{0x0008, 0x0010, 0x0020}, /* MSP_OP_REQ_PAYLOAD, MSP_OP_REQ_HK, MSP_OP_REQ_PUS */
+	{0x0040, 0x0080, 0x0000}  /* MSP_OP_SEND_TIME, MSP_OP_SEND_PUS */
+};
+
 /*
  * Returns flag position information for the specified opcode. The mask field
  * is set to 0 if the opcode does not have an associated flag.
@@ -205,53 +216,22 @@ int msp_seqflags_set(volatile msp_seqflags_t *flags, unsigned char opcode, unsig
 static struct msp_flag_position msp_get_flag_pos(unsigned char opcode)
 {
 	struct msp_flag_position fp;
+	unsigned char type = opcode >> 4;
+	unsigned char number = opcode & 0x0F;
 
 	if (MSP_OP_IS_CUSTOM(opcode)) {
-		switch (MSP_OP_TYPE(opcode)) {
-		case MSP_OP_TYPE_SYS:
-			fp.index = 1;
-			break;
-		case MSP_OP_TYPE_REQ:
-			fp.index = 2;
-			break;
-		case MSP_OP_TYPE_SEND:
-			fp.index = 3;
-			break;
-		}
-
-		fp.mask = 1 << (opcode & 0x0F);
+		/* the custom opcodes are 0x50 to 0x7F, their type is never control */
+		fp.index = MSP_OP_TYPE(opcode) >> 4;
+		fp.mask = 1 << number;
 	} else {
 		fp.index = 0;
 
-		switch (opcode) {
-		case MSP_OP_ACTIVE:
-			fp.mask = 0x0001;
-			break;
-		case MSP_OP_SLEEP:
-			fp.mask = 0x0002;
-			break;
-		case MSP_OP_POWER_OFF:
-			fp.mask = 0x0004;
-			break;
-		case MSP_OP_REQ_PAYLOAD:
-			fp.mask = 0x0008;
-			break;
-		case MSP_OP_REQ_HK:
-			fp.mask = 0x0010;
-			break;
-		case MSP_OP_REQ_PUS:
-			fp.mask = 0x0020;
-			break;
-		case MSP_OP_SEND_TIME:
-			fp.mask = 0x0040;
-			break;
-		case MSP_OP_SEND_PUS:
-			fp.mask = 0x0080;
-			break;
-		default:
+		if (type >= 1 && type <= 3 && number < 3)
+			fp.mask = msp_standard_flag_masks[type - 1][number];
+		else if (opcode == MSP_OP_REQ_WINDOW)
+			fp.mask = 0x0100;
+		else
 			fp.mask = 0;
-			break;
-		}
 	}
 
 	return fp;
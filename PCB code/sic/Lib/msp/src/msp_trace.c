@@ -0,0 +1,162 @@
+/**
+ * @file      msp_trace.c
+ * @brief     Implements the binary trace of the MSP state machine.
+ *
+ * @details
+ * The ring is indexed by two free running counters, head counts the records
+ * that have been written and tail the records that the OBC has taken. Both
+ * wrap around together, so head - tail is always the number of records that
+ * have not been taken, and the ones beyond MSP_TRACE_SIZE were overwritten.
+ *
+ * While a download is in progress the records that are sent are kept: a new
+ * record that would overwrite one of them is dropped and counted instead.
+ */
+
+#include "msp_endian.h"
+#include "msp_opcodes.h"
+#include "msp_trace.h"
+
+#ifdef MSP_TRACE
+
+struct msp_trace_record {
+	unsigned char event;
+	unsigned char opcode;
+	unsigned char state;
+	unsigned char frame_id;
+	unsigned long arg;
+	unsigned long tick;
+};
+
+static struct msp_trace_record records[MSP_TRACE_SIZE];
+
+/* Written by msp_trace_put() only */
+static volatile unsigned long head = 0;
+static volatile unsigned long dropped = 0;
+
+/* Written by the download only */
+static volatile unsigned long tail = 0;
+static volatile unsigned long first = 0;  /* First record of the download */
+static volatile unsigned char sending = 0;
+static unsigned long count = 0;           /* Records in the download */
+static unsigned long lost = 0;            /* Lost records in the download */
+static unsigned long dropped_open = 0;    /* Dropped when the download started */
+static unsigned long dropped_taken = 0;   /* Dropped when the last one ended */
+static unsigned long open_tick = 0;
+
+void msp_trace_put(volatile struct msp_exp_state_information *state, unsigned char event, unsigned char opcode, unsigned char frame_id, unsigned long arg)
+{
+	struct msp_trace_record *record;
+	unsigned long h;
+
+	h = head;
+	if (sending && h - first >= MSP_TRACE_SIZE) {
+		dropped++;
+		return;
+	}
+
+	record = &records[h & (MSP_TRACE_SIZE - 1)];
+	record->event = event;
+	record->opcode = opcode;
+	if (state == 0)
+		record->state = 0xFF;
+	else
+		record->state = (unsigned char) (((state - msp_exp_states) << 4) | (state->type & 0x0F));
+	record->frame_id = frame_id;
+	record->arg = arg;
+	record->tick = msp_trace_tick();
+
+	/* The record is complete before it is counted */
+	head = h + 1;
+}
+
+void msp_trace_put_frame(volatile struct msp_exp_state_information *state, unsigned char event, const unsigned char *frame, unsigned long len)
+{
+	unsigned char opcode;
+	unsigned long arg;
+
+	if (len == 0) {
+		msp_trace_put(state, event, 0, 0, 0);
+		return;
+	}
+
+	opcode = frame[0] & 0x7F;
+	if (opcode == MSP_OP_DATA_FRAME || MSP_OP_IS_WINDOW_DATA(opcode))
+		arg = len >= 5 ? len - 5 : 0;
+	else if (len == 9)
+		arg = msp_from_bigendian32(frame + 1);
+	else
+		arg = len;
+
+	msp_trace_put(state, event, opcode, (frame[0] >> 7) & 0x01, arg);
+}
+
+unsigned long msp_trace_open(void)
+{
+	unsigned long h;
+
+	h = head;
+	dropped_open = dropped;
+
+	count = h - tail;
+	lost = dropped_open - dropped_taken;
+	if (count > MSP_TRACE_SIZE) {
+		lost += count - MSP_TRACE_SIZE;
+		count = MSP_TRACE_SIZE;
+	}
+	first = h - count;
+	sending = 1;
+	open_tick = msp_trace_tick();
+
+	return MSP_TRACE_HEADER_SIZE + count * MSP_TRACE_RECORD_SIZE;
+}
+
+void msp_trace_copy(unsigned char *buf, unsigned long len, unsigned long offset)
+{
+	unsigned char bytes[MSP_TRACE_RECORD_SIZE];
+	const struct msp_trace_record *record;
+	unsigned long i, index, at;
+
+	index = (unsigned long) -1;
+	for (i = 0; i < len; i++) {
+		at = offset + i;
+		if (at < MSP_TRACE_HEADER_SIZE) {
+			msp_to_bigendian32(bytes, lost);
+			msp_to_bigendian32(bytes + 4, open_tick);
+			buf[i] = bytes[at];
+			continue;
+		}
+
+		at -= MSP_TRACE_HEADER_SIZE;
+		if (at / MSP_TRACE_RECORD_SIZE >= count) {
+			buf[i] = 0;
+			continue;
+		}
+		if (at / MSP_TRACE_RECORD_SIZE != index) {
+			/* Serialize the next record */
+			index = at / MSP_TRACE_RECORD_SIZE;
+			record = &records[(first + index) & (MSP_TRACE_SIZE - 1)];
+			bytes[0] = record->event;
+			bytes[1] = record->opcode;
+			bytes[2] = record->state;
+			bytes[3] = record->frame_id;
+			msp_to_bigendian32(bytes + 4, record->arg);
+			msp_to_bigendian32(bytes + 8, record->tick);
+		}
+		buf[i] = bytes[at % MSP_TRACE_RECORD_SIZE];
+	}
+}
+
+void msp_trace_release(void)
+{
+	tail = first + count;
+	dropped_taken = dropped_open;
+	sending = 0;
+}
+
+void msp_trace_abort(void)
+{
+	/* The same records, and the lost ones, are sent next time */
+	sending = 0;
+}
+
+#endif
@@ -20,8 +20,11 @@
 
 #include "piezo.h"
 #include "usart.h"
+#include "tim.h"
 #include "power_management.h"
 #include "tools.h"
+#include "arena.h"
+#include "msp_i2c_slave.h"
 
 
 int NUMBER_OF_READ_ATTEMTS = 3;
@@ -31,24 +34,62 @@ char xm3_buffer[4]="XM3;";
 char xm4_buffer[4]="XM4;";
 
 /* data section */
-uint8_t xu6_buffer[6]; // used for sending data request
+uint8_t xu6_buffer[20]; // used for sending data request
 uint8_t saveDataPointer[1];
-uint8_t piezoData[200];
-int piezoBufferRxInt[200];
 uint8_t piezoBufferint8[200];
 extern UART_HandleTypeDef huart1;
 int dataLength = 0;
 
+/* in-run telemetry section */
+struct piezo_sample {
+  uint32_t tick;                          // HAL tick when the record was read
+  uint16_t values[PIEZO_RECORD_VALUES];   // the record, truncated to 16 bits
+};
+static struct piezo_sample piezoSamples[PIEZO_SAMPLE_RING_SIZE];
+static uint8_t sampleFirst = 0;           // index of the oldest sample
+static uint8_t sampleCount = 0;           // number of samples in the ring
+static uint8_t sampleDownloadCount = 0;   // samples locked by a REQ_PIEZO
+static uint16_t pollRecord = 0;           // next record to ask the motor for
+static uint16_t pollInterval = PIEZO_POLL_INTERVAL_MS;
+static bool volatile pollPending = false;
+
+/* power up section */
+static piezo_state_type piezoState = PIEZO_STATE_OFF;
+static uint32_t bootStart = 0;            // HAL tick when the motor was powered
+static uint32_t bootTime = 0;             // ms until the controller answered
+static bool bootTimedOut = false;         // XM3 was sent without an answer
+
+/* record dump section, read by the OBC requests */
+static bool volatile dumpRunning = false;
+static uint32_t volatile dumpRecordStart = 0; // HAL tick when the current record was asked for
+static uint8_t volatile dumpRecordsDone = 0;
+
+static int piezo_query_record(int record, uint8_t *rxBuffer, int rxSize, uint32_t timeout);
+static bool record_is_well_formed(const uint8_t *rxBuffer, int length);
+static void piezo_push_sample(const int *record);
+static void piezo_probe(void);
+static void piezo_begin_run(void);
+
+// the reply being parsed and the values of the records read so far
+ARENA_FITS(piezo_acquisition, ARENA_ROUND(PIEZO_DUMP_REPLY_LENGTH) + ARENA_ROUND(sizeof(int) * PIEZO_DUMP_VALUES));
+
 
 /**
 	Sets the mode of RS-485 communication. Needs to be called before
 	attempting transmitting or receiveing data.
 
+	The driver (DE485) is controlled by USART1 in hardware, it is only
+	enabled while a frame is sent. This function only controls the
+	receiver (RE485). Use RS_MODE_RECEIVE before sending a command that
+	has a reply, the receiver is then already on when the stop bit
+	has been sent.
+
 	Always end a transaction with mode RS_MODE_DEACTIVATE.
 	This command sets the transceiver to low power mode(turns off).
 
 	Example:
 		RS485(RS_MODE_RECEIVE);
+		piezo_transmit(command, length, 100);
 		HAL_UART_Receive(&huart1, (uint8_t *)saveDataPointer, 1, 100);
 
 		// If no more communication will be done
@@ -58,41 +99,96 @@ int dataLength = 0;
 void RS485(uint8_t rs485_mode){
 	switch (rs485_mode) {
 		case RS_MODE_RECEIVE:
-			HAL_GPIO_WritePin(GPIOA, RE485_Pin, GPIO_PIN_RESET);
-			HAL_GPIO_WritePin(GPIOA, DE485_Pin, GPIO_PIN_RESET);
+			HAL_GPIO_WritePin(RE485_GPIO_Port, RE485_Pin, GPIO_PIN_RESET);
                         break;
 
 		case RS_MODE_TRANSMIT:
-			HAL_GPIO_WritePin(GPIOA, RE485_Pin, GPIO_PIN_SET);
-			HAL_GPIO_WritePin(GPIOA, DE485_Pin, GPIO_PIN_SET);
-                        break;
-
 		case RS_MODE_DEACTIVATE:
-			HAL_GPIO_WritePin(GPIOA, RE485_Pin, GPIO_PIN_SET);
-			HAL_GPIO_WritePin(GPIOA, DE485_Pin, GPIO_PIN_RESET);
+			HAL_GPIO_WritePin(RE485_GPIO_Port, RE485_Pin, GPIO_PIN_SET);
                         break;
-                
-                //case RS_MODE_TRANSMIT
 	}
 }
 
+/**
+ * @brief sends a command to the motor
+ * @param data the command
+ * @param length number of bytes in the command
+ * @param timeout max number of milliseconds the transfer may take
+ * @return true if the command was sent
+ *
+ * the command is sent with DMA, the driver is turned on and off by the USART.
+ * Bytes that were echoed by the transceiver while sending are dropped so
+ * that the next byte received is the first byte of the reply.
+ */
+bool piezo_transmit(const uint8_t *data, uint16_t length, uint32_t timeout)
+{
+  HAL_StatusTypeDef status = usart1_transmit_dma(data, length, timeout);
+
+  __HAL_UART_SEND_REQ(&huart1, UART_RXDATA_FLUSH_REQUEST);
+  return status == HAL_OK;
+}
 
+
+/**
+ * @brief clears the dumped records, called when the OBC has taken them
+ */
 void clear_piezo_buffer (void)
 {
-    Flush_Buffer8(piezoData, (dataLength));
     Flush_Buffer8(piezoBufferint8, (dataLength));
+    dataLength = 0;
 }
 
 /**
- * @brief starts the motor by sending xm3
+ * @brief powers the motor, xm3 is sent by piezo_poll() once the controller
+ * has booted.
+ *
+ * the controller is probed every PIEZO_PROBE_INTERVAL_MS, xm3 is sent as
+ * soon as it answers or after PIEZO_BOOT_TIMEOUT_MS if it never does.
  */
 void piezo_start_exp(void)
 {
   piezo_power_on();
-  HAL_Delay(3000); // time it takes for the motor to turn on.
+  bootStart = HAL_GetTick();
+  piezoState = PIEZO_STATE_BOOTING;
+  pollPending = false;
+  tim21_set_period_ms(PIEZO_PROBE_INTERVAL_MS);
+  HAL_TIM_Base_Start_IT(&htim21);
+}
+
+/**
+ * @brief sends xm3 and starts sampling the records while the motor is running
+ */
+static void piezo_begin_run(void)
+{
   RS485(RS_MODE_TRANSMIT);
-  HAL_UART_Transmit(&huart1, (uint8_t *)xm3_buffer, 4, 1000);
+  piezo_transmit((uint8_t *)xm3_buffer, 4, 1000);
   RS485(RS_MODE_DEACTIVATE);
+
+  sampleFirst = 0;
+  sampleCount = 0;
+  sampleDownloadCount = 0;
+  pollRecord = 0;
+  pollPending = false;
+  piezoState = PIEZO_STATE_RUNNING;
+  tim21_set_period_ms(pollInterval);
+}
+
+/**
+ * @brief asks the controller for a record to see if it has booted
+ */
+static void piezo_probe(void)
+{
+  uint8_t rxBuffer[PIEZO_RECORD_MAX_LENGTH];
+  uint32_t elapsed = HAL_GetTick() - bootStart;
+  int length = piezo_query_record(0, rxBuffer, PIEZO_RECORD_MAX_LENGTH, PIEZO_POLL_RX_TIMEOUT_MS);
+  bool answered = length > 0 && rxBuffer[length - 1] == '\r';
+
+  if (answered || elapsed >= PIEZO_BOOT_TIMEOUT_MS)
+  {
+    bootTime = elapsed;
+    bootTimedOut = !answered;
+    piezo_begin_run();
+  }
 }
 
 /**
@@ -100,9 +196,24 @@ void piezo_start_exp(void)
  */
 void piezo_stop_exp(void)
 {
+  HAL_TIM_Base_Stop_IT(&htim21);
+  pollPending = false;
+  if (piezoState == PIEZO_STATE_BOOTING)
+  {
+    // the motor was never started, there is nothing to read
+    piezoState = PIEZO_STATE_OFF;
+    piezo_power_off();
+    return;
+  }
+  piezoState = PIEZO_STATE_OFF;
+
+  dumpRecordsDone = 0;
+  dumpRecordStart = HAL_GetTick();
+  dumpRunning = true;
   RS485(RS_MODE_TRANSMIT);
-  HAL_UART_Transmit(&huart1, (uint8_t *)xm4_buffer, 4, 1000);
+  piezo_transmit((uint8_t *)xm4_buffer, 4, 1000);
   dataLength = piezo_read_data_records();
+  dumpRunning = false;
   piezo_power_off();
   RS485(RS_MODE_DEACTIVATE); // Not really necessary, just added for clarity
 
@@ -123,6 +234,29 @@ void piezo_get_data(unsigned char *buf, long data_offset)
   }
 }
 
+/**
+ * @brief estimates the time until the records of a stopped run are read
+ * @return milliseconds, 0 when no records are being read
+ *
+ * counts as if every record that fits in the buffer is read, the motor
+ * usually has fewer. Never 0 while the records are read.
+ */
+uint32_t piezo_time_to_ready(void)
+{
+  uint32_t remaining;
+  uint32_t elapsed;
+
+  if (!dumpRunning)
+    return 0;
+
+  remaining = (uint32_t)(PIEZO_DUMP_MAX_RECORDS - dumpRecordsDone) * PIEZO_DUMP_RECORD_ESTIMATE_MS;
+  elapsed = HAL_GetTick() - dumpRecordStart;
+  // a record that is read again takes longer than the estimate
+  if (elapsed >= remaining)
+    return 1;
+  return remaining - elapsed;
+}
+
 /**
  * @brief retrieves the length of the buffer
  */
@@ -147,9 +281,16 @@ unsigned char piezo_read_data_records(void)
   int record_counter = 0;
   uint16_t dataOffset = 0;
   int a=0;
+  uint8_t *piezoData;
+  int *piezoBufferRxInt;
+
+  //the checksum reads the two values after a record, the arena clears them
+  arena_begin(ARENA_PHASE_PIEZO_ACQUISITION);
+  piezoData = arena_alloc(PIEZO_DUMP_REPLY_LENGTH);
+  piezoBufferRxInt = arena_alloc(sizeof(int) * PIEZO_DUMP_VALUES);
 
-  //read data records until a empty record is read.
-  while(isThereMoreData)
+  //read data records until a empty record is read or the buffer is full.
+  while(isThereMoreData && record_counter < PIEZO_DUMP_MAX_RECORDS)
   {
     //printf("Gather");
     //retry reading data until max attempts is reached if checksum was not ok.
@@ -160,31 +301,8 @@ unsigned char piezo_read_data_records(void)
      //be reset because of checksum check since we want to exit if we fail checksum test more than max read attempts
       isThereMoreData = true;
 
-
-      sprintf((char *)xu6_buffer, "XU6,%d\r", record_counter);
-      //printf("%d", xu6_buffer);
-      int i=0;
-      RS485(RS_MODE_TRANSMIT); // Set transceiver to transmit
-      HAL_Delay(10);
-      HAL_UART_Transmit(&huart1, (uint8_t *)xu6_buffer, 6, 100);
-
-      //HAL_Delay(10);
-      RS485(RS_MODE_RECEIVE); // Set transceiver to receive
-      //HAL_Delay(10);
-      while(1)
-      {
-        if(HAL_UART_Receive(&huart1, (uint8_t *)saveDataPointer, 1, 100) != HAL_OK)
-          //printf("Abort reception of data");
-          break; // stop reading
-        piezoData[i++] = saveDataPointer[0];
-        //printf("%d\n", piezoData[i]);
-        if ('\r' == saveDataPointer[0]||i==199)//199 so we do not write outside array
-           //printf("r received");
-           break; // stop reading
-      }
-      
-      HAL_Delay(1000);
-      RS485(RS_MODE_DEACTIVATE); // Turn off communication
+      int i = piezo_query_record(record_counter, piezoData, PIEZO_DUMP_REPLY_LENGTH - 1, 100);
+      msp_i2c_delay(1000);
 
       //check if record was empty
       if(record_was_empty((char *)&piezoData[6]))
@@ -192,29 +310,277 @@ unsigned char piezo_read_data_records(void)
         isThereMoreData = false;
         break; // break the attempt loop
       }
-      //convert to integers, skip (xu6:) therefore 4
-      ascii_to_int((char *)&piezoData[4], (int *)&piezoBufferRxInt[dataOffset]);
-
-      //calulate checksum
-      if(piezo_checksum((int *)&piezoBufferRxInt[dataOffset]))
-      {
-        //if the checksum was correct, read the next record.
-        dataOffset += 9;
-        record_counter++;
-        break; // break the attempt loop
-      }
-      else
+      //a reply that lost bytes is read again
+      if(record_is_well_formed(piezoData, i))
       {
-        //flush the last recived incorrect values
-        Flush_Buffer8(piezoData, i);
-        isThereMoreData = false;
+        //convert to integers, skip (xu6:) therefore 4
+        ascii_to_int((char *)&piezoData[4], (int *)&piezoBufferRxInt[dataOffset]);
+
+        //calulate checksum
+        if(piezo_checksum((int *)&piezoBufferRxInt[dataOffset]))
+        {
+          //if the checksum was correct, read the next record.
+          dataOffset += 9;
+          record_counter++;
+          dumpRecordsDone = record_counter;
+          dumpRecordStart = HAL_GetTick();
+          break; // break the attempt loop
+        }
       }
+      //flush the last recived incorrect values
+      Flush_Buffer8(piezoData, i);
+      isThereMoreData = false;
     }
   }
-  convert_to_8bit(piezoBufferint8, dataOffset*2);
+  convert_to_8bit(piezoBufferint8, piezoBufferRxInt, dataOffset);
+  arena_end();
   return dataOffset*2;
 }
 
+/**
+ * @brief asks the motor for one data record and reads the reply
+ * @param record the number of the record to read
+ * @param rxBuffer buffer the reply is written to
+ * @param rxSize the maximum number of bytes to read
+ * @param timeout the number of milliseconds to wait for each byte
+ * @return the number of bytes that was read
+ *
+ * reading stops at the first carriage return, when the buffer is full or when
+ * no byte arrives within the timeout. The transceiver is turned off afterwards.
+ */
+static int piezo_query_record(int record, uint8_t *rxBuffer, int rxSize, uint32_t timeout)
+{
+  int length = sprintf((char *)xu6_buffer, "XU6,%d\r", record);
+  int i = 0;
+
+  RS485(RS_MODE_RECEIVE); // receiver on, the USART drives the driver while sending
+  if (!piezo_transmit(xu6_buffer, length, 100))
+  {
+    RS485(RS_MODE_DEACTIVATE);
+    return 0;
+  }
+
+  while (i < rxSize)
+  {
+    if(HAL_UART_Receive(&huart1, (uint8_t *)saveDataPointer, 1, timeout) != HAL_OK)
+      break; // stop reading
+    rxBuffer[i++] = saveDataPointer[0];
+    if ('\r' == saveDataPointer[0])
+      break; // stop reading
+  }
+
+  RS485(RS_MODE_DEACTIVATE); // Turn off communication
+  return i;
+}
+
+/**
+ * @brief called from the TIM21 update interrupt, schedules the next poll.
+ */
+void piezo_poll_tick(void)
+{
+  pollPending = true;
+}
+
+/**
+ * @brief reads the next data record while the motor is running
+ *
+ * should be called from the main loop. Does nothing unless the poll timer has
+ * expired since the last call. While the motor is powering up the controller
+ * is probed instead, see piezo_start_exp(). A record that is empty (not yet written by the
+ * motor) or that fails the checksum is asked for again on the next poll.
+ */
+void piezo_poll(void)
+{
+  uint8_t rxBuffer[PIEZO_RECORD_MAX_LENGTH] = {0};
+  int record[PIEZO_RECORD_VALUES + 2] = {0};
+  int length;
+
+  if (!pollPending)
+    return;
+  pollPending = false;
+
+  if (piezoState == PIEZO_STATE_BOOTING)
+  {
+    piezo_probe();
+    return;
+  }
+  if (piezoState != PIEZO_STATE_RUNNING)
+    return;
+
+  length = piezo_query_record(pollRecord, rxBuffer, PIEZO_RECORD_MAX_LENGTH, PIEZO_POLL_RX_TIMEOUT_MS);
+  if (!record_is_well_formed(rxBuffer, length) || record_was_empty((char *)&rxBuffer[6]))
+    return;
+
+  //convert to integers, skip (xu6:) therefore 4
+  ascii_to_int((char *)&rxBuffer[4], record);
+  if (!piezo_checksum(record))
+    return;
+
+  piezo_push_sample(record);
+  pollRecord++;
+}
+
+/**
+ * @brief sets the number of milliseconds between two polls
+ * @param interval_ms the new interval, takes effect immediately if running
+ */
+void piezo_set_poll_interval(uint16_t interval_ms)
+{
+  if (interval_ms == 0)
+    return;
+  pollInterval = interval_ms;
+  if (piezoState == PIEZO_STATE_RUNNING)
+    tim21_set_period_ms(pollInterval);
+}
+
+/**
+ * @brief tells if the motor is running and records are being sampled
+ */
+bool piezo_telemetry_running(void)
+{
+  return piezoState == PIEZO_STATE_RUNNING;
+}
+
+/**
+ * @brief tells where the motor is in its power up
+ */
+piezo_state_type piezo_get_state(void)
+{
+  return piezoState;
+}
+
+/**
+ * @brief retrieves the time it took for the controller to boot
+ * @param timed_out set to true if xm3 was sent without an answer from the
+ * controller, may be NULL
+ * @return the number of milliseconds from power on until xm3 was sent
+ */
+uint32_t piezo_get_boot_time(bool *timed_out)
+{
+  if (timed_out != NULL)
+    *timed_out = bootTimedOut;
+  return bootTime;
+}
+
+/**
+ * @brief locks the sampled records for a download
+ * @return the number of bytes that will be sent
+ *
+ * the locked samples are kept in the ring until piezo_release_samples() is
+ * called, new samples are still appended behind them.
+ */
+int piezo_get_sample_length(void)
+{
+  sampleDownloadCount = sampleCount;
+  return sampleDownloadCount * PIEZO_SAMPLE_SIZE;
+}
+
+/**
+ * @brief copies locked samples, each sample is sent as a 32 bit tick followed
+ * by the record values, all big endian.
+ * @param buf buffer to copy the data to
+ * @param len number of bytes to copy
+ * @param data_offset offset into the locked samples
+ */
+void piezo_get_samples(unsigned char *buf, unsigned long len, unsigned long data_offset)
+{
+  for (unsigned long i = 0; i < len; i++)
+  {
+    unsigned long position = data_offset + i;
+    struct piezo_sample *sample = &piezoSamples[(sampleFirst + position / PIEZO_SAMPLE_SIZE) % PIEZO_SAMPLE_RING_SIZE];
+    uint8_t field = position % PIEZO_SAMPLE_SIZE;
+
+    if (field < 4)
+    {
+      buf[i] = (sample->tick >> (24 - 8 * field)) & 0xFF;
+    }
+    else
+    {
+      field -= 4;
+      if (field & 1)
+        buf[i] = sample->values[field / 2] & 0xFF;
+      else
+        buf[i] = sample->values[field / 2] >> 8 & 0xFF;
+    }
+  }
+}
+
+/**
+ * @brief removes the locked samples from the ring, called when the OBC has
+ * acknowledged the download.
+ */
+void piezo_release_samples(void)
+{
+  sampleFirst = (sampleFirst + sampleDownloadCount) % PIEZO_SAMPLE_RING_SIZE;
+  sampleCount -= sampleDownloadCount;
+  sampleDownloadCount = 0;
+}
+
+/**
+ * @brief unlocks the samples without removing them, the download failed.
+ */
+void piezo_abort_samples(void)
+{
+  sampleDownloadCount = 0;
+}
+
+/**
+ * @brief checks that a reply holds a whole record before it is parsed
+ *
+ * after the four byte header there must be exactly PIEZO_RECORD_VALUES
+ * numbers separated by commas and ended by a carriage return. The checksum
+ * does not cover the first value nor the header, a reply that lost a byte
+ * there would otherwise be accepted.
+ */
+static bool record_is_well_formed(const uint8_t *rxBuffer, int length)
+{
+  int values = 0;
+  int digits = 0;
+
+  if (length < 5 || rxBuffer[length - 1] != '\r')
+    return false;
+  for (int i = 4; i < length; i++)
+  {
+    if (rxBuffer[i] >= '0' && rxBuffer[i] <= '9')
+    {
+      digits++;
+    }
+    else if ((rxBuffer[i] == ',' || rxBuffer[i] == '\r') && digits > 0)
+    {
+      values++;
+      digits = 0;
+    }
+    else
+    {
+      return false;
+    }
+  }
+  return values == PIEZO_RECORD_VALUES;
+}
+
+/**
+ * @brief appends a record to the sample ring, the oldest sample is dropped
+ * when the ring is full unless it is locked by a download.
+ */
+static void piezo_push_sample(const int *record)
+{
+  struct piezo_sample *sample;
+
+  if (sampleCount == PIEZO_SAMPLE_RING_SIZE)
+  {
+    if (sampleDownloadCount != 0)
+      return;
+    sampleFirst = (sampleFirst + 1) % PIEZO_SAMPLE_RING_SIZE;
+    sampleCount--;
+  }
+
+  sample = &piezoSamples[(sampleFirst + sampleCount) % PIEZO_SAMPLE_RING_SIZE];
+  sample->tick = HAL_GetTick();
+  for (int v = 0; v < PIEZO_RECORD_VALUES; v++)
+    sample->values[v] = record[v] & 0xFFFF;
+  sampleCount++;
+}
+
 /**
  * @brief check if the record that was read was empty, eather by containg 0,0,0
  * or by containing null.
@@ -274,12 +640,12 @@ void ascii_to_int (char * bufferIn, int * bufferOut)
   }
 }
 
-void convert_to_8bit(uint8_t * buffer, uint16_t length)
+void convert_to_8bit(uint8_t * buffer, const int * values, uint16_t length)
 {
   for (int i = 0; i < length; i++)
   {
-      *buffer = piezoBufferRxInt[i] >>8 & 0xFF  ;
-      *++buffer = piezoBufferRxInt[i]  & 0xFF  ;
+      *buffer = values[i] >>8 & 0xFF  ;
+      *++buffer = values[i]  & 0xFF  ;
       buffer++;
   }
 }
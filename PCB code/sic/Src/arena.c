@@ -0,0 +1,86 @@
+/****************************************************************************
+ * SCRATCH ARENA                                                            *
+ ****************************************************************************/
+
+/**
+ *****************************************************************************
+ * @file arena.c
+ * @brief scratch memory that the experiment phases borrow in turn
+ *****************************************************************************
+ * the SiC sweep, the Piezo record dump and the test driver each need a few
+ * hundred bytes, but never at the same time. Instead of a buffer each they
+ * borrow from one pool: a phase begins, takes what it needs with
+ * arena_alloc and gives all of it back with arena_end.
+ *
+ * only one phase can hold the arena. The phases run from the main loop one
+ * after the other, beginning a phase while another one holds the arena or
+ * taking more than the arena has is a bug and ends in Error_Handler. Every
+ * phase checks at compile time that its allocations fit, see ARENA_FITS.
+ *
+ * the results (the SiC buffer, the Piezo dump and the sample ring) are kept
+ * outside the arena, they wait for the OBC across phases.
+ */
+
+#include <string.h>
+#include "main.h"
+#include "arena.h"
+
+static uint32_t pool[ARENA_SIZE / 4];
+static uint16_t used = 0;       // bytes taken by the phase
+static uint16_t highWater = 0;  // most bytes ever taken by a phase
+static arena_phase phase = ARENA_PHASE_IDLE;
+
+/**
+ * @brief starts a phase, the whole arena is free for it
+ */
+void arena_begin(arena_phase next)
+{
+  if (phase != ARENA_PHASE_IDLE || next == ARENA_PHASE_IDLE)
+    Error_Handler();
+  phase = next;
+  used = 0;
+}
+
+/**
+ * @brief takes memory from the arena for the current phase
+ * @param size number of bytes
+ * @return word aligned memory, cleared, that is valid until arena_end
+ */
+void *arena_alloc(uint16_t size)
+{
+  uint8_t *memory = (uint8_t *)pool + used;
+
+  if (phase == ARENA_PHASE_IDLE || ARENA_ROUND(size) > ARENA_SIZE - used)
+    Error_Handler();
+
+  used += ARENA_ROUND(size);
+  if (used > highWater)
+    highWater = used;
+  memset(memory, 0, size);
+  return memory;
+}
+
+/**
+ * @brief ends the phase, everything it took is given back
+ */
+void arena_end(void)
+{
+  phase = ARENA_PHASE_IDLE;
+  used = 0;
+}
+
+/**
+ * @brief tells which phase holds the arena
+ */
+arena_phase arena_get_phase(void)
+{
+  return phase;
+}
+
+/**
+ * @brief retrieves the most bytes a phase has taken since boot
+ */
+uint16_t arena_get_high_water(void)
+{
+  return highWater;
+}
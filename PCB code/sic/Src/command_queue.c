@@ -0,0 +1,122 @@
+/****************************************************************************
+ * COMMAND QUEUE                                                            *
+ ****************************************************************************/
+
+/**
+ *****************************************************************************
+ * @file command_queue.c
+ * @brief commands from the OBC, waiting for the main loop
+ *****************************************************************************
+ * the MSP handlers push a command for every system command the OBC sends
+ * and the main loop runs them in order, so several commands sent in one go
+ * are all carried out.
+ *
+ * there is one producer (the MSP handlers) and one consumer (the main
+ * loop). head is only written by the producer and tail only by the
+ * consumer, so pushing is safe from an interrupt as well. While the queue
+ * is full msp_i2c_poll() holds the frames that may push a command and the
+ * OBC reads EXP_BUSY from their address until a command has been taken out.
+ * The other frames are still answered, so a request that is open on the
+ * other address can end and let the main loop run the queue.
+ *
+ * a command may run for seconds. It waits in msp_i2c_delay(), which keeps
+ * answering the OBC, so the commands sent meanwhile are pushed as well and
+ * run after it. Commands are never run from there.
+ */
+
+#include "main.h"
+#include "command_queue.h"
+#include "piezo.h"
+#include "start_test.h"
+#include "interface_flags.h"
+#include "power_management.h"
+
+static command queue[COMMAND_QUEUE_LENGTH];
+static volatile uint8_t head = 0; // next free slot, written by the producer
+static volatile uint8_t tail = 0; // oldest command, written by the consumer
+
+static void command_execute(const command *cmd);
+
+/**
+ * @brief adds a command at the end of the queue
+ * @return false if the queue is full and the command was not added
+ */
+bool command_queue_push(command_type type, uint16_t argument)
+{
+  uint8_t slot = head;
+
+  if (command_queue_full())
+    return false;
+
+  queue[slot % COMMAND_QUEUE_LENGTH].type = type;
+  queue[slot % COMMAND_QUEUE_LENGTH].argument = argument;
+  // the command must be complete before the consumer can see it
+  __DMB();
+  head = slot + 1;
+  return true;
+}
+
+/**
+ * @brief tells if another command can not be added
+ */
+bool command_queue_full(void)
+{
+  return (uint8_t)(head - tail) >= COMMAND_QUEUE_LENGTH;
+}
+
+/**
+ * @brief takes the oldest command out of the queue and runs it
+ *
+ * should be called from the main loop.
+ * @return true if a command was run, false if the queue was empty
+ */
+bool command_queue_run_next(void)
+{
+  uint8_t slot = tail;
+  command cmd;
+
+  if (slot == head)
+    return false;
+
+  cmd = queue[slot % COMMAND_QUEUE_LENGTH];
+  // the slot is free once it has been copied, the command may run for long
+  __DMB();
+  tail = slot + 1;
+
+  command_execute(&cmd);
+  return true;
+}
+
+static void command_execute(const command *cmd)
+{
+  switch (cmd->type)
+  {
+    case COMMAND_PIEZO_START:
+      piezo_start_exp();
+      break;
+
+    case COMMAND_PIEZO_STOP:
+      piezo_stop_exp();
+      break;
+
+    case COMMAND_SIC_START:
+      start_test();
+      break;
+
+    case COMMAND_SAVE_SEQFLAGS:
+      save_seqflags();
+      break;
+
+    case COMMAND_SLEEP:
+      power_sleep();
+      break;
+
+    case COMMAND_ACTIVE:
+      power_active();
+      break;
+
+    case COMMAND_PIEZO_POLL_INTERVAL:
+      piezo_set_poll_interval(cmd->argument);
+      break;
+  }
+}
@@ -7,15 +7,41 @@
  * @file eeprom_circular.c
  * @date 2019-06-15
  * @bug no known buggs
- * @brief An implementation of a circular eeprom buffer
+ * @brief A circular journal of halfwords in the data eeprom
  *****************************************************************************
- * This is a High Endurance EEPROM driver based on AMTELs High Endurance
- * EEPROM driver example, aplicaiton note (AVR 101).
+ * This is a High Endurance EEPROM driver in the spirit of AMTELs High
+ * Endurance EEPROM driver example, aplicaiton note (AVR 101): the writes
+ * move around a circular buffer, so every location is worn equally.
  * The implemenationt utiliezes STs HAL driver to interface with the
- * EEPROM. The driver was developed for KTHs MIST project. 
+ * EEPROM. The driver was developed for KTHs MIST project.
  * The EEPROM in the STM32l053c6 has a size of 2k and uses the adresses space:
- * 0x0808 0000 - 0x0808 07FF.
- *  
+ * 0x0808 0000 - 0x0808 07FF. The journal takes the first JOURNAL_RECORDS*8
+ * bytes.
+ *
+ * The journal keeps JOURNAL_HALFWORDS halfwords. Only a halfword that
+ * changed is written, as a record of its own: a word with a 12 bit sequence
+ * number, the number of the halfword and its value, followed by the
+ * complement of that word. A write that is cut off by a power loss leaves a
+ * record whose two words do not match, and it is ignored.
+ *
+ * The sequence number grows by one from record to record, so the newest
+ * record is found with a binary search: up to it the sequence numbers follow
+ * on from the first record, after it they belong to the lap before or were
+ * never written. Before a record is overwritten, a halfword that has no newer
+ * record is written again, one record ahead, so the journal always holds
+ * every halfword, also when a write is cut off.
+ *
+ * Nothing waits for the eeprom. EEPROM_write queues the writes, packed into
+ * words where the alignment allows, and the flash end of operation interrupt
+ * starts the next one, so MSP is answered while a write takes its 3 ms. A
+ * write that would not change the eeprom is skipped. EEPROM_idle tells when
+ * everything has been programmed and EEPROM_flush waits for it.
+ *
+ * The queue only holds the words that are on their way, not a copy of the
+ * data. Both users make their data a word at a time, a journal record or the
+ * next word of an archived sweep, so a few entries keep the eeprom busy and
+ * a full queue only means waiting for the writes already queued.
+ *
  * @see http://ww1.microchip.com/downloads/en/appnotes/doc2526.pdf
  * @see https://www.st.com/resource/en/datasheet/stm32l053c6.pdf
  */
@@ -26,166 +52,417 @@
 
 
 /*defines (constants) section*/
-#define WRITE_CYCLES            2000
 #define EEPROM_START_ADRESS     0x08080000UL
 #define EEPROM_END_ADRESS       0x080807FFUL
-#define BUFFER_SIZE             0x00000044UL
+#define JOURNAL_START_ADDR      EEPROM_START_ADRESS
+#define RECORD_SIZE             8
+#define SEQUENCE_MASK           0x0FFFU
+#define NO_RECORD               0xFF
+
+#define RECORD_SEQUENCE(word)   ((word) >> 20)
+#define RECORD_HALFWORD(word)   (((word) >> 16) & 0x0F)
+#define RECORD_VALUE(word)      ((word) & 0xFFFF)
+#define WRITE_ADDRESS(write)    (EEPROM_START_ADRESS + (write)->offset)
+#define FLASH_ERRORS            (FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_SIZERR | FLASH_FLAG_FWWERR | FLASH_FLAG_NOTZEROERR)
+
+typedef struct {
+  uint32_t data;
+  uint16_t offset; // from the start of the eeprom
+  uint8_t size;    // 1, 2 or 4 bytes
+} eeprom_write;
+
+static eeprom_write queue[EEPROM_QUEUE_LENGTH];
+static volatile uint8_t queue_head = 0;     // next free slot, written by the main loop
+static volatile uint8_t queue_tail = 0;     // the write in progress, written by the interrupt
+static volatile bool programming = false;   // the eeprom is unlocked and a write is in progress
+static uint16_t error_count = 0;
+
+static uint16_t journal[JOURNAL_HALFWORDS]; // the newest value of every halfword
+static uint8_t newest[JOURNAL_HALFWORDS];   // the record that holds it, NO_RECORD if none
+static uint8_t head = 0;                    // the record that is written next
+static uint16_t sequence = 0;               // the sequence number of the next record
 
-#define INDEX_BUFFER_START_ADDR 0x08080000UL + (BUFFER_SIZE*0)
-#define BUFFER_1_START_ADDR     0x08080000UL + (BUFFER_SIZE*1)
-#define BUFFER_2_START_ADDR     0x08080000UL + (BUFFER_SIZE*2)
-#define BUFFER_3_START_ADDR     0x08080000UL + (BUFFER_SIZE*3)
-#define BUFFER_4_START_ADDR     0x08080000UL + (BUFFER_SIZE*4)
-#define BUFFER_5_START_ADDR     0x08080000UL + (BUFFER_SIZE*5)
-#define BUFFER_6_START_ADDR     0x08080000UL + (BUFFER_SIZE*6)
-#define BUFFER_7_START_ADDR     0x08080000UL + (BUFFER_SIZE*7)
-#define BUFFER_8_START_ADDR     0x08080000UL + (BUFFER_SIZE*8)
-#define CHECKSUM_BUFFER         0x08080000UL + (BUFFER_SIZE*9)
+static bool start_next_write(void);
 
 /**
- * @brief simple checksum for EEPROM.
- * @param 8 bit pointer
- * @param the length of array
- * @return the checksum
+ * @brief Reads a record.
+ * @param the index of the record
+ * @param the first word of the record (pointer)
+ * @return true if the record is complete
  */
-uint16_t checksum(uint16_t *ptr1, uint8_t size1, uint16_t *ptr2, uint8_t size2) 
+static bool read_record(uint8_t index, uint32_t *word)
 {
-    uint16_t chk = 0;
-    while (size1-- != 0)
-        chk -= *ptr1++;
-    while (size2-- != 0)
-        chk -= *ptr2++;
-    return chk;
+  uint32_t address = JOURNAL_START_ADDR + index*RECORD_SIZE;
+
+  *word = (*(__IO uint32_t *)(address));
+  return (*(__IO uint32_t *)(address + 4)) == ~*word;
 }
 
 /**
- * @brief Finds the current index in the index buffer.
- * @return the offset from the base adress of the buffer
+ * @brief Finds the newest record with a binary search.
+ * @return the index of the record, JOURNAL_RECORDS if the journal is empty
+ */
+static uint8_t find_newest_record(void)
+{
+  uint32_t first;
+  uint32_t word;
+  uint8_t low = 0;
+  uint8_t high = JOURNAL_RECORDS - 1;
+
+  if (!read_record(0, &first))
+  {
+    // either nothing was written, or the write that wrapped around was cut off
+    return read_record(JOURNAL_RECORDS - 1, &word) ? JOURNAL_RECORDS - 1 : JOURNAL_RECORDS;
+  }
+
+  while (low < high)
+  {
+    uint8_t middle = (low + high + 1) / 2;
+
+    if (read_record(middle, &word) &&
+        ((RECORD_SEQUENCE(word) - RECORD_SEQUENCE(first)) & SEQUENCE_MASK) == middle)
+      low = middle;
+    else
+      high = middle - 1;
+  }
+  return low;
+}
+
+/**
+ * @brief Queues a record at the head of the journal.
+ * @return false if the write queue is full
+ */
+static bool append(uint8_t halfword, uint16_t value)
+{
+  uint32_t address = JOURNAL_START_ADDR + head*RECORD_SIZE;
+  uint32_t record[2];
+
+  record[0] = ((uint32_t)(sequence & SEQUENCE_MASK) << 20) | ((uint32_t)halfword << 16) | value;
+  record[1] = ~record[0];
+  if (!EEPROM_write(address, record, sizeof(record)))
+    return false;
+
+  journal[halfword] = value;
+  newest[halfword] = head;
+  head = (head + 1) % JOURNAL_RECORDS;
+  sequence++;
+  return true;
+}
+
+/**
+ * @brief Writes again the halfwords whose newest record is at or follows the head.
+ * @return false if the write queue is full
  *
- * finds the offset for the current memmory location
+ * the record at the head never holds the newest value of a halfword, so a
+ * write that is cut off there loses nothing. The record after it is checked
+ * before the head moves on to it. After EEPROM_journal_restore the walk
+ * back may have found a newest value in the oldest record, which is the
+ * one at the head, so that one is written again before anything else.
  */
-static int find_current_EEPROM_address(void)
+static bool keep_overwritten(void)
 {
-  int offset = 0;
+  uint8_t i = 0;
 
-  while (((*(__IO uint16_t *)(INDEX_BUFFER_START_ADDR + offset))+1) == (*(__IO uint16_t *)(INDEX_BUFFER_START_ADDR + offset +2)))
+  while (i < JOURNAL_HALFWORDS)
   {
-    offset = (offset + 2)%BUFFER_SIZE;
+    if (newest[i] == head || newest[i] == (head + 1) % JOURNAL_RECORDS)
+    {
+      if (!append(i, journal[i]))
+        return false;
+      i = 0; // the head moved on, check the next record
+    }
+    else
+    {
+      i++;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Tells if the eeprom already holds the data of a write.
+ */
+static bool holds(const eeprom_write *write)
+{
+  switch (write->size)
+  {
+    case 4:
+      return (*(__IO uint32_t *)WRITE_ADDRESS(write)) == write->data;
+    case 2:
+      return (*(__IO uint16_t *)WRITE_ADDRESS(write)) == (uint16_t)write->data;
+    default:
+      return (*(__IO uint8_t *)WRITE_ADDRESS(write)) == (uint8_t)write->data;
+  }
+}
+
+/**
+ * @brief Starts the oldest queued write that changes the eeprom.
+ * @return false if there is none
+ *
+ * called from the flash interrupt, or with it masked. The eeprom must be
+ * unlocked.
+ */
+static bool start_next_write(void)
+{
+  while (queue_tail != queue_head)
+  {
+    eeprom_write *write = &queue[queue_tail % EEPROM_QUEUE_LENGTH];
+
+    if (holds(write))
+    {
+      queue_tail++;
+      continue;
+    }
+
+    __HAL_FLASH_ENABLE_IT(FLASH_IT_EOP | FLASH_IT_ERR);
+    if (write->size == 4)
+      *(__IO uint32_t *)WRITE_ADDRESS(write) = write->data;
+    else if (write->size == 2)
+      *(__IO uint16_t *)WRITE_ADDRESS(write) = (uint16_t)write->data;
+    else
+      *(__IO uint8_t *)WRITE_ADDRESS(write) = (uint8_t)write->data;
+    return true;
+  }
+  return false;
+}
+
+/**
+ * @brief Size of the next write, the largest that the alignment allows.
+ */
+static uint8_t write_size(uint32_t address, uint16_t length)
+{
+  if ((address & 3) == 0 && length >= 4)
+    return 4;
+  if ((address & 1) == 0 && length >= 2)
+    return 2;
+  return 1;
+}
+
+
+
+
+/**
+ * @brief Enables the flash interrupt that drives the writes.
+ */
+void EEPROM_init(void)
+{
+  HAL_NVIC_SetPriority(FLASH_IRQn, 3, 0);
+  HAL_NVIC_EnableIRQ(FLASH_IRQn);
+}
+
+
+/**
+ * @brief Queues data to be written to the eeprom in the background.
+ * @param the eeprom address
+ * @param the data (pointer)
+ * @param number of bytes
+ * @return false if the queue has no room for all of it, then nothing is queued
+ *
+ * the writes are done in order, as words where the alignment allows and as
+ * halfwords and bytes at the ends.
+ */
+bool EEPROM_write(uint32_t address, const void *data, uint16_t length)
+{
+  const uint8_t *bytes = data;
+  uint16_t count = 0;
+  uint8_t slot = queue_head;
+
+  for (uint16_t i = 0; i < length; i += write_size(address + i, length - i))
+    count++;
+  if ((uint8_t)(slot - queue_tail) + count > EEPROM_QUEUE_LENGTH)
+    return false;
+
+  while (length > 0)
+  {
+    eeprom_write *write = &queue[slot % EEPROM_QUEUE_LENGTH];
+
+    write->offset = address - EEPROM_START_ADRESS;
+    write->size = write_size(address, length);
+    write->data = 0;
+    for (uint8_t i = 0; i < write->size; i++)
+      write->data |= (uint32_t)bytes[i] << (8*i);
+
+    address += write->size;
+    bytes += write->size;
+    length -= write->size;
+    slot++;
+  }
+  // the writes must be complete before the interrupt can see them
+  __DMB();
+  queue_head = slot;
+
+  __disable_irq();
+  if (!programming)
+  {
+    HAL_FLASHEx_DATAEEPROM_Unlock();
+    programming = start_next_write();
+    if (!programming)
+      HAL_FLASHEx_DATAEEPROM_Lock();
+  }
+  __enable_irq();
+  return true;
+}
+
+
+/**
+ * @brief Tells if every queued write has been programmed.
+ */
+bool EEPROM_idle(void)
+{
+  return !programming && queue_head == queue_tail;
+}
+
+
+/**
+ * @brief Waits until every queued write has been programmed.
+ */
+void EEPROM_flush(void)
+{
+  // the end of operation interrupt wakes the core, also with interrupts masked
+  __disable_irq();
+  while (!EEPROM_idle())
+  {
+    __WFI();
+    __enable_irq();
+    __disable_irq();
+  }
+  __enable_irq();
+}
+
+
+/**
+ * @brief Number of writes that failed since boot.
+ */
+uint16_t EEPROM_get_error_count(void)
+{
+  return error_count;
+}
+
+
+/**
+ * @brief Handles the end of an eeprom write and starts the next one.
+ *
+ * should be called from FLASH_IRQHandler.
+ */
+void EEPROM_IRQHandler(void)
+{
+  if (__HAL_FLASH_GET_FLAG(FLASH_ERRORS))
+  {
+    // the write is dropped, the journal tells a torn record apart
+    __HAL_FLASH_CLEAR_FLAG(FLASH_ERRORS);
+    error_count++;
+  }
+  else if (__HAL_FLASH_GET_FLAG(FLASH_FLAG_EOP))
+  {
+    __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP);
+  }
+  else
+  {
+    return;
+  }
+
+  queue_tail++;
+  if (!start_next_write())
+  {
+    __HAL_FLASH_DISABLE_IT(FLASH_IT_EOP | FLASH_IT_ERR);
+    HAL_FLASHEx_DATAEEPROM_Lock();
+    programming = false;
   }
-  return offset;
 }
 
 
 
 
 /** @brief Restarts eeprom buffer.
- *  
- *  Resets the EEPROM buffer by zeroing it.
+ *
+ *  Resets the journal by zeroing it.
  */
 void reset_EEPROM_buffer(void)
 {
+  EEPROM_flush();
   HAL_FLASHEx_DATAEEPROM_Unlock();
-  for (int i =0x08080000UL; i<0x080802AAUL; i=i+4)
+  for (uint32_t i = JOURNAL_START_ADDR; i < JOURNAL_START_ADDR + JOURNAL_RECORDS*RECORD_SIZE; i=i+4)
   {
     HAL_FLASHEx_DATAEEPROM_Program(FLASH_TYPEPROGRAMDATA_WORD, i, 0);
   }
   HAL_FLASHEx_DATAEEPROM_Lock();
+
+  for (uint8_t i = 0; i < JOURNAL_HALFWORDS; i++)
+  {
+    journal[i] = 0;
+    newest[i] = NO_RECORD;
+  }
+  head = 0;
+  sequence = 0;
 }
 
 
 
 
 /**
- * @brief Reads data from the two data bufferts.
- * @param 32 bit of data to be written to the first buffer (pointer)
- * @param 32 bit of data to be written to the second buffer (pointer)
- * @return bool indicating if the checksum was correct
+ * @brief Reads the newest value of every halfword from the journal.
+ * @param JOURNAL_HALFWORDS halfwords (pointer), a halfword that was never
+ *        written keeps the value it has
  *
- * function written inorder to save 64 bit of data. shoud
- * be used for saving msp sequence flags
- *  
- */
-bool EEPROM_read_buffer(unsigned short *data1, unsigned short *data2)
-{
-  int offset = find_current_EEPROM_address();
-  uint16_t checksum_stored;
-  
-  if (offset == 0)
-  {
-    data1[0] = (*(__IO uint16_t *)(BUFFER_1_START_ADDR));
-    data1[1] = (*(__IO uint16_t *)(BUFFER_2_START_ADDR));
-    data1[2] = (*(__IO uint16_t *)(BUFFER_3_START_ADDR));
-    data1[3] = (*(__IO uint16_t *)(BUFFER_4_START_ADDR));
-    
-    data2[0] = (*(__IO uint16_t *)(BUFFER_5_START_ADDR));
-    data2[1] = (*(__IO uint16_t *)(BUFFER_6_START_ADDR));
-    data2[2] = (*(__IO uint16_t *)(BUFFER_7_START_ADDR));
-    data2[3] = (*(__IO uint16_t *)(BUFFER_8_START_ADDR));
-    
-    checksum_stored = (*(__IO uint16_t *)(CHECKSUM_BUFFER));
-  }  
-  else
+ * should be called once at boot, before EEPROM_journal_update.
+ */
+void EEPROM_journal_restore(uint16_t *data)
+{
+  uint8_t last = find_newest_record();
+  uint8_t found = 0;
+  uint8_t index = last;
+  uint32_t word;
+
+  for (uint8_t i = 0; i < JOURNAL_HALFWORDS; i++)
+    newest[i] = NO_RECORD;
+
+  head = 0;
+  sequence = 0;
+  if (last < JOURNAL_RECORDS)
   {
-    offset = offset-2;
-    
-    data1[0] = (*(__IO uint16_t *)(BUFFER_1_START_ADDR + offset));
-    data1[1] = (*(__IO uint16_t *)(BUFFER_2_START_ADDR + offset));
-    data1[2] = (*(__IO uint16_t *)(BUFFER_3_START_ADDR + offset));
-    data1[3] = (*(__IO uint16_t *)(BUFFER_4_START_ADDR + offset));
-    
-    data2[0] = (*(__IO uint16_t *)(BUFFER_5_START_ADDR + offset));
-    data2[1] = (*(__IO uint16_t *)(BUFFER_6_START_ADDR + offset));
-    data2[2] = (*(__IO uint16_t *)(BUFFER_7_START_ADDR + offset));
-    data2[3] = (*(__IO uint16_t *)(BUFFER_8_START_ADDR + offset));
-    
-    checksum_stored = (*(__IO uint16_t *)(CHECKSUM_BUFFER + offset));
+    read_record(last, &word);
+    head = (last + 1) % JOURNAL_RECORDS;
+    sequence = RECORD_SEQUENCE(word) + 1;
+
+    // walk back from the newest record until every halfword has been seen
+    for (uint8_t n = 0; n < JOURNAL_RECORDS && found < JOURNAL_HALFWORDS; n++)
+    {
+      if (read_record(index, &word) && RECORD_HALFWORD(word) < JOURNAL_HALFWORDS &&
+          newest[RECORD_HALFWORD(word)] == NO_RECORD)
+      {
+        newest[RECORD_HALFWORD(word)] = index;
+        data[RECORD_HALFWORD(word)] = RECORD_VALUE(word);
+        found++;
+      }
+      index = (index + JOURNAL_RECORDS - 1) % JOURNAL_RECORDS;
+    }
   }
-  
 
-  uint16_t checksum_result = checksum(data1, 4, data2, 4);
-  return ((checksum_result-checksum_stored) == 0);
+  for (uint8_t i = 0; i < JOURNAL_HALFWORDS; i++)
+    journal[i] = data[i];
 }
 
 
 /**
- * @brief Writes data to the two buffers.
- * @param 32 bit of data to be written to the first buffer (pointer)
- * @param 32 bit of data to be written to the second buffer (pointer)
+ * @brief Queues the halfwords that changed since they were last written.
+ * @param JOURNAL_HALFWORDS halfwords (pointer)
+ * @return the number of halfwords that were queued
  *
- * writes the data and checksum
- */
-void EEPROM_write_buffer(unsigned short *data1, unsigned short *data2)
-{ 
-   HAL_FLASHEx_DATAEEPROM_Unlock();
-
-  /*get the offset from the index buffer*/
-  int offset = find_current_EEPROM_address();
-  
-  /*calculate the checksum*/
-  uint16_t value_checksum = checksum (data1, 4, data2, 4); 
- 
-  /*write the data*/
-  HAL_FLASHEx_DATAEEPROM_Program(FLASH_TYPEPROGRAMDATA_HALFWORD, (BUFFER_1_START_ADDR+offset), data1[0]);
-  HAL_FLASHEx_DATAEEPROM_Program(FLASH_TYPEPROGRAMDATA_HALFWORD, (BUFFER_2_START_ADDR+offset), data1[1]);
-  HAL_FLASHEx_DATAEEPROM_Program(FLASH_TYPEPROGRAMDATA_HALFWORD, (BUFFER_3_START_ADDR+offset), data1[2]);
-  HAL_FLASHEx_DATAEEPROM_Program(FLASH_TYPEPROGRAMDATA_HALFWORD, (BUFFER_4_START_ADDR+offset), data1[3]);
-  
-  HAL_FLASHEx_DATAEEPROM_Program(FLASH_TYPEPROGRAMDATA_HALFWORD, (BUFFER_5_START_ADDR+offset), data2[0]);
-  HAL_FLASHEx_DATAEEPROM_Program(FLASH_TYPEPROGRAMDATA_HALFWORD, (BUFFER_6_START_ADDR+offset), data2[1]);
-  HAL_FLASHEx_DATAEEPROM_Program(FLASH_TYPEPROGRAMDATA_HALFWORD, (BUFFER_7_START_ADDR+offset), data2[2]);
-  HAL_FLASHEx_DATAEEPROM_Program(FLASH_TYPEPROGRAMDATA_HALFWORD, (BUFFER_8_START_ADDR+offset), data2[3]);
-  
-  /*write checksum*/
-  HAL_FLASHEx_DATAEEPROM_Program(FLASH_TYPEPROGRAMDATA_HALFWORD, (CHECKSUM_BUFFER+offset), value_checksum);
-
-  
-  /*uppdate the index buffert*/
-  uint16_t index_var = (*(__IO uint16_t *)((offset) + INDEX_BUFFER_START_ADDR));
-  index_var++;
-  uint32_t address = ((offset+2)%BUFFER_SIZE) + INDEX_BUFFER_START_ADDR;
-  HAL_FLASHEx_DATAEEPROM_Program(FLASH_TYPEPROGRAMDATA_HALFWORD, address, index_var);
-  int readvar = (*(__IO uint16_t *)(address));
-  HAL_FLASHEx_DATAEEPROM_Lock();
-}
+ * every record takes two word writes of about 3 ms each. Halfwords that do
+ * not fit in the write queue are left for the next call.
+ */
+uint8_t EEPROM_journal_update(const uint16_t *data)
+{
+  uint8_t changed = 0;
 
+  for (uint8_t i = 0; i < JOURNAL_HALFWORDS; i++)
+  {
+    if (data[i] == journal[i])
+      continue;
 
+    if (!keep_overwritten() || !append(i, data[i]))
+      break;
+    changed++;
+  }
+  return changed;
+}
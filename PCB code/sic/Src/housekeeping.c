@@ -0,0 +1,62 @@
+/****************************************************************************
+ * HOUSEKEEPING                                                             *
+ ****************************************************************************/
+
+/**
+ *****************************************************************************
+ * @file housekeeping.c
+ * @brief the housekeeping report sent for MSP_OP_REQ_HK
+ *****************************************************************************
+ * the report is taken when the OBC asks for it, so the values in one
+ * transaction belong together. The layout is given in housekeeping.h.
+ *
+ * MSP_OP_REQ_HK and the MSP_OP_REQ_PAYLOAD container send the same copy of
+ * the report. Either one takes a new snapshot when it starts.
+ */
+
+#include "housekeeping.h"
+#include "msp_i2c_slave.h"
+#include "eeprom_circular.h"
+#include "arena.h"
+#include "msp_exp_handler.h"
+
+static uint8_t report[HOUSEKEEPING_LENGTH];
+
+static void put16(uint8_t *report, uint8_t offset, uint16_t value)
+{
+  report[offset] = value >> 8 & 0xFF;
+  report[offset + 1] = value & 0xFF;
+}
+
+static void put32(uint8_t *report, uint8_t offset, uint32_t value)
+{
+  put16(report, offset, value >> 16);
+  put16(report, offset + 2, value & 0xFFFF);
+}
+
+/**
+ * @brief takes the housekeeping report, called when a transaction starts
+ */
+void housekeeping_snapshot(void)
+{
+  put32(report, HK_BOOT_LISTEN_US, msp_i2c_get_boot_listen_us());
+  put32(report, HK_BOOT_ANSWER_US, msp_i2c_get_boot_answer_us());
+  put16(report, HK_I2C_RECOVERIES, msp_i2c_get_recovery_count());
+  put16(report, HK_WAKE_LATENCY_US, msp_i2c_get_wake_latency_us());
+  put16(report, HK_EEPROM_ERRORS, EEPROM_get_error_count());
+  put16(report, HK_ARENA_HIGH_WATER, arena_get_high_water());
+  put32(report, HK_I2C_BUSY, msp_i2c_get_busy_count());
+  msp_stats_snapshot(&report[HK_MSP_STATS]);
+}
+
+
+/**
+ * @brief copies a part of the report into the frame
+ * @param buf the data field of the frame
+ * @param len number of bytes to copy
+ * @param offset offset into the report
+ */
+void housekeeping_copy(unsigned char *buf, unsigned long len, unsigned long offset)
+{
+  msp_expsend_copy(buf, &report[offset], len);
+}
@@ -9,29 +9,55 @@
  * @bug no known buggs
  * @brief functions to save and restore msp flags
  *****************************************************************************
+ * the sequence flags of both MSP addresses are kept in the eeprom journal,
+ * 8 halfwords each. save_seqflags is called after every transaction, so only
+ * the flag that changed is written and a power loss loses nothing.
  */
 
 #include <stdbool.h>
 #include "msp_exp_state.h"
+#include "eeprom_circular.h"
+#include "msp_i2c_slave.h"
+
+#define ADDRESS_COUNT 2
+
+// the addresses in the order their sequence flags are kept in the journal
+static const uint8_t addresses[ADDRESS_COUNT] = {MSP_I2C_ADDR_SIC, MSP_I2C_ADDR_PIEZO};
 
 void restore_seqflags(void)
 {
+    uint16_t data[JOURNAL_HALFWORDS] = {0}; // flags that were never saved are blank
     msp_seqflags_t seqflags;
 
-    bool checksum_correct = EEPROM_read_buffer(seqflags.values, seqflags.inits);
-    if (checksum_correct)
+    EEPROM_journal_restore(data);
+    for (uint8_t i = 0; i < ADDRESS_COUNT; i++)
     {
-        msp_exp_state_initialize(seqflags);
-    }
-    else
-    {
-        msp_exp_state_initialize(msp_seqflags_init());
+        for (uint8_t j = 0; j < 4; j++)
+        {
+            seqflags.values[j] = data[i*8 + j];
+            seqflags.inits[j] = data[i*8 + 4 + j];
+        }
+        msp_exp_state_initialize(seqflags, addresses[i]);
     }
 }
 
-void save_seqflags(void)
+/**
+ * @brief writes the sequence flags that changed to the eeprom journal
+ * @return true if anything was written
+ */
+bool save_seqflags(void)
 {
-    msp_seqflags_t seqflags = msp_exp_state_get_seqflags();
+    uint16_t data[JOURNAL_HALFWORDS];
+
+    for (uint8_t i = 0; i < ADDRESS_COUNT; i++)
+    {
+        msp_seqflags_t seqflags = msp_exp_state_get_seqflags(addresses[i]);
 
-    EEPROM_write_buffer(seqflags.values, seqflags.inits);
+        for (uint8_t j = 0; j < 4; j++)
+        {
+            data[i*8 + j] = seqflags.values[j];
+            data[i*8 + 4 + j] = seqflags.inits[j];
+        }
+    }
+    return EEPROM_journal_update(data) != 0;
 }
\ No newline at end of file
@@ -25,8 +25,10 @@
 #include "main.h"
 #include "adc.h"
 #include "dac.h"
+#include "dma.h"
 #include "i2c.h"
 #include "iwdg.h"
+#include "tim.h"
 #include "usart.h"
 #include "gpio.h"
 #include "stm32l0xx_hal_i2c.h"
@@ -38,6 +40,9 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include "piezo.h"
+#include "msp_i2c_slave.h"
+#include "power_management.h"
+#include "command_queue.h"
 #include "msp_exp.h"
 #include "eeprom_circular.h"
 #include "msp_exp.h"
@@ -45,6 +50,8 @@
 #include "interface_flags.h"
 #include "tools.h"
 #include "experiment_constants.h"
+#include "result_archive.h"
+#include "arena.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -65,13 +72,8 @@
 /* Private variables ---------------------------------------------------------*/
 
 /* USER CODE BEGIN PV */
-uint8_t aBuffer[MSP_EXP_MAX_FRAME_SIZE];
-unsigned long buffLength = 0;
-uint8_t transferDirectionGlobal;
-uint8_t volatile addr = 0x45; //defines the adress when only one i2c adress is used.
-bool volatile has_function_to_execute = false;
-void (* volatile command_ptr) () = NULL;
 extern I2C_HandleTypeDef hi2c1;
+extern uint8_t buffer[BUFFERLENGTH]; // SiC results, see start_test.c
 
 
 void print16bit(uint8_t , uint8_t, uint8_t );
@@ -93,17 +95,14 @@ void SystemClock_Config(void);
 void RECIVE_FINISHED(I2C_HandleTypeDef *hi2c);
 uint8_t IF_DIRECTION_IS_RECIVE(I2C_HandleTypeDef *hi2c);
 uint8_t IF_DIRECTION_IS_SEND(I2C_HandleTypeDef *hi2c);
-void BUFF_LENTH(uint8_t* pBuffer, long *BufferLength);
-uint8_t msp_error_code_receive;
-uint8_t msp_error_code_send;
 
 
 
 // TEST DRIVER debug 
-uint16_t addr_debug = 0x0;
-uint8_t piezoBufferDebug[200];
+#define PIEZO_DEBUG_LENGTH 200
+ARENA_FITS(piezo_download, ARENA_ROUND(PIEZO_DEBUG_LENGTH));
+ARENA_FITS(sic_download, ARENA_ROUND(BUFFERLENGTH));
 uint8_t current_state = 0x0;
-uint8_t sic_test_data[BUFFERLENGTH];
 volatile uint16_t bffLength = BUFFERLENGTH;
 uint16_t max_number_lines = 0;
 uint16_t test_index = 0;
@@ -115,7 +114,6 @@ bool run_sic_test = 1;
 bool run_dac = 0;
 
 
-extern volatile struct msp_exp_state_information msp_exp_state;
 bool ready = false;
 //piezo_sic_type volatile piezo_sic = NONE;
 
@@ -128,59 +126,52 @@ int main(void)
 {
   HAL_Init();
   SystemClock_Config();
+  power_init();
 
 
 
   /* Initialize all configured peripherals */
   // the following funtion call will initialize the eeprom by clearing it.
   // reset_EEPROM_buffer(void);
+  EEPROM_init();
   restore_seqflags();
+  msp_exp_frame_prepare_cache(MSP_I2C_ADDR_SIC);
+  msp_exp_frame_prepare_cache(MSP_I2C_ADDR_PIEZO);
   MX_GPIO_Init();
-  MX_ADC_Init();
-  MX_DAC_Init();
+  MX_DMA_Init();
   MX_I2C1_Init();
-  MX_USART1_UART_Init();
-  
- 
- 
+  msp_i2c_start();
+  // the OBC is answered from here on, a frame that arrives now reads EXP_BUSY
+  // the ADC, DAC, USART and TIM21 are brought up by the experiment that needs them
+  result_archive_init(buffer); // a sweep the OBC did not take before the power was cut
 
-    
   while (1)
   {
     //start_driver(); // If this line is included, runs the test program instead
     
-    if(HAL_I2C_Slave_TxRx_IT(&hi2c1, (uint8_t *)aBuffer, buffLength) != HAL_OK)
-    { 
-      Error_Handler();
-    }
-   
-    //wait for the i2c reception to finish this must timeout at some point, otherwise there is risk for getting stuck.
-    while (HAL_I2C_GetState(&hi2c1) != HAL_I2C_STATE_READY)
-    {
-   
-    }
+    // answer the frame the OBC wrote, the transfers themselves run in the i2c interrupt
+    if(msp_i2c_poll())
+      continue;
 
-    buff_length((uint8_t *)aBuffer, &buffLength);
-    
-    
-    if(!transferDirectionGlobal)//if we recived a command
-    {
-       //this funtion returnes the negative error codes in MSP.
-       msp_error_code_receive = msp_recv_callback((uint8_t *)aBuffer, buffLength, addr);
-       msp_error_code_send = msp_send_callback((uint8_t *)aBuffer, &buffLength, addr);
-       
-       /* this tells us if we are in a msp transaktion, except for the time inbetween the msp code is running
-        and the i2c code is running, needs to be covered by flow controll*/ 
-    }
-    else //if a command was sent
+    // build the next data frames before the OBC asks for them
+    if(msp_exp_prepare_next(MSP_I2C_ADDR_SIC) || msp_exp_prepare_next(MSP_I2C_ADDR_PIEZO))
+      continue;
+
+    // never while a request sends the data that these change
+    if(msp_i2c_idle())
     {
-       Flush_Buffer8((uint8_t *)aBuffer, buffLength);
-       if(msp_exp_state.type == MSP_EXP_STATE_READY && has_function_to_execute)
-       {
-            (*command_ptr) ();
-            has_function_to_execute = false;
-       }
+      // journal the sequence flags of the transactions that completed
+      if(save_seqflags())
+        continue;
+      // the commands the OBC sent, oldest first. A long one still answers the OBC, see msp_i2c_delay
+      if(command_queue_run_next())
+        continue;
+      // sample the motor while running
+      piezo_poll();
     }
+
+    // nothing left to do until the next interrupt
+    msp_i2c_sleep();
   }
 }
 
@@ -208,6 +199,8 @@ void start_driver(void){
       piezo_stop_exp();
       
       
+      arena_begin(ARENA_PHASE_DOWNLOAD);
+      uint8_t *piezoBufferDebug = arena_alloc(PIEZO_DEBUG_LENGTH);
       piezo_get_data((uint8_t*) piezoBufferDebug, 0);
       uint16_t length = piezo_get_data_length();
       //printf("%d\n", length);
@@ -229,6 +222,7 @@ void start_driver(void){
         }
         printf("0x%02x\t", piezoBufferDebug[i]);
       }
+      arena_end();
       HAL_Delay(60000);
     }
     
@@ -250,6 +244,8 @@ void start_driver(void){
       if(max_number_lines < 360){
         current_state = 0x4;
         start_test();
+        arena_begin(ARENA_PHASE_DOWNLOAD);
+        uint8_t *sic_test_data = arena_alloc(BUFFERLENGTH);
         sic_get_data((uint8_t*) sic_test_data, 0);
         
        
@@ -265,6 +261,7 @@ void start_driver(void){
           print16bit(sic_test_data[test_index*2], sic_test_data[test_index*2+1], 0);
           
         }
+        arena_end();
         printf("\n");
         //sic_power_off();
         //HAL_Delay(100);
@@ -334,27 +331,16 @@ void print16bit(uint8_t biggest_number, uint8_t smallest_number, uint8_t number_
 
 
 /**
-  * @brief A callback from the hal i2c library
-  * @param i2c handle
-  * @param the direction of the communication
-  * @param the adress that was called
+  * @brief A callback from the hal tim library
+  * @param tim handle
   * @retval None
   */
-void HAL_I2C_AddrCallback(I2C_HandleTypeDef *i2cHandle, uint8_t transferDirection, uint16_t addrMatchCode)
+void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
 {
-  transferDirectionGlobal = transferDirection;
-  addr_debug = addrMatchCode;
-// the code bellow is neede if two i2c adresses should be used.
-//  if (addrMatchCode == 138)//202
-//  {
-//    addr = 0x45;
-//    piezo_sic = SIC;
-//  }
-//  if (addrMatchCode == 202)//138
-//  {
-//    addr = 0x65;
-//    piezo_sic = PIEZO;
-//  }
+  if (htim->Instance == TIM21)
+  {
+    piezo_poll_tick();
+  }
 }
 
 
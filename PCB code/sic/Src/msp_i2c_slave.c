@@ -0,0 +1,602 @@
+/****************************************************************************
+ * MSP I2C SLAVE TRANSPORT FOR KTH MIST (SiC in space)                      *
+ ****************************************************************************/
+
+/**
+ *****************************************************************************
+ * @file msp_i2c_slave.c
+ * @brief interrupt and DMA driven I2C slave for the MSP library
+ *****************************************************************************
+ * I2C1 is kept in listen mode. The interrupt callbacks only move bytes: a
+ * frame written by the OBC is received into the rxBuffer of its address and
+ * a read is served
+ * from the frame that msp_send_frame() prepared. The MSP callbacks run in
+ * msp_i2c_poll() from the main loop, so the core can sleep in between.
+ *
+ * The opcode byte of a received frame is taken by interrupt. The body of a
+ * data frame is then received by DMA, and data frames are sent by DMA, so
+ * a 507 byte frame costs a few interrupts instead of one per byte. Header
+ * frames stay byte by byte, a read past their end is padded by the HAL.
+ *
+ * While a received frame waits for msp_i2c_poll() the OBC reads EXP_BUSY
+ * from that address, and a second write to it is dropped. While the command
+ * queue is full, a frame that may push another command, a system command,
+ * a send or a data frame, is held the same way. The other frames are still
+ * handled, so an open request can end and the main loop can drain the
+ * queue, see msp_i2c_idle(). A transfer that has not reached STOP after
+ * MSP_I2C_TRANSFER_TIMEOUT_MS, or a bus error, resets the peripheral. A
+ * request that the OBC has not written a frame to for
+ * MSP_I2C_REQUEST_TIMEOUT_MS is aborted, so an OBC that gave up on it does
+ * not keep the commands from running.
+ *
+ * An experiment that keeps the main loop waiting waits in msp_i2c_delay(),
+ * which keeps answering the OBC. Commands sent during the run are queued
+ * and run after it.
+ *
+ * The SiC and the Piezo experiment answer on their own address, OA1 and OA2,
+ * each with its own MSP state. A read is served from the frame of the
+ * address it was sent to, so the OBC can talk to one experiment while the
+ * other is in the middle of a transaction. Each address also receives into
+ * its own buffer, so a frame written to one is kept while a frame written
+ * to the other waits, and only the address of a waiting frame answers
+ * EXP_BUSY.
+ *
+ * Between transactions the core waits in Stop mode and the address match
+ * wakes it. SysTick stops there, so Stop is not used while a transaction is
+ * open, whose duration msp_stats.c measures in HAL ticks, nor before the
+ * first frame has been answered. The time from the wake-up to the address callback, while SCL
+ * is stretched, is measured. If it ever exceeds MSP_I2C_WAKE_LATENCY_LIMIT_US
+ * only the core is put to sleep from then on.
+ *
+ * The time from reset until I2C1 listens, and until the first frame from
+ * the OBC has been answered, is kept for the housekeeping report. So are
+ * the statistics of every frame handed to MSP, see msp_stats.c.
+ */
+
+#include "msp_i2c_slave.h"
+#include "i2c.h"
+#include "msp_exp.h"
+#include "power_management.h"
+#include "command_queue.h"
+#include "msp_stats.h"
+
+#define ADDRESS_COUNT 2
+
+static const uint8_t addresses[ADDRESS_COUNT] = {MSP_I2C_ADDR_SIC, MSP_I2C_ADDR_PIEZO};
+
+static uint8_t rxBuffer[ADDRESS_COUNT][MSP_EXP_MAX_FRAME_SIZE];
+static uint8_t rxDiscard;                 // sink for a write that is dropped
+static uint8_t busyFrame[ADDRESS_COUNT][9]; // EXP_BUSY, sent while a frame waits in rxBuffer
+static const uint8_t *volatile txFrame[ADDRESS_COUNT]; // the frame the OBC reads next from each address
+static volatile uint16_t txLength[ADDRESS_COUNT];
+static volatile uint16_t rxLength[ADDRESS_COUNT];
+static volatile bool rxPending[ADDRESS_COUNT]; // a frame in rxBuffer waits for msp_i2c_poll()
+static volatile uint8_t rxAddress = 0;    // index of the address the current write goes to
+static volatile bool rxActive = false;    // the current write goes to rxBuffer
+static volatile bool rxOpcode = false;    // only the opcode byte has been asked for
+static volatile bool rxDma = false;       // the frame body is received by DMA
+static uint8_t nextAddress = 0;           // index of the address whose frame is handled first
+static uint32_t lastFrame[ADDRESS_COUNT]; // HAL tick of the last frame handled for each address
+static volatile bool transferActive = false;
+static volatile uint32_t transferStart = 0;
+static volatile bool recoveryNeeded = false;
+static uint16_t recoveryCount = 0;
+static volatile bool wakeMeasure = false; // the core left Stop and no address has been matched yet
+static uint32_t wakeTick;
+static uint32_t wakeCount;                // SysTick->VAL at the wake-up
+static uint16_t wakeLatencyMax = 0;       // us
+static uint32_t bootListen = 0;           // us from reset until the OBC could be answered
+static uint32_t bootAnswer = 0;           // us from reset until the first frame was answered
+static volatile uint32_t busyServed = 0;  // EXP_BUSY read while a frame waited for msp_i2c_poll()
+
+static void listen(void);
+static bool recover_if_stuck(void);
+static bool abort_stalled_request(void);
+static void recover(void);
+static uint8_t address_index(uint16_t addrMatchCode);
+static uint8_t pending_address(bool holdCommands);
+static bool may_push_command(uint8_t index);
+static bool tick_needed(void);
+static uint32_t time_since_reset_us(void);
+static void systick_now(uint32_t *tick, uint32_t *count);
+static uint32_t elapsed_us(uint32_t startTick, uint32_t startCount);
+
+/**
+ * @brief prepares the first frames and starts listening for the OBC
+ */
+void msp_i2c_start(void)
+{
+  const unsigned char *frame;
+  unsigned long length;
+
+  for (uint8_t i = 0; i < ADDRESS_COUNT; i++)
+  {
+    msp_exp_frame_format_empty_header(busyFrame[i], MSP_OP_EXP_BUSY, addresses[i]);
+    msp_send_frame(&frame, &length, addresses[i]);
+    txFrame[i] = frame;
+    txLength[i] = length;
+  }
+  listen();
+  bootListen = time_since_reset_us();
+}
+
+/**
+ * @brief handles a frame received from the OBC and prepares the answer
+ *
+ * should be called from the main loop, and is from msp_i2c_delay() while an
+ * experiment runs. Also resets the I2C peripheral if a transfer is stuck or
+ * the bus reported an error.
+ * @return true if something was done, false if there was nothing to do
+ */
+bool msp_i2c_poll(void)
+{
+  const unsigned char *frame;
+  unsigned long length;
+  int receiveCode;
+  int sendCode;
+  uint32_t startTick;
+  uint32_t startCount;
+  uint8_t index;
+
+  if (recover_if_stuck() || abort_stalled_request())
+    return true;
+
+  // the OBC reads EXP_BUSY until the main loop has taken out a command
+  index = pending_address(command_queue_full());
+  if (index == ADDRESS_COUNT)
+  {
+    // listen mode is left after every transfer, make sure it was entered again
+    if (HAL_I2C_GetState(&hi2c1) == HAL_I2C_STATE_READY)
+      listen();
+    return false;
+  }
+
+  // both return the negative error codes of MSP, they are counted in msp_stats.c
+  systick_now(&startTick, &startCount);
+  msp_stats_receiving(addresses[index]);
+  receiveCode = msp_recv_callback(rxBuffer[index], rxLength[index], addresses[index]);
+  msp_stats_received(addresses[index], receiveCode);
+  sendCode = msp_send_frame(&frame, &length, addresses[index]);
+  msp_stats_sent(sendCode, frame[0], elapsed_us(startTick, startCount));
+
+  // the answer must be in place before the OBC stops getting EXP_BUSY
+  txFrame[index] = frame;
+  txLength[index] = length;
+  rxPending[index] = false;
+  nextAddress = (index + 1) % ADDRESS_COUNT;
+  lastFrame[index] = HAL_GetTick();
+  if (bootAnswer == 0)
+    bootAnswer = time_since_reset_us();
+  return true;
+}
+
+/**
+ * @brief waits like HAL_Delay, for the experiments that keep the main loop waiting
+ *
+ * the frames the OBC writes in the meantime are answered and a stuck
+ * transfer is reset, instead of after the experiment, which can take many
+ * seconds. Must not be called from an MSP handler.
+ */
+void msp_i2c_delay(uint32_t ms)
+{
+  uint32_t start = HAL_GetTick();
+
+  while (HAL_GetTick() - start < ms)
+    msp_i2c_poll();
+}
+
+/**
+ * @brief sleeps until the next interrupt unless a frame is waiting
+ *
+ * the check and WFI run with interrupts masked, so a frame that arrives in
+ * between still wakes the core. Stop mode is only used between transactions.
+ */
+void msp_i2c_sleep(void)
+{
+  __disable_irq();
+  if (pending_address(command_queue_full()) == ADDRESS_COUNT && !recoveryNeeded)
+  {
+    if (!transferActive && !tick_needed() && HAL_I2C_GetState(&hi2c1) == HAL_I2C_STATE_LISTEN &&
+        wakeLatencyMax <= MSP_I2C_WAKE_LATENCY_LIMIT_US && power_stop_allowed())
+    {
+      power_enter_stop();
+      // only a wake-up by an address match is timed
+      wakeMeasure = __HAL_I2C_GET_FLAG(&hi2c1, I2C_FLAG_ADDR);
+      wakeTick = HAL_GetTick();
+      wakeCount = SysTick->VAL;
+    }
+    else
+    {
+      __WFI();
+    }
+  }
+  __enable_irq();
+}
+
+/**
+ * @brief tells if the main loop may change the data that a request sends
+ *
+ * the commands and the Piezo sampling only run while no address is in a
+ * request. A send, or a frame held for the full command queue, does not
+ * stop them, so the queue drains whatever the other address does.
+ */
+bool msp_i2c_idle(void)
+{
+  for (uint8_t i = 0; i < ADDRESS_COUNT; i++)
+  {
+    if (msp_exp_state_in_request(addresses[i]))
+      return false;
+  }
+  return true;
+}
+
+/**
+ * @brief number of times the I2C peripheral has been reset since boot
+ */
+uint16_t msp_i2c_get_recovery_count(void)
+{
+  return recoveryCount;
+}
+
+/**
+ * @brief longest time from a wake-up from Stop to the address callback
+ * @return microseconds, 0xFFFF if it took longer than a SysTick period
+ */
+uint16_t msp_i2c_get_wake_latency_us(void)
+{
+  return wakeLatencyMax;
+}
+
+/**
+ * @brief time from reset until I2C1 started listening for the OBC
+ * @return microseconds
+ */
+uint32_t msp_i2c_get_boot_listen_us(void)
+{
+  return bootListen;
+}
+
+/**
+ * @brief time from reset until the first frame from the OBC was answered
+ * @return microseconds, 0 if no frame has been answered
+ */
+uint32_t msp_i2c_get_boot_answer_us(void)
+{
+  return bootAnswer;
+}
+
+/**
+ * @brief number of times the OBC read EXP_BUSY because a frame it wrote had not been handled yet
+ */
+uint32_t msp_i2c_get_busy_count(void)
+{
+  return busyServed;
+}
+
+/**
+ * @brief tells if the HAL tick has to keep counting, which it does not in Stop
+ *
+ * true while an address is in a transaction, whose duration is measured and
+ * which is aborted after MSP_I2C_REQUEST_TIMEOUT_MS, and until the first
+ * frame has been answered, as the boot times count from reset.
+ */
+static bool tick_needed(void)
+{
+  volatile struct msp_exp_state_information *state;
+
+  if (bootAnswer == 0)
+    return true;
+  for (uint8_t i = 0; i < ADDRESS_COUNT; i++)
+  {
+    state = msp_exp_state_get(addresses[i]);
+    if (state != 0 && state->type != MSP_EXP_STATE_READY)
+      return true;
+  }
+  return false;
+}
+
+/**
+ * @brief microseconds since reset, from the HAL tick and SysTick
+ *
+ * the tick counts from reset, the few us of the startup code before
+ * HAL_Init are not seen. Saturates after 71 minutes.
+ */
+static uint32_t time_since_reset_us(void)
+{
+  uint32_t tick;
+  uint32_t count;
+
+  systick_now(&tick, &count);
+  if (tick >= 0xFFFFFFFFUL / 1000 - 1)
+    return 0xFFFFFFFFUL;
+  return tick * 1000 + (SysTick->LOAD - count) * 1000 / (SystemCoreClock / 1000);
+}
+
+/**
+ * @brief reads the HAL tick and SysTick->VAL of the same tick
+ */
+static void systick_now(uint32_t *tick, uint32_t *count)
+{
+  // the tick may move on between the two reads
+  do
+  {
+    *tick = HAL_GetTick();
+    *count = SysTick->VAL;
+  } while (*tick != HAL_GetTick());
+}
+
+/**
+ * @brief microseconds since a time read with systick_now
+ */
+static uint32_t elapsed_us(uint32_t startTick, uint32_t startCount)
+{
+  uint32_t tick;
+  uint32_t count;
+  uint32_t cycles;
+
+  systick_now(&tick, &count);
+  // SysTick counts down from LOAD once per tick
+  cycles = (tick - startTick) * (SysTick->LOAD + 1) + startCount - count;
+  return cycles / (SystemCoreClock / 1000000U);
+}
+
+/**
+ * @brief updates the wake-up latency, called at the first address match after Stop
+ */
+static void measure_wake_latency(void)
+{
+  uint32_t period = SysTick->LOAD + 1;
+  uint32_t cycles = (wakeCount + period - SysTick->VAL) % period;
+  uint32_t latency = cycles / (SystemCoreClock / 1000000U);
+
+  // SysTick counts down and wraps every tick, a longer wait only shows in the tick count
+  if (HAL_GetTick() - wakeTick > 1)
+    latency = 0xFFFF;
+  if (latency > wakeLatencyMax)
+    wakeLatencyMax = latency;
+  wakeMeasure = false;
+}
+
+/**
+ * @brief index in addresses of the address the OBC called
+ * @param the address code of the match, the 7 bit address shifted left by one
+ */
+static uint8_t address_index(uint16_t addrMatchCode)
+{
+  return (addrMatchCode >> 1) == MSP_I2C_ADDR_PIEZO ? 1 : 0;
+}
+
+/**
+ * @brief index of the address whose frame msp_i2c_poll() handles next
+ *
+ * the addresses take turns, so frames written to one cannot keep the other
+ * waiting.
+ * @param true to pass over the frames that may push a command
+ * @return ADDRESS_COUNT if no frame is waiting
+ */
+static uint8_t pending_address(bool holdCommands)
+{
+  for (uint8_t i = 0; i < ADDRESS_COUNT; i++)
+  {
+    uint8_t index = (nextAddress + i) % ADDRESS_COUNT;
+
+    if (rxPending[index] && !(holdCommands && may_push_command(index)))
+      return index;
+  }
+  return ADDRESS_COUNT;
+}
+
+/**
+ * @brief tells if handling the waiting frame of an address may push a command
+ *
+ * the system commands push one when their header arrives, a send when its
+ * last data frame arrives, or its header if it carries no data.
+ */
+static bool may_push_command(uint8_t index)
+{
+  uint8_t opcode = rxBuffer[index][0] & 0x7F;
+
+  return MSP_OP_TYPE(opcode) == MSP_OP_TYPE_SYS || MSP_OP_TYPE(opcode) == MSP_OP_TYPE_SEND ||
+         opcode == MSP_OP_DATA_FRAME || MSP_OP_IS_WINDOW_DATA(opcode);
+}
+
+static void listen(void)
+{
+  if (HAL_I2C_EnableListen_IT(&hi2c1) != HAL_OK)
+    recoveryNeeded = true;
+}
+
+/**
+ * @brief resets I2C1 if a transfer is stuck or the bus reported an error
+ * @return true if it was reset
+ */
+static bool recover_if_stuck(void)
+{
+  if (!recoveryNeeded && !(transferActive && HAL_GetTick() - transferStart > MSP_I2C_TRANSFER_TIMEOUT_MS))
+    return false;
+  recover();
+  return true;
+}
+
+/**
+ * @brief aborts a request that the OBC has not written a frame to for MSP_I2C_REQUEST_TIMEOUT_MS
+ * @return true if one was aborted
+ */
+static bool abort_stalled_request(void)
+{
+  const unsigned char *frame;
+  unsigned long length;
+
+  for (uint8_t i = 0; i < ADDRESS_COUNT; i++)
+  {
+    // a frame that waits, or is being read, still belongs to the request
+    if (rxPending[i] || transferActive || !msp_exp_state_in_request(addresses[i]) ||
+        HAL_GetTick() - lastFrame[i] <= MSP_I2C_REQUEST_TIMEOUT_MS)
+      continue;
+    if (!msp_exp_abort(addresses[i]))
+      continue;
+
+    // the prepared frames are released, the OBC reads MSP_OP_NULL from now on
+    msp_send_frame(&frame, &length, addresses[i]);
+    __disable_irq();
+    txFrame[i] = frame;
+    txLength[i] = length;
+    __enable_irq();
+    return true;
+  }
+  return false;
+}
+
+/**
+ * @brief resets I2C1, which releases SCL and SDA, and listens again
+ */
+static void recover(void)
+{
+  HAL_I2C_DeInit(&hi2c1);
+  MX_I2C1_Init();
+
+  // a frame that was cut off is not handed to MSP
+  rxActive = false;
+  rxOpcode = false;
+  rxDma = false;
+  transferActive = false;
+  recoveryNeeded = false;
+  recoveryCount++;
+  listen();
+}
+
+/**
+  * @brief A callback from the hal i2c library, called when the OBC addresses us
+  * @param i2c handle
+  * @param the direction of the communication
+  * @param the adress that was called
+  * @retval None
+  */
+void HAL_I2C_AddrCallback(I2C_HandleTypeDef *i2cHandle, uint8_t transferDirection, uint16_t addrMatchCode)
+{
+  HAL_StatusTypeDef status;
+  uint8_t index = address_index(addrMatchCode);
+
+  if (wakeMeasure)
+    measure_wake_latency();
+  transferActive = true;
+  transferStart = HAL_GetTick();
+
+  if (transferDirection == I2C_DIRECTION_TRANSMIT)
+  {
+    // the OBC is writing a frame, start its FCS before the first byte arrives
+    rxActive = !rxPending[index];
+    rxDma = false;
+    if (rxActive)
+    {
+      // the opcode decides how the rest is received, see HAL_I2C_SlaveRxCpltCallback
+      rxAddress = index;
+      msp_exp_frame_rx_start(addresses[index]);
+      rxOpcode = true;
+      status = HAL_I2C_Slave_Seq_Receive_IT(i2cHandle, rxBuffer[index], 1, I2C_FIRST_FRAME);
+    }
+    else
+    {
+      status = HAL_I2C_Slave_Seq_Receive_IT(i2cHandle, &rxDiscard, 1, I2C_FIRST_AND_LAST_FRAME);
+    }
+  }
+  else
+  {
+    // the OBC is reading, send the prepared frame without copying it. The
+    // OBC reads a data frame at its exact length, so DMA does not run dry
+    if (rxPending[index])
+    {
+      busyServed++;
+      status = HAL_I2C_Slave_Seq_Transmit_IT(i2cHandle, busyFrame[index], sizeof(busyFrame[index]), I2C_FIRST_AND_LAST_FRAME);
+    }
+    else if (txLength[index] > sizeof(busyFrame[index]))
+      status = HAL_I2C_Slave_Seq_Transmit_DMA(i2cHandle, (uint8_t *)txFrame[index], txLength[index], I2C_FIRST_AND_LAST_FRAME);
+    else
+      status = HAL_I2C_Slave_Seq_Transmit_IT(i2cHandle, (uint8_t *)txFrame[index], txLength[index], I2C_FIRST_AND_LAST_FRAME);
+  }
+
+  if (status != HAL_OK)
+    recoveryNeeded = true;
+}
+
+/**
+  * @brief A callback from the hal i2c library, called for every received byte
+  * @param i2c handle
+  * @retval None
+  */
+void HAL_I2C_SlaveRxByteCallback(I2C_HandleTypeDef *i2cHandle)
+{
+  // fold the byte into the FCS now, so the frame is not scanned again
+  if (rxActive)
+    msp_exp_frame_rx_update(rxBuffer[rxAddress], i2cHandle->pBuffPtr - rxBuffer[rxAddress], addresses[rxAddress]);
+}
+
+/**
+  * @brief A callback from the hal i2c library, called when the opcode byte has been received
+  * @param i2c handle
+  * @retval None
+  */
+void HAL_I2C_SlaveRxCpltCallback(I2C_HandleTypeDef *i2cHandle)
+{
+  HAL_StatusTypeDef status;
+  uint8_t *buffer = rxBuffer[rxAddress];
+
+  // the rest of the frame also completes here, at STOP or when the buffer is full
+  if (!rxOpcode)
+    return;
+  rxOpcode = false;
+
+  // a frame of a single byte has already ended
+  if (!__HAL_I2C_GET_FLAG(i2cHandle, I2C_FLAG_BUSY))
+    return;
+
+  // the FCS of a body received by DMA is completed by msp_recv_callback()
+  if ((buffer[0] & 0x7F) == MSP_OP_DATA_FRAME)
+  {
+    rxDma = true;
+    status = HAL_I2C_Slave_Seq_Receive_DMA(i2cHandle, buffer + 1, sizeof(rxBuffer[0]) - 1, I2C_LAST_FRAME);
+  }
+  else
+  {
+    status = HAL_I2C_Slave_Seq_Receive_IT(i2cHandle, buffer + 1, sizeof(rxBuffer[0]) - 1, I2C_LAST_FRAME);
+  }
+
+  if (status != HAL_OK)
+    recoveryNeeded = true;
+}
+
+/**
+  * @brief A callback from the hal i2c library, called at the STOP that ends a transfer
+  * @param i2c handle
+  * @retval None
+  */
+void HAL_I2C_ListenCpltCallback(I2C_HandleTypeDef *i2cHandle)
+{
+  if (rxActive)
+  {
+    // pBuffPtr is right after the last received byte, also when the frame ends in 0x00.
+    // DMA does not move it, there the channel counts the bytes still missing
+    if (rxDma)
+      rxLength[rxAddress] = sizeof(rxBuffer[0]) - __HAL_DMA_GET_COUNTER(i2cHandle->hdmarx);
+    else
+      rxLength[rxAddress] = i2cHandle->pBuffPtr - rxBuffer[rxAddress];
+    rxActive = false;
+    rxOpcode = false;
+    rxDma = false;
+    rxPending[rxAddress] = true;
+  }
+  transferActive = false;
+  listen();
+}
+
+/**
+  * @brief A callback from the hal i2c library
+  * @param i2c handle
+  * @retval None
+  */
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *i2cHandle)
+{
+  // AF only means that the OBC wrote less than the whole buffer or stopped reading early
+  if (i2cHandle->ErrorCode & ~HAL_I2C_ERROR_AF)
+    recoveryNeeded = true;
+}
@@ -0,0 +1,256 @@
+/****************************************************************************
+ * MSP LINK STATISTICS                                                      *
+ ****************************************************************************/
+
+/**
+ *****************************************************************************
+ * @file msp_stats.c
+ * @brief counters and histograms of the MSP link, sent with housekeeping
+ *****************************************************************************
+ * msp_i2c_poll() reports every frame it hands to MSP, with the error codes
+ * of the two callbacks and the time they took. The handler dispatch in
+ * msp_handlers.c reports the start, the data and the end of every
+ * transaction. Each report is a few additions, so the statistics cost the
+ * same for every frame however long the link has been up.
+ *
+ * A frame counts for the transaction that was running before or after it,
+ * as the MSP state of its address shows: the header that starts one, the
+ * EXP_BUSY and the acknowledgements in between, the T_ACK that ends it.
+ * An OBC send or a system command that is started again after it completed
+ * is seen when its header moves the state to OBC_SEND_RX_DUPLICATE, MSP
+ * acknowledges it without calling the handlers.
+ *
+ * The histograms count in log2 buckets: bucket 0 holds 0, bucket n the
+ * values from 2^(n-1) to 2^n - 1, the last bucket everything above. All
+ * counters stop at their largest value instead of wrapping.
+ *
+ * The durations are HAL tick deltas. The tick stands still in Stop mode,
+ * so msp_i2c_sleep() does not enter it while a transaction is open.
+ *
+ * Everything runs in the main loop, so nothing here is touched by an
+ * interrupt.
+ */
+
+#include <stddef.h>
+#include "stm32l0xx_hal.h"
+#include "msp_stats.h"
+#include "msp_opcodes.h"
+#include "msp_exp_error.h"
+#include "msp_exp_state.h"
+
+#define OTHER_SLOT (MSP_STATS_OPCODES - 1)
+
+typedef struct {
+  uint32_t bytes;
+  uint16_t completed;
+  uint16_t aborted;
+  uint16_t repeated;
+  uint16_t latency[MSP_STATS_BUCKETS];
+  uint16_t duration[MSP_STATS_BUCKETS];
+  uint32_t start;      // HAL tick when the transaction started
+  bool running;
+} opcode_stats;
+
+static const uint8_t opcodes[OTHER_SLOT] = MSP_STATS_OPCODE_LIST;
+
+static uint32_t rxFrames = 0;
+static uint32_t rxRejected = 0;
+static uint32_t fcsMismatches = 0;
+static uint32_t duplicates = 0;
+static uint32_t txFrames = 0;
+static uint32_t busyReplies = 0;
+static uint32_t aborted = 0;
+static opcode_stats perOpcode[MSP_STATS_OPCODES];
+static uint8_t frameType;     // the MSP state before the frame
+static uint8_t frameOpcode;
+static opcode_stats *frameStats = &perOpcode[OTHER_SLOT]; // the transaction of the frame
+
+static void count32(uint32_t *counter)
+{
+  if (*counter != 0xFFFFFFFFUL)
+    (*counter)++;
+}
+
+static void count16(uint16_t *counter)
+{
+  if (*counter != 0xFFFF)
+    (*counter)++;
+}
+
+/**
+ * @brief the log2 bucket of a value, at most MSP_STATS_BUCKETS steps
+ */
+static uint8_t bucket(uint32_t value)
+{
+  uint8_t n = 0;
+
+  while (value != 0 && n < MSP_STATS_BUCKETS - 1)
+  {
+    value >>= 1;
+    n++;
+  }
+  return n;
+}
+
+static opcode_stats *stats_for(uint8_t opcode)
+{
+  for (uint8_t i = 0; i < OTHER_SLOT; i++)
+  {
+    if (opcodes[i] == opcode)
+      return &perOpcode[i];
+  }
+  return &perOpcode[OTHER_SLOT];
+}
+
+static void put16(uint8_t *report, uint16_t offset, uint16_t value)
+{
+  report[offset] = value >> 8 & 0xFF;
+  report[offset + 1] = value & 0xFF;
+}
+
+static void put32(uint8_t *report, uint16_t offset, uint32_t value)
+{
+  put16(report, offset, value >> 16);
+  put16(report, offset + 2, value & 0xFFFF);
+}
+
+
+
+
+/**
+ * @brief notes the MSP state of an address before a frame is handed to MSP
+ */
+void msp_stats_receiving(uint8_t address)
+{
+  volatile struct msp_exp_state_information *state = msp_exp_state_get(address);
+
+  frameType = state != NULL ? state->type : MSP_EXP_STATE_READY;
+  frameOpcode = state != NULL ? state->opcode : 0;
+}
+
+
+/**
+ * @brief counts a frame that was handed to MSP
+ * @param the address the frame was written to
+ * @param the return value of msp_recv_callback
+ */
+void msp_stats_received(uint8_t address, int receiveCode)
+{
+  volatile struct msp_exp_state_information *state = msp_exp_state_get(address);
+  uint8_t type = state != NULL ? state->type : MSP_EXP_STATE_READY;
+
+  count32(&rxFrames);
+  if (receiveCode != 0)
+    count32(&rxRejected);
+  if (receiveCode == MSP_EXP_ERR_FCS_MISMATCH)
+    count32(&fcsMismatches);
+  if (receiveCode == MSP_EXP_ERR_DUPLICATE_FRAME)
+    count32(&duplicates);
+
+  if (type != MSP_EXP_STATE_READY)
+    frameStats = stats_for(state->opcode);
+  else if (frameType != MSP_EXP_STATE_READY)
+    frameStats = stats_for(frameOpcode);
+  else
+    frameStats = &perOpcode[OTHER_SLOT];
+
+  if (type == MSP_EXP_STATE_OBC_SEND_RX_DUPLICATE && frameType != MSP_EXP_STATE_OBC_SEND_RX_DUPLICATE)
+    count16(&frameStats->repeated);
+}
+
+
+/**
+ * @brief counts the answer to a frame
+ * @param the return value of msp_send_frame
+ * @param the opcode of the answer
+ * @param the time both callbacks took, in us
+ */
+void msp_stats_sent(int sendCode, uint8_t sentOpcode, uint32_t latencyUs)
+{
+  count32(&txFrames);
+  // with an error code the EXP_BUSY only tells that MSP was inside a callback
+  if ((sentOpcode & 0x7F) == MSP_OP_EXP_BUSY && sendCode == 0)
+    count32(&busyReplies);
+
+  count16(&frameStats->latency[bucket(latencyUs)]);
+}
+
+
+/**
+ * @brief notes the start of an OBC request or send
+ */
+void msp_stats_start(uint8_t opcode)
+{
+  opcode_stats *stats = stats_for(opcode);
+
+  stats->start = HAL_GetTick();
+  stats->running = true;
+}
+
+
+/**
+ * @brief counts data bytes of a transaction
+ */
+void msp_stats_bytes(uint8_t opcode, uint32_t length)
+{
+  opcode_stats *stats = stats_for(opcode);
+
+  stats->bytes = stats->bytes + length < stats->bytes ? 0xFFFFFFFFUL : stats->bytes + length;
+}
+
+
+/**
+ * @brief counts a transaction that ended, and how long it took if its start was seen
+ * @param the opcode of the transaction
+ * @param true if it completed, false if it ended with an error
+ */
+void msp_stats_end(uint8_t opcode, bool completed)
+{
+  opcode_stats *stats = stats_for(opcode);
+
+  if (completed)
+  {
+    count16(&stats->completed);
+  }
+  else
+  {
+    count16(&stats->aborted);
+    count32(&aborted);
+  }
+
+  // a system command has no start, an OBC send that was a duplicate neither
+  if (stats->running)
+    count16(&stats->duration[bucket(HAL_GetTick() - stats->start)]);
+  stats->running = false;
+}
+
+
+/**
+ * @brief fills in the statistics of the housekeeping report
+ * @param report MSP_STATS_LENGTH bytes, see msp_stats.h
+ */
+void msp_stats_snapshot(uint8_t *report)
+{
+  put32(report, MSP_STATS_RX_FRAMES, rxFrames);
+  put32(report, MSP_STATS_RX_REJECTED, rxRejected);
+  put32(report, MSP_STATS_FCS_MISMATCHES, fcsMismatches);
+  put32(report, MSP_STATS_DUPLICATES, duplicates);
+  put32(report, MSP_STATS_TX_FRAMES, txFrames);
+  put32(report, MSP_STATS_BUSY, busyReplies);
+  put32(report, MSP_STATS_ABORTED, aborted);
+
+  for (uint8_t i = 0; i < MSP_STATS_OPCODES; i++)
+  {
+    uint16_t block = MSP_STATS_OPCODE + i*MSP_STATS_OPCODE_SIZE;
+
+    put32(report, block + MSP_STATS_OPCODE_BYTES, perOpcode[i].bytes);
+    put16(report, block + MSP_STATS_OPCODE_COMPLETED, perOpcode[i].completed);
+    put16(report, block + MSP_STATS_OPCODE_ABORTED, perOpcode[i].aborted);
+    put16(report, block + MSP_STATS_OPCODE_REPEATED, perOpcode[i].repeated);
+    for (uint8_t b = 0; b < MSP_STATS_BUCKETS; b++)
+    {
+      put16(report, block + MSP_STATS_OPCODE_LATENCY + 2*b, perOpcode[i].latency[b]);
+      put16(report, block + MSP_STATS_OPCODE_DURATION + 2*b, perOpcode[i].duration[b]);
+    }
+  }
+}
@@ -0,0 +1,202 @@
+/****************************************************************************
+ * PAYLOAD                                                                  *
+ ****************************************************************************/
+
+/**
+ *****************************************************************************
+ * @file payload.c
+ * @brief everything the OBC has not taken yet, in one MSP_OP_REQ_PAYLOAD
+ *****************************************************************************
+ * instead of a REQ_SIC, a REQ_PIEZO and a MSP_OP_REQ_HK transaction, each
+ * with its own headers and acknowledgements, the OBC can take all of it
+ * with a single MSP_OP_REQ_PAYLOAD. The layout of the container is given in
+ * payload.h, an item is only in it if there is something to send.
+ *
+ * the items are chosen and their lengths fixed when the transaction starts,
+ * the values are copied from where they are kept frame by frame, so the
+ * container takes no memory of its own besides the small items. Nothing is
+ * released before the OBC has acknowledged the whole transaction, after a
+ * failed one the same items are sent again.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "payload.h"
+#include "msp_exp_handler.h"
+#include "experiment_constants.h"
+#include "start_test.h"
+#include "piezo.h"
+#include "result_archive.h"
+#include "housekeeping.h"
+
+typedef struct {
+  uint8_t type;
+  uint16_t length;  // bytes of the value
+} payload_item;
+
+extern uint8_t buffer[BUFFERLENGTH]; // SiC results, see start_test.c
+extern uint8_t piezoBufferint8[200];
+
+static payload_item items[PAYLOAD_MAX_ITEMS];
+static uint8_t itemCount = 0;
+static uint8_t piezoTiming[PAYLOAD_PIEZO_TIMING_LENGTH];
+
+static void add_item(uint8_t type, uint16_t length)
+{
+  items[itemCount].type = type;
+  items[itemCount].length = length;
+  itemCount++;
+}
+
+static void take_piezo_timing(void)
+{
+  bool timedOut;
+  uint32_t bootTime = piezo_get_boot_time(&timedOut);
+
+  piezoTiming[0] = bootTime >> 24 & 0xFF;
+  piezoTiming[1] = bootTime >> 16 & 0xFF;
+  piezoTiming[2] = bootTime >> 8 & 0xFF;
+  piezoTiming[3] = bootTime & 0xFF;
+  piezoTiming[4] = timedOut;
+}
+
+/**
+ * @brief copies a part of the value of an item into the frame
+ */
+static void copy_value(const payload_item *item, unsigned char *buf, unsigned long len, unsigned long offset)
+{
+  switch (item->type)
+  {
+    case PAYLOAD_SIC:
+      msp_expsend_copy(buf, &buffer[offset], len);
+      break;
+    case PAYLOAD_PIEZO_RECORDS:
+      msp_expsend_copy(buf, &piezoBufferint8[offset], len);
+      break;
+    case PAYLOAD_PIEZO_SAMPLES:
+      piezo_get_samples(buf, len, offset);
+      msp_expsend_fcs_update(buf, len);
+      break;
+    case PAYLOAD_HOUSEKEEPING:
+      housekeeping_copy(buf, len, offset);
+      break;
+    case PAYLOAD_PIEZO_TIMING:
+      msp_expsend_copy(buf, &piezoTiming[offset], len);
+      break;
+  }
+}
+
+/**
+ * @brief chooses the items of the container, called when the OBC asks for it
+ * @return the number of bytes of the container
+ *
+ * the Piezo samples are locked until the container is released or aborted.
+ */
+unsigned long payload_open(void)
+{
+  unsigned long length = 0;
+  int samples;
+
+  itemCount = 0;
+  if (result_archive_pending())
+    add_item(PAYLOAD_SIC, BUFFERLENGTH);
+  if (piezo_get_data_length() > 0)
+    add_item(PAYLOAD_PIEZO_RECORDS, piezo_get_data_length());
+  samples = piezo_get_sample_length();
+  if (samples > 0)
+    add_item(PAYLOAD_PIEZO_SAMPLES, samples);
+
+  housekeeping_snapshot();
+  add_item(PAYLOAD_HOUSEKEEPING, HOUSEKEEPING_LENGTH);
+  take_piezo_timing();
+  add_item(PAYLOAD_PIEZO_TIMING, PAYLOAD_PIEZO_TIMING_LENGTH);
+
+  for (uint8_t i = 0; i < itemCount; i++)
+    length += PAYLOAD_ITEM_HEADER + items[i].length;
+  return length;
+}
+
+/**
+ * @brief copies a part of the container into the frame
+ * @param buf the data field of the frame
+ * @param len number of bytes to copy
+ * @param offset offset into the container
+ */
+void payload_copy(unsigned char *buf, unsigned long len, unsigned long offset)
+{
+  unsigned long start = 0; // where the item starts in the container
+
+  for (uint8_t i = 0; i < itemCount && len > 0; i++)
+  {
+    unsigned long end = start + PAYLOAD_ITEM_HEADER + items[i].length;
+
+    if (offset < end)
+    {
+      unsigned long position = offset - start;
+      unsigned long count;
+
+      if (position < PAYLOAD_ITEM_HEADER)
+      {
+        uint8_t header[PAYLOAD_ITEM_HEADER] = {items[i].type, items[i].length >> 8, items[i].length & 0xFF};
+
+        count = PAYLOAD_ITEM_HEADER - position;
+        if (count > len)
+          count = len;
+        msp_expsend_copy(buf, &header[position], count);
+        buf += count;
+        offset += count;
+        position += count;
+        len -= count;
+      }
+
+      count = end - offset;
+      if (count > len)
+        count = len;
+      if (count > 0)
+      {
+        copy_value(&items[i], buf, count, position - PAYLOAD_ITEM_HEADER);
+        buf += count;
+        offset += count;
+        len -= count;
+      }
+    }
+    start = end;
+  }
+}
+
+/**
+ * @brief releases everything that was sent, the OBC has acknowledged it
+ */
+void payload_release(void)
+{
+  for (uint8_t i = 0; i < itemCount; i++)
+  {
+    switch (items[i].type)
+    {
+      case PAYLOAD_SIC:
+        clear_sic_buffer();
+        result_archive_acknowledge(buffer); // the next sweep that was not taken, if any
+        break;
+      case PAYLOAD_PIEZO_RECORDS:
+        clear_piezo_buffer();
+        break;
+      case PAYLOAD_PIEZO_SAMPLES:
+        piezo_release_samples();
+        break;
+    }
+  }
+  itemCount = 0;
+}
+
+/**
+ * @brief keeps everything for the next request, the transaction failed
+ */
+void payload_abort(void)
+{
+  for (uint8_t i = 0; i < itemCount; i++)
+  {
+    if (items[i].type == PAYLOAD_PIEZO_SAMPLES)
+      piezo_abort_samples();
+  }
+  itemCount = 0;
+}
@@ -13,22 +13,47 @@
  * inactive, wich is neccesary inorder to stop removing power from a runnig 
  * experiment if they are runned simultaneously.
  * fucntions are defined in order to turn off the power buses induvidualy
+ *
+ * it also keeps the power state the OBC sets with MSP_OP_SLEEP and
+ * MSP_OP_ACTIVE. While sleeping the rails are off and the ADC, DAC, USART
+ * and TIM21 are de-initialized, which gates their clocks. Whenever the
+ * experiment is idle the core waits in Stop mode, I2C1 wakes it on an
+ * address match.
+ *
+ * only I2C is brought up at boot, so the OBC is answered as soon as
+ * possible. The ADC and DAC are initialized when the SiC rail is turned on
+ * for the first time, the USART and TIM21 when the Piezo rails are, and
+ * again after a sleep.
  */
 
 
 #include "power_management.h"
 #include "stdbool.h"
+#include "adc.h"
+#include "dac.h"
 #include "usart.h"
+#include "tim.h"
+#include "piezo.h"
+#include "eeprom_circular.h"
 
 /* data section */
 bool is_sic_running = false;
 bool is_piezo_running = false;
+static volatile bool is_sleeping = false;
+static bool sic_peripherals_ready = false;   // ADC and DAC
+static bool piezo_peripherals_ready = false; // USART1 and TIM21
 
 /**
  * @brief turns on power for piezo
  */
 void piezo_power_on(void)
 {
+  if (!piezo_peripherals_ready)
+  {
+    MX_USART1_UART_Init();
+    MX_TIM21_Init();
+    piezo_peripherals_ready = true;
+  }
   is_piezo_running = true;
   HAL_GPIO_WritePin(GPIOB, Battery_SW_ON_Pin, GPIO_PIN_SET);
   HAL_GPIO_WritePin(GPIOB, Piezo_48V_ON_Pin, GPIO_PIN_SET);
@@ -54,6 +79,12 @@ void piezo_power_off(void)
  */
 void sic_power_on(void)
 {
+  if (!sic_peripherals_ready)
+  {
+    MX_ADC_Init();
+    MX_DAC_Init();
+    sic_peripherals_ready = true;
+  }
   is_sic_running = true;
   HAL_GPIO_WritePin(GPIOB, Battery_SW_ON_Pin, GPIO_PIN_SET);
   HAL_GPIO_WritePin(GPIOB, Linear_10V_ON_Pin, GPIO_PIN_SET);
@@ -103,3 +134,93 @@ void turn_off_vbat(void)
 {
   HAL_GPIO_WritePin(GPIOB, Battery_SW_ON_Pin, GPIO_PIN_RESET);
 }
+
+/**
+ * @brief sets up the regulator for short wake-ups from Stop mode
+ *
+ * VREFINT is off in Stop and the core does not wait for it when it wakes,
+ * so the I2C transfer that woke it is stretched for a few us only.
+ */
+void power_init(void)
+{
+  __HAL_RCC_PWR_CLK_ENABLE();
+  HAL_PWREx_EnableUltraLowPower();
+  HAL_PWREx_EnableFastWakeUp();
+  // the core wakes on MSI, in the range SystemClock_Config() set
+  __HAL_RCC_WAKEUPSTOP_CLK_CONFIG(RCC_STOP_WAKEUPCLOCK_MSI);
+}
+
+/**
+ * @brief MSP_OP_SLEEP, stops the experiments and gates everything but I2C
+ */
+void power_sleep(void)
+{
+  if (is_sleeping)
+    return;
+
+  if (piezo_get_state() != PIEZO_STATE_OFF)
+    piezo_stop_exp();
+  sic_power_off();
+  RS485(RS_MODE_DEACTIVATE);
+
+  // the MspDeInit functions disable the clocks and release the pins
+  if (sic_peripherals_ready)
+  {
+    HAL_ADC_DeInit(&hadc);
+    HAL_DAC_DeInit(&hdac);
+    sic_peripherals_ready = false;
+  }
+  if (piezo_peripherals_ready)
+  {
+    HAL_UART_DeInit(&huart1);
+    HAL_TIM_Base_DeInit(&htim21);
+    piezo_peripherals_ready = false;
+  }
+  is_sleeping = true;
+}
+
+/**
+ * @brief MSP_OP_ACTIVE, allows the experiments to run again
+ *
+ * the rails and the peripherals stay off, they are turned on by the
+ * experiment that needs them.
+ */
+void power_active(void)
+{
+  is_sleeping = false;
+}
+
+/**
+ * @brief true between MSP_OP_SLEEP and MSP_OP_ACTIVE
+ */
+bool power_is_sleeping(void)
+{
+  return is_sleeping;
+}
+
+/**
+ * @brief tells if the clocks may stop, only I2C1 can wake the core from Stop
+ */
+bool power_stop_allowed(void)
+{
+  HAL_UART_StateTypeDef uartState = HAL_UART_GetState(&huart1);
+
+  // TIM21 samples the motor and the USART DMA talks to it while it runs
+  if (piezo_get_state() != PIEZO_STATE_OFF)
+    return false;
+  // the flash interrupt has to start the next eeprom write
+  if (!EEPROM_idle())
+    return false;
+  return uartState == HAL_UART_STATE_READY || uartState == HAL_UART_STATE_RESET;
+}
+
+/**
+ * @brief waits in Stop mode until an interrupt, call with interrupts masked
+ *
+ * the clock configuration is kept through Stop, so the core runs at the
+ * same speed as soon as it is woken.
+ */
+void power_enter_stop(void)
+{
+  HAL_PWR_EnterSTOPMode(PWR_LOWPOWERREGULATOR_ON, PWR_STOPENTRY_WFI);
+}
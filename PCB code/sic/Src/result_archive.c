@@ -0,0 +1,369 @@
+/****************************************************************************
+ * RESULT ARCHIVE                                                           *
+ ****************************************************************************/
+
+/**
+ *****************************************************************************
+ * @file result_archive.c
+ * @brief the SiC sweeps the OBC has not taken yet, kept in the data eeprom
+ *****************************************************************************
+ * every sweep is written to the 1k of the data eeprom after the sequence
+ * flag journal, so a sweep that the OBC did not read before a power loss is
+ * served again through REQ_SIC after the boot, and the experiment does not
+ * have to be repeated.
+ *
+ * the archive is a ring of entries, each one written after the one before,
+ * so every location is worn equally. A new entry overwrites the oldest
+ * ones, depending on how well the sweeps compress the archive holds the
+ * last one to three of them.
+ *
+ * An entry is a header of four words followed by the compressed sweep:
+ *  - ARCHIVE_MAGIC and a 16 bit sequence number
+ *  - the number of words of the compressed sweep
+ *  - the CRC-32 of the compressed sweep and the two words before
+ *  - the acknowledged word, ARCHIVE_ACKNOWLEDGED once the OBC has taken
+ *    the sweep with T_ACK
+ * The first word is cleared before anything else is written and set last,
+ * so an entry that is cut off by a power loss is ignored, and so is an old
+ * entry as soon as a new one reaches it. Only the acknowledged word is
+ * outside the CRC, a torn acknowledgement leaves the sweep to be served
+ * once more.
+ *
+ * every channel of the sweep is compressed on its own: its first value,
+ * the number of bits of the largest difference between two following
+ * values and then every difference in that many bits. The differences are
+ * zigzag coded, so small steps down take as few bits as small steps up.
+ * A sweep of noise needs 728 bytes, so any sweep fits in the archive.
+ */
+
+#include "stm32l0xx_hal.h"
+#include "result_archive.h"
+#include "eeprom_circular.h"
+#include "experiment_constants.h"
+#include "msp_crc.h"
+#include "msp_i2c_slave.h"
+
+#define ARCHIVE_MAGIC           0x51C5U
+#define ARCHIVE_ACKNOWLEDGED    0xAC4ED0C5UL
+#define HEADER_WORDS            4
+#define NO_ENTRY                0xFFFF
+
+#define CHANNEL_VALUES          (BUFFERLENGTH / 2 / ARCHIVE_CHANNELS)
+#define ENTRY_ADDRESS(entry, word) (ARCHIVE_START_ADDR + 4UL*((entry) + (word)))
+#define ENTRY_WORD(entry, word) (*(__IO uint32_t *)ENTRY_ADDRESS(entry, word))
+#define ENTRY_MAGIC(entry)      (ENTRY_WORD(entry, 0) >> 16)
+#define ENTRY_SEQUENCE(entry)   ((uint16_t)ENTRY_WORD(entry, 0))
+#define ENTRY_LENGTH(entry)     ((uint16_t)ENTRY_WORD(entry, 1))
+#define ENTRY_CRC(entry)        ENTRY_WORD(entry, 2)
+#define ENTRY_ACKNOWLEDGED(entry) ENTRY_WORD(entry, 3)
+
+typedef struct {
+  uint32_t address;    // where the next word is written, 0 to only count
+  uint32_t word;
+  uint8_t used;        // bits of word that are filled
+  uint16_t words;      // words written so far
+  unsigned long crc;
+} bit_writer;
+
+typedef struct {
+  const __IO uint32_t *next;
+  uint32_t word;
+  uint8_t used;        // bits of word that are taken, 32 when it is empty
+} bit_reader;
+
+static uint16_t next_entry = 0;       // the word where the next entry starts
+static uint16_t next_sequence = 0;
+static uint16_t served = NO_ENTRY;    // the entry that is in the SiC buffer
+static uint16_t acknowledged = NO_ENTRY; // its acknowledged word may still be queued
+
+/**
+ * @brief Waits for the flash interrupt and answers the OBC meanwhile.
+ *
+ * a sweep is a few hundred words and every word takes 3.2 ms, too long to
+ * leave the OBC unanswered. Must not be called from an MSP handler, see
+ * msp_i2c_delay.
+ */
+static void wait_for_eeprom(void)
+{
+  if (!msp_i2c_poll())
+    msp_i2c_sleep();
+}
+
+/**
+ * @brief Writes a word to the eeprom, waits while the queue is full.
+ */
+static void write_word(uint32_t address, uint32_t word)
+{
+  while (!EEPROM_write(address, &word, 4))
+    wait_for_eeprom();
+}
+
+static void put_word(bit_writer *w)
+{
+  w->crc = msp_crc32((const unsigned char *)&w->word, 4, w->crc);
+  if (w->address != 0)
+  {
+    write_word(w->address, w->word);
+    w->address += 4;
+  }
+  w->words++;
+}
+
+static void put_bits(bit_writer *w, uint32_t value, uint8_t bits)
+{
+  w->word |= value << w->used;
+  w->used += bits;
+  if (w->used >= 32)
+  {
+    put_word(w);
+    w->used -= 32;
+    w->word = w->used ? value >> (bits - w->used) : 0;
+  }
+}
+
+static uint32_t get_bits(bit_reader *r, uint8_t bits)
+{
+  uint32_t value;
+
+  if (bits == 0)
+    return 0;
+  if (r->used == 32)
+  {
+    r->word = *r->next++;
+    r->used = 0;
+  }
+  value = r->word >> r->used;
+  if (r->used + bits > 32)
+  {
+    uint8_t taken = 32 - r->used;
+
+    r->word = *r->next++;
+    value |= r->word << taken;
+    r->used = bits - taken;
+  }
+  else
+  {
+    r->used += bits;
+  }
+  return value & ((1UL << bits) - 1);
+}
+
+/**
+ * @brief The value of a channel in the SiC buffer, stored big endian.
+ */
+static uint16_t sweep_value(const uint8_t *data, uint8_t channel, uint16_t index)
+{
+  const uint8_t *value = &data[2*(channel + index*ARCHIVE_CHANNELS)];
+
+  return ((uint16_t)value[0] << 8) | value[1];
+}
+
+/**
+ * @brief Compresses a sweep, see the top of the file.
+ */
+static void compress(const uint8_t *data, bit_writer *w)
+{
+  for (uint8_t channel = 0; channel < ARCHIVE_CHANNELS; channel++)
+  {
+    uint16_t largest = 0;
+    uint8_t bits = 0;
+
+    for (uint16_t i = 1; i < CHANNEL_VALUES; i++)
+    {
+      int16_t step = (int16_t)(sweep_value(data, channel, i) - sweep_value(data, channel, i - 1));
+      uint16_t zigzag = (uint16_t)(step << 1) ^ (uint16_t)(step >> 15);
+
+      if (zigzag > largest)
+        largest = zigzag;
+    }
+    while (bits < 16 && (largest >> bits) != 0)
+      bits++;
+
+    put_bits(w, sweep_value(data, channel, 0), 16);
+    put_bits(w, bits, 5);
+    for (uint16_t i = 1; i < CHANNEL_VALUES; i++)
+    {
+      int16_t step = (int16_t)(sweep_value(data, channel, i) - sweep_value(data, channel, i - 1));
+
+      put_bits(w, (uint16_t)(step << 1) ^ (uint16_t)(step >> 15), bits);
+    }
+  }
+  if (w->used > 0)
+    put_word(w);
+}
+
+static void decompress(uint16_t entry, uint8_t *data)
+{
+  bit_reader r = {&ENTRY_WORD(entry, HEADER_WORDS), 0, 32};
+
+  for (uint8_t channel = 0; channel < ARCHIVE_CHANNELS; channel++)
+  {
+    uint16_t value = get_bits(&r, 16);
+    uint8_t bits = get_bits(&r, 5);
+
+    for (uint16_t i = 0; i < CHANNEL_VALUES; i++)
+    {
+      uint8_t *out = &data[2*(channel + i*ARCHIVE_CHANNELS)];
+
+      if (i > 0)
+      {
+        uint16_t zigzag = get_bits(&r, bits);
+        value += (zigzag >> 1) ^ (uint16_t)-(zigzag & 1);
+      }
+      out[0] = value >> 8;
+      out[1] = value & 0xFF;
+    }
+  }
+}
+
+/**
+ * @brief Tells if a valid entry starts at a word of the archive.
+ */
+static bool entry_valid(uint16_t entry)
+{
+  unsigned long crc;
+
+  if (entry > ARCHIVE_WORDS - HEADER_WORDS || ENTRY_MAGIC(entry) != ARCHIVE_MAGIC)
+    return false;
+  if (ENTRY_LENGTH(entry) > ARCHIVE_WORDS - HEADER_WORDS - entry)
+    return false;
+
+  crc = msp_crc32((const unsigned char *)&ENTRY_WORD(entry, HEADER_WORDS), 4UL*ENTRY_LENGTH(entry), 0);
+  crc = msp_crc32((const unsigned char *)&ENTRY_WORD(entry, 0), 8, crc);
+  return crc == ENTRY_CRC(entry);
+}
+
+static bool entry_acknowledged(uint16_t entry)
+{
+  return entry == acknowledged || ENTRY_ACKNOWLEDGED(entry) == ARCHIVE_ACKNOWLEDGED;
+}
+
+/**
+ * @brief Loads the oldest sweep that has not been acknowledged.
+ * @param the SiC buffer (pointer), left as it is if there is none
+ */
+static void load_oldest(uint8_t *data)
+{
+  uint16_t oldest = NO_ENTRY;
+
+  for (uint16_t entry = 0; entry <= ARCHIVE_WORDS - HEADER_WORDS; entry++)
+  {
+    if (!entry_valid(entry) || entry_acknowledged(entry))
+      continue;
+    if (oldest == NO_ENTRY || (int16_t)(ENTRY_SEQUENCE(entry) - ENTRY_SEQUENCE(oldest)) < 0)
+      oldest = entry;
+  }
+
+  served = oldest;
+  if (oldest != NO_ENTRY)
+    decompress(oldest, data);
+}
+
+
+
+
+/**
+ * @brief Finds the newest entry and loads the oldest sweep that was not
+ *        taken by the OBC.
+ * @param the SiC buffer (pointer)
+ *
+ * should be called once at boot, after EEPROM_init.
+ */
+void result_archive_init(uint8_t *data)
+{
+  uint16_t newest = NO_ENTRY;
+
+  for (uint16_t entry = 0; entry <= ARCHIVE_WORDS - HEADER_WORDS; entry++)
+  {
+    if (!entry_valid(entry))
+      continue;
+    if (newest == NO_ENTRY || (int16_t)(ENTRY_SEQUENCE(entry) - ENTRY_SEQUENCE(newest)) > 0)
+      newest = entry;
+  }
+
+  if (newest != NO_ENTRY)
+  {
+    next_entry = newest + HEADER_WORDS + ENTRY_LENGTH(newest);
+    next_sequence = ENTRY_SEQUENCE(newest) + 1;
+  }
+  load_oldest(data);
+}
+
+
+/**
+ * @brief Archives a sweep, it becomes the one the OBC is served.
+ * @param the SiC buffer (pointer)
+ *
+ * waits until the entry is queued in full, the last writes are done in the
+ * background. The OBC is answered while it waits and reads EXP_BUSY for
+ * REQ_SIC until the sweep has been archived, see sic_time_to_ready.
+ */
+void result_archive_store(const uint8_t *data)
+{
+  bit_writer w = {0, 0, 0, 0, 0};
+  uint32_t header[2];
+  uint32_t address;
+
+  // a first pass gives the size, which decides where the entry goes, and the CRC
+  compress(data, &w);
+  if (next_entry + HEADER_WORDS + w.words > ARCHIVE_WORDS)
+    next_entry = 0;
+
+  // an acknowledgement that is still queued is written before the entry
+  while (!EEPROM_idle())
+    wait_for_eeprom();
+  acknowledged = NO_ENTRY;
+
+  address = ENTRY_ADDRESS(next_entry, 0);
+  header[0] = ((uint32_t)ARCHIVE_MAGIC << 16) | next_sequence;
+  header[1] = w.words;
+
+  write_word(address, 0);
+  write_word(address + 4, header[1]);
+  write_word(address + 8, msp_crc32((const unsigned char *)header, sizeof(header), w.crc));
+  write_word(address + 12, 0);
+  w.address = address + 4*HEADER_WORDS;
+  w.word = 0;
+  w.used = 0;
+  w.words = 0;
+  compress(data, &w);
+  // the entry is valid from here on
+  write_word(address, header[0]);
+
+  served = next_entry;
+  next_entry += HEADER_WORDS + w.words;
+  next_sequence++;
+}
+
+
+/**
+ * @brief Marks the served sweep as taken by the OBC and loads the next one.
+ * @param the SiC buffer (pointer), left as it is if no sweep is left
+ *
+ * should be called when REQ_SIC has been acknowledged.
+ */
+void result_archive_acknowledge(uint8_t *data)
+{
+  uint32_t word = ARCHIVE_ACKNOWLEDGED;
+
+  if (served == NO_ENTRY)
+    return;
+
+  // only one acknowledgement is remembered until the flash interrupt has written it
+  if (acknowledged != NO_ENTRY && ENTRY_ACKNOWLEDGED(acknowledged) != ARCHIVE_ACKNOWLEDGED)
+    EEPROM_flush();
+  // called from the T_ACK handler, where the OBC can not be answered, a single word does not wait long
+  while (!EEPROM_write(ENTRY_ADDRESS(served, 3), &word, 4))
+    EEPROM_flush();
+  acknowledged = served;
+  load_oldest(data);
+}
+
+
+/**
+ * @brief Tells if the SiC buffer holds a sweep the OBC has not taken.
+ */
+bool result_archive_pending(void)
+{
+  return served != NO_ENTRY;
+}
@@ -15,6 +15,9 @@
 #include "power_management.h"
 #include "tools.h"
 #include "experiment_constants.h"
+#include "result_archive.h"
+#include "arena.h"
+#include "msp_i2c_slave.h"
 //#include "header.h"
 
 
@@ -44,7 +47,17 @@ extern ADC_HandleTypeDef                hadc;
 extern DAC_HandleTypeDef    		hdac;
 extern UART_HandleTypeDef 		huart1;
 extern I2C_HandleTypeDef 		hi2c1;
-static struct experiment_package  	experiments[EXPERIMENTPOINTS];
+static struct experiment_package  	*experiments; // EXPERIMENTPOINTS, in the arena during the sweep
+
+#define SIC_STEPS (EXPERIMENTPOINTS / 2) // the sweep reads every second point
+
+/* progress of the sweep, read by the OBC requests */
+static bool volatile sweepRunning = false;
+static uint32_t volatile sweepStart = 0;     // HAL tick when the SiC rail was powered
+static uint32_t volatile stepsStart = 0;     // HAL tick when the first step began
+static uint16_t volatile stepsDone = 0;
+
+ARENA_FITS(sic_acquisition, ARENA_ROUND(sizeof(struct experiment_package) * EXPERIMENTPOINTS));
 
 
 void setDAC(uint32_t);
@@ -75,14 +88,15 @@ void sic_get_data(unsigned char *buf, long data_offset)
          check if the voltage levels are set to the correct values. (Battery voltage, 48V voltage etc.)
 */
 void start_test(void){
-  for(uint16_t i = 0; i < EXPERIMENTPOINTS; i++){
-    experiments[i].temperature = 0;
-    experiments[i].Vb = 0;
-    experiments[i].Vbe = 0;
-    experiments[i].Vc = 0;
-  }
+  // the memory is cleared, every point starts from zero
+  arena_begin(ARENA_PHASE_SIC_ACQUISITION);
+  experiments = arena_alloc(sizeof(struct experiment_package) * EXPERIMENTPOINTS);
+  stepsDone = 0;
+  sweepStart = HAL_GetTick();
+  sweepRunning = true;
   sic_power_on();
-  HAL_Delay(1000);
+  msp_i2c_delay(SIC_SETTLE_MS);
+  stepsStart = HAL_GetTick();
   uint16_t dac_voltage = DACMINIMUMVOLTAGE;
   // setDAC( Voltage * constant) = set DAC to Voltage. Constant is 1241 and is
   // used to translate voltage into digital signal.
@@ -90,13 +104,46 @@ void start_test(void){
     setDAC_voltage(dac_voltage);
     dac_voltage += DACSTEPS;
     readADCvalues(index);
+    stepsDone++;
   }
   convert_8bit(buffer);
+  arena_end();
+  experiments = NULL;
 
   setDAC(0);
-  HAL_Delay(100);
+  msp_i2c_delay(100);
   sic_power_off();
 
+  // kept until the OBC has taken it, also over a power loss
+  result_archive_store(buffer);
+  sweepRunning = false;
+}
+
+/**
+ * @brief estimates the time until the sweep is archived
+ * @return milliseconds, 0 when no sweep is running
+ *
+ * the time of a step is measured once the first one is done, the settling
+ * and the end of the sweep are estimated. Never 0 while the sweep runs.
+ */
+uint32_t sic_time_to_ready(void)
+{
+  uint32_t now = HAL_GetTick();
+  uint32_t remaining = SIC_FINISH_ESTIMATE_MS;
+  uint16_t done = stepsDone;
+  uint32_t elapsed;
+
+  if (!sweepRunning)
+    return 0;
+
+  elapsed = now - sweepStart;
+  if (done == 0 && elapsed < SIC_SETTLE_MS)
+    return remaining + SIC_SETTLE_MS - elapsed + SIC_STEPS * SIC_STEP_ESTIMATE_MS;
+  if (done == 0)
+    return remaining + SIC_STEPS * SIC_STEP_ESTIMATE_MS;
+  if (done < SIC_STEPS)
+    remaining += (SIC_STEPS - done) * ((now - stepsStart) / done);
+  return remaining;
 }
 
 void readADCvalues(uint8_t index){
@@ -109,7 +156,7 @@ void readADCvalues(uint8_t index){
       Error_Handler();
     }
 
-    HAL_Delay(10);
+    msp_i2c_delay(10);
 
     //Start ADC reading
 
@@ -169,7 +216,7 @@ void readADCvalues(uint8_t index){
     HAL_ADC_PollForConversion(&hadc, 100);
 
 
-    HAL_Delay (2);
+    msp_i2c_delay(2);
 
     HAL_ADC_Stop (&hadc);
   }
@@ -39,13 +39,3 @@ void Flush_Buffer8(uint8_t* pBuffer, uint16_t BufferLength)
   }
 }
 
-void buff_length(uint8_t* pBuffer, long *BufferLength)
-{
-  for(int i=0; i<MSP_EXP_MAX_FRAME_SIZE; i++)
-  {
-    if(* pBuffer != '\0')
-      *BufferLength = (i+1); 
-    pBuffer++;
-  }
-}
-